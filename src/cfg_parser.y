@@ -60,7 +60,15 @@ extern char input_line[512];
 %token TOK_OCSP_REFRESH_INTERVAL TOK_PEM_DIR TOK_PEM_DIR_GLOB
 %token TOK_LOG_LEVEL TOK_PROXY_TLV TOK_PROXY_AUTHORITY TOK_TFO
 %token TOK_CLIENT_VERIFY TOK_VERIFY_NONE TOK_VERIFY_OPT TOK_VERIFY_REQ
-%token TOK_CLIENT_VERIFY_CA
+%token TOK_CLIENT_VERIFY_CA TOK_STATS_SOCKET TOK_ADMIN_LISTEN
+%token TOK_STALL_THRESHOLD TOK_STALL_WATCHDOG TOK_ACCESS_LOG
+%token TOK_FLIGHT_RECORDER TOK_CONTROL_SOCKET TOK_IDLE_TIMEOUT
+%token TOK_CONN_TRACE TOK_HANDSHAKE_RATE TOK_HANDSHAKE_RATE_RESUMED
+%token TOK_HANDSHAKE_RATE_PREFIX TOK_MAX_CONNECTIONS TOK_MAX_BUFFER_MEMORY
+%token TOK_HANDSHAKE_BUDGET TOK_HANDSHAKE_QUEUE TOK_ADAPTIVE_TIMEOUTS
+%token TOK_FINGERPRINT_DENY TOK_FINGERPRINT_RATE TOK_PROXY_FINGERPRINT
+%token TOK_DEFER_ACCEPT TOK_DRAIN_TIMEOUT TOK_MAX_GENERATIONS
+%token TOK_WORKERS_MAX TOK_WORKERS_LOAD TOK_KTLS
 
 %parse-param { hitch_config *cfg }
 
@@ -123,6 +131,32 @@ CFG_RECORD
 	| ECDH_CURVE_REC
 	| CLIENT_VERIFY_REC
 	| CLIENT_VERIFY_CA_REC
+	| STATS_SOCKET_REC
+	| ADMIN_LISTEN_REC
+	| STALL_THRESHOLD_REC
+	| STALL_WATCHDOG_REC
+	| ACCESS_LOG_REC
+	| FLIGHT_RECORDER_REC
+	| CONTROL_SOCKET_REC
+	| IDLE_TIMEOUT_REC
+	| CONN_TRACE_REC
+	| HANDSHAKE_RATE_REC
+	| HANDSHAKE_RATE_RESUMED_REC
+	| HANDSHAKE_RATE_PREFIX_REC
+	| MAX_CONNECTIONS_REC
+	| MAX_BUFFER_MEMORY_REC
+	| HANDSHAKE_BUDGET_REC
+	| HANDSHAKE_QUEUE_REC
+	| ADAPTIVE_TIMEOUTS_REC
+	| FINGERPRINT_DENY_REC
+	| FINGERPRINT_RATE_REC
+	| PROXY_FINGERPRINT_REC
+	| DEFER_ACCEPT_REC
+	| DRAIN_TIMEOUT_REC
+	| MAX_GENERATIONS_REC
+	| WORKERS_MAX_REC
+	| WORKERS_LOAD_REC
+	| KTLS_REC
 	;
 
 FRONTEND_REC
@@ -163,6 +197,8 @@ FB_REC
 	| FB_CIPHERS
 	| FB_CIPHERSUITES
 	| FB_PREF_SRV_CIPH
+	| FB_HANDSHAKE_RATE
+	| FB_HANDSHAKE_RATE_RESUMED
 	;
 
 FB_HOST: TOK_HOST '=' STRING {
@@ -361,6 +397,14 @@ FB_PREF_SRV_CIPH: TOK_PREFER_SERVER_CIPHERS '=' BOOL {
 	cur_fa->prefer_server_ciphers = $3;
 };
 
+FB_HANDSHAKE_RATE: TOK_HANDSHAKE_RATE '=' UINT {
+	cur_fa->handshake_rate = $3;
+};
+
+FB_HANDSHAKE_RATE_RESUMED: TOK_HANDSHAKE_RATE_RESUMED '=' UINT {
+	cur_fa->handshake_rate_resumed = $3;
+};
+
 QUIET_REC: TOK_QUIET '=' BOOL {
 	if ($3)
 		cfg->LOG_LEVEL = 0;
@@ -546,8 +590,127 @@ LOG_FILENAME_REC: TOK_LOG_FILENAME '=' STRING {
 		YYABORT;
 };
 
+STATS_SOCKET_REC: TOK_STATS_SOCKET '=' STRING {
+	/* XXX: passing an empty string for file */
+	if ($3 &&
+	    config_param_validate("stats-socket", $3, cfg, "",
+	    yyget_lineno()) != 0)
+		YYABORT;
+};
+
+CONTROL_SOCKET_REC: TOK_CONTROL_SOCKET '=' STRING {
+	if ($3 &&
+	    config_param_validate("control-socket", $3, cfg, "",
+	    yyget_lineno()) != 0)
+		YYABORT;
+};
+
+ADMIN_LISTEN_REC: TOK_ADMIN_LISTEN '=' STRING {
+	if ($3 &&
+	    config_param_validate("admin-listen", $3, cfg, "",
+	    yyget_lineno()) != 0)
+		YYABORT;
+};
+
 LOG_LEVEL_REC: TOK_LOG_LEVEL '=' UINT { cfg->LOG_LEVEL = $3; };
 
+STALL_THRESHOLD_REC: TOK_STALL_THRESHOLD '=' UINT {
+	cfg->STALL_THRESHOLD = $3;
+};
+
+STALL_WATCHDOG_REC: TOK_STALL_WATCHDOG '=' BOOL {
+	cfg->STALL_WATCHDOG = $3;
+};
+
+ACCESS_LOG_REC: TOK_ACCESS_LOG '=' BOOL { cfg->ACCESS_LOG = $3; };
+
+FLIGHT_RECORDER_REC: TOK_FLIGHT_RECORDER '=' UINT {
+	cfg->FLIGHT_RECORDER = $3;
+};
+
+IDLE_TIMEOUT_REC: TOK_IDLE_TIMEOUT '=' UINT {
+	cfg->IDLE_TIMEOUT = $3;
+};
+
+CONN_TRACE_REC: TOK_CONN_TRACE '=' BOOL { cfg->CONN_TRACE = $3; };
+
+HANDSHAKE_RATE_REC: TOK_HANDSHAKE_RATE '=' UINT {
+	cfg->HANDSHAKE_RATE = $3;
+};
+
+HANDSHAKE_RATE_RESUMED_REC: TOK_HANDSHAKE_RATE_RESUMED '=' UINT {
+	cfg->HANDSHAKE_RATE_RESUMED = $3;
+};
+
+HANDSHAKE_RATE_PREFIX_REC: TOK_HANDSHAKE_RATE_PREFIX '=' STRING {
+	if ($3 && config_param_validate("handshake-rate-prefix", $3, cfg,
+	    "", yyget_lineno()) != 0)
+		YYABORT;
+};
+
+MAX_CONNECTIONS_REC: TOK_MAX_CONNECTIONS '=' UINT {
+	cfg->MAX_CONNECTIONS = $3;
+};
+
+MAX_BUFFER_MEMORY_REC: TOK_MAX_BUFFER_MEMORY '=' UINT {
+	cfg->MAX_BUFFER_MEMORY = $3;
+};
+
+HANDSHAKE_BUDGET_REC: TOK_HANDSHAKE_BUDGET '=' UINT {
+	cfg->HANDSHAKE_BUDGET = $3;
+};
+
+HANDSHAKE_QUEUE_REC: TOK_HANDSHAKE_QUEUE '=' UINT {
+	cfg->HANDSHAKE_QUEUE = $3;
+};
+
+ADAPTIVE_TIMEOUTS_REC: TOK_ADAPTIVE_TIMEOUTS '=' BOOL {
+	cfg->ADAPTIVE_TIMEOUTS = $3;
+};
+
+FINGERPRINT_DENY_REC: TOK_FINGERPRINT_DENY '=' STRING {
+	if ($3 &&
+	    config_param_validate("fingerprint-deny", $3, cfg, "",
+	    yyget_lineno()) != 0)
+		YYABORT;
+};
+
+FINGERPRINT_RATE_REC: TOK_FINGERPRINT_RATE '=' UINT {
+	cfg->FINGERPRINT_RATE = $3;
+};
+
+PROXY_FINGERPRINT_REC: TOK_PROXY_FINGERPRINT '=' BOOL {
+	cfg->PROXY_FINGERPRINT = $3;
+};
+
+DEFER_ACCEPT_REC: TOK_DEFER_ACCEPT '=' UINT {
+	cfg->DEFER_ACCEPT = $3;
+};
+
+DRAIN_TIMEOUT_REC: TOK_DRAIN_TIMEOUT '=' UINT {
+	cfg->DRAIN_TIMEOUT = $3;
+};
+
+MAX_GENERATIONS_REC: TOK_MAX_GENERATIONS '=' UINT {
+	cfg->MAX_GENERATIONS = $3;
+};
+
+WORKERS_MAX_REC: TOK_WORKERS_MAX '=' UINT {
+	cfg->WORKERS_MAX = $3;
+};
+
+WORKERS_LOAD_REC: TOK_WORKERS_LOAD '=' UINT {
+	if ($3 < 1 || $3 > 100) {
+		config_error_set("workers-load out of range (1-100).");
+		YYABORT;
+	}
+	cfg->WORKERS_LOAD = $3;
+};
+
+KTLS_REC: TOK_KTLS '=' BOOL {
+	cfg->KTLS = $3;
+};
+
 SESSION_CACHE_REC: TOK_SESSION_CACHE '=' UINT {
 #ifdef USE_SHARED_CACHE
 	cfg->SHARED_CACHE = $3;
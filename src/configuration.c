@@ -78,6 +78,52 @@
 #define CFG_SNI_NOMATCH_ABORT "sni-nomatch-abort"
 #define CFG_OCSP_DIR "ocsp-dir"
 #define CFG_TLS_PROTOS "tls-protos"
+#define CFG_STATS_SOCKET "stats-socket"
+#define CFG_PARAM_STATS_SOCKET 11018
+#define CFG_ADMIN_LISTEN "admin-listen"
+#define CFG_PARAM_ADMIN_LISTEN 11019
+#define CFG_STALL_THRESHOLD "stall-threshold"
+#define CFG_PARAM_STALL_THRESHOLD 11020
+#define CFG_STALL_WATCHDOG "stall-watchdog"
+#define CFG_ACCESS_LOG "access-log"
+#define CFG_FLIGHT_RECORDER "flight-recorder"
+#define CFG_PARAM_FLIGHT_RECORDER 11021
+#define CFG_CONTROL_SOCKET "control-socket"
+#define CFG_PARAM_CONTROL_SOCKET 11022
+#define CFG_IDLE_TIMEOUT "idle-timeout"
+#define CFG_PARAM_IDLE_TIMEOUT 11023
+#define CFG_CONN_TRACE "conn-trace"
+#define CFG_HANDSHAKE_RATE "handshake-rate"
+#define CFG_PARAM_HANDSHAKE_RATE 11024
+#define CFG_HANDSHAKE_RATE_RESUMED "handshake-rate-resumed"
+#define CFG_PARAM_HANDSHAKE_RATE_RESUMED 11025
+#define CFG_HANDSHAKE_RATE_PREFIX "handshake-rate-prefix"
+#define CFG_PARAM_HANDSHAKE_RATE_PREFIX 11026
+#define CFG_MAX_CONNECTIONS "max-connections"
+#define CFG_PARAM_MAX_CONNECTIONS 11027
+#define CFG_MAX_BUFFER_MEMORY "max-buffer-memory"
+#define CFG_PARAM_MAX_BUFFER_MEMORY 11028
+#define CFG_HANDSHAKE_BUDGET "handshake-budget"
+#define CFG_PARAM_HANDSHAKE_BUDGET 11029
+#define CFG_HANDSHAKE_QUEUE "handshake-queue"
+#define CFG_PARAM_HANDSHAKE_QUEUE 11030
+#define CFG_ADAPTIVE_TIMEOUTS "adaptive-timeouts"
+#define CFG_FINGERPRINT_DENY "fingerprint-deny"
+#define CFG_PARAM_FINGERPRINT_DENY 11031
+#define CFG_FINGERPRINT_RATE "fingerprint-rate"
+#define CFG_PARAM_FINGERPRINT_RATE 11032
+#define CFG_PROXY_FINGERPRINT "proxy-fingerprint"
+#define CFG_DEFER_ACCEPT "defer-accept"
+#define CFG_PARAM_DEFER_ACCEPT 11033
+#define CFG_DRAIN_TIMEOUT "drain-timeout"
+#define CFG_PARAM_DRAIN_TIMEOUT 11034
+#define CFG_MAX_GENERATIONS "max-generations"
+#define CFG_PARAM_MAX_GENERATIONS 11035
+#define CFG_WORKERS_MAX "workers-max"
+#define CFG_PARAM_WORKERS_MAX 11036
+#define CFG_WORKERS_LOAD "workers-load"
+#define CFG_PARAM_WORKERS_LOAD 11037
+#define CFG_KTLS "ktls"
 #ifdef TCP_FASTOPEN_WORKS
 	#define CFG_TFO "enable-tcp-fastopen"
 #endif
@@ -150,6 +196,8 @@ front_arg_new(void)
 	fa->selected_protos = 0;
 	fa->prefer_server_ciphers = -1;
 	fa->client_verify = -1;
+	fa->handshake_rate = -1;
+	fa->handshake_rate_resumed = -1;
 
 	return (fa);
 }
@@ -252,6 +300,34 @@ config_new(void)
 
 	r->LOG_FILENAME			= NULL;
 	r->PIDFILE			= NULL;
+	r->STATS_SOCKET			= NULL;
+	r->ADMIN_IP			= NULL;
+	r->ADMIN_PORT			= NULL;
+	r->STALL_THRESHOLD		= 0;
+	r->STALL_WATCHDOG		= 0;
+	r->ACCESS_LOG			= 0;
+	r->FLIGHT_RECORDER		= 0;
+	r->CONTROL_SOCKET		= NULL;
+	r->IDLE_TIMEOUT			= 0;
+	r->CONN_TRACE			= 0;
+	r->HANDSHAKE_RATE		= 0;
+	r->HANDSHAKE_RATE_RESUMED	= 0;
+	r->HANDSHAKE_RATE_PREFIX4	= 32;
+	r->HANDSHAKE_RATE_PREFIX6	= 64;
+	r->MAX_CONNECTIONS		= 0;
+	r->MAX_BUFFER_MEMORY		= 0;
+	r->HANDSHAKE_BUDGET		= 0;
+	r->HANDSHAKE_QUEUE		= 256;
+	r->ADAPTIVE_TIMEOUTS		= 0;
+	r->FINGERPRINT_DENY		= NULL;
+	r->FINGERPRINT_RATE		= 0;
+	r->PROXY_FINGERPRINT		= 0;
+	r->DEFER_ACCEPT			= 1;
+	r->DRAIN_TIMEOUT		= 0;
+	r->MAX_GENERATIONS		= 0;
+	r->WORKERS_MAX			= 0;
+	r->WORKERS_LOAD			= 70;
+	r->KTLS				= 0;
 
 	r->RING_SLOTS			= 0;
 	r->RING_DATA_LEN		= 0;
@@ -298,6 +374,11 @@ config_destroy(hitch_config *cfg)
 	free(cfg->CIPHERSUITES_TLSv13);
 	free(cfg->ENGINE);
 	free(cfg->PIDFILE);
+	free(cfg->STATS_SOCKET);
+	free(cfg->CONTROL_SOCKET);
+	free(cfg->FINGERPRINT_DENY);
+	free(cfg->ADMIN_IP);
+	free(cfg->ADMIN_PORT);
 	free(cfg->OCSP_DIR);
 	free(cfg->ALPN_PROTOS);
 	free(cfg->ALPN_PROTOS_LV);
@@ -508,6 +589,45 @@ config_param_val_int(char *str, int *dst, int non_negative)
 	return (1);
 }
 
+/* IPv4/IPv6 prefix lengths, for example "24/56" */
+static int
+config_param_val_prefix(char *str, hitch_config *cfg)
+{
+	int p4, p6;
+	char c;
+
+	if (sscanf(str, "%d/%d%c", &p4, &p6, &c) != 2) {
+		config_error_set("Expected IPv4/IPv6 prefix lengths.");
+		return (0);
+	}
+	if (p4 < 0 || p4 > 32 || p6 < 0 || p6 > 128) {
+		config_error_set("Prefix length out of range.");
+		return (0);
+	}
+	cfg->HANDSHAKE_RATE_PREFIX4 = p4;
+	cfg->HANDSHAKE_RATE_PREFIX6 = p6;
+	return (1);
+}
+
+/* A comma separated list of JA3 hashes */
+static int
+config_param_val_fingerprints(const char *str)
+{
+	const char *p;
+	size_t n;
+
+	for (p = str; *p != '\0'; p += n + (p[n] == ',')) {
+		n = strcspn(p, ",");
+		if (n > 0 && (n != 32 || strspn(p, "0123456789abcdefABCDEF")
+		    < n)) {
+			config_error_set("Expected 32 hex digits per "
+			    "fingerprint.");
+			return (0);
+		}
+	}
+	return (1);
+}
+
 static int
 config_param_val_long(char *str, long *dst, int non_negative)
 {
@@ -1026,6 +1146,69 @@ config_param_validate(char *k, char *v, hitch_config *cfg,
 		r = config_param_val_bool(v, &cfg->SNI_NOMATCH_ABORT);
 	} else if (strcmp(k, CFG_OCSP_DIR) == 0) {
 		config_assign_str(&cfg->OCSP_DIR, v);
+	} else if (strcmp(k, CFG_STATS_SOCKET) == 0) {
+		if (strlen(v) > 0) {
+			config_assign_str(&cfg->STATS_SOCKET, v);
+		}
+	} else if (strcmp(k, CFG_ADMIN_LISTEN) == 0) {
+		if (strlen(v) > 0)
+			r = config_param_host_port_wildcard(v, &cfg->ADMIN_IP,
+			    &cfg->ADMIN_PORT, NULL, 1, NULL);
+	} else if (strcmp(k, CFG_STALL_THRESHOLD) == 0) {
+		r = config_param_val_int(v, &cfg->STALL_THRESHOLD, 1);
+	} else if (strcmp(k, CFG_STALL_WATCHDOG) == 0) {
+		r = config_param_val_bool(v, &cfg->STALL_WATCHDOG);
+	} else if (strcmp(k, CFG_ACCESS_LOG) == 0) {
+		r = config_param_val_bool(v, &cfg->ACCESS_LOG);
+	} else if (strcmp(k, CFG_FLIGHT_RECORDER) == 0) {
+		r = config_param_val_int(v, &cfg->FLIGHT_RECORDER, 1);
+	} else if (strcmp(k, CFG_CONTROL_SOCKET) == 0) {
+		if (strlen(v) > 0)
+			config_assign_str(&cfg->CONTROL_SOCKET, v);
+	} else if (strcmp(k, CFG_IDLE_TIMEOUT) == 0) {
+		r = config_param_val_int(v, &cfg->IDLE_TIMEOUT, 1);
+	} else if (strcmp(k, CFG_CONN_TRACE) == 0) {
+		r = config_param_val_bool(v, &cfg->CONN_TRACE);
+	} else if (strcmp(k, CFG_HANDSHAKE_RATE) == 0) {
+		r = config_param_val_int(v, &cfg->HANDSHAKE_RATE, 1);
+	} else if (strcmp(k, CFG_HANDSHAKE_RATE_RESUMED) == 0) {
+		r = config_param_val_int(v, &cfg->HANDSHAKE_RATE_RESUMED, 1);
+	} else if (strcmp(k, CFG_HANDSHAKE_RATE_PREFIX) == 0) {
+		r = config_param_val_prefix(v, cfg);
+	} else if (strcmp(k, CFG_MAX_CONNECTIONS) == 0) {
+		r = config_param_val_int(v, &cfg->MAX_CONNECTIONS, 1);
+	} else if (strcmp(k, CFG_MAX_BUFFER_MEMORY) == 0) {
+		r = config_param_val_int(v, &cfg->MAX_BUFFER_MEMORY, 1);
+	} else if (strcmp(k, CFG_HANDSHAKE_BUDGET) == 0) {
+		r = config_param_val_int(v, &cfg->HANDSHAKE_BUDGET, 1);
+	} else if (strcmp(k, CFG_HANDSHAKE_QUEUE) == 0) {
+		r = config_param_val_int(v, &cfg->HANDSHAKE_QUEUE, 1);
+	} else if (strcmp(k, CFG_ADAPTIVE_TIMEOUTS) == 0) {
+		r = config_param_val_bool(v, &cfg->ADAPTIVE_TIMEOUTS);
+	} else if (strcmp(k, CFG_FINGERPRINT_DENY) == 0) {
+		r = config_param_val_fingerprints(v);
+		if (r && strlen(v) > 0)
+			config_assign_str(&cfg->FINGERPRINT_DENY, v);
+	} else if (strcmp(k, CFG_FINGERPRINT_RATE) == 0) {
+		r = config_param_val_int(v, &cfg->FINGERPRINT_RATE, 1);
+	} else if (strcmp(k, CFG_PROXY_FINGERPRINT) == 0) {
+		r = config_param_val_bool(v, &cfg->PROXY_FINGERPRINT);
+	} else if (strcmp(k, CFG_DEFER_ACCEPT) == 0) {
+		r = config_param_val_int(v, &cfg->DEFER_ACCEPT, 1);
+	} else if (strcmp(k, CFG_DRAIN_TIMEOUT) == 0) {
+		r = config_param_val_int(v, &cfg->DRAIN_TIMEOUT, 1);
+	} else if (strcmp(k, CFG_MAX_GENERATIONS) == 0) {
+		r = config_param_val_int(v, &cfg->MAX_GENERATIONS, 1);
+	} else if (strcmp(k, CFG_WORKERS_MAX) == 0) {
+		r = config_param_val_int(v, &cfg->WORKERS_MAX, 1);
+	} else if (strcmp(k, CFG_WORKERS_LOAD) == 0) {
+		r = config_param_val_int(v, &cfg->WORKERS_LOAD, 1);
+		if (r && (cfg->WORKERS_LOAD < 1 || cfg->WORKERS_LOAD > 100)) {
+			config_error_set("Load out of range (1-100).");
+			r = 0;
+		}
+	} else if (strcmp(k, CFG_KTLS) == 0) {
+		r = config_param_val_bool(v, &cfg->KTLS);
 #ifdef TCP_FASTOPEN_WORKS
 	} else if (strcmp(k, CFG_TFO) == 0) {
 		config_param_val_bool(v, &cfg->TFO);
@@ -1294,6 +1477,12 @@ config_print_usage_fd(char *prog, FILE *out)
 	fprintf(out, "  -l  --log-filename=FILE    Send log message to a logfile instead of stderr/stdout\n");
 	fprintf(out, "  -s  --syslog               Send log message to syslog in addition to stderr/stdout\n");
 	fprintf(out, "      --syslog-facility=FACILITY    Syslog facility to use (Default: \"%s\")\n", config_disp_log_facility(cfg->SYSLOG_FACILITY));
+	fprintf(out, "      --access-log           Log one record per connection (Default: %s)\n", config_disp_bool(cfg->ACCESS_LOG));
+	fprintf(out, "      --flight-recorder=MS   Log the recent events of connections that fail, or\n");
+	fprintf(out, "                             with a handshake, backend connect or backend\n");
+	fprintf(out, "                             response slower than this (Default: %d, disabled)\n", cfg->FLIGHT_RECORDER);
+	fprintf(out, "      --conn-trace           Log a trace of every connection, for replay\n");
+	fprintf(out, "                             by hitch-bench (Default: %s)\n", config_disp_bool(cfg->CONN_TRACE));
 	fprintf(out, "\n");
 	fprintf(out, "OTHER OPTIONS:\n");
 	fprintf(out, "      --daemon               Fork into background and become a daemon (Default: %s)\n", config_disp_bool(cfg->DAEMONIZE));
@@ -1319,6 +1508,57 @@ config_print_usage_fd(char *prog, FILE *out)
 	fprintf(out, "      --ocsp-dir=DIR         Set OCSP staple cache directory\n");
 	fprintf(out, "                             This enables automated retrieval and stapling of OCSP responses\n");
 	fprintf(out, "                             (Default: \"%s\")\n", config_disp_str(cfg->OCSP_DIR));
+	fprintf(out, "      --stats-socket=FILE    Serve runtime statistics on a UNIX socket\n");
+	fprintf(out, "                             (Default: \"%s\")\n", config_disp_str(cfg->STATS_SOCKET));
+	fprintf(out, "      --control-socket=FILE  Accept management commands on a UNIX socket\n");
+	fprintf(out, "                             (Default: \"%s\")\n", config_disp_str(cfg->CONTROL_SOCKET));
+	fprintf(out, "      --idle-timeout=SECS    Close established connections idle for longer than this\n");
+	fprintf(out, "                             (Default: %d, disabled)\n", cfg->IDLE_TIMEOUT);
+	fprintf(out, "      --handshake-rate=NUM   Full handshakes per second allowed to a client\n");
+	fprintf(out, "                             address, 0 for no limit (Default: %d)\n", cfg->HANDSHAKE_RATE);
+	fprintf(out, "      --handshake-rate-resumed=NUM\n");
+	fprintf(out, "                             Resumed handshakes per second allowed to a client\n");
+	fprintf(out, "                             address, 0 for no limit (Default: %d)\n", cfg->HANDSHAKE_RATE_RESUMED);
+	fprintf(out, "      --handshake-rate-prefix=V4/V6\n");
+	fprintf(out, "                             Prefix lengths of the addresses sharing a rate\n");
+	fprintf(out, "                             (Default: \"%d/%d\")\n", cfg->HANDSHAKE_RATE_PREFIX4, cfg->HANDSHAKE_RATE_PREFIX6);
+	fprintf(out, "      --max-connections=NUM  Connections per worker before accepting pauses\n");
+	fprintf(out, "                             (Default: %d, no limit)\n", cfg->MAX_CONNECTIONS);
+	fprintf(out, "      --max-buffer-memory=MB Memory of the connection buffers of all workers\n");
+	fprintf(out, "                             (Default: %d, no limit)\n", cfg->MAX_BUFFER_MEMORY);
+	fprintf(out, "      --handshake-budget=MS  Time for full handshakes per event loop iteration,\n");
+	fprintf(out, "                             the others are queued (Default: %d, no limit)\n", cfg->HANDSHAKE_BUDGET);
+	fprintf(out, "      --handshake-queue=NUM  Full handshakes queued per worker before the\n");
+	fprintf(out, "                             oldest ones are dropped (Default: %d)\n", cfg->HANDSHAKE_QUEUE);
+	fprintf(out, "      --adaptive-timeouts    Shorten the timeouts of a worker nearing its\n");
+	fprintf(out, "                             connection or memory limits (Default: %s)\n", config_disp_bool(cfg->ADAPTIVE_TIMEOUTS));
+	fprintf(out, "      --fingerprint-deny=LIST\n");
+	fprintf(out, "                             Refuse handshakes with these ClientHello\n");
+	fprintf(out, "                             JA3 hashes, comma separated (Default: \"%s\")\n", config_disp_str(cfg->FINGERPRINT_DENY));
+	fprintf(out, "      --fingerprint-rate=NUM Full handshakes per second allowed to a\n");
+	fprintf(out, "                             ClientHello fingerprint, 0 for no limit (Default: %d)\n", cfg->FINGERPRINT_RATE);
+	fprintf(out, "      --proxy-fingerprint    Send the ClientHello fingerprint in a PROXY v2\n");
+	fprintf(out, "                             TLV of type 0xE0 (Default: %s)\n", config_disp_bool(cfg->PROXY_FINGERPRINT));
+	fprintf(out, "      --defer-accept=SECS    Seconds the kernel waits for the first bytes\n");
+	fprintf(out, "                             before passing on a connection (Default: %d)\n", cfg->DEFER_ACCEPT);
+	fprintf(out, "      --drain-timeout=SECS   Time a retired worker has to finish its\n");
+	fprintf(out, "                             connections (Default: %d, no limit)\n", cfg->DRAIN_TIMEOUT);
+	fprintf(out, "      --max-generations=NUM  Worker generations running at once, the\n");
+	fprintf(out, "                             oldest are closed (Default: %d, no limit)\n", cfg->MAX_GENERATIONS);
+	fprintf(out, "      --workers-max=NUM      Workers to start under load, from the\n");
+	fprintf(out, "                             number of workers up (Default: %d, fixed)\n", cfg->WORKERS_MAX);
+	fprintf(out, "      --workers-load=PCT     Load of the workers to scale at\n");
+	fprintf(out, "                             (Default: %d)\n", cfg->WORKERS_LOAD);
+	fprintf(out, "      --ktls                 Have the kernel do the TLS records, to migrate\n");
+	fprintf(out, "                             connections on reload (Default: %s)\n", config_disp_bool(cfg->KTLS));
+	fprintf(out, "      --admin-listen=[HOST]:PORT\n");
+	fprintf(out, "                             Serve runtime statistics and OpenMetrics over HTTP\n");
+	fprintf(out, "                             (Default: \"%s\")\n", config_disp_hostport(cfg->ADMIN_IP, cfg->ADMIN_PORT));
+	fprintf(out, "      --stall-threshold=MS   Log event loop iterations running longer than this\n");
+	fprintf(out, "                             (Default: %d, disabled)\n", cfg->STALL_THRESHOLD);
+	fprintf(out, "      --stall-watchdog       Log a backtrace when an event loop is stuck\n");
+	fprintf(out, "                             for longer than the stall threshold\n");
+	fprintf(out, "                             (Default: %s)\n", config_disp_bool(cfg->STALL_WATCHDOG));
 	fprintf(out, "\n");
 	fprintf(out, "  -t  --test                 Test configuration and exit\n");
 	fprintf(out, "  -p  --pidfile=FILE         PID file\n");
@@ -1437,6 +1677,35 @@ config_parse_cli(int argc, char **argv, hitch_config *cfg)
 		{ CFG_ALPN_PROTOS, 1, NULL, CFG_PARAM_ALPN_PROTOS },
 		{ CFG_SNI_NOMATCH_ABORT, 0, &cfg->SNI_NOMATCH_ABORT, 1 },
 		{ CFG_OCSP_DIR, 1, NULL, 'o' },
+		{ CFG_STATS_SOCKET, 1, NULL, CFG_PARAM_STATS_SOCKET },
+		{ CFG_ADMIN_LISTEN, 1, NULL, CFG_PARAM_ADMIN_LISTEN },
+		{ CFG_STALL_THRESHOLD, 1, NULL, CFG_PARAM_STALL_THRESHOLD },
+		{ CFG_STALL_WATCHDOG, 0, &cfg->STALL_WATCHDOG, 1 },
+		{ CFG_ACCESS_LOG, 0, &cfg->ACCESS_LOG, 1 },
+		{ CFG_FLIGHT_RECORDER, 1, NULL, CFG_PARAM_FLIGHT_RECORDER },
+		{ CFG_CONTROL_SOCKET, 1, NULL, CFG_PARAM_CONTROL_SOCKET },
+		{ CFG_IDLE_TIMEOUT, 1, NULL, CFG_PARAM_IDLE_TIMEOUT },
+		{ CFG_CONN_TRACE, 0, &cfg->CONN_TRACE, 1 },
+		{ CFG_HANDSHAKE_RATE, 1, NULL, CFG_PARAM_HANDSHAKE_RATE },
+		{ CFG_HANDSHAKE_RATE_RESUMED, 1, NULL,
+		    CFG_PARAM_HANDSHAKE_RATE_RESUMED },
+		{ CFG_HANDSHAKE_RATE_PREFIX, 1, NULL,
+		    CFG_PARAM_HANDSHAKE_RATE_PREFIX },
+		{ CFG_MAX_CONNECTIONS, 1, NULL, CFG_PARAM_MAX_CONNECTIONS },
+		{ CFG_MAX_BUFFER_MEMORY, 1, NULL,
+		    CFG_PARAM_MAX_BUFFER_MEMORY },
+		{ CFG_HANDSHAKE_BUDGET, 1, NULL, CFG_PARAM_HANDSHAKE_BUDGET },
+		{ CFG_HANDSHAKE_QUEUE, 1, NULL, CFG_PARAM_HANDSHAKE_QUEUE },
+		{ CFG_ADAPTIVE_TIMEOUTS, 0, &cfg->ADAPTIVE_TIMEOUTS, 1 },
+		{ CFG_FINGERPRINT_DENY, 1, NULL, CFG_PARAM_FINGERPRINT_DENY },
+		{ CFG_FINGERPRINT_RATE, 1, NULL, CFG_PARAM_FINGERPRINT_RATE },
+		{ CFG_PROXY_FINGERPRINT, 0, &cfg->PROXY_FINGERPRINT, 1 },
+		{ CFG_DEFER_ACCEPT, 1, NULL, CFG_PARAM_DEFER_ACCEPT },
+		{ CFG_DRAIN_TIMEOUT, 1, NULL, CFG_PARAM_DRAIN_TIMEOUT },
+		{ CFG_MAX_GENERATIONS, 1, NULL, CFG_PARAM_MAX_GENERATIONS },
+		{ CFG_WORKERS_MAX, 1, NULL, CFG_PARAM_WORKERS_MAX },
+		{ CFG_WORKERS_LOAD, 1, NULL, CFG_PARAM_WORKERS_LOAD },
+		{ CFG_KTLS, 0, &cfg->KTLS, 1 },
 		{ "test", 0, NULL, 't' },
 		{ "version", 0, NULL, 'V' },
 		{ "help", 0, NULL, 'h' },
@@ -1503,6 +1772,26 @@ CFG_ARG(CFG_PARAM_SYSLOG_FACILITY, CFG_SYSLOG_FACILITY);
 CFG_ARG(CFG_PARAM_SEND_BUFSIZE, CFG_SEND_BUFSIZE);
 CFG_ARG(CFG_PARAM_RECV_BUFSIZE, CFG_RECV_BUFSIZE);
 CFG_ARG(CFG_PARAM_ALPN_PROTOS, CFG_ALPN_PROTOS);
+CFG_ARG(CFG_PARAM_STATS_SOCKET, CFG_STATS_SOCKET);
+CFG_ARG(CFG_PARAM_ADMIN_LISTEN, CFG_ADMIN_LISTEN);
+CFG_ARG(CFG_PARAM_STALL_THRESHOLD, CFG_STALL_THRESHOLD);
+CFG_ARG(CFG_PARAM_FLIGHT_RECORDER, CFG_FLIGHT_RECORDER);
+CFG_ARG(CFG_PARAM_CONTROL_SOCKET, CFG_CONTROL_SOCKET);
+CFG_ARG(CFG_PARAM_IDLE_TIMEOUT, CFG_IDLE_TIMEOUT);
+CFG_ARG(CFG_PARAM_HANDSHAKE_RATE, CFG_HANDSHAKE_RATE);
+CFG_ARG(CFG_PARAM_HANDSHAKE_RATE_RESUMED, CFG_HANDSHAKE_RATE_RESUMED);
+CFG_ARG(CFG_PARAM_HANDSHAKE_RATE_PREFIX, CFG_HANDSHAKE_RATE_PREFIX);
+CFG_ARG(CFG_PARAM_MAX_CONNECTIONS, CFG_MAX_CONNECTIONS);
+CFG_ARG(CFG_PARAM_MAX_BUFFER_MEMORY, CFG_MAX_BUFFER_MEMORY);
+CFG_ARG(CFG_PARAM_HANDSHAKE_BUDGET, CFG_HANDSHAKE_BUDGET);
+CFG_ARG(CFG_PARAM_HANDSHAKE_QUEUE, CFG_HANDSHAKE_QUEUE);
+CFG_ARG(CFG_PARAM_FINGERPRINT_DENY, CFG_FINGERPRINT_DENY);
+CFG_ARG(CFG_PARAM_FINGERPRINT_RATE, CFG_FINGERPRINT_RATE);
+CFG_ARG(CFG_PARAM_DEFER_ACCEPT, CFG_DEFER_ACCEPT);
+CFG_ARG(CFG_PARAM_DRAIN_TIMEOUT, CFG_DRAIN_TIMEOUT);
+CFG_ARG(CFG_PARAM_MAX_GENERATIONS, CFG_MAX_GENERATIONS);
+CFG_ARG(CFG_PARAM_WORKERS_MAX, CFG_WORKERS_MAX);
+CFG_ARG(CFG_PARAM_WORKERS_LOAD, CFG_WORKERS_LOAD);
 CFG_ARG('c', CFG_CIPHERS);
 CFG_ARG('e', CFG_SSL_ENGINE);
 CFG_ARG('b', CFG_BACKEND);
@@ -1600,6 +1889,14 @@ CFG_ON('s', CFG_SYSLOG);
 	}
 
 
+#ifndef HAVE_KTLS
+	if (cfg->KTLS) {
+		config_error_set("ktls is set, but hitch is built without"
+		    " kTLS support.");
+		return (1);
+	}
+#endif
+
 #ifdef USE_SHARED_CACHE
 	if (cfg->SHCUPD_IP != NULL && ! cfg->SHARED_CACHE) {
 		config_error_set("Shared cache update listener is defined,"
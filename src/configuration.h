@@ -83,6 +83,8 @@ struct front_arg {
 	int			selected_protos;
 	int			client_verify;
 	char			*client_verify_ca;
+	int			handshake_rate;
+	int			handshake_rate_resumed;
 	int			mark;
 	UT_hash_handle		hh;
 };
@@ -150,6 +152,34 @@ struct __hitch_config {
 	double			OCSP_RESP_TMO;
 	double			OCSP_CONN_TMO;
 	int			OCSP_REFRESH_INTERVAL;
+	char			*STATS_SOCKET;
+	char			*ADMIN_IP;
+	char			*ADMIN_PORT;
+	int			STALL_THRESHOLD;
+	int			STALL_WATCHDOG;
+	int			ACCESS_LOG;
+	int			FLIGHT_RECORDER;
+	char			*CONTROL_SOCKET;
+	int			IDLE_TIMEOUT;
+	int			CONN_TRACE;
+	int			HANDSHAKE_RATE;
+	int			HANDSHAKE_RATE_RESUMED;
+	int			HANDSHAKE_RATE_PREFIX4;
+	int			HANDSHAKE_RATE_PREFIX6;
+	int			MAX_CONNECTIONS;
+	int			MAX_BUFFER_MEMORY;
+	int			HANDSHAKE_BUDGET;
+	int			HANDSHAKE_QUEUE;
+	int			ADAPTIVE_TIMEOUTS;
+	char			*FINGERPRINT_DENY;
+	int			FINGERPRINT_RATE;
+	int			PROXY_FINGERPRINT;
+	int			DEFER_ACCEPT;
+	int			DRAIN_TIMEOUT;
+	int			MAX_GENERATIONS;
+	int			WORKERS_MAX;
+	int			WORKERS_LOAD;
+	int			KTLS;
 #ifdef TCP_FASTOPEN_WORKS
 	int			TFO;
 #endif
@@ -161,5 +191,6 @@ const char * config_error_get (void);
 hitch_config * config_new (void);
 void config_destroy (hitch_config *cfg);
 int config_parse_cli(int argc, char **argv, hitch_config *cfg);
+int config_scan_pem_dir(char *pemdir, hitch_config *cfg);
 
 #endif  /* CONFIGURATION_H_INCLUDED */
@@ -0,0 +1,246 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#include "config.h"
+
+#include <arpa/inet.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "connreg.h"
+#include "foreign/miniobj.h"
+#include "foreign/vas.h"
+
+#define HCONN_MIN_SLOTS		256
+
+struct hconn *hconn_tab;
+static unsigned hconn_n;
+static unsigned hconn_sz;
+
+static const char * const hconn_state_name[HCONN__MAX] = {
+	[HCONN_PENDING] =	"pending",
+	[HCONN_PROXY] =		"proxy",
+	[HCONN_HANDSHAKE] =	"handshake",
+	[HCONN_CONNECT] =	"connect",
+	[HCONN_ESTABLISHED] =	"established",
+	[HCONN_CLOSING] =	"closing",
+};
+
+void
+HCONN_add(proxystate *ps, enum hconn_state state, double now)
+{
+	struct hconn *hc;
+
+	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	assert(state < HCONN__MAX);
+	if (hconn_n == hconn_sz) {
+		hconn_sz = hconn_sz ? 2 * hconn_sz : HCONN_MIN_SLOTS;
+		hconn_tab = realloc(hconn_tab, hconn_sz * sizeof *hconn_tab);
+		AN(hconn_tab);
+	}
+	ps->conn_idx = hconn_n;
+	hc = &hconn_tab[hconn_n++];
+	hc->ps = ps;
+	hc->t_accept = now;
+	hc->t_active = now;
+	hc->state = state;
+}
+
+void
+HCONN_del(proxystate *ps)
+{
+	unsigned i;
+
+	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	i = ps->conn_idx;
+	assert(i < hconn_n);
+	assert(hconn_tab[i].ps == ps);
+	if (i != --hconn_n) {
+		hconn_tab[i] = hconn_tab[hconn_n];
+		hconn_tab[i].ps->conn_idx = i;
+	}
+}
+
+void
+HCONN_state(proxystate *ps, enum hconn_state state)
+{
+	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	assert(ps->conn_idx < hconn_n);
+	assert(state < HCONN__MAX);
+	hconn_tab[ps->conn_idx].state = state;
+}
+
+unsigned
+HCONN_count(void)
+{
+	return (hconn_n);
+}
+
+void
+HCONN_iter(hconn_iter_f *func, void *priv)
+{
+	unsigned i;
+
+	AN(func);
+	for (i = hconn_n; i-- > 0; )
+		func(priv, &hconn_tab[i]);
+}
+
+const char *
+HCONN_state_name(enum hconn_state state)
+{
+	assert(state < HCONN__MAX);
+	return (hconn_state_name[state]);
+}
+
+void
+HCONN_match_init(struct hconn_match *m)
+{
+	AN(m);
+	memset(m, 0, sizeof *m);
+	m->state = -1;
+	m->fd = -1;
+}
+
+/* Parse NAME=VALUE filters:
+ *
+ *	state=NAME	in this state
+ *	age=SECS	accepted more than SECS ago
+ *	idle=SECS	no data read for more than SECS
+ *	sni=NAME	with this SNI server name
+ *	client=ADDR	from this client address
+ *	fd=N		with this client socket
+ */
+int
+HCONN_match_parse(struct hconn_match *m, int argc, char * const *argv,
+    struct vsb *err)
+{
+	const char *v;
+	char *end;
+	size_t l;
+	int i, s;
+
+	AN(m);
+	AN(err);
+	HCONN_match_init(m);
+	for (i = 0; i < argc; i++) {
+		v = strchr(argv[i], '=');
+		if (v == NULL || v[1] == '\0') {
+			VSB_printf(err, "Invalid filter: %s\n", argv[i]);
+			return (-1);
+		}
+		l = v++ - argv[i];
+		end = NULL;
+		if (l == 5 && strncmp(argv[i], "state", l) == 0) {
+			for (s = 0; s < HCONN__MAX; s++)
+				if (strcmp(v, hconn_state_name[s]) == 0)
+					break;
+			if (s == HCONN__MAX) {
+				VSB_printf(err, "Unknown state: %s\n", v);
+				return (-1);
+			}
+			m->state = s;
+		} else if (l == 3 && strncmp(argv[i], "age", l) == 0) {
+			m->min_age = strtod(v, &end);
+		} else if (l == 4 && strncmp(argv[i], "idle", l) == 0) {
+			m->min_idle = strtod(v, &end);
+		} else if (l == 2 && strncmp(argv[i], "fd", l) == 0) {
+			m->fd = strtol(v, &end, 10);
+		} else if (l == 3 && strncmp(argv[i], "sni", l) == 0 &&
+		    strlen(v) < sizeof m->sni) {
+			strcpy(m->sni, v);
+		} else if (l == 6 && strncmp(argv[i], "client", l) == 0 &&
+		    strlen(v) < sizeof m->client) {
+			strcpy(m->client, v);
+		} else {
+			VSB_printf(err, "Invalid filter: %s\n", argv[i]);
+			return (-1);
+		}
+		if (end != NULL && *end != '\0') {
+			VSB_printf(err, "Invalid number: %s\n", argv[i]);
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+static int
+hconn_match_client(const char *client, const struct sockaddr_storage *ss)
+{
+	char buf[INET6_ADDRSTRLEN];
+	const void *a;
+
+	if (ss->ss_family == AF_INET)
+		a = &((const struct sockaddr_in *)ss)->sin_addr;
+	else if (ss->ss_family == AF_INET6)
+		a = &((const struct sockaddr_in6 *)ss)->sin6_addr;
+	else
+		return (0);
+	if (inet_ntop(ss->ss_family, a, buf, sizeof buf) == NULL)
+		return (0);
+	return (strcmp(client, buf) == 0);
+}
+
+int
+HCONN_match(const struct hconn_match *m, const struct hconn *hc, double now)
+{
+	const char *sni = NULL;
+	const proxystate *ps;
+
+	AN(m);
+	AN(hc);
+	if (m->state >= 0 && hc->state != (enum hconn_state)m->state)
+		return (0);
+	if (m->min_age > 0. && now - hc->t_accept <= m->min_age)
+		return (0);
+	if (m->min_idle > 0. && now - hc->t_active <= m->min_idle)
+		return (0);
+
+	CHECK_OBJ_NOTNULL(hc->ps, PROXYSTATE_MAGIC);
+	ps = hc->ps;
+	if (m->fd >= 0 && ps->fd_up != m->fd)
+		return (0);
+	if (m->client[0] != '\0' &&
+	    !hconn_match_client(m->client, &ps->remote_ip))
+		return (0);
+	if (m->sni[0] != '\0') {
+#ifndef OPENSSL_NO_TLSEXT
+		if (ps->ssl != NULL)
+			sni = SSL_get_servername(ps->ssl,
+			    TLSEXT_NAMETYPE_host_name);
+#endif
+		if (sni == NULL || strcasecmp(sni, m->sni) != 0)
+			return (0);
+	}
+	return (1);
+}
@@ -0,0 +1,101 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+
+#ifndef CONNREG_H_INCLUDED
+#define CONNREG_H_INCLUDED
+
+#include <netinet/in.h>
+
+#include "hitch.h"
+#include "foreign/vsb.h"
+
+/*
+ * Connection registry of a worker.
+ *
+ * Every live proxystate has an entry in a dense array, and knows the
+ * index of its entry. Removing a connection moves the last entry into
+ * the hole, so insertion and removal are O(1), and walking the
+ * connections only touches the array. The entries hold what is needed
+ * to select connections without dereferencing them: their state, and
+ * the times of accept and of the last data read.
+ */
+
+enum hconn_state {
+	HCONN_PENDING,		/* Waiting for the first bytes */
+	HCONN_PROXY,		/* Waiting for the PROXY line */
+	HCONN_HANDSHAKE,
+	HCONN_CONNECT,		/* Connecting to the backend */
+	HCONN_ESTABLISHED,
+	HCONN_CLOSING,
+	HCONN__MAX
+};
+
+struct hconn {
+	proxystate		*ps;
+	double			t_accept;
+	double			t_active;
+	enum hconn_state	state;
+};
+
+/* Selects connections. Fixed size, so that it can be passed from the
+ * master to the workers as is. */
+struct hconn_match {
+	int			state;		/* -1 for any */
+	int			fd;		/* -1 for any */
+	double			min_age;
+	double			min_idle;
+	char			sni[64];
+	char			client[INET6_ADDRSTRLEN];
+};
+
+extern struct hconn *hconn_tab;
+
+#define HCONN_TOUCH(ps, now)	(hconn_tab[(ps)->conn_idx].t_active = (now))
+
+/* Called for each connection, the last one first. The callback may
+ * close the connection it is passed, but no other. */
+typedef void hconn_iter_f(void *priv, const struct hconn *hc);
+
+void HCONN_add(proxystate *ps, enum hconn_state state, double now);
+void HCONN_del(proxystate *ps);
+void HCONN_state(proxystate *ps, enum hconn_state state);
+unsigned HCONN_count(void);
+void HCONN_iter(hconn_iter_f *func, void *priv);
+const char *HCONN_state_name(enum hconn_state state);
+
+void HCONN_match_init(struct hconn_match *m);
+int HCONN_match_parse(struct hconn_match *m, int argc, char * const *argv,
+    struct vsb *err);
+int HCONN_match(const struct hconn_match *m, const struct hconn *hc,
+    double now);
+
+#endif /* CONNREG_H_INCLUDED */
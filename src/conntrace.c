@@ -0,0 +1,226 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "conntrace.h"
+#include "foreign/miniobj.h"
+#include "foreign/vas.h"
+
+struct htrace_burst {
+	uint32_t		ms;		/* Since accept */
+	uint32_t		bytes;
+	char			dir;
+};
+
+struct htrace {
+	unsigned		magic;
+#define HTRACE_MAGIC		0x2b7c91e4
+	unsigned		hello:1;
+	unsigned		resume:1;	/* Offered a session */
+	unsigned		n;
+	unsigned		lost;
+	double			t0;
+	double			hello_ms;
+	unsigned		version;	/* Highest offered */
+	unsigned		ciphers;
+	char			alpn[64];	/* Offered protocols */
+	struct htrace_burst	b[HTRACE_BURSTS];
+};
+
+/* Returns NULL if out of memory, the connection then goes without */
+struct htrace *
+HTRACE_new(double t0)
+{
+	struct htrace *tr;
+
+	ALLOC_OBJ(tr, HTRACE_MAGIC);
+	if (tr == NULL)
+		return (NULL);
+	tr->t0 = t0;
+	return (tr);
+}
+
+void
+HTRACE_free(struct htrace **trp)
+{
+	struct htrace *tr;
+
+	AN(trp);
+	CAST_OBJ_NOTNULL(tr, *trp, HTRACE_MAGIC);
+	*trp = NULL;
+	FREE_OBJ(tr);
+}
+
+#ifdef HAVE_SSL_CTX_SET_CLIENT_HELLO_CB
+/* GREASE values, RFC 8701, are 0x?a?a */
+#define HTRACE_GREASE(v)	(((v) & 0x0f0f) == 0x0a0a)
+
+/* The protocols go into the record as a comma separated list, anything
+ * that could break up the list or the record is replaced. */
+static void
+htrace_alpn(struct htrace *tr, const unsigned char *p, size_t len)
+{
+	size_t i, l, n, o = 0;
+
+	if (len < 2)
+		return;
+	len = len - 2 < (size_t)(p[0] << 8 | p[1]) ?
+	    len - 2 : (size_t)(p[0] << 8 | p[1]);
+	p += 2;
+	while (len > 0) {
+		l = *p++;
+		len--;
+		if (l > len)
+			break;
+		n = o > 0 ? l + 1 : l;
+		if (o + n >= sizeof tr->alpn)
+			break;
+		if (o > 0)
+			tr->alpn[o++] = ',';
+		for (i = 0; i < l; i++)
+			tr->alpn[o++] = (p[i] > ' ' && p[i] < 0x7f &&
+			    p[i] != ',') ? p[i] : '?';
+		p += l;
+		len -= l;
+	}
+	tr->alpn[o] = '\0';
+}
+
+void
+HTRACE_hello(struct htrace *tr, SSL *ssl, double now)
+{
+	const unsigned char *p;
+	size_t len, i;
+	unsigned v;
+
+	CHECK_OBJ_NOTNULL(tr, HTRACE_MAGIC);
+	if (tr->hello)
+		return;
+	tr->hello = 1;
+	tr->hello_ms = now > tr->t0 ? (now - tr->t0) * 1e3 : 0;
+	tr->version = SSL_client_hello_get0_legacy_version(ssl);
+	if (SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_supported_versions,
+	    &p, &len) && len > 0) {
+		for (i = 1; i + 1 < len && i <= p[0]; i += 2) {
+			v = p[i] << 8 | p[i + 1];
+			if (!HTRACE_GREASE(v) && v > tr->version)
+				tr->version = v;
+		}
+	}
+	tr->ciphers = SSL_client_hello_get0_ciphers(ssl, &p) / 2;
+	if (SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_psk, &p, &len) ||
+	    (SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_session_ticket,
+	    &p, &len) && len > 0))
+		tr->resume = 1;
+	if (SSL_client_hello_get0_ext(ssl,
+	    TLSEXT_TYPE_application_layer_protocol_negotiation, &p, &len))
+		htrace_alpn(tr, p, len);
+}
+#endif
+
+void
+HTRACE_data(struct htrace *tr, int dir, size_t len, double now)
+{
+	struct htrace_burst *b;
+
+	CHECK_OBJ_NOTNULL(tr, HTRACE_MAGIC);
+	assert(dir == HTRACE_CLIENT || dir == HTRACE_BACKEND);
+	if (tr->n > 0 && tr->b[tr->n - 1].dir == dir) {
+		b = &tr->b[tr->n - 1];
+		b->bytes = len > UINT32_MAX - b->bytes ?
+		    UINT32_MAX : b->bytes + len;
+		return;
+	}
+	if (tr->n == HTRACE_BURSTS) {
+		tr->lost++;
+		return;
+	}
+	b = &tr->b[tr->n++];
+	b->dir = dir;
+	b->ms = now > tr->t0 ? (now - tr->t0) * 1e3 : 0;
+	b->bytes = len > UINT32_MAX ? UINT32_MAX : len;
+}
+
+static const char *
+htrace_version(unsigned v)
+{
+
+	switch (v) {
+	case 0x0300:	return ("SSLv3");
+	case 0x0301:	return ("TLSv1");
+	case 0x0302:	return ("TLSv1.1");
+	case 0x0303:	return ("TLSv1.2");
+	case 0x0304:	return ("TLSv1.3");
+	default:	return ("-");
+	}
+}
+
+/*
+ * The trace fields of the record: ClientHello time in milliseconds,
+ * highest version offered, number of cipher suites, whether a session
+ * was offered, ALPN protocols offered, and the bursts.
+ */
+const char *
+HTRACE_str(const struct htrace *tr, char *buf, size_t sz)
+{
+	const struct htrace_burst *b;
+	size_t l;
+	unsigned i;
+	int n;
+
+	CHECK_OBJ_NOTNULL(tr, HTRACE_MAGIC);
+	AN(buf);
+	assert(sz > 0);
+	if (!tr->hello)
+		n = snprintf(buf, sz, "-\t-\t-\t-\t-\t");
+	else
+		n = snprintf(buf, sz, "%.3f\t%s\t%u\t%u\t%s\t", tr->hello_ms,
+		    htrace_version(tr->version), tr->ciphers, tr->resume,
+		    tr->alpn[0] != '\0' ? tr->alpn : "-");
+	l = n < 0 ? 0 : (size_t)n;
+	if (tr->n == 0 && l < sz)
+		(void)snprintf(buf + l, sz - l, "-");
+	for (i = 0; i < tr->n && l < sz; i++) {
+		b = &tr->b[i];
+		n = snprintf(buf + l, sz - l, "%s%c%u:%u", i > 0 ? "," : "",
+		    b->dir, b->ms, b->bytes);
+		l += n < 0 ? 0 : (size_t)n;
+	}
+	if (tr->lost > 0 && l < sz)
+		(void)snprintf(buf + l, sz - l, ",+%u", tr->lost);
+	return (buf);
+}
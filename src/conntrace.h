@@ -0,0 +1,64 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#ifndef CONNTRACE_H_INCLUDED
+#define CONNTRACE_H_INCLUDED
+
+#include "hitch.h"
+
+/*
+ * Per-connection traces.
+ *
+ * When enabled, every connection notes what its ClientHello offered,
+ * and the bursts of data it carried: how many bytes went one way
+ * before data came back the other way, and when. A record is logged
+ * when the connection is freed, for hitch-bench to replay the same
+ * workload later.
+ */
+
+#define HTRACE_BURSTS		24
+
+#define HTRACE_CLIENT		'c'	/* Read from the TLS side */
+#define HTRACE_BACKEND		'b'	/* Read from the clear side */
+
+#define HTRACE_DATA(ps, dir, len, now)					\
+	do {								\
+		if ((ps)->trace != NULL)				\
+			HTRACE_data((ps)->trace, (dir), (len), (now));	\
+	} while (0)
+
+struct htrace *HTRACE_new(double t0);
+void HTRACE_hello(struct htrace *tr, SSL *ssl, double now);
+void HTRACE_data(struct htrace *tr, int dir, size_t len, double now);
+const char *HTRACE_str(const struct htrace *tr, char *buf, size_t sz);
+void HTRACE_free(struct htrace **trp);
+
+#endif /* CONNTRACE_H_INCLUDED */
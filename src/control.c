@@ -0,0 +1,380 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#include "config.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "logging.h"
+#include "foreign/miniobj.h"
+#include "foreign/vas.h"
+#include "foreign/vqueue.h"
+
+/* hitch.c */
+extern hitch_config *CONFIG;
+
+#define HCTL_SESS_TIMEOUT	300.0
+#define HCTL_REQ_LEN		1024
+
+/* A connection to the control socket */
+struct hctl_sess {
+	unsigned		magic;
+#define HCTL_SESS_MAGIC		0x3b81d4a7
+	int			fd;
+	ev_io			ev_r;
+	ev_io			ev_w;
+	ev_timer		ev_t;
+	char			req[HCTL_REQ_LEN];
+	size_t			req_len;
+	struct vsb		*resp;
+	ssize_t			resp_off;
+	VTAILQ_ENTRY(hctl_sess)	list;
+};
+
+static VTAILQ_HEAD(, hctl_sess) hctl_sessions =
+    VTAILQ_HEAD_INITIALIZER(hctl_sessions);
+
+static pid_t hctl_master;
+static int hctl_fd = -1;
+static ev_io hctl_listener;
+static char *hctl_path;
+static struct ev_loop *hctl_loop;
+static hctl_cmd_f *hctl_cmd;
+
+static void
+hctl_sess_close(struct hctl_sess *cs)
+{
+	CHECK_OBJ_NOTNULL(cs, HCTL_SESS_MAGIC);
+	ev_io_stop(hctl_loop, &cs->ev_r);
+	ev_io_stop(hctl_loop, &cs->ev_w);
+	ev_timer_stop(hctl_loop, &cs->ev_t);
+	VTAILQ_REMOVE(&hctl_sessions, cs, list);
+	(void)close(cs->fd);
+	if (cs->resp != NULL)
+		VSB_delete(cs->resp);
+	FREE_OBJ(cs);
+}
+
+/* Split a request line into words, in place */
+static int
+hctl_split(char *line, char **argv)
+{
+	int argc = 0;
+
+	while (*line != '\0') {
+		while (isspace((unsigned char)*line))
+			*line++ = '\0';
+		if (*line == '\0')
+			break;
+		if (argc == HCTL_MAX_ARGS)
+			return (-1);
+		argv[argc++] = line;
+		while (*line != '\0' && !isspace((unsigned char)*line))
+			line++;
+	}
+	argv[argc] = NULL;
+	return (argc);
+}
+
+/* Run every complete line in the request buffer, and queue the
+ * responses. */
+static void
+hctl_sess_run(struct hctl_sess *cs)
+{
+	char *argv[HCTL_MAX_ARGS + 1];
+	struct vsb *body;
+	char *nl;
+	size_t l;
+	int argc, status;
+
+	CHECK_OBJ_NOTNULL(cs, HCTL_SESS_MAGIC);
+	body = VSB_new_auto();
+	AN(body);
+	AZ(cs->resp);
+	cs->resp = VSB_new_auto();
+	AN(cs->resp);
+
+	while ((nl = memchr(cs->req, '\n', cs->req_len)) != NULL) {
+		*nl = '\0';
+		l = nl + 1 - cs->req;
+		argc = hctl_split(cs->req, argv);
+		if (argc == 0) {
+			memmove(cs->req, nl + 1, cs->req_len - l);
+			cs->req_len -= l;
+			continue;
+		}
+
+		VSB_clear(body);
+		if (argc < 0) {
+			VSB_cat(body, "Too many arguments\n");
+			status = HCTL_BAD_REQUEST;
+		} else
+			status = hctl_cmd(body, argc, argv);
+		AZ(VSB_finish(body));
+		VSB_printf(cs->resp, "%03d %zd\n", status, VSB_len(body));
+		VSB_bcat(cs->resp, VSB_data(body), VSB_len(body));
+
+		memmove(cs->req, nl + 1, cs->req_len - l);
+		cs->req_len -= l;
+	}
+	VSB_delete(body);
+
+	if (VSB_len(cs->resp) == 0) {
+		VSB_delete(cs->resp);
+		cs->resp = NULL;
+	} else
+		AZ(VSB_finish(cs->resp));
+}
+
+static void
+hctl_sess_wr(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct hctl_sess *cs;
+	ssize_t l;
+
+	(void)revents;
+	CAST_OBJ_NOTNULL(cs, w->data, HCTL_SESS_MAGIC);
+	AN(cs->resp);
+
+	l = write(cs->fd, VSB_data(cs->resp) + cs->resp_off,
+	    VSB_len(cs->resp) - cs->resp_off);
+	if (l < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (l <= 0) {
+		hctl_sess_close(cs);
+		return;
+	}
+	cs->resp_off += l;
+	if (cs->resp_off < VSB_len(cs->resp))
+		return;
+
+	VSB_delete(cs->resp);
+	cs->resp = NULL;
+	cs->resp_off = 0;
+	ev_io_stop(loop, &cs->ev_w);
+	ev_io_start(loop, &cs->ev_r);
+}
+
+static void
+hctl_sess_rd(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct hctl_sess *cs;
+	ssize_t l;
+
+	(void)revents;
+	CAST_OBJ_NOTNULL(cs, w->data, HCTL_SESS_MAGIC);
+
+	l = read(cs->fd, cs->req + cs->req_len,
+	    sizeof cs->req - 1 - cs->req_len);
+	if (l < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (l <= 0) {
+		hctl_sess_close(cs);
+		return;
+	}
+	cs->req_len += l;
+	ev_timer_again(loop, &cs->ev_t);
+
+	if (memchr(cs->req, '\n', cs->req_len) == NULL) {
+		if (cs->req_len == sizeof cs->req - 1)
+			hctl_sess_close(cs);
+		return;
+	}
+
+	hctl_sess_run(cs);
+	if (cs->resp == NULL)
+		return;
+	ev_io_stop(loop, &cs->ev_r);
+	ev_io_start(loop, &cs->ev_w);
+}
+
+static void
+hctl_sess_timeout(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	struct hctl_sess *cs;
+
+	(void)loop;
+	(void)revents;
+	CAST_OBJ_NOTNULL(cs, w->data, HCTL_SESS_MAGIC);
+	hctl_sess_close(cs);
+}
+
+static void
+hctl_accept(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct hctl_sess *cs;
+	int fd;
+
+	(void)revents;
+	fd = accept4(w->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK &&
+		    errno != EINTR && errno != ECONNABORTED)
+			ERR("{control} accept() failed: %s\n",
+			    strerror(errno));
+		return;
+	}
+
+	ALLOC_OBJ(cs, HCTL_SESS_MAGIC);
+	if (cs == NULL) {
+		(void)close(fd);
+		return;
+	}
+	cs->fd = fd;
+	VTAILQ_INSERT_TAIL(&hctl_sessions, cs, list);
+	ev_io_init(&cs->ev_r, hctl_sess_rd, fd, EV_READ);
+	ev_io_init(&cs->ev_w, hctl_sess_wr, fd, EV_WRITE);
+	ev_init(&cs->ev_t, hctl_sess_timeout);
+	cs->ev_t.repeat = HCTL_SESS_TIMEOUT;
+	cs->ev_r.data = cs;
+	cs->ev_w.data = cs;
+	cs->ev_t.data = cs;
+	ev_io_start(loop, &cs->ev_r);
+	ev_timer_again(loop, &cs->ev_t);
+}
+
+/* Bind the control socket. Called before daemonizing, so that
+ * relative paths work as expected. The socket is only accessible to
+ * the owner. */
+int
+HCTL_listen(const char *path)
+{
+	struct sockaddr_un sun;
+	mode_t um;
+	int fd, flags;
+
+	AN(path);
+	AZ(hctl_path);
+	if (strlen(path) >= sizeof sun.sun_path) {
+		ERR("{core} Control socket path too long: %s\n", path);
+		return (-1);
+	}
+
+	memset(&sun, 0, sizeof sun);
+	sun.sun_family = PF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	fd = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		ERR("{core} Unable to create control socket: %s\n",
+		    strerror(errno));
+		return (-1);
+	}
+
+	/* Remove a stale socket left behind by an earlier instance */
+	(void)unlink(path);
+	um = umask(077);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof sun) != 0 ||
+	    listen(fd, 16) != 0) {
+		ERR("{core} Unable to bind control socket %s: %s\n",
+		    path, strerror(errno));
+		(void)umask(um);
+		(void)close(fd);
+		return (-1);
+	}
+	(void)umask(um);
+
+	flags = fcntl(fd, F_GETFL);
+	AZ(flags < 0);
+	AZ(fcntl(fd, F_SETFL, flags | O_NONBLOCK));
+
+	hctl_path = realpath(path, NULL);
+	if (hctl_path == NULL)
+		hctl_path = strdup(path);
+	AN(hctl_path);
+	hctl_fd = fd;
+	return (0);
+}
+
+static void
+hctl_atexit(void)
+{
+	if (getpid() != hctl_master || hctl_path == NULL)
+		return;
+	(void)unlink(hctl_path);
+}
+
+/* Start serving the control socket from the master's event loop */
+void
+HCTL_start(struct ev_loop *loop, hctl_cmd_f *func)
+{
+	AN(loop);
+	AN(func);
+	if (hctl_fd < 0)
+		return;
+
+	hctl_loop = loop;
+	hctl_cmd = func;
+	hctl_master = getpid();
+
+	ev_io_init(&hctl_listener, hctl_accept, hctl_fd, EV_READ);
+	ev_io_start(loop, &hctl_listener);
+	AZ(atexit(hctl_atexit));
+}
+
+/* Stop accepting control sessions, leaving the socket file to the
+ * master taking over after a hot upgrade. Open sessions go on. */
+void
+HCTL_stop(void)
+{
+	if (hctl_fd < 0)
+		return;
+	if (hctl_loop != NULL)
+		ev_io_stop(hctl_loop, &hctl_listener);
+	(void)close(hctl_fd);
+	hctl_fd = -1;
+	free(hctl_path);
+	hctl_path = NULL;
+}
+
+/* Called in a child right after fork(): the control socket and its
+ * sessions belong to the master. A command forking workers would
+ * otherwise leave its session open in all of them. */
+void
+HCTL_close_fds(void)
+{
+	struct hctl_sess *cs;
+
+	VTAILQ_FOREACH(cs, &hctl_sessions, list)
+		(void)close(cs->fd);
+	if (hctl_fd >= 0)
+		(void)close(hctl_fd);
+	hctl_fd = -1;
+}
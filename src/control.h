@@ -0,0 +1,71 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+
+#ifndef CONTROL_H_INCLUDED
+#define CONTROL_H_INCLUDED
+
+#include <ev.h>
+
+#include "foreign/vsb.h"
+
+/*
+ * Control socket.
+ *
+ * The master accepts management commands on a UNIX socket, one per
+ * line, with the words separated by white space. Every command is
+ * answered with a status line holding a three digit status code and
+ * the length of the body that follows:
+ *
+ *	200 12
+ *	log-level 2
+ *
+ * A session stays open for more commands until the client closes it
+ * or stays idle for too long.
+ */
+
+#define HCTL_OK			200
+#define HCTL_BAD_REQUEST	400
+#define HCTL_NOT_FOUND		404
+#define HCTL_FAILED		500
+
+#define HCTL_MAX_ARGS		8
+
+/* Runs one command, writing the response body to vsb. Returns the
+ * status code. */
+typedef int hctl_cmd_f(struct vsb *vsb, int argc, char * const *argv);
+
+int HCTL_listen(const char *path);
+void HCTL_start(struct ev_loop *loop, hctl_cmd_f *func);
+void HCTL_stop(void);
+void HCTL_close_fds(void);
+
+#endif /* CONTROL_H_INCLUDED */
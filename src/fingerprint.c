@@ -0,0 +1,236 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+
+#include "fingerprint.h"
+#include "foreign/vas.h"
+#include "foreign/vsb.h"
+
+/* GREASE values, RFC 8701, are 0x?a?a */
+#define HFP_GREASE(v)		(((v) & 0x0f0f) == 0x0a0a)
+
+/* Extensions of a ClientHello fingerprinted without allocating, more
+ * are fingerprinted too, in an allocated list */
+#define HFP_EXTS		64
+
+static uint8_t (*hfp_deny)[HFP_LEN];
+static size_t hfp_ndeny;
+
+/* Parse 'len' characters of hex digits, which must be HFP_HEX_LEN */
+int
+HFP_parse(uint8_t *fp, const char *s, size_t len)
+{
+	unsigned u;
+	int c, v;
+
+	AN(fp);
+	AN(s);
+	if (len != HFP_HEX_LEN)
+		return (-1);
+	for (u = 0; u < HFP_HEX_LEN; u++) {
+		c = s[u];
+		if (c >= '0' && c <= '9')
+			v = c - '0';
+		else if (c >= 'a' && c <= 'f')
+			v = c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			v = c - 'A' + 10;
+		else
+			return (-1);
+		if (u % 2 == 0)
+			fp[u / 2] = v << 4;
+		else
+			fp[u / 2] |= v;
+	}
+	return (0);
+}
+
+static int
+hfp_cmp(const void *a, const void *b)
+{
+
+	return (memcmp(a, b, HFP_LEN));
+}
+
+/* Load a comma separated list of fingerprints to deny, or none if
+ * 'list' is NULL */
+int
+HFP_deny_init(const char *list)
+{
+	const char *p, *e;
+	size_t n;
+
+	free(hfp_deny);
+	hfp_deny = NULL;
+	hfp_ndeny = 0;
+	if (list == NULL)
+		return (0);
+
+	n = 1;
+	for (p = list; *p != '\0'; p++)
+		if (*p == ',')
+			n++;
+	hfp_deny = calloc(n, sizeof *hfp_deny);
+	AN(hfp_deny);
+	for (p = list; *p != '\0'; p = *e == ',' ? e + 1 : e) {
+		e = strchr(p, ',');
+		if (e == NULL)
+			e = strchr(p, '\0');
+		if (e == p)
+			continue;
+		if (HFP_parse(hfp_deny[hfp_ndeny], p, e - p) != 0)
+			return (-1);
+		hfp_ndeny++;
+	}
+	qsort(hfp_deny, hfp_ndeny, sizeof *hfp_deny, hfp_cmp);
+	return (0);
+}
+
+int
+HFP_denied(const uint8_t *fp)
+{
+
+	AN(fp);
+	if (hfp_ndeny == 0)
+		return (0);
+	return (bsearch(fp, hfp_deny, hfp_ndeny, sizeof *hfp_deny,
+	    hfp_cmp) != NULL);
+}
+
+/* A dash separated list of 'len' bytes of 'w' octet values */
+static void
+hfp_list(struct vsb *vsb, const unsigned char *p, size_t len, size_t w)
+{
+	const char *sep = "";
+	unsigned v;
+	size_t i;
+
+	for (i = 0; i + w <= len; i += w) {
+		v = w == 2 ? p[i] << 8 | p[i + 1] : p[i];
+		if (w == 2 && HFP_GREASE(v))
+			continue;
+		VSB_printf(vsb, "%s%u", sep, v);
+		sep = "-";
+	}
+}
+
+/* Compute the fingerprint of the ClientHello being processed. Returns
+ * -1 if it can not be done. */
+int
+HFP_hello(SSL *ssl, uint8_t *fp)
+{
+	struct vsb vsb[1];
+	char buf[4096];
+	const unsigned char *p;
+	const char *sep = "";
+	unsigned int mdlen;
+	size_t len, n, i;
+	int r = -1;
+#ifdef HAVE_SSL_CLIENT_HELLO_GET_EXTENSION_ORDER
+	uint16_t ext_buf[HFP_EXTS], *exts = ext_buf;
+#else
+	int *exts;
+#endif
+
+	AN(fp);
+#ifdef HAVE_SSL_CLIENT_HELLO_GET_EXTENSION_ORDER
+	if (SSL_client_hello_get_extension_order(ssl, NULL, &n) != 1)
+		return (-1);
+	if (n > HFP_EXTS) {
+		exts = malloc(n * sizeof *exts);
+		if (exts == NULL)
+			return (-1);
+	}
+	if (SSL_client_hello_get_extension_order(ssl, exts, &n) != 1) {
+		if (exts != ext_buf)
+			free(exts);
+		return (-1);
+	}
+#else
+	/* Allocates the list of extensions */
+	if (SSL_client_hello_get1_extensions_present(ssl, &exts, &n) != 1)
+		return (-1);
+#endif
+	/* Extended for a ClientHello padded with ciphers or extensions */
+	AN(VSB_new(vsb, buf, sizeof buf, VSB_AUTOEXTEND));
+	VSB_printf(vsb, "%u,", SSL_client_hello_get0_legacy_version(ssl));
+	len = SSL_client_hello_get0_ciphers(ssl, &p);
+	hfp_list(vsb, p, len, 2);
+	VSB_putc(vsb, ',');
+	for (i = 0; i < n; i++) {
+		if (HFP_GREASE((unsigned)exts[i]))
+			continue;
+		VSB_printf(vsb, "%s%u", sep, (unsigned)exts[i]);
+		sep = "-";
+	}
+	VSB_putc(vsb, ',');
+	if (SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_supported_groups,
+	    &p, &len) && len >= 2 && (size_t)(p[0] << 8 | p[1]) <= len - 2)
+		hfp_list(vsb, p + 2, p[0] << 8 | p[1], 2);
+	VSB_putc(vsb, ',');
+	if (SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_ec_point_formats,
+	    &p, &len) && len >= 1 && p[0] <= len - 1)
+		hfp_list(vsb, p + 1, p[0], 1);
+
+	if (VSB_finish(vsb) == 0 &&
+	    EVP_Digest(VSB_data(vsb), VSB_len(vsb), fp, &mdlen, EVP_md5(),
+	    NULL) == 1 && mdlen == HFP_LEN)
+		r = 0;
+	VSB_delete(vsb);
+#ifdef HAVE_SSL_CLIENT_HELLO_GET_EXTENSION_ORDER
+	if (exts != ext_buf)
+		free(exts);
+#else
+	OPENSSL_free(exts);
+#endif
+	return (r);
+}
+
+/* Format a fingerprint in a buffer of HFP_HEX_LEN + 1 bytes */
+const char *
+HFP_hex(const uint8_t *fp, char *buf)
+{
+	unsigned u;
+
+	AN(fp);
+	AN(buf);
+	for (u = 0; u < HFP_LEN; u++)
+		sprintf(buf + 2 * u, "%02x", fp[u]);
+	return (buf);
+}
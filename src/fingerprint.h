@@ -0,0 +1,63 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+
+#ifndef FINGERPRINT_H_INCLUDED
+#define FINGERPRINT_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <openssl/ssl.h>
+
+/*
+ * ClientHello fingerprints.
+ *
+ * A fingerprint is the JA3 hash of a ClientHello: the MD5 digest of its
+ * legacy version, cipher suites, extensions in the order sent,
+ * supported groups and EC point formats, leaving out GREASE values. It
+ * is computed from the ClientHello callback, before any key exchange,
+ * and checked against the fingerprint-deny list and fingerprint-rate.
+ *
+ * The list is kept sorted for a binary search, and is parsed by each
+ * worker from its configuration.
+ */
+
+#define HFP_LEN		16
+#define HFP_HEX_LEN	(2 * HFP_LEN)
+
+int HFP_parse(uint8_t *fp, const char *s, size_t len);
+int HFP_deny_init(const char *list);
+int HFP_denied(const uint8_t *fp);
+int HFP_hello(SSL *ssl, uint8_t *fp);
+const char *HFP_hex(const uint8_t *fp, char *buf);
+
+#endif /* FINGERPRINT_H_INCLUDED */
@@ -0,0 +1,160 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "flightrec.h"
+#include "logging.h"
+#include "foreign/miniobj.h"
+#include "foreign/vas.h"
+
+struct hrec_ev {
+	double			t;
+	const char		*name;
+	int			a;
+	int			b;
+	enum hrec_e		ev;
+};
+
+struct hrec {
+	unsigned		magic;
+#define HREC_MAGIC		0x5f1c0a27
+	unsigned		error:1;
+	unsigned		n;
+	double			t0;
+	struct hrec_ev		ev[HREC_EVENTS];
+};
+
+static const struct hrec_tbl {
+	const char		*name;
+	const char		*a;
+	const char		*b;
+	int			error;
+} hrec_tbl[HREC__MAX] = {
+#define HREC_EV(n, a, b, e)	[HREC_##n] = { #n, a, b, e },
+#include "flightrec_tbl.h"
+#undef HREC_EV
+};
+
+static double
+hrec_now(void)
+{
+	struct timespec ts;
+
+	AZ(clock_gettime(CLOCK_MONOTONIC, &ts));
+	return (ts.tv_sec + 1e-9 * ts.tv_nsec);
+}
+
+/* Returns NULL if out of memory, the connection then goes without */
+struct hrec *
+HREC_new(void)
+{
+	struct hrec *rec;
+
+	ALLOC_OBJ(rec, HREC_MAGIC);
+	if (rec == NULL)
+		return (NULL);
+	rec->t0 = hrec_now();
+	return (rec);
+}
+
+void
+HREC_event(struct hrec *rec, enum hrec_e ev, int a, int b,
+    const char *name)
+{
+	struct hrec_ev *e;
+
+	CHECK_OBJ_NOTNULL(rec, HREC_MAGIC);
+	assert(ev >= 0 && ev < HREC__MAX);
+	e = &rec->ev[rec->n++ % HREC_EVENTS];
+	e->t = hrec_now();
+	e->ev = ev;
+	e->a = a;
+	e->b = b;
+	e->name = name;
+	if (hrec_tbl[ev].error)
+		rec->error = 1;
+}
+
+static void
+hrec_dump(const struct hrec *rec, proxystate *ps, const char *why)
+{
+	const struct hrec_tbl *tbl;
+	const struct hrec_ev *e;
+	char a[32], b[32];
+	unsigned i, first;
+
+	first = rec->n > HREC_EVENTS ? rec->n - HREC_EVENTS : 0;
+	logproxy(LOG_ERR, ps, "flight recorder: %s, %u events%s\n", why,
+	    rec->n, first > 0 ? ", oldest ones lost" : "");
+	for (i = first; i < rec->n; i++) {
+		e = &rec->ev[i % HREC_EVENTS];
+		tbl = &hrec_tbl[e->ev];
+		a[0] = b[0] = '\0';
+		if (tbl->a != NULL)
+			(void)snprintf(a, sizeof a, " %s=%d", tbl->a, e->a);
+		if (tbl->b != NULL)
+			(void)snprintf(b, sizeof b, " %s=%d", tbl->b, e->b);
+		logproxy(LOG_ERR, ps, "flight recorder: +%.3f ms %s%s%s%s%s\n",
+		    (e->t - rec->t0) * 1e3, tbl->name,
+		    e->name != NULL ? " " : "",
+		    e->name != NULL ? e->name : "", a, b);
+	}
+}
+
+/* Called when the connection is freed: dump the events if something
+ * went wrong or was slow, then free the recorder. */
+void
+HREC_close(proxystate *ps, double threshold)
+{
+	struct hrec *rec;
+	const char *why = NULL;
+
+	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	CAST_OBJ_NOTNULL(rec, ps->rec, HREC_MAGIC);
+	ps->rec = NULL;
+
+	if (rec->error)
+		why = "error";
+	else if (ps->d_handshake > threshold)
+		why = "slow handshake";
+	else if (ps->d_connect > threshold)
+		why = "slow backend connect";
+	else if (ps->d_ttfb > threshold)
+		why = "slow backend response";
+	if (why != NULL)
+		hrec_dump(rec, ps, why);
+	FREE_OBJ(rec);
+}
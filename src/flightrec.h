@@ -0,0 +1,74 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#ifndef FLIGHTREC_H_INCLUDED
+#define FLIGHTREC_H_INCLUDED
+
+#include "hitch.h"
+
+/*
+ * Per-connection flight recorder.
+ *
+ * When enabled, every connection keeps the last HREC_EVENTS events of
+ * its life with monotonic timestamps. If the connection ends with an
+ * error, or one of its latencies went over the configured threshold,
+ * the events are dumped to the log when it is freed. Otherwise they
+ * are thrown away.
+ */
+
+#define HREC_EVENTS		32
+
+enum hrec_e {
+#define HREC_EV(n, a, b, e)	HREC_##n,
+#include "flightrec_tbl.h"
+#undef HREC_EV
+	HREC__MAX
+};
+
+#define HREC(ps, ev, a, b)						\
+	do {								\
+		if ((ps)->rec != NULL)					\
+			HREC_event((ps)->rec, HREC_##ev, (a), (b), NULL); \
+	} while (0)
+
+/* Events about a watcher, recorded with its name */
+#define HREC_IO(ps, ev, name)						\
+	do {								\
+		if ((ps)->rec != NULL)					\
+			HREC_event((ps)->rec, HREC_##ev, 0, 0, (name));	\
+	} while (0)
+
+struct hrec *HREC_new(void);
+void HREC_event(struct hrec *rec, enum hrec_e ev, int a, int b,
+    const char *name);
+void HREC_close(proxystate *ps, double threshold);
+
+#endif /* FLIGHTREC_H_INCLUDED */
@@ -0,0 +1,59 @@
+/*
+ * Copyright 2020 Varnish Software
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    1. Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ *
+ * HREC_EV(name, arg_a, arg_b, error)
+ *
+ * Events of the per-connection flight recorder. arg_a and arg_b name
+ * the two integer arguments, or are NULL when unused. Recording an
+ * event with 'error' set makes the connection dumped when it closes.
+ */
+
+HREC_EV(accept, "fd", NULL, 0)
+HREC_EV(not_tls, "byte", NULL, 1)
+HREC_EV(connect_start, "fd", NULL, 0)
+HREC_EV(connect_done, NULL, NULL, 0)
+HREC_EV(connect_fail, "errno", NULL, 1)
+HREC_EV(connect_timeout, NULL, NULL, 1)
+HREC_EV(handshake_start, "want", NULL, 0)
+HREC_EV(handshake_done, "resumed", NULL, 0)
+HREC_EV(handshake_timeout, NULL, NULL, 1)
+HREC_EV(handshake_queued, "queue", NULL, 0)
+HREC_EV(handshake_shed, NULL, NULL, 1)
+HREC_EV(ssl_read, "bytes", "ring", 0)
+HREC_EV(ssl_write, "bytes", "left", 0)
+HREC_EV(clear_read, "bytes", "ring", 0)
+HREC_EV(clear_write, "bytes", "left", 0)
+HREC_EV(ssl_want, "err", NULL, 0)
+HREC_EV(ssl_error, "err", "errno", 1)
+HREC_EV(sock_error, "errno", "backend", 1)
+HREC_EV(eof, "backend", NULL, 0)
+HREC_EV(io_start, NULL, NULL, 0)
+HREC_EV(io_stop, NULL, NULL, 0)
+HREC_EV(shutdown, "req", NULL, 0)
@@ -53,6 +53,10 @@
 #  include <sys/filio.h>
 #endif
 
+#ifdef HAVE_KTLS
+#  include <linux/tls.h>
+#endif
+
 #include <net/if.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>  /* TCP_NODELAY */
@@ -63,7 +67,11 @@
 #include <grp.h>
 #include <libgen.h>
 #include <limits.h>
+#ifdef HAVE_MALLOC_H
+#include <malloc.h>
+#endif
 #include <netdb.h>
+#include <poll.h>
 #include <pwd.h>
 #include <sched.h>
 #include <signal.h>
@@ -75,12 +83,24 @@
 #include <unistd.h>
 
 #include "configuration.h"
+#include "connreg.h"
+#include "conntrace.h"
+#include "control.h"
+#include "fingerprint.h"
 #include "hitch.h"
 #include "hssl_locks.h"
 #include "logging.h"
+#include "proxyhdr.h"
 #include "proxyv2.h"
 #include "ocsp.h"
+#include "ratelimit.h"
 #include "shctx.h"
+#include "sni.h"
+#include "flightrec.h"
+#include "loopmon.h"
+#include "probes.h"
+#include "stats.h"
+#include "upgrade.h"
 #include "foreign/vpf.h"
 #include "foreign/uthash.h"
 #include "foreign/vsa.h"
@@ -128,12 +148,33 @@ extern FILE *logfile;
 extern struct stat logf_st;
 extern time_t logf_check_t;
 
+/* configuration.c */
+struct cfg_cert_file *cfg_cert_file_new(void);
+void cfg_cert_file_free(struct cfg_cert_file **cfptr);
+int cfg_cert_vfy(struct cfg_cert_file *cf);
+
 /* Globals */
 struct ev_loop *loop;
 hitch_config *CONFIG;
 
-/* Worker proc's read side of mgt->worker pipe(2) */
+/* Worker proc's side of the mgt<->worker socketpair(2) */
 static ev_io mgt_rd;
+static ev_io mgt_wr;
+
+/* What is left to write of the worker's answers to the master */
+static struct vsb *mgt_replyq;
+static size_t mgt_replyq_off;
+
+/* Worker proc's side of the socketpair(2) TLS sessions and kTLS
+ * connections are handed over on, between the generations of workers */
+static int handoff_fd = -1;
+static ev_io handoff_rd;
+
+/* The master's event loop. Kept apart from the default loop, which
+ * is set up by each child after fork(). */
+static struct ev_loop *mgt_loop;
+static ev_timer mgt_backend_refresh;
+static ev_timer mgt_scaler;
 
 struct backend {
 	unsigned		magic;
@@ -151,6 +192,31 @@ static SSL_SESSION *client_session;
 /* The current number of active client connections. */
 static uint64_t n_conns;
 
+/* Connections without their TLS state and buffers yet */
+static uint64_t n_pending;
+
+/* The highest number of connections since memory was last trimmed. */
+static uint64_t n_conns_peak;
+
+/* Memory of the ring buffers of this worker, and its share of
+ * max-buffer-memory. */
+static size_t buf_bytes;
+static size_t buf_budget;
+
+/* Set while the listeners are stopped at the limits, or for a while
+ * after running out of file descriptors. */
+static int accept_paused;
+static ev_timer accept_retry;
+
+/* Set from the control socket. Workers close new connections right
+ * away while the backend is marked down. */
+static int backend_down;
+
+/* When this worker started draining, and the timer closing its
+ * connections within drain-timeout. */
+static double drain_t0;
+static ev_timer drain_timer;
+
 /* Current generation of worker processes. Bumped after a sighup prior
  * to launching new children. */
 static unsigned worker_gen;
@@ -169,11 +235,26 @@ struct worker_proc {
 	unsigned			magic;
 #define WORKER_PROC_MAGIC		0xbc7fe9e6
 
-	/* Writer end of pipe(2) for mgt -> worker ipc */
+	/* Master end of socketpair(2) for mgt <-> worker ipc */
 	int				pfd;
+	/* Master end of the socketpair(2) for session and connection
+	 * handovers */
+	int				hfd;
+	ev_io				ev_handoff;
 	pid_t				pid;
 	unsigned			gen;
 	int				core_id;
+	int				draining;
+	int				expired;
+	/* The last connections query sent to the worker */
+	unsigned			conns_seq;
+	struct hstat_slab		*slab;
+	/* Last load sample, and for how many samples in a row the
+	 * worker was busier than the others */
+	double				cpu;
+	double				cpu_t;
+	double				load;
+	unsigned			hot;
 	VTAILQ_ENTRY(worker_proc)	list;
 };
 
@@ -203,6 +284,9 @@ struct frontend {
 	struct sslctx_s		*ssl_ctxs;
 	struct sslctx_s		*default_ctx;
 	char			*pspec;
+	int			stats_idx;
+	int			hs_rate;
+	int			hs_rate_resumed;
 	struct listen_sock_head	socks;
 	VTAILQ_ENTRY(frontend)	list;
 };
@@ -222,6 +306,20 @@ static unsigned char shared_secret[SHA_DIGEST_LENGTH];
 int create_workers;
 static struct vpf_fh *pfh = NULL;
 
+/* The binary and arguments to execute again in a hot upgrade, and the
+ * directory to run it from */
+static const char *mgt_exe;
+static char **mgt_argv;
+static char *mgt_cwd;
+
+/* The socket pair to the other master during a hot upgrade, and the
+ * pid of the new one. A master that handed over is retired, and exits
+ * once its workers are drained. */
+static int upgrade_fd = -1;
+static pid_t upgrade_pid;
+static ev_io upgrade_watcher;
+static int mgt_retired;
+
 static char tcp_proxy_line[128] = "";
 
 /* What agent/state requests the shutdown--for proper half-closed
@@ -251,12 +349,28 @@ static int load_cert_ctx(sslctx *so);
 
 enum worker_update_type {
 	WORKER_GEN,
-	BACKEND_REFRESH
+	BACKEND_REFRESH,
+	WORKER_DRAIN,
+	WORKER_LOG_LEVEL,
+	WORKER_BACKEND_STATE,
+	WORKER_CONNS,
+	WORKER_EXPIRE,
+	WORKER_SHED
+};
+
+/* Lists or closes the connections of a worker */
+struct worker_query {
+	unsigned		seq;
+	int			kill;
+	struct hconn_match	match;
 };
 
 union worker_update_payload {
 	unsigned		gen;
 	struct sockaddr_storage	addr;
+	int			level;
+	int			down;
+	struct worker_query	query;
 };
 
 struct worker_update {
@@ -264,6 +378,85 @@ struct worker_update {
 	union worker_update_payload 	payload;
 };
 
+/* Header of a worker's answer to a WORKER_CONNS query, followed by
+ * len bytes of text. */
+struct worker_reply {
+	unsigned			seq;
+	unsigned			len;
+};
+
+/* One of the recent TLS sessions a draining worker hands over to the
+ * current generation, with the file and the digest of the certificate
+ * that served it. The master passes it on to all the workers of the
+ * current generation. Only the 'len' bytes of 'sess' in use are sent. */
+struct worker_handoff {
+	unsigned			magic;
+#define WORKER_HANDOFF_MAGIC		0x5c2e81d7
+	char				frontend[256];
+	char				cert[256];
+	unsigned char			md[EVP_MAX_MD_SIZE];
+	unsigned			len;
+	unsigned char			sess[2048];
+};
+
+#define HANDOFF_HDR_LEN			offsetof(struct worker_handoff, sess)
+#define SESS_EXPORT_MAX			128	/* Recent sessions kept */
+#define MIGRATE_RING_MAX		16384	/* Bytes buffered, each way */
+
+/* An established connection with kTLS both ways a draining worker
+ * migrates to the current generation, sent along with its client and
+ * backend sockets. The master passes it on to the worker of the
+ * current generation with the fewest connections. 'data' has the
+ * 'up_len' bytes buffered for the backend, then the 'down_len' ones
+ * for the client. */
+struct worker_migrate {
+	unsigned			magic;
+#define WORKER_MIGRATE_MAGIC		0x1e6b93f4
+	char				frontend[256];
+	struct sockaddr_storage		addr;
+	int				connect_port;
+	double				t_accept;
+	uint64_t			ssl2clear_bytes;
+	uint64_t			clear2ssl_bytes;
+	unsigned			up_len;
+	unsigned			down_len;
+	unsigned char			data[2 * MIGRATE_RING_MAX];
+};
+
+#define MIGRATE_HDR_LEN			offsetof(struct worker_migrate, data)
+
+/* What the socket pairs between the master and the workers for the
+ * handovers carry, told apart by their magic */
+union worker_handover {
+	unsigned			magic;
+	struct worker_handoff		sess;
+	struct worker_migrate		conn;
+};
+
+#define WORKER_REPLY_TIMEOUT		2000	/* ms */
+#define MEM_TRIM_CONNS			64	/* Peak before trimming */
+#define ACCEPT_RESUME_PCT		90	/* Of the limits, to resume */
+#define ACCEPT_RETRY			1.0	/* s, out of descriptors */
+#define RING_REDUCE_PCT			75	/* Of the buffer budget */
+#define TMO_ADAPT_LOAD			0.5	/* Load to start shrinking at */
+#define TMO_ADAPT_MIN			0.1	/* Of a timeout, at full load */
+#define SCALE_INTERVAL			1.0	/* s, between load samples */
+#define SCALE_UP_SAMPLES		3	/* Over workers-load to start */
+#define SCALE_DOWN_SAMPLES		10	/* Under half of it to retire */
+#define SCALE_HOT_SAMPLES		3	/* Busier than the others */
+#define SCALE_HOT_RATIO			2.0	/* Of the others' mean load */
+
+/* The most workers of a generation: workers, or up to workers-max
+ * under load */
+static long
+workers_max(void)
+{
+
+	if (CONFIG->WORKERS_MAX > CONFIG->NCORES)
+		return (CONFIG->WORKERS_MAX);
+	return (CONFIG->NCORES);
+}
+
 /* set a file descriptor (socket) to non-blocking mode */
 static int
 setnonblocking(int fd)
@@ -376,6 +569,259 @@ info_callback(const SSL *ssl, int where, int ret)
 	}
 }
 
+/* The handshake rates of a frontend, or the global ones */
+static void
+frontend_rates(const struct frontend *fr, struct hrl_rates *r)
+{
+
+	CHECK_OBJ_NOTNULL(fr, FRONTEND_MAGIC);
+	r->full = fr->hs_rate >= 0 ? fr->hs_rate : CONFIG->HANDSHAKE_RATE;
+	r->resumed = fr->hs_rate_resumed >= 0 ? fr->hs_rate_resumed :
+	    CONFIG->HANDSHAKE_RATE_RESUMED;
+}
+
+/* Checks a new connection against the handshake rates of its source.
+ * Without a ClientHello callback, a full handshake is charged now. */
+static int
+rate_limited(const struct frontend *fr, const struct hrl_src *src)
+{
+	struct hrl_rates r;
+	int refuse;
+
+	if (src->family == 0)
+		return (0);
+	frontend_rates(fr, &r);
+#ifdef HAVE_SSL_CTX_SET_CLIENT_HELLO_CB
+	refuse = HRL_accept(src, fr->stats_idx, &r, ev_now(loop));
+#else
+	refuse = HRL_hello(src, fr->stats_idx, &r, 0, ev_now(loop));
+#endif
+	if (refuse) {
+		HSTAT_INC(rate_limited_accept);
+		HSTAT_FE_INC(fr->stats_idx, rate_limited);
+	}
+	return (refuse);
+}
+
+/*
+ * Full handshake scheduling. With a handshake budget, every loop
+ * iteration spends at most that long in full handshakes. ClientHellos
+ * asking for one past the budget are suspended in a queue, so that
+ * resumptions and established connections keep going. The queue is
+ * served oldest first once the other callbacks of an iteration ran,
+ * and overflows by dropping its oldest entries.
+ */
+VTAILQ_HEAD(hs_queue_head, proxystate);
+static struct hs_queue_head hs_queue = VTAILQ_HEAD_INITIALIZER(hs_queue);
+static unsigned hs_queue_len;
+static double hs_spent;		/* In full handshakes, this iteration */
+static ev_check hs_check;
+static ev_idle hs_idle;
+
+static void shutdown_proxy(proxystate *ps, SHUTDOWN_REQUESTOR req);
+static void client_handshake(struct ev_loop *loop, ev_io *w, int revents);
+
+static void
+hs_dequeue(proxystate *ps)
+{
+
+	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	assert(ps->hs_queued);
+	VTAILQ_REMOVE(&hs_queue, ps, hs_list);
+	ps->hs_queued = 0;
+	hs_queue_len--;
+	HSTAT_SET(hs_queue, hs_queue_len);
+	if (hs_queue_len == 0)
+		ev_idle_stop(loop, &hs_idle);
+}
+
+/* Drop a queued handshake, resetting the connection */
+static void
+hs_shed(proxystate *ps)
+{
+	struct linger lin;
+
+	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	hs_dequeue(ps);
+	HREC(ps, handshake_shed, 0, 0);
+	HSTAT_INC(hs_fail_shed);
+	HSTAT_FE_INC(ps->stats_fe, hs_fail);
+	lin.l_onoff = 1;
+	lin.l_linger = 0;
+	(void)setsockopt(ps->fd_up, SOL_SOCKET, SO_LINGER, &lin, sizeof lin);
+	shutdown_proxy(ps, SHUTDOWN_HARD);
+}
+
+/* Whether a full handshake waits for budget: 1 when queued, -1 when it
+ * cannot be queued at all. */
+static int
+hs_defer(proxystate *ps)
+{
+
+	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	if (CONFIG->HANDSHAKE_BUDGET == 0 || ps->handshaked ||
+	    ps->resume_offered || ps->hs_admitted)
+		return (0);
+	if (hs_queue_len == 0 && hs_spent * 1e3 < CONFIG->HANDSHAKE_BUDGET) {
+		ps->hs_admitted = 1;
+		return (0);
+	}
+	if (CONFIG->HANDSHAKE_QUEUE == 0)
+		return (-1);
+	while (hs_queue_len >= (unsigned)CONFIG->HANDSHAKE_QUEUE)
+		hs_shed(VTAILQ_FIRST(&hs_queue));
+	VTAILQ_INSERT_TAIL(&hs_queue, ps, hs_list);
+	ps->hs_queued = 1;
+	hs_queue_len++;
+	HSTAT_INC(hs_queued);
+	HSTAT_SET(hs_queue, hs_queue_len);
+	HREC(ps, handshake_queued, hs_queue_len, 0);
+	ev_idle_start(loop, &hs_idle);
+	return (1);
+}
+
+/* Runs last in every loop iteration, letting queued handshakes through
+ * while the budget lasts, and at least one. */
+static void
+hs_sched(struct ev_loop *loop, ev_check *w, int revents)
+{
+	proxystate *ps;
+	unsigned n;
+
+	(void)w;
+	(void)revents;
+	HLOOP_MARK(NULL);
+	for (n = 0; (ps = VTAILQ_FIRST(&hs_queue)) != NULL; n++) {
+		if (n > 0 && hs_spent * 1e3 >= CONFIG->HANDSHAKE_BUDGET)
+			break;
+		hs_dequeue(ps);
+		ps->hs_admitted = 1;
+		client_handshake(loop, &ps->ev_r_handshake, EV_READ);
+	}
+	hs_spent = 0.;
+}
+
+/* Keeps the loop from blocking while handshakes are queued */
+static void
+hs_wait(struct ev_loop *loop, ev_idle *w, int revents)
+{
+
+	(void)loop;
+	(void)w;
+	(void)revents;
+	HLOOP_MARK(NULL);
+}
+
+#ifdef HAVE_SSL_CTX_SET_CLIENT_HELLO_CB
+/* A ClientHello offering a session: a PSK for TLS 1.3, or a ticket or a
+ * session id for earlier versions. TLS 1.3 clients send a session id
+ * of their own, for middlebox compatibility. */
+static int
+hello_resumes(SSL *ssl)
+{
+	const unsigned char *p;
+	size_t len;
+
+	if (SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_psk, &p, &len))
+		return (1);
+	if (SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_supported_versions,
+	    &p, &len))
+		return (0);
+	if (SSL_client_hello_get0_ext(ssl, TLSEXT_TYPE_session_ticket,
+	    &p, &len) && len > 0)
+		return (1);
+	return (SSL_client_hello_get0_session_id(ssl, &p) > 0);
+}
+
+/* Take the fingerprint of a ClientHello when anything needs it, and
+ * check it against the deny list and the fingerprint rate. A hello
+ * that can not be fingerprinted is still held to the fingerprint rate,
+ * all of them sharing the fingerprint of only zeros. Returns -1 if the
+ * handshake is refused. */
+static int
+fingerprint_hello(proxystate *ps, SSL *ssl)
+{
+	struct hrl_rates r;
+	struct hrl_src src;
+	char buf[HFP_HEX_LEN + 1];
+
+	if (CONFIG->FINGERPRINT_DENY == NULL && CONFIG->FINGERPRINT_RATE == 0 &&
+	    !CONFIG->PROXY_FINGERPRINT)
+		return (0);
+	if (HFP_hello(ssl, ps->fingerprint) != 0) {
+		HSTAT_INC(fingerprint_failed);
+		memset(ps->fingerprint, 0, sizeof ps->fingerprint);
+	} else {
+		ps->fingerprinted = 1;
+		HSTAT_INC(fingerprints);
+	}
+	if (HFP_denied(ps->fingerprint)) {
+		HSTAT_INC(fingerprint_denied);
+		LOGPROXY(ps, "fingerprint %s denied\n",
+		    HFP_hex(ps->fingerprint, buf));
+		return (-1);
+	}
+	if (CONFIG->FINGERPRINT_RATE > 0) {
+		HRL_src_fingerprint(&src, ps->fingerprint);
+		r.full = CONFIG->FINGERPRINT_RATE;
+		r.resumed = 0;
+		if (HRL_hello(&src, -1, &r, ps->resume_offered,
+		    ev_now(loop)) != 0) {
+			HSTAT_INC(fingerprint_rate_limited);
+			LOGPROXY(ps, "fingerprint %s rate exceeded\n",
+			    HFP_hex(ps->fingerprint, buf));
+			return (-1);
+		}
+		ps->fingerprint_rated = 1;
+	}
+	return (0);
+}
+
+static int
+client_hello_cb(SSL *ssl, int *al, void *arg)
+{
+	struct hrl_rates r;
+	proxystate *ps;
+
+	(void)arg;
+	CAST_OBJ_NOTNULL(ps, SSL_get_app_data(ssl), PROXYSTATE_MAGIC);
+	if (!ps->hello_seen) {
+		ps->hello_seen = 1;
+		HSTAT_observe(HSTAT_H_clienthello_seconds,
+		    ev_time() - ps->t_accept);
+		if (ps->trace != NULL)
+			HTRACE_hello(ps->trace, ssl, ev_now(loop));
+		ps->resume_offered = hello_resumes(ssl);
+		if (fingerprint_hello(ps, ssl) != 0) {
+			*al = SSL_AD_HANDSHAKE_FAILURE;
+			return (SSL_CLIENT_HELLO_ERROR);
+		}
+		if (ps->hrl_src.family != 0) {
+			frontend_rates(ps->frontend, &r);
+			if (HRL_hello(&ps->hrl_src, ps->frontend->stats_idx,
+			    &r, ps->resume_offered, ev_now(loop)) != 0) {
+				HSTAT_INC(rate_limited_hello);
+				HSTAT_FE_INC(ps->stats_fe, rate_limited);
+				LOGPROXY(ps, "handshake rate exceeded\n");
+				*al = SSL_AD_HANDSHAKE_FAILURE;
+				return (SSL_CLIENT_HELLO_ERROR);
+			}
+		}
+	}
+	switch (hs_defer(ps)) {
+	case 1:
+		LOGPROXY(ps, "full handshake queued\n");
+		return (SSL_CLIENT_HELLO_RETRY);
+	case -1:
+		LOGPROXY(ps, "full handshake over the budget\n");
+		*al = SSL_AD_HANDSHAKE_FAILURE;
+		return (SSL_CLIENT_HELLO_ERROR);
+	default:
+		return (SSL_CLIENT_HELLO_SUCCESS);
+	}
+}
+#endif
+
 #ifdef OPENSSL_WITH_NPN
 static int npn_select_cb(SSL *ssl, const unsigned char **out,
     unsigned *outlen, void *arg) {
@@ -734,45 +1180,6 @@ load_privatekey(SSL_CTX *ctx, const char *file)
 }
 
 #ifndef OPENSSL_NO_TLSEXT
-static int
-sni_match(const sni_name *sn, const char *srvname)
-{
-	if (!sn->is_wildcard)
-		return (strcasecmp(srvname, sn->sni_key) == 0);
-	else {
-		char *s = strchr(srvname, '.');
-		if (s == NULL)
-			return (0);
-		return (strcasecmp(s, sn->sni_key + 1) == 0);
-	}
-}
-
-static const sslctx *
-sni_lookup(const char *sni_key, const sni_name *sn_tab)
-{
-	const sni_name *sn;
-
-	AN(sni_key);
-	CHECK_OBJ_NOTNULL(sn_tab, SNI_NAME_MAGIC);
-
-	HASH_FIND_STR(sn_tab, sni_key, sn);
-	if (sn == NULL) {
-		char *s;
-		/* attempt another lookup for wildcard matches */
-		s = strchr(sni_key, '.');
-		if (s != NULL)
-			HASH_FIND_STR(sn_tab, s, sn);
-	}
-
-	if (sn != NULL) {
-		CHECK_OBJ_NOTNULL(sn, SNI_NAME_MAGIC);
-		if (sni_match(sn, sni_key))
-			return (sn->sctx);
-	}
-
-	return (NULL);
-}
-
 static int
 sni_try_lookup(SSL *ssl, const char *sni_key, const struct sni_name_s *sn_tab)
 {
@@ -791,28 +1198,12 @@ sni_try_lookup(SSL *ssl, const char *sni_key, const struct sni_name_s *sn_tab)
 	return (1);
 }
 
-char *
-sni_build_key(const char *servername)
-{
-	char *key, *c;
-
-	if (servername == NULL)
-		return (NULL);
-
-	AN(servername);
-	key = strdup(servername);
-
-	for (c = key; *c != '\0'; c++)
-		*c = tolower(*c);
-	return (key);
-}
-
 /*
  * Switch the context of the current SSL object to the most appropriate one
  * based on the SNI header
  */
 static int
-sni_switch_ctx(SSL *ssl, int *al, void *data)
+sni_select_ctx(SSL *ssl, void *data)
 {
 	const struct frontend *fr = NULL;
 	const char *servername;
@@ -821,7 +1212,6 @@ sni_switch_ctx(SSL *ssl, int *al, void *data)
 	int sni_nomatch_abort = CONFIG->SNI_NOMATCH_ABORT;
 
 	AN(ssl);
-	(void)al;
 	if (data != NULL)
 		CAST_OBJ_NOTNULL(fr, data, FRONTEND_MAGIC);
 
@@ -855,6 +1245,19 @@ sni_switch_ctx(SSL *ssl, int *al, void *data)
 	else
 		return (SSL_TLSEXT_ERR_NOACK);
 }
+
+static int
+sni_switch_ctx(SSL *ssl, int *al, void *data)
+{
+	proxystate *ps;
+	int r;
+
+	(void)al;
+	r = sni_select_ctx(ssl, data);
+	CAST_OBJ_NOTNULL(ps, SSL_get_app_data(ssl), PROXYSTATE_MAGIC);
+	HPROBE_ARG(sni, ps, r);
+	return (r);
+}
 #endif /* OPENSSL_NO_TLSEXT */
 
 static void
@@ -974,6 +1377,92 @@ client_vfy_init(SSL_CTX *ctx, int flags, const char *cafile)
 	return (0);
 }
 
+/* The context whose session cache and ticket keys serve a frontend:
+ * the one its connections start with, before any SNI switch. */
+static sslctx *
+frontend_sess_ctx(const struct frontend *fr)
+{
+	sslctx *sc;
+
+	CHECK_OBJ_NOTNULL(fr, FRONTEND_MAGIC);
+	if (fr->default_ctx != NULL)
+		CAST_OBJ_NOTNULL(sc, fr->default_ctx, SSLCTX_MAGIC);
+	else
+		CAST_OBJ_NOTNULL(sc, default_ctx, SSLCTX_MAGIC);
+	return (sc);
+}
+
+/* The typed accessors of the session caches, see lhash(3) */
+DEFINE_LHASH_OF(SSL_SESSION);
+
+/* The most recent sessions of a worker, handed over to the next
+ * generation when it retires */
+struct sess_recent {
+	SSL_SESSION		*sess;
+	struct frontend		*frontend;
+	const sslctx		*sc;		/* Served it, after SNI */
+};
+
+static struct sess_recent sess_recent[SESS_EXPORT_MAX];
+static unsigned sess_recent_n;
+
+/* Keep a reference to a session, for the next generation */
+static void
+sess_remember(struct frontend *fr, const sslctx *sc, SSL_SESSION *sess)
+{
+	struct sess_recent *sr;
+
+	sr = &sess_recent[sess_recent_n++ % SESS_EXPORT_MAX];
+	if (sr->sess != NULL)
+		SSL_SESSION_free(sr->sess);
+	sr->sess = sess;
+	sr->frontend = fr;
+	sr->sc = sc;
+}
+
+static int
+sess_new_cb(SSL *ssl, SSL_SESSION *sess)
+{
+	const sslctx *sc;
+	proxystate *ps;
+
+	ps = SSL_get_app_data(ssl);
+	if (ps == NULL)
+		return (0);
+	CHECK_OBJ(ps, PROXYSTATE_MAGIC);
+	/* TLSv1.3 tickets are not kept in the cache, they carry their
+	 * own state. */
+	if (SSL_SESSION_get_protocol_version(sess) >= TLS1_3_VERSION)
+		return (0);
+	CAST_OBJ_NOTNULL(sc, SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)),
+	    SSLCTX_MAGIC);
+	sess_remember(ps->frontend, sc, sess);
+	return (1);
+}
+
+/* A context rebuilt for the same certificate, after its file was
+ * touched or its OCSP staple changed, keeps the session ticket keys of
+ * the one it replaces. Tickets issued before the reload still resume
+ * with the new generation. */
+static void
+sctx_keep_tickets(sslctx *sc, const sslctx *old)
+{
+	unsigned char keys[80];
+
+	CHECK_OBJ_NOTNULL(sc, SSLCTX_MAGIC);
+	if (old == NULL)
+		return;
+	CHECK_OBJ(old, SSLCTX_MAGIC);
+	if (sc->x509 == NULL || old->x509 == NULL ||
+	    X509_cmp(sc->x509, old->x509) != 0)
+		return;
+	if (SSL_CTX_get_tlsext_ticket_keys(old->ctx, keys, sizeof keys) > 0 &&
+	    SSL_CTX_set_tlsext_ticket_keys(sc->ctx, keys, sizeof keys) > 0)
+		LOG("{core} Keeping the session ticket keys of '%s'\n",
+		    sc->filename);
+	OPENSSL_cleanse(keys, sizeof keys);
+}
+
 /* Initialize an SSL context */
 static sslctx *
 make_ctx_fr(const struct cfg_cert_file *cf, const struct frontend *fr,
@@ -1029,8 +1518,15 @@ make_ctx_fr(const struct cfg_cert_file *cf, const struct frontend *fr,
 	ctx = SSL_CTX_new((CONFIG->PMODE == SSL_CLIENT) ?
 	    SSLv23_client_method() : SSLv23_server_method());
 
+#ifdef HAVE_KTLS
+	if (CONFIG->KTLS && CONFIG->PMODE == SSL_SERVER)
+		ssloptions |= SSL_OP_ENABLE_KTLS;
+#endif
 	SSL_CTX_set_options(ctx, ssloptions);
 	SSL_CTX_set_info_callback(ctx, info_callback);
+#ifdef HAVE_SSL_CTX_SET_CLIENT_HELLO_CB
+	SSL_CTX_set_client_hello_cb(ctx, client_hello_cb, NULL);
+#endif
 #ifdef OPENSSL_WITH_ALPN
 	if (CONFIG->ALPN_PROTOS != NULL)
 		SSL_CTX_set_alpn_select_cb(ctx, alpn_select_cb, NULL);
@@ -1071,12 +1567,15 @@ make_ctx_fr(const struct cfg_cert_file *cf, const struct frontend *fr,
 
 	AN(SSL_CTX_set_session_id_context(ctx, (const unsigned char *) "hitch",
 		strlen("hitch")));
+	/* Replaced by the shared cache's, when there is one */
+	SSL_CTX_sess_set_new_cb(ctx, sess_new_cb);
 
 	ALLOC_OBJ(sc, SSLCTX_MAGIC);
 	AN(sc);
 	sc->filename = strdup(cf->filename);
 	sc->mtim = cf->mtim;
 	sc->ctx = ctx;
+	SSL_CTX_set_app_data(ctx, sc);
 	sc->staple_vfy = cf->ocsp_vfy;
 	VTAILQ_INIT(&sc->sni_list);
 
@@ -1407,11 +1906,99 @@ destroy_frontend(struct frontend *fr)
 	}
 
 	AZ(HASH_COUNT(fr->sni_names));
+	HSTAT_fe_release(fr->stats_idx);
 	free(fr->pspec);
 	FREE_OBJ(fr);
 }
 
-/* Create the bound socket in the parent process */
+/* Create a socket bound to one of the addresses of a frontend */
+static int
+frontend_bind(const struct front_arg *fa, const struct addrinfo *it)
+{
+	int fd, r;
+
+	fd = socket(it->ai_family, SOCK_STREAM, IPPROTO_TCP);
+	if (fd == -1) {
+		ERR("{socket: main}: %s: %s\n", strerror(errno),
+		    fa->pspec);
+		return (-1);
+	}
+
+	int t = 1;
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR,
+		&t, sizeof(int))
+	    < 0) {
+		ERR("{setsockopt-reuseaddr}: %s: %s\n", strerror(errno),
+		    fa->pspec);
+		goto bind_err;
+	}
+#ifdef SO_REUSEPORT_WORKS
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT,
+		&t, sizeof(int))
+	    < 0) {
+		ERR("{setsockopt-reuseport}: %s: %s\n", strerror(errno),
+		    fa->pspec);
+		goto bind_err;
+	}
+#endif
+
+#ifdef TCP_FASTOPEN_WORKS
+	if (CONFIG->TFO) {
+		if (setsockopt(fd, SOL_TCP, TCP_FASTOPEN,
+			&t, sizeof(int))
+			< 0) {
+			ERR("{setsockopt-tcp_fastopen}: %s: %s\n", strerror(errno),
+				fa->pspec);
+			goto bind_err;
+		}
+	}
+#endif
+
+#ifdef IPV6_V6ONLY
+	t = 1;
+	if (it->ai_family == AF_INET6 &&
+	    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &t,
+		sizeof (t)) != 0) {
+		ERR("{setsockopt-ipv6only}: %s: %s\n", strerror(errno),
+		    fa->pspec);
+		goto bind_err;
+	}
+#endif
+	if (CONFIG->RECV_BUFSIZE > 0) {
+		r = setsockopt(fd, SOL_SOCKET, SO_RCVBUF,
+		    &CONFIG->RECV_BUFSIZE,
+		    sizeof(CONFIG->RECV_BUFSIZE));
+		if (r < 0) {
+			ERR("{setsockopt-rcvbuf}: %s: %s\n",
+			    strerror(errno), fa->pspec);
+			goto bind_err;
+		}
+	}
+	if (CONFIG->SEND_BUFSIZE > 0) {
+		r = setsockopt(fd, SOL_SOCKET, SO_SNDBUF,
+		    &CONFIG->SEND_BUFSIZE,
+		    sizeof(CONFIG->SEND_BUFSIZE));
+		if (r < 0) {
+			ERR("{setsockopt-sndbuf}: %s: %s\n",
+			    strerror(errno), fa->pspec);
+			goto bind_err;
+		}
+	}
+
+	if (bind(fd, it->ai_addr, it->ai_addrlen)) {
+		ERR("{bind-socket}: %s: %s\n", strerror(errno),
+		    fa->pspec);
+		goto bind_err;
+	}
+	return (fd);
+
+bind_err:
+	(void)close(fd);
+	return (-1);
+}
+
+/* Create the bound sockets in the parent process, or take over those
+ * of an earlier master */
 static int
 frontend_listen(const struct front_arg *fa, struct listen_sock_head *slist)
 {
@@ -1420,7 +2007,7 @@ frontend_listen(const struct front_arg *fa, struct listen_sock_head *slist)
 	char buf[INET6_ADDRSTRLEN+20];
 	char abuf[INET6_ADDRSTRLEN];
 	char pbuf[8];
-	int r, count = 0;
+	int r, count = 0, inherited = 0;
 
 	CHECK_OBJ_NOTNULL(fa, FRONT_ARG_MAGIC);
 	memset(&hints, 0, sizeof hints);
@@ -1440,95 +2027,31 @@ frontend_listen(const struct front_arg *fa, struct listen_sock_head *slist)
 		VTAILQ_INSERT_TAIL(slist, ls, list);
 		count++;
 
-		ls->sock = socket(it->ai_family, SOCK_STREAM, IPPROTO_TCP);
-		if (ls->sock == -1) {
-			ERR("{socket: main}: %s: %s\n", strerror(errno),
-			    fa->pspec);
+		ls->sock = HUPG_take(it->ai_addr);
+		if (ls->sock < 0)
+			ls->sock = frontend_bind(fa, it);
+		else
+			inherited = 1;
+		if (ls->sock < 0)
 			goto creat_frontend_err;
-		}
 
-		int t = 1;
-		if (setsockopt(ls->sock, SOL_SOCKET, SO_REUSEADDR,
-			&t, sizeof(int))
-		    < 0) {
-			ERR("{setsockopt-reuseaddr}: %s: %s\n", strerror(errno),
-			    fa->pspec);
+		if(setnonblocking(ls->sock) < 0) {
+			ERR("{listen sock: setnonblocking}: %s: %s\n",
+			    strerror(errno), fa->pspec);
 			goto creat_frontend_err;
 		}
-#ifdef SO_REUSEPORT_WORKS
-		if (setsockopt(ls->sock, SOL_SOCKET, SO_REUSEPORT,
-			&t, sizeof(int))
-		    < 0) {
-			ERR("{setsockopt-reuseport}: %s: %s\n", strerror(errno),
-			    fa->pspec);
+
+#ifndef NO_DEFER_ACCEPT
+#if TCP_DEFER_ACCEPT
+		int timeout = CONFIG->DEFER_ACCEPT;
+		if (timeout > 0 &&
+		    setsockopt(ls->sock, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+			&timeout, sizeof(int)) < 0) {
+			ERR("{setsockopt-defer_accept}: %s: %s\n",
+			    strerror(errno), fa->pspec);
 			goto creat_frontend_err;
 		}
-#endif
-
-#ifdef TCP_FASTOPEN_WORKS
-		if (CONFIG->TFO) {
-			if (setsockopt(ls->sock, SOL_TCP, TCP_FASTOPEN,
-				&t, sizeof(int))
-				< 0) {
-				ERR("{setsockopt-tcp_fastopen}: %s: %s\n", strerror(errno),
-					fa->pspec);
-				goto creat_frontend_err;
-			}
-		}
-#endif
-
-		if(setnonblocking(ls->sock) < 0) {
-			ERR("{listen sock: setnonblocking}: %s: %s\n",
-			    strerror(errno), fa->pspec);
-			goto creat_frontend_err;
-		}
-#ifdef IPV6_V6ONLY
-		t = 1;
-		if (it->ai_family == AF_INET6 &&
-		    setsockopt(ls->sock, IPPROTO_IPV6, IPV6_V6ONLY, &t,
-			sizeof (t)) != 0) {
-			ERR("{setsockopt-ipv6only}: %s: %s\n", strerror(errno),
-			    fa->pspec);
-			goto creat_frontend_err;
-		}
-#endif
-		if (CONFIG->RECV_BUFSIZE > 0) {
-			r = setsockopt(ls->sock, SOL_SOCKET, SO_RCVBUF,
-			    &CONFIG->RECV_BUFSIZE,
-			    sizeof(CONFIG->RECV_BUFSIZE));
-			if (r < 0) {
-				ERR("{setsockopt-rcvbuf}: %s: %s\n",
-				    strerror(errno), fa->pspec);
-				goto creat_frontend_err;
-			}
-		}
-		if (CONFIG->SEND_BUFSIZE > 0) {
-			r = setsockopt(ls->sock, SOL_SOCKET, SO_SNDBUF,
-			    &CONFIG->SEND_BUFSIZE,
-			    sizeof(CONFIG->SEND_BUFSIZE));
-			if (r < 0) {
-				ERR("{setsockopt-sndbuf}: %s: %s\n",
-				    strerror(errno), fa->pspec);
-				goto creat_frontend_err;
-			}
-		}
-
-		if (bind(ls->sock, it->ai_addr, it->ai_addrlen)) {
-			ERR("{bind-socket}: %s: %s\n", strerror(errno),
-			    fa->pspec);
-			goto creat_frontend_err;
-		}
-
-#ifndef NO_DEFER_ACCEPT
-#if TCP_DEFER_ACCEPT
-		int timeout = 1;
-		if (setsockopt(ls->sock, IPPROTO_TCP, TCP_DEFER_ACCEPT,
-			&timeout, sizeof(int)) < 0) {
-			ERR("{setsockopt-defer_accept}: %s: %s\n",
-			    strerror(errno), fa->pspec);
-			goto creat_frontend_err;
-		}
-#endif /* TCP_DEFER_ACCEPT */
+#endif /* TCP_DEFER_ACCEPT */
 #endif
 		if (listen(ls->sock, CONFIG->BACKLOG) != 0) {
 			ERR("{listen-socket}: %s: %s\n", strerror(errno),
@@ -1553,7 +2076,9 @@ frontend_listen(const struct front_arg *fa, struct listen_sock_head *slist)
 		}
 		ls->name = strdup(buf);
 		AN(ls->name);
-		LOG("{core} Listening on %s\n", ls->name);
+		LOG("{core} Listening on %s%s\n", ls->name,
+		    inherited ? " (inherited)" : "");
+		inherited = 0;
 	}
 
 	freeaddrinfo(ai);
@@ -1589,6 +2114,9 @@ create_frontend(const struct front_arg *fa)
 	fr->pspec = strdup(fa->pspec);
 	fr->match_global_certs = fa->match_global_certs;
 	fr->sni_nomatch_abort = fa->sni_nomatch_abort;
+	fr->hs_rate = fa->handshake_rate;
+	fr->hs_rate_resumed = fa->handshake_rate_resumed;
+	fr->stats_idx = HSTAT_fe_register(fa->pspec);
 
 	VTAILQ_INIT(&tmp_list);
 	count = frontend_listen(fa, &fr->socks);
@@ -1694,32 +2222,247 @@ create_back_socket(struct backend *b)
 
 /* Only enable a libev ev_io event if the proxied connection still
  * has both up and down connected */
+static const char *
+ps_io_name(const proxystate *ps, const ev_io *w)
+{
+	if (w == &ps->ev_r_ssl)
+		return ("ev_r_ssl");
+	if (w == &ps->ev_w_ssl)
+		return ("ev_w_ssl");
+	if (w == &ps->ev_r_clear)
+		return ("ev_r_clear");
+	if (w == &ps->ev_w_clear)
+		return ("ev_w_clear");
+	return ("?");
+}
+
 static void
 safe_enable_io(proxystate *ps, ev_io *w)
 {
 	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
-	if (!ps->want_shutdown)
+	if (!ps->want_shutdown) {
+		if (!ev_is_active(w))
+			HREC_IO(ps, io_start, ps_io_name(ps, w));
 		ev_io_start(loop, w);
+	}
 }
 
 static void
 check_exit_state(void)
 {
-	if (worker_state == WORKER_EXITING && n_conns == 0) {
+	if (worker_state == WORKER_EXITING && n_conns == 0 &&
+	    mgt_replyq == NULL) {
 		LOGL("Worker %d (gen: %d) in state EXITING "
 		    "is now exiting.\n", core_id, worker_gen);
+		HLOG_stop();
 		_exit(0);
 	}
 }
 
+/* Bytes of the two ring buffers of a connection with this many slots */
+static size_t
+ring_bytes(int slots)
+{
+
+	return (2 * (size_t)slots *
+	    (CONFIG->RING_DATA_LEN ? CONFIG->RING_DATA_LEN : DEF_RING_DATA_LEN));
+}
+
+/* Bytes of the buffers in use, with the smallest rings reserved for the
+ * connections still waiting for their first bytes. */
+static size_t
+buf_used(uint64_t pending)
+{
+
+	return (buf_bytes + pending * ring_bytes(1));
+}
+
+/* Whether the connections or the buffers of this worker are at pct
+ * percent of their limits. Buffers are at the limit when the smallest
+ * rings of one more connection would not fit. */
+static int
+accept_limited(unsigned pct)
+{
+
+	if (CONFIG->MAX_CONNECTIONS > 0 &&
+	    n_conns * 100 >= (uint64_t)CONFIG->MAX_CONNECTIONS * pct)
+		return (1);
+	if (buf_budget > 0 &&
+	    (buf_used(n_pending) + ring_bytes(1)) * 100 > buf_budget * pct)
+		return (1);
+	return (0);
+}
+
+/* Ring slots for a new connection: a single one under memory pressure,
+ * and none over the budget. The other pending connections keep their
+ * reservations. */
+static int
+ring_slots(uint64_t pending)
+{
+	int slots;
+
+	slots = CONFIG->RING_SLOTS ? CONFIG->RING_SLOTS : DEF_RING_SLOTS;
+	if (buf_budget == 0 ||
+	    (buf_used(pending) + ring_bytes(slots)) * 100 <=
+	    buf_budget * RING_REDUCE_PCT)
+		return (slots);
+	if (buf_used(pending) + ring_bytes(1) > buf_budget)
+		return (0);
+	HSTAT_INC(ring_reduced);
+	return (1);
+}
+
+/* Stop accepting new connections, until enough of them are closed or,
+ * with a retry, for a while. */
+static void
+accept_pause(int retry)
+{
+	struct frontend *fr;
+	struct listen_sock *ls;
+
+	if (retry) {
+		ev_timer_set(&accept_retry, ACCEPT_RETRY, 0.);
+		ev_timer_start(loop, &accept_retry);
+	}
+	if (accept_paused)
+		return;
+	accept_paused = 1;
+	VTAILQ_FOREACH(fr, &frontends, list) {
+		CHECK_OBJ_NOTNULL(fr, FRONTEND_MAGIC);
+		VTAILQ_FOREACH(ls, &fr->socks, list) {
+			CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+			ev_io_stop(loop, &ls->listener);
+		}
+	}
+	HSTAT_INC(accept_pauses);
+	HSTAT_SET(accept_paused, 1);
+}
+
+/* Accept again once below the resume marks of the limits */
+static void
+accept_resume(void)
+{
+	struct frontend *fr;
+	struct listen_sock *ls;
+
+	if (!accept_paused || worker_state == WORKER_EXITING ||
+	    ev_is_active(&accept_retry) || accept_limited(ACCEPT_RESUME_PCT))
+		return;
+	accept_paused = 0;
+	VTAILQ_FOREACH(fr, &frontends, list) {
+		CHECK_OBJ_NOTNULL(fr, FRONTEND_MAGIC);
+		VTAILQ_FOREACH(ls, &fr->socks, list) {
+			CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+			ev_io_start(loop, &ls->listener);
+		}
+	}
+	HSTAT_SET(accept_paused, 0);
+}
+
+static void
+handle_accept_retry(struct ev_loop *loop, ev_timer *w, int revents)
+{
+
+	(void)loop;
+	(void)w;
+	(void)revents;
+	HLOOP_MARK(NULL);
+	accept_resume();
+}
+
+/* How close this worker is to its connection or buffer limits, from 0
+ * to 1 */
+static double
+worker_load(void)
+{
+	double l, m;
+
+	l = 0.;
+	if (CONFIG->MAX_CONNECTIONS > 0)
+		l = (double)n_conns / CONFIG->MAX_CONNECTIONS;
+	if (buf_budget > 0) {
+		m = (double)buf_bytes / buf_budget;
+		if (m > l)
+			l = m;
+	}
+	return (l > 1. ? 1. : l);
+}
+
+/* A timeout shortened with adaptive-timeouts, from its full length at
+ * half load down to a tenth of it at full load, but not below a second
+ * unless it was shorter already. */
+static double
+adapt_tmo(int secs)
+{
+	double l, t;
+
+	t = secs;
+	if (!CONFIG->ADAPTIVE_TIMEOUTS || t <= 1.)
+		return (t);
+	l = worker_load();
+	if (l <= TMO_ADAPT_LOAD)
+		return (t);
+	t *= 1. - (1. - TMO_ADAPT_MIN) * (l - TMO_ADAPT_LOAD) /
+	    (1. - TMO_ADAPT_LOAD);
+	return (t < 1. ? 1. : t);
+}
+
+static void access_log(proxystate *ps, SHUTDOWN_REQUESTOR req);
+static void trace_log(proxystate *ps, SHUTDOWN_REQUESTOR req);
+
+#ifdef HAVE_KTLS
+/* Send a close_notify alert on a connection taken over with kTLS, as
+ * SSL_shutdown() would */
+static void
+ktls_close_notify(int fd)
+{
+	unsigned char alert[2] = { SSL3_AL_WARNING, SSL_AD_CLOSE_NOTIFY };
+	union {
+		struct cmsghdr	cm;
+		char		buf[CMSG_SPACE(sizeof(unsigned char))];
+	} cmsg;
+	struct cmsghdr *cm;
+	struct msghdr mh;
+	struct iovec iov;
+
+	memset(&mh, 0, sizeof mh);
+	memset(&cmsg, 0, sizeof cmsg);
+	iov.iov_base = alert;
+	iov.iov_len = sizeof alert;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cmsg.buf;
+	mh.msg_controllen = sizeof cmsg.buf;
+	cm = CMSG_FIRSTHDR(&mh);
+	cm->cmsg_level = SOL_TLS;
+	cm->cmsg_type = TLS_SET_RECORD_TYPE;
+	cm->cmsg_len = CMSG_LEN(sizeof(unsigned char));
+	*CMSG_DATA(cm) = SSL3_RT_ALERT;
+	(void)sendmsg(fd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+}
+#endif
+
 /* Only enable a libev ev_io event if the proxied connection still
  * has both up and down connected */
 static void
 shutdown_proxy(proxystate *ps, SHUTDOWN_REQUESTOR req)
 {
 	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	HPROBE_ARG(shutdown, ps, req);
+	HREC(ps, shutdown, req, 0);
 	LOGPROXY(ps, "proxy shutdown req=%s\n", SHUTDOWN_STR[req]);
 	if (ps->want_shutdown || req == SHUTDOWN_HARD) {
+		/* The worker taking a connection over logs it */
+		if (CONFIG->ACCESS_LOG && !ps->migrated)
+			access_log(ps, ps->want_shutdown ?
+			    (SHUTDOWN_REQUESTOR)ps->shutdown_req : req);
+		if (ps->rec != NULL)
+			HREC_close(ps, CONFIG->FLIGHT_RECORDER * 1e-3);
+		if (ps->trace != NULL && ps->migrated)
+			HTRACE_free(&ps->trace);
+		if (ps->trace != NULL)
+			trace_log(ps, ps->want_shutdown ?
+			    (SHUTDOWN_REQUESTOR)ps->shutdown_req : req);
 		ev_io_stop(loop, &ps->ev_w_ssl);
 		ev_io_stop(loop, &ps->ev_r_ssl);
 		ev_io_stop(loop, &ps->ev_w_handshake);
@@ -1730,25 +2473,55 @@ shutdown_proxy(proxystate *ps, SHUTDOWN_REQUESTOR req)
 		ev_io_stop(loop, &ps->ev_w_clear);
 		ev_io_stop(loop, &ps->ev_r_clear);
 		ev_io_stop(loop, &ps->ev_proxy);
-
-		(void)SSL_shutdown(ps->ssl);
-
-		ERR_clear_error();
-		SSL_free(ps->ssl);
+		if (ps->hs_queued)
+			hs_dequeue(ps);
+
+		if (ps->ssl != NULL) {
+			/* Quiet once migrated, the TLS session goes on */
+			if (ps->migrated)
+				SSL_set_quiet_shutdown(ps->ssl, 1);
+			(void)SSL_shutdown(ps->ssl);
+			ERR_clear_error();
+			SSL_free(ps->ssl);
+		} else if (ps->ktls) {
+#ifdef HAVE_KTLS
+			ktls_close_notify(ps->fd_up);
+#endif
+		} else {
+			n_pending--;
+			HSTAT_SET(pending, n_pending);
+		}
 
 		close(ps->fd_up);
-		close(ps->fd_down);
+		if (ps->fd_down >= 0)
+			close(ps->fd_down);
 		backend_deref(&ps->backend);
 
+		buf_bytes -= ringbuffer_bytes(&ps->ring_clear2ssl) +
+		    ringbuffer_bytes(&ps->ring_ssl2clear);
+		HSTAT_SET(buffer_bytes, buf_bytes);
 		ringbuffer_cleanup(&ps->ring_clear2ssl);
 		ringbuffer_cleanup(&ps->ring_ssl2clear);
+
+		HSTAT_FE_DEC(ps->stats_fe, conns);
+		if (!ps->migrated) {
+			HSTAT_observe(HSTAT_H_conn_duration_seconds,
+			    ev_time() - ps->t_accept);
+			HSTAT_observe(HSTAT_H_conn_bytes,
+			    ps->ssl2clear_bytes + ps->clear2ssl_bytes);
+		}
+		HCONN_del(ps);
 		free(ps);
 
 		n_conns--;
+		HSTAT_SET(conns, n_conns);
 		check_exit_state();
+		accept_resume();
 	}
 	else {
 		ps->want_shutdown = 1;
+		ps->shutdown_req = req;
+		HCONN_state(ps, HCONN_CLOSING);
 		if (req == SHUTDOWN_CLEAR &&
 		    ringbuffer_is_empty(&ps->ring_clear2ssl))
 			shutdown_proxy(ps, SHUTDOWN_HARD);
@@ -1766,6 +2539,7 @@ handle_socket_errno(proxystate *ps, int backend)
 	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
 		return;
 
+	HREC(ps, sock_error, errno, backend);
 	if (backend)
 		ERR("{backend} Socket error: %s\n", strerror(errno));
 	else
@@ -1786,19 +2560,63 @@ start_connect(proxystate *ps)
 	addr = VSA_Get_Sockaddr(ps->backend->backaddr, &len);
 	AN(addr);
 
+	if (ps->fd_down < 0) {
+		ps->fd_down = create_back_socket(ps->backend);
+		if (ps->fd_down < 0) {
+			t = errno;
+			ERR("{backend-socket}: %s\n", strerror(t));
+			HSTAT_INC(backend_conn_fail);
+			shutdown_proxy(ps, SHUTDOWN_HARD);
+			if (t == EMFILE || t == ENFILE)
+				accept_pause(1);
+			return (-1);
+		}
+		ev_io_set(&ps->ev_w_connect, ps->fd_down, EV_WRITE);
+		ev_io_set(&ps->ev_w_clear, ps->fd_down, EV_WRITE);
+		ev_io_set(&ps->ev_r_clear, ps->fd_down, EV_READ);
+	}
+
+	ps->t_connect = ev_time();
+	HPROBE(connect__start, ps);
+	HREC(ps, connect_start, ps->fd_down, 0);
 	t = connect(ps->fd_down, addr, len);
 	if (t == 0 || errno == EINPROGRESS || errno == EINTR) {
 		ev_io_start(loop, &ps->ev_w_connect);
+		if (!ev_is_active(&ps->ev_t_connect))
+			ev_timer_set(&ps->ev_t_connect,
+			    adapt_tmo(CONFIG->BACKEND_CONNECT_TIMEOUT), 0.);
 		ev_timer_start(loop, &ps->ev_t_connect);
 		return (0);
 	}
 
+	HREC(ps, connect_fail, errno, 0);
 	ERR("{backend-connect}: %s\n", strerror(errno));
+	HSTAT_INC(backend_conn_fail);
 	shutdown_proxy(ps, SHUTDOWN_HARD);
 
 	return (-1);
 }
 
+/* Time from the first byte read from the client to the first byte
+ * read from the backend. Protocols where the backend speaks first
+ * are not measured. */
+static void
+backend_ttfb(proxystate *ps, int fd)
+{
+	if (ps->backend_replied)
+		return;
+	if (fd != ps->fd_down) {
+		if (ps->t_request == 0.)
+			ps->t_request = ev_time();
+		return;
+	}
+	ps->backend_replied = 1;
+	if (ps->t_request > 0.) {
+		ps->d_ttfb = ev_time() - ps->t_request;
+		HSTAT_observe(HSTAT_H_backend_ttfb_seconds, ps->d_ttfb);
+	}
+}
+
 /* Read some data from the backend when libev says data is available--
  * write it into the upstream buffer and make sure the write event is
  * enabled for the upstream socket */
@@ -1809,6 +2627,7 @@ clear_read(struct ev_loop *loop, ev_io *w, int revents)
 	int t;
 	proxystate *ps;
 	CAST_OBJ_NOTNULL(ps, w->data, PROXYSTATE_MAGIC);
+	HLOOP_MARK(ps);
 	if (ps->want_shutdown) {
 		ev_io_stop(loop, &ps->ev_r_clear);
 		return;
@@ -1819,12 +2638,24 @@ clear_read(struct ev_loop *loop, ev_io *w, int revents)
 
 	if (t > 0) {
 		ringbuffer_write_append(&ps->ring_clear2ssl, t);
-		if (ringbuffer_is_full(&ps->ring_clear2ssl))
+		HSTAT_ADD(clear2ssl_bytes, t);
+		HSTAT_FE_ADD(ps->stats_fe, clear2ssl_bytes, t);
+		ps->clear2ssl_bytes += t;
+		HCONN_TOUCH(ps, ev_now(loop));
+		HTRACE_DATA(ps, HTRACE_BACKEND, t, ev_now(loop));
+		HREC(ps, clear_read, t, ringbuffer_size(&ps->ring_clear2ssl));
+		backend_ttfb(ps, fd);
+		if (ringbuffer_is_full(&ps->ring_clear2ssl)) {
+			HSTAT_INC(clear2ssl_ring_full);
+			HPROBE(clear2ssl__full, ps);
+			HREC_IO(ps, io_stop, "ev_r_clear");
 			ev_io_stop(loop, &ps->ev_r_clear);
+		}
 		if (ps->handshaked)
 			safe_enable_io(ps, &ps->ev_w_ssl);
 	}
 	else if (t == 0) {
+		HREC(ps, eof, fd == ps->fd_down, 0);
 		LOGPROXY(ps,"Connection closed by %s\n",
 		    fd == ps->fd_down ? "backend" : "client");
 		shutdown_proxy(ps, SHUTDOWN_CLEAR);
@@ -1848,12 +2679,14 @@ clear_write(struct ev_loop *loop, ev_io *w, int revents)
 	int sz;
 
 	CAST_OBJ_NOTNULL(ps, w->data, PROXYSTATE_MAGIC);
+	HLOOP_MARK(ps);
 	assert(!ringbuffer_is_empty(&ps->ring_ssl2clear));
 
 	char *next = ringbuffer_read_next(&ps->ring_ssl2clear, &sz);
 	t = send(fd, next, sz, MSG_NOSIGNAL);
 
 	if (t > 0) {
+		HREC(ps, clear_write, t, sz - t);
 		if (t == sz) {
 			ringbuffer_read_pop(&ps->ring_ssl2clear);
 			if (ps->handshaked)
@@ -1906,6 +2739,7 @@ handle_connect(struct ev_loop *loop, ev_io *w, int revents)
 
 	(void)revents;
 	CAST_OBJ_NOTNULL(ps, w->data, PROXYSTATE_MAGIC);
+	HLOOP_MARK(ps);
 	CHECK_OBJ_NOTNULL(ps->backend, BACKEND_MAGIC);
 	addr = VSA_Get_Sockaddr(ps->backend->backaddr, &len);
 	AN(addr);
@@ -1915,6 +2749,10 @@ handle_connect(struct ev_loop *loop, ev_io *w, int revents)
 	if (!t || errno == EISCONN || !errno) {
 		ev_io_stop(loop, &ps->ev_w_connect);
 		ev_timer_stop(loop, &ps->ev_t_connect);
+		ps->d_connect = ev_time() - ps->t_connect;
+		HSTAT_observe(HSTAT_H_backend_connect_seconds, ps->d_connect);
+		HPROBE(connect__done, ps);
+		HREC(ps, connect_done, 0, 0);
 
 		if (!ps->clear_connected) {
 			struct sockaddr_storage ss;
@@ -1927,8 +2765,10 @@ handle_connect(struct ev_loop *loop, ev_io *w, int revents)
 			ps->connect_port = sockaddr_port(
 				(struct sockaddr *) &ss);
 			LOGPROXY(ps, "backend connected\n");
+			HSTAT_INC(backend_conn);
 
 			ps->clear_connected = 1;
+			HCONN_state(ps, HCONN_ESTABLISHED);
 
 			/* if incoming buffer is not full */
 			if (!ringbuffer_is_full(&ps->ring_clear2ssl))
@@ -1948,7 +2788,9 @@ handle_connect(struct ev_loop *loop, ev_io *w, int revents)
 	else if (errno == EINPROGRESS || errno == EINTR || errno == EALREADY) {
 		/* do nothing, we'll get phoned home again... */
 	} else {
+		HREC(ps, connect_fail, errno, 0);
 		ERR("{backend-connect}: %s\n", strerror(errno));
+		HSTAT_INC(backend_conn_fail);
 		shutdown_proxy(ps, SHUTDOWN_HARD);
 	}
 }
@@ -1960,7 +2802,10 @@ connect_timeout(EV_P_ ev_timer *w, int revents)
 	(void)revents;
 	proxystate *ps;
 	CAST_OBJ_NOTNULL(ps, w->data, PROXYSTATE_MAGIC);
+	HLOOP_MARK(ps);
 	ERRPROXY(ps,"backend connect timeout\n");
+	HREC(ps, connect_timeout, 0, 0);
+	HSTAT_INC(backend_conn_timeout);
 	//shutdown_proxy(ps, SHUTDOWN_HARD);
 }
 
@@ -1975,12 +2820,19 @@ start_handshake(proxystate *ps, int err)
 	ev_io_stop(loop, &ps->ev_w_ssl);
 
 	ps->handshaked = 0;
+	ps->t_handshake = ev_time();
+	HCONN_state(ps, HCONN_HANDSHAKE);
+	HPROBE(handshake__start, ps);
+	HREC(ps, handshake_start, err, 0);
 
 	LOGPROXY(ps,"ssl handshake start\n");
 	if (err == SSL_ERROR_WANT_READ)
 		ev_io_start(loop, &ps->ev_r_handshake);
 	else if (err == SSL_ERROR_WANT_WRITE)
 		ev_io_start(loop, &ps->ev_w_handshake);
+	if (!ev_is_active(&ps->ev_t_handshake))
+		ev_timer_set(&ps->ev_t_handshake,
+		    adapt_tmo(CONFIG->SSL_HANDSHAKE_TIMEOUT), 0.);
 	ev_timer_start(loop, &ps->ev_t_handshake);
 }
 
@@ -1999,81 +2851,23 @@ get_alpn(proxystate *ps, const unsigned char **selected, unsigned *len) {
 }
 #endif /* OPENSSL_WITH_NPN || OPENSSL_WITH_ALPN */
 
-static int
-proxy_tlv_append(char *dst, ssize_t dstlen, unsigned type,
-    const char *val, ssize_t len)
-{
-	if (len == -1)
-		len = strlen(val);
-	if (dstlen < len + 3)
-		return (0);
-	dst[0] = type;
-	dst[1] = (len >> 8) & 0xff;
-	dst[2] = len & 0xff;
-	memcpy(dst + 3, val, len);
-	return (len + 3);
-}
-
 static void
 write_proxy_v2(proxystate *ps, const struct sockaddr *local)
 {
-	struct pp2_hdr *p;
-	size_t len = 16, maxlen;
+	size_t len, maxlen;
 	char *base;
 	const char *tlv_tok;
 	unsigned tlv_len;
+	char fp[HFP_HEX_LEN + 1];
 	int i;
 
-	union addr {
-		struct sockaddr		sa;
-		struct sockaddr_in	sa4;
-		struct sockaddr_in6	sa6;
-	} *l, *r;
-
 	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
 	base = ringbuffer_write_ptr(&ps->ring_ssl2clear);
-	p = (struct pp2_hdr *)base;
-	l = (union addr *) local;
-	r = (union addr *) &ps->remote_ip;
 	maxlen = ps->ring_ssl2clear.data_len;
 	/* XXX: should it be rounded down to PP2_HEADER_MAX? */
 
-	memcpy(&p->sig, PP2_SIG, sizeof PP2_SIG);
-	p->ver_cmd = PP2_VERSION|PP2_CMD_PROXY;
-	p->fam = l->sa.sa_family == AF_INET ?
-	    PP2_TRANS_STREAM|PP2_FAM_INET :
-	    PP2_TRANS_STREAM|PP2_FAM_INET6;
-
-	if (l->sa.sa_family == AF_INET) {
-		len += 12;
-
-		/* src/client */
-		memcpy(&p->addr.ipv4.src_addr, &r->sa4.sin_addr.s_addr,
-		    sizeof p->addr.ipv4.src_addr);
-		memcpy(&p->addr.ipv4.src_port, &r->sa4.sin_port,
-		    sizeof p->addr.ipv4.src_port);
-
-		/* dst/server */
-		memcpy(&p->addr.ipv4.dst_addr, &l->sa4.sin_addr.s_addr,
-		    sizeof p->addr.ipv4.dst_addr);
-		memcpy(&p->addr.ipv4.dst_port, &l->sa4.sin_port,
-		    sizeof p->addr.ipv4.dst_port);
-	} else {
-		assert (l->sa.sa_family == AF_INET6);
-		len += 36;
-
-		/* src/client */
-		memcpy(&p->addr.ipv6.src_addr, &r->sa6.sin6_addr.s6_addr,
-		    sizeof p->addr.ipv6.src_addr);
-		memcpy(&p->addr.ipv6.src_port, &r->sa6.sin6_port,
-		    sizeof p->addr.ipv6.src_port);
-
-		/* dst/server */
-		memcpy(&p->addr.ipv6.dst_addr, &l->sa6.sin6_addr.s6_addr,
-		    sizeof p->addr.ipv6.dst_addr);
-		memcpy(&p->addr.ipv6.dst_port, &l->sa6.sin6_port,
-		    sizeof p->addr.ipv6.dst_port);
-	}
+	len = proxy_hdr_v2(base, maxlen, local,
+	    (struct sockaddr *)&ps->remote_ip);
 
 	/* This is where we add something related to NPN or ALPN*/
 #if defined(OPENSSL_WITH_ALPN) || defined(OPENSSL_WITH_NPN)
@@ -2098,6 +2892,12 @@ write_proxy_v2(proxystate *ps, const struct sockaddr *local)
 			len += i;
 		}
 	}
+	if (CONFIG->PROXY_FINGERPRINT && ps->fingerprinted) {
+		i = proxy_tlv_append(base + len, maxlen - len,
+		    PP2_TYPE_FINGERPRINT, HFP_hex(ps->fingerprint, fp),
+		    HFP_HEX_LEN);
+		len += i;
+	}
 	if (CONFIG->PROXY_TLV) {
 		X509 *crt;
 		ssize_t sz = 0;
@@ -2144,40 +2944,19 @@ write_proxy_v2(proxystate *ps, const struct sockaddr *local)
 		tlvp[2] = sz & 0xff;
 	}
 
-	p->len = htons(len - 16);
+	proxy_hdr_v2_len(base, len);
 	ringbuffer_write_append(&ps->ring_ssl2clear, len);
 }
 
 static void
 write_proxy_v1(proxystate *ps, const struct sockaddr *local, socklen_t slen)
 {
-	char *p;
-	char src_addr[INET6_ADDRSTRLEN+1], dst_addr[INET6_ADDRSTRLEN+1];
-	char src_port[8], dst_port[8];
 	size_t len;
-	int n;
 
 	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
-
-	p = ringbuffer_write_ptr(&ps->ring_ssl2clear);
-	n = getnameinfo(local, slen, dst_addr, sizeof dst_addr, dst_port,
-	    sizeof dst_port, NI_NUMERICHOST | NI_NUMERICSERV);
-	AZ(n);
-
-	n = getnameinfo((struct sockaddr *) &ps->remote_ip, slen, src_addr,
-	    sizeof src_addr, src_port, sizeof src_port,
-	    NI_NUMERICHOST | NI_NUMERICSERV);
-	AZ(n);
-
-	if (local->sa_family == AF_INET) {
-		len = sprintf(p, "PROXY TCP4 %s %s %s %s\r\n", src_addr,
-		    dst_addr, src_port, dst_port);
-	} else {
-		assert (local->sa_family == AF_INET6);
-		len = sprintf(p, "PROXY TCP6 %s %s %s %s\r\n", src_addr,
-		    dst_addr, src_port, dst_port);
-	}
-	assert (len > 0);
+	len = proxy_hdr_v1(ringbuffer_write_ptr(&ps->ring_ssl2clear),
+	    ps->ring_ssl2clear.data_len, local,
+	    (struct sockaddr *)&ps->remote_ip, slen);
 	ringbuffer_write_append(&ps->ring_ssl2clear, len);
 }
 
@@ -2245,9 +3024,146 @@ static int is_alpn_shutdown_needed(proxystate *ps) {
 }
 #endif
 
+/* Name of the key exchange group, for the statistics */
+static const char *
+ssl_group_name(SSL *ssl)
+{
+#ifdef SSL_CTRL_GET_NEGOTIATED_GROUP
+	const char *s;
+	int nid;
+
+	nid = SSL_get_negotiated_group(ssl);
+	if (nid > 0 && (s = OBJ_nid2sn(nid)) != NULL)
+		return (s);
+#else
+	(void)ssl;
+#endif
+	return ("");
+}
+
+/* Copy a field of the access log, replacing anything that could break
+ * up the record. */
+static const char *
+access_field(char *buf, size_t sz, const char *s, size_t l)
+{
+	size_t i;
+
+	if (s == NULL || l == 0)
+		return ("-");
+	if (l >= sz)
+		l = sz - 1;
+	for (i = 0; i < l; i++)
+		buf[i] = ((unsigned char)s[i] > ' ' &&
+		    (unsigned char)s[i] < 0x7f) ? s[i] : '?';
+	buf[i] = '\0';
+	return (buf);
+}
+
+static const char *
+access_ms(char *buf, size_t sz, double d)
+{
+	if (d <= 0.)
+		return ("-");
+	(void)snprintf(buf, sz, "%.3f", d * 1e3);
+	return (buf);
+}
+
+/* One tab separated record per connection, see access-log in
+ * hitch.conf(5) for the fields. */
+static void
+access_log(proxystate *ps, SHUTDOWN_REQUESTOR req)
+{
+	char sni[256], cert[256], alpn[64], t_hs[32], t_conn[32];
+	const char *fe = NULL, *s, *proto = "-", *cipher = "-";
+	const char *group = "-", *type = "-";
+	const unsigned char *a = NULL;
+	unsigned alen = 0;
+	const sslctx *sc;
+
+	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	if (ps->frontend != NULL) {
+		CHECK_OBJ(ps->frontend, FRONTEND_MAGIC);
+		fe = ps->frontend->pspec;
+	}
+	s = NULL;
+	sc = NULL;
+	if (ps->ssl != NULL) {
+		s = SSL_get_servername(ps->ssl, TLSEXT_NAMETYPE_host_name);
+		sc = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ps->ssl));
+		CHECK_OBJ_ORNULL(sc, SSLCTX_MAGIC);
+	}
+	/* Connections taken over with kTLS have no SSL state */
+	if (ps->handshaked && ps->ssl != NULL) {
+		proto = SSL_get_version(ps->ssl);
+		cipher = SSL_get_cipher_name(ps->ssl);
+		if (*ssl_group_name(ps->ssl) != '\0')
+			group = ssl_group_name(ps->ssl);
+		type = SSL_session_reused(ps->ssl) ? "resumed" : "full";
+#if defined(OPENSSL_WITH_NPN) || defined(OPENSSL_WITH_ALPN)
+		get_alpn(ps, &a, &alen);
+#endif
+	}
+
+	WLOG(LOG_INFO, "{access}\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s"
+	    "\t%s\t%ju\t%ju\t%.3f\t%s\n",
+	    logproxy_addr(ps), fe != NULL ? fe : "-",
+	    access_field(sni, sizeof sni, s, s != NULL ? strlen(s) : 0),
+	    sc != NULL ? access_field(cert, sizeof cert, sc->filename,
+	    strlen(sc->filename)) : "-",
+	    proto, cipher, group,
+	    access_field(alpn, sizeof alpn, (const char *)a, alen), type,
+	    access_ms(t_hs, sizeof t_hs, ps->d_handshake),
+	    access_ms(t_conn, sizeof t_conn, ps->d_connect),
+	    (uintmax_t)ps->ssl2clear_bytes, (uintmax_t)ps->clear2ssl_bytes,
+	    (ev_time() - ps->t_accept) * 1e3, SHUTDOWN_STR[req]);
+}
+
+/* One tab separated record per connection, see conn-trace in
+ * hitch.conf(5) for the fields. */
+static void
+trace_log(proxystate *ps, SHUTDOWN_REQUESTOR req)
+{
+	char sni[128], alpn[64], t_hs[32], tr[640];
+	const char *fe = NULL, *s, *proto = "-", *type = "-";
+	const unsigned char *a = NULL;
+	unsigned alen = 0;
+
+	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	AN(ps->trace);
+	if (ps->frontend != NULL) {
+		CHECK_OBJ(ps->frontend, FRONTEND_MAGIC);
+		fe = ps->frontend->pspec;
+	}
+	s = NULL;
+	if (ps->ssl != NULL)
+		s = SSL_get_servername(ps->ssl, TLSEXT_NAMETYPE_host_name);
+	if (ps->handshaked && ps->ssl != NULL) {
+		proto = SSL_get_version(ps->ssl);
+		type = SSL_session_reused(ps->ssl) ? "resumed" : "full";
+#if defined(OPENSSL_WITH_NPN) || defined(OPENSSL_WITH_ALPN)
+		get_alpn(ps, &a, &alen);
+#endif
+	}
+
+	WLOG(LOG_INFO, "{trace}\t%.3f\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%.3f"
+	    "\t%s\t%ju\t%ju\t%s\n",
+	    ps->t_accept, logproxy_addr(ps), fe != NULL ? fe : "-",
+	    access_field(sni, sizeof sni, s, s != NULL ? strlen(s) : 0),
+	    proto, type,
+	    access_field(alpn, sizeof alpn, (const char *)a, alen),
+	    access_ms(t_hs, sizeof t_hs, ps->d_handshake),
+	    (ev_time() - ps->t_accept) * 1e3, SHUTDOWN_STR[req],
+	    (uintmax_t)ps->ssl2clear_bytes, (uintmax_t)ps->clear2ssl_bytes,
+	    HTRACE_str(ps->trace, tr, sizeof tr));
+	HTRACE_free(&ps->trace);
+}
+
 /* After OpenSSL is done with a handshake, re-wire standard read/write handlers
  * for data transmission */
 static void end_handshake(proxystate *ps) {
+	struct hrl_rates r;
+	struct hrl_src src;
+
 	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
 	ev_io_stop(loop, &ps->ev_r_handshake);
 	ev_io_stop(loop, &ps->ev_w_handshake);
@@ -2255,11 +3171,38 @@ static void end_handshake(proxystate *ps) {
 
 #if defined(OPENSSL_WITH_NPN) || defined(OPENSSL_WITH_ALPN)
 	if (is_alpn_shutdown_needed(ps)) {
+		HSTAT_INC(hs_fail_alpn);
+		HSTAT_FE_INC(ps->stats_fe, hs_fail);
 		shutdown_proxy(ps, SHUTDOWN_HARD);
 		return;
 	}
 #endif
 	LOGPROXY(ps,"ssl end handshake\n");
+	ps->d_handshake = ev_time() - ps->t_handshake;
+	HSTAT_handshake(SSL_get_cipher_name(ps->ssl), ssl_group_name(ps->ssl),
+	    SSL_session_reused(ps->ssl), ps->d_handshake);
+	HPROBE_ARG(handshake__done, ps, SSL_session_reused(ps->ssl));
+	HREC(ps, handshake_done, SSL_session_reused(ps->ssl), 0);
+	if (ps->hrl_src.family != 0) {
+		frontend_rates(ps->frontend, &r);
+		HRL_done(&ps->hrl_src, ps->frontend->stats_idx, &r,
+		    ps->resume_offered, SSL_session_reused(ps->ssl),
+		    ev_now(loop));
+	}
+	if (ps->fingerprint_rated) {
+		HRL_src_fingerprint(&src, ps->fingerprint);
+		r.full = CONFIG->FINGERPRINT_RATE;
+		r.resumed = 0;
+		HRL_done(&src, -1, &r, ps->resume_offered,
+		    SSL_session_reused(ps->ssl), ev_now(loop));
+	}
+	if (SSL_session_reused(ps->ssl)) {
+		HSTAT_INC(hs_resumed);
+		HSTAT_FE_INC(ps->stats_fe, hs_resumed);
+	} else {
+		HSTAT_INC(hs_full);
+		HSTAT_FE_INC(ps->stats_fe, hs_full);
+	}
 	/* Disable renegotiation (CVE-2009-3555) */
 #ifdef HAVE_STRUCT_SSL_ST_S3
 	/* For OpenSSL 1.1, setting the following flag does not seem
@@ -2271,6 +3214,8 @@ static void end_handshake(proxystate *ps) {
 	}
 #endif
 	ps->handshaked = 1;
+	HCONN_state(ps, ps->clear_connected ? HCONN_ESTABLISHED :
+	    HCONN_CONNECT);
 
 	/* Check if clear side is connected */
 	if (!ps->clear_connected) {
@@ -2318,10 +3263,12 @@ client_proxy_proxy(struct ev_loop *loop, ev_io *w, int revents)
 	int t;
 	char *proxy = tcp_proxy_line;
 	char *end = tcp_proxy_line + sizeof(tcp_proxy_line);
+	struct sockaddr_storage src;
 	proxystate *ps;
 	BIO *b;
 
 	CAST_OBJ_NOTNULL(ps, w->data, PROXYSTATE_MAGIC);
+	HLOOP_MARK(ps);
 	b = SSL_get_rbio(ps->ssl);
 
 	// Copy characters one-by-one until we hit a \n or an error
@@ -2349,6 +3296,19 @@ client_proxy_proxy(struct ev_loop *loop, ev_io *w, int revents)
 		if (*(proxy - 1) == '\n') {
 			ev_io_stop(loop, &ps->ev_proxy);
 
+			/* Now the source is known */
+			if (proxy_v1_src(tcp_proxy_line,
+			    proxy - tcp_proxy_line, &src) == 0) {
+				HRL_src(&ps->hrl_src, (struct sockaddr *)&src,
+				    CONFIG->HANDSHAKE_RATE_PREFIX4,
+				    CONFIG->HANDSHAKE_RATE_PREFIX6);
+				if (rate_limited(ps->frontend,
+				    &ps->hrl_src)) {
+					shutdown_proxy(ps, SHUTDOWN_SSL);
+					return;
+				}
+			}
+
 			// Start the real handshake
 			start_handshake(ps, SSL_ERROR_WANT_READ);
 		}
@@ -2369,12 +3329,18 @@ client_handshake(struct ev_loop *loop, ev_io *w, int revents)
 	const char *errtok;
 	proxystate *ps;
 	int errno_val;
+	double t0 = 0.;
 
 
 	CAST_OBJ_NOTNULL(ps, w->data, PROXYSTATE_MAGIC);
+	HLOOP_MARK(ps);
 
 	LOGPROXY(ps,"ssl client handshake revents=%x\n",revents);
+	if (CONFIG->HANDSHAKE_BUDGET > 0)
+		t0 = ev_time();
 	t = SSL_do_handshake(ps->ssl);
+	if (ps->hs_admitted)
+		hs_spent += ev_time() - t0;
 	if (t == 1) {
 		end_handshake(ps);
 	} else {
@@ -2390,22 +3356,42 @@ client_handshake(struct ev_loop *loop, ev_io *w, int revents)
 		}
 
 		LOGPROXY(ps,"ssl client handshake err=%s\n",errtok);
+		if (err == SSL_ERROR_WANT_READ ||
+		    err == SSL_ERROR_WANT_WRITE)
+			HREC(ps, ssl_want, err, 0);
+		else if (err == SSL_ERROR_ZERO_RETURN ||
+		    (err == SSL_ERROR_SYSCALL && errno_val == 0))
+			HREC(ps, eof, w->fd != ps->fd_up, 0);
+		else
+			HREC(ps, ssl_error, err, errno_val);
 		if (err == SSL_ERROR_WANT_READ) {
 			ev_io_stop(loop, &ps->ev_w_handshake);
 			ev_io_start(loop, &ps->ev_r_handshake);
 		} else if (err == SSL_ERROR_WANT_WRITE) {
 			ev_io_stop(loop, &ps->ev_r_handshake);
 			ev_io_start(loop, &ps->ev_w_handshake);
+#ifdef HAVE_SSL_CTX_SET_CLIENT_HELLO_CB
+		} else if (err == SSL_ERROR_WANT_CLIENT_HELLO_CB) {
+			/* Queued, the handshake timer keeps running */
+			ev_io_stop(loop, &ps->ev_r_handshake);
+			ev_io_stop(loop, &ps->ev_w_handshake);
+#endif
 		} else if (err == SSL_ERROR_ZERO_RETURN) {
 			LOG("{%s} Connection closed (in handshake)\n",
 			    w->fd == ps->fd_up ? "client" : "backend");
+			HSTAT_INC(hs_fail_closed);
+			HSTAT_FE_INC(ps->stats_fe, hs_fail);
 			shutdown_proxy(ps, SHUTDOWN_SSL);
 		} else if (err == SSL_ERROR_SYSCALL) {
 			LOG("{%s} SSL socket error in handshake: %s\n",
 			    w->fd == ps->fd_up ? "client" : "backend",
 			    strerror(errno_val));
+			HSTAT_INC(hs_fail_syscall);
+			HSTAT_FE_INC(ps->stats_fe, hs_fail);
 			shutdown_proxy(ps, SHUTDOWN_SSL);
 		} else {
+			HSTAT_INC(hs_fail_ssl);
+			HSTAT_FE_INC(ps->stats_fe, hs_fail);
 			if (err == SSL_ERROR_SSL) {
 				log_ssl_error(ps, "Handshake failure");
 			} else {
@@ -2426,7 +3412,11 @@ handshake_timeout(EV_P_ ev_timer *w, int revents)
 	(void)revents;
 	proxystate *ps;
 	CAST_OBJ_NOTNULL(ps, w->data, PROXYSTATE_MAGIC);
+	HLOOP_MARK(ps);
 	LOGPROXY(ps,"SSL handshake timeout\n");
+	HREC(ps, handshake_timeout, 0, 0);
+	HSTAT_INC(hs_fail_timeout);
+	HSTAT_FE_INC(ps->stats_fe, hs_fail);
 	shutdown_proxy(ps, SHUTDOWN_HARD);
 }
 
@@ -2453,6 +3443,11 @@ static void
 handle_fatal_ssl_error(proxystate *ps, int err, int backend)
 {
 	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	if (err == SSL_ERROR_ZERO_RETURN ||
+	    (err == SSL_ERROR_SYSCALL && errno == 0))
+		HREC(ps, eof, backend, 0);
+	else
+		HREC(ps, ssl_error, err, errno);
 	if (backend) {
 		SSLERR(ps, "backend", ERRPROXY);
 	} else {
@@ -2461,6 +3456,30 @@ handle_fatal_ssl_error(proxystate *ps, int err, int backend)
 	shutdown_proxy(ps, SHUTDOWN_SSL);
 }
 
+/* Buffer the t bytes read from the secure socket for the backend */
+static void
+ssl_read_done(struct ev_loop *loop, proxystate *ps, int fd, int t)
+{
+
+	ringbuffer_write_append(&ps->ring_ssl2clear, t);
+	HSTAT_ADD(ssl2clear_bytes, t);
+	HSTAT_FE_ADD(ps->stats_fe, ssl2clear_bytes, t);
+	ps->ssl2clear_bytes += t;
+	HCONN_TOUCH(ps, ev_now(loop));
+	HTRACE_DATA(ps, HTRACE_CLIENT, t, ev_now(loop));
+	HPROBE_ARG(ssl__read, ps, t);
+	HREC(ps, ssl_read, t, ringbuffer_size(&ps->ring_ssl2clear));
+	backend_ttfb(ps, fd);
+	if (ringbuffer_is_full(&ps->ring_ssl2clear)) {
+		HSTAT_INC(ssl2clear_ring_full);
+		HPROBE(ssl2clear__full, ps);
+		HREC_IO(ps, io_stop, "ev_r_ssl");
+		ev_io_stop(loop, &ps->ev_r_ssl);
+	}
+	if (ps->clear_connected)
+		safe_enable_io(ps, &ps->ev_w_clear);
+}
+
 /* Read some data from the upstream secure socket via OpenSSL,
  * and buffer anything we get for writing to the backend */
 static void
@@ -2471,6 +3490,7 @@ ssl_read(struct ev_loop *loop, ev_io *w, int revents)
 	proxystate *ps;
 
 	CAST_OBJ_NOTNULL(ps, w->data, PROXYSTATE_MAGIC);
+	HLOOP_MARK(ps);
 
 	if (ps->want_shutdown) {
 		ev_io_stop(loop, &ps->ev_r_ssl);
@@ -2492,11 +3512,7 @@ ssl_read(struct ev_loop *loop, ev_io *w, int revents)
 	}
 
 	if (t > 0) {
-		ringbuffer_write_append(&ps->ring_ssl2clear, t);
-		if (ringbuffer_is_full(&ps->ring_ssl2clear))
-			ev_io_stop(loop, &ps->ev_r_ssl);
-		if (ps->clear_connected)
-			safe_enable_io(ps, &ps->ev_w_clear);
+		ssl_read_done(loop, ps, w->fd, t);
 	} else {
 		int err = SSL_get_error(ps->ssl, t);
 		if (err == SSL_ERROR_WANT_WRITE) {
@@ -2513,6 +3529,31 @@ ssl_read(struct ev_loop *loop, ev_io *w, int revents)
 	}
 }
 
+/* Consume the t bytes of the sz at the head of the buffer written to
+ * the secure socket. The connection is gone if it was shutting down. */
+static void
+ssl_write_done(struct ev_loop *loop, proxystate *ps, int t, int sz)
+{
+
+	HPROBE_ARG(ssl__write, ps, t);
+	HREC(ps, ssl_write, t, sz - t);
+	if (t == sz) {
+		ringbuffer_read_pop(&ps->ring_clear2ssl);
+		if (ps->clear_connected)
+			// can be re-enabled b/c we've popped
+			safe_enable_io(ps, &ps->ev_r_clear);
+		if (ringbuffer_is_empty(&ps->ring_clear2ssl)) {
+			if (ps->want_shutdown) {
+				shutdown_proxy(ps, SHUTDOWN_HARD);
+				return;
+			}
+			ev_io_stop(loop, &ps->ev_w_ssl);
+		}
+	} else {
+		ringbuffer_read_skip(&ps->ring_clear2ssl, t);
+	}
+}
+
 /* Write some previously-buffered backend data upstream on the
  * secure socket using OpenSSL */
 static void
@@ -2524,26 +3565,13 @@ ssl_write(struct ev_loop *loop, ev_io *w, int revents)
 	proxystate *ps;
 
 	CAST_OBJ_NOTNULL(ps, w->data, PROXYSTATE_MAGIC);
+	HLOOP_MARK(ps);
 
 	assert(!ringbuffer_is_empty(&ps->ring_clear2ssl));
 	char *next = ringbuffer_read_next(&ps->ring_clear2ssl, &sz);
 	t = SSL_write(ps->ssl, next, sz);
 	if (t > 0) {
-		if (t == sz) {
-			ringbuffer_read_pop(&ps->ring_clear2ssl);
-			if (ps->clear_connected)
-				// can be re-enabled b/c we've popped
-				safe_enable_io(ps, &ps->ev_r_clear);
-			if (ringbuffer_is_empty(&ps->ring_clear2ssl)) {
-				if (ps->want_shutdown) {
-					shutdown_proxy(ps, SHUTDOWN_HARD);
-					return;
-				}
-				ev_io_stop(loop, &ps->ev_w_ssl);
-			}
-		} else {
-			ringbuffer_read_skip(&ps->ring_clear2ssl, t);
-		}
+		ssl_write_done(loop, ps, t, sz);
 	} else {
 		int err = SSL_get_error(ps->ssl, t);
 		if (err == SSL_ERROR_WANT_READ) {
@@ -2564,49 +3592,261 @@ ssl_write(struct ev_loop *loop, ev_io *w, int revents)
 	}
 }
 
-
-/* libev read handler for the bound sockets.  Socket is accepted,
- * the proxystate is allocated and initalized, and we're off the races
- * connecting to the backend */
+#ifdef HAVE_KTLS
+/* Read the records the kernel decrypted, on a connection taken over
+ * with kTLS. Without SSL state left to handle alerts, key updates or
+ * renegotiations, anything but application data ends the connection. */
 static void
-handle_accept(struct ev_loop *loop, ev_io *w, int revents)
+ktls_read(struct ev_loop *loop, ev_io *w, int revents)
 {
-	(void)revents;
-	(void)loop;
-	struct sockaddr_storage addr;
-	sslctx *so;
-	struct frontend *fr;
+	union {
+		struct cmsghdr	cm;
+		char		buf[CMSG_SPACE(sizeof(unsigned char))];
+	} cmsg;
+	unsigned char type = SSL3_RT_APPLICATION_DATA;
+	struct cmsghdr *cm;
+	struct msghdr mh;
+	struct iovec iov;
 	proxystate *ps;
-	socklen_t sl = sizeof(addr);
-
-#if HAVE_ACCEPT4==1
-	int client = accept4(w->fd, (struct sockaddr *) &addr, &sl,
-	    SOCK_NONBLOCK);
-#else
-	int client = accept(w->fd, (struct sockaddr *) &addr, &sl);
-#endif
-	if (client == -1) {
-		switch (errno) {
-		case EMFILE:
-			ERR("{client} accept() failed; "
-			    "too many open files for this process\n");
-			break;
+	ssize_t t;
 
-		case ENFILE:
-			ERR("{client} accept() failed; "
-			    "too many open files for this system\n");
-			break;
+	(void)revents;
+	CAST_OBJ_NOTNULL(ps, w->data, PROXYSTATE_MAGIC);
+	HLOOP_MARK(ps);
 
-		default:
-			if (errno != EINTR && errno != EWOULDBLOCK &&
-			    errno != EAGAIN && errno != ENOTTY &&
-			    errno != ECONNABORTED) {
-				SOCKERR("{client} accept() failed");
+	if (ps->want_shutdown) {
+		ev_io_stop(loop, &ps->ev_r_ssl);
+		return;
+	}
+	if (ringbuffer_is_full(&ps->ring_ssl2clear)) {
+		ERRPROXY(ps, "attempt to read ssl when ring full");
+		ev_io_stop(loop, &ps->ev_r_ssl);
+		return;
+	}
+
+	memset(&mh, 0, sizeof mh);
+	iov.iov_base = ringbuffer_write_ptr(&ps->ring_ssl2clear);
+	iov.iov_len = ps->ring_ssl2clear.data_len;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cmsg.buf;
+	mh.msg_controllen = sizeof cmsg.buf;
+	t = recvmsg(w->fd, &mh, 0);
+	for (cm = CMSG_FIRSTHDR(&mh); t > 0 && cm != NULL;
+	    cm = CMSG_NXTHDR(&mh, cm))
+		if (cm->cmsg_level == SOL_TLS &&
+		    cm->cmsg_type == TLS_GET_RECORD_TYPE)
+			type = *CMSG_DATA(cm);
+
+	if (t > 0 && type == SSL3_RT_APPLICATION_DATA) {
+		ssl_read_done(loop, ps, w->fd, t);
+	} else if (t > 0) {
+		LOGPROXY(ps, "kTLS record of type %u from the client\n", type);
+		HREC(ps, ssl_error, SSL_ERROR_SSL, type);
+		shutdown_proxy(ps, SHUTDOWN_SSL);
+	} else if (t == 0) {
+		handle_fatal_ssl_error(ps, SSL_ERROR_ZERO_RETURN, 0);
+	} else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		handle_fatal_ssl_error(ps, SSL_ERROR_SYSCALL, 0);
+	}
+}
+
+/* Write some previously-buffered backend data on a connection taken
+ * over with kTLS, the kernel makes the records */
+static void
+ktls_write(struct ev_loop *loop, ev_io *w, int revents)
+{
+	proxystate *ps;
+	char *next;
+	int sz;
+	ssize_t t;
+
+	(void)revents;
+	CAST_OBJ_NOTNULL(ps, w->data, PROXYSTATE_MAGIC);
+	HLOOP_MARK(ps);
+
+	assert(!ringbuffer_is_empty(&ps->ring_clear2ssl));
+	next = ringbuffer_read_next(&ps->ring_clear2ssl, &sz);
+	t = send(w->fd, next, sz, MSG_NOSIGNAL);
+	if (t > 0)
+		ssl_write_done(loop, ps, t, sz);
+	else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		handle_fatal_ssl_error(ps, SSL_ERROR_SYSCALL, 0);
+}
+#endif
+
+
+/* Give a connection its TLS state and buffers. Returns -1 if it was
+ * closed instead. */
+static int
+client_setup(proxystate *ps)
+{
+	sslctx *so;
+	SSL *ssl;
+	int slots;
+
+	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	AZ(ps->ssl);
+	AN(n_pending);
+	slots = ring_slots(n_pending - 1);
+	if (slots == 0) {
+		HSTAT_INC(overload_drops);
+		shutdown_proxy(ps, SHUTDOWN_HARD);
+		accept_pause(0);
+		return (-1);
+	}
+
+	so = frontend_sess_ctx(ps->frontend);
+	ssl = SSL_new(so->ctx);
+	if (ssl == NULL) {
+		ERR("{SSL_new}: %s\n", strerror(errno));
+		shutdown_proxy(ps, SHUTDOWN_HARD);
+		return (-1);
+	}
+
+	long mode = SSL_MODE_ENABLE_PARTIAL_WRITE;
+#ifdef SSL_MODE_RELEASE_BUFFERS
+	mode |= SSL_MODE_RELEASE_BUFFERS;
+#endif
+	SSL_set_mode(ssl, mode);
+	SSL_set_accept_state(ssl);
+	SSL_set_fd(ssl, ps->fd_up);
+
+	/* Link back proxystate to SSL state */
+	SSL_set_app_data(ssl, ps);
+	ps->ssl = ssl;
+	n_pending--;
+	HSTAT_SET(pending, n_pending);
+
+	ringbuffer_init(&ps->ring_clear2ssl, slots, CONFIG->RING_DATA_LEN);
+	ringbuffer_init(&ps->ring_ssl2clear, slots, CONFIG->RING_DATA_LEN);
+	buf_bytes += ringbuffer_bytes(&ps->ring_clear2ssl) +
+	    ringbuffer_bytes(&ps->ring_ssl2clear);
+	HSTAT_SET(buffer_bytes, buf_bytes);
+	return (0);
+}
+
+/* The libev read handler of a connection waiting for its first bytes.
+ * Peeks at the first one, to close connections that do not start with
+ * a TLS handshake record, or a PROXY line, before anything else gets
+ * allocated for them. */
+static void
+client_pending(struct ev_loop *loop, ev_io *w, int revents)
+{
+	proxystate *ps;
+	unsigned char c;
+	ssize_t n;
+
+	(void)revents;
+	CAST_OBJ_NOTNULL(ps, w->data, PROXYSTATE_MAGIC);
+	HLOOP_MARK(ps);
+
+	n = recv(ps->fd_up, &c, 1, MSG_PEEK);
+	if (n < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return;
+		LOGPROXY(ps, "socket error before any data: %s\n",
+		    strerror(errno));
+		HSTAT_INC(pending_closed);
+		shutdown_proxy(ps, SHUTDOWN_HARD);
+		return;
+	}
+	if (n == 0) {
+		LOGPROXY(ps, "closed before any data\n");
+		HSTAT_INC(pending_closed);
+		shutdown_proxy(ps, SHUTDOWN_HARD);
+		return;
+	}
+	if (c != (CONFIG->PROXY_PROXY_LINE ? 'P' : SSL3_RT_HANDSHAKE)) {
+		LOGPROXY(ps, "not a TLS handshake, first byte 0x%02x\n", c);
+		HREC(ps, not_tls, c, 0);
+		HSTAT_INC(pending_rejected);
+		shutdown_proxy(ps, SHUTDOWN_HARD);
+		return;
+	}
+
+	ev_io_stop(loop, w);
+	ev_set_cb(w, client_handshake);
+	if (client_setup(ps) != 0)
+		return;
+	if (CONFIG->PROXY_PROXY_LINE) {
+		HCONN_state(ps, HCONN_PROXY);
+		ev_io_start(loop, &ps->ev_proxy);
+	} else {
+		/* for client-first handshake */
+		start_handshake(ps, SSL_ERROR_WANT_READ);
+	}
+}
+
+static void client_new(struct ev_loop *loop, int client,
+    const struct sockaddr_storage *addr, struct frontend *fr,
+    const struct hrl_src *src);
+
+/* libev read handler for the bound sockets.  Socket is accepted, and
+ * the proxystate is allocated to wait for the first bytes */
+static void
+handle_accept(struct ev_loop *loop, ev_io *w, int revents)
+{
+	(void)revents;
+	(void)loop;
+	struct sockaddr_storage addr;
+	struct hrl_src src;
+	struct frontend *fr;
+	socklen_t sl = sizeof(addr);
+
+	HLOOP_MARK(NULL);
+#if HAVE_ACCEPT4==1
+	int client = accept4(w->fd, (struct sockaddr *) &addr, &sl,
+	    SOCK_NONBLOCK);
+#else
+	int client = accept(w->fd, (struct sockaddr *) &addr, &sl);
+#endif
+	if (client == -1) {
+		switch (errno) {
+		case EMFILE:
+			HSTAT_INC(accept_fail);
+			ERR("{client} accept() failed; "
+			    "too many open files for this process\n");
+			accept_pause(1);
+			break;
+
+		case ENFILE:
+			HSTAT_INC(accept_fail);
+			ERR("{client} accept() failed; "
+			    "too many open files for this system\n");
+			accept_pause(1);
+			break;
+
+		default:
+			if (errno != EINTR && errno != EWOULDBLOCK &&
+			    errno != EAGAIN && errno != ENOTTY &&
+			    errno != ECONNABORTED) {
+				HSTAT_INC(accept_fail);
+				SOCKERR("{client} accept() failed");
 			}
 		}
 		return;
 	}
 
+	if (backend_down) {
+		HSTAT_INC(backend_down_drops);
+		(void)close(client);
+		return;
+	}
+
+	/* Behind a proxy, the source is only known from its PROXY line */
+	CAST_OBJ_NOTNULL(fr, w->data, FRONTEND_MAGIC);
+	memset(&src, 0, sizeof src);
+	if (!CONFIG->PROXY_PROXY_LINE) {
+		HRL_src(&src, (struct sockaddr *)&addr,
+		    CONFIG->HANDSHAKE_RATE_PREFIX4,
+		    CONFIG->HANDSHAKE_RATE_PREFIX6);
+		if (rate_limited(fr, &src)) {
+			(void)close(client);
+			return;
+		}
+	}
+
 	int flag = 1;
 	int ret = setsockopt(client, IPPROTO_TCP, TCP_NODELAY,
 	    (char *)&flag, sizeof(flag) );
@@ -2630,73 +3870,25 @@ handle_accept(struct ev_loop *loop, ev_io *w, int revents)
 #endif
 
 	settcpkeepalive(client);
+	client_new(loop, client, &addr, fr, &src);
+}
 
-	ALLOC_OBJ(ps, PROXYSTATE_MAGIC);
-	if (ps == NULL) {
-		(void)close(client);
-		ERR("{malloc-err}: %s\n", strerror(errno));
-		return;
-	}
-
-	ps->backend = backend_ref();
-	ps->fd_down = create_back_socket(ps->backend);
-	if (ps->fd_down == -1) {
-		(void) close(client);
-		backend_deref(&ps->backend);
-		free(ps);
-		ERR("{backend-socket}: %s\n", strerror(errno));
-		return;
-	}
-
-
-	CAST_OBJ_NOTNULL(fr, w->data, FRONTEND_MAGIC);
-	if (fr->default_ctx != NULL)
-		CAST_OBJ_NOTNULL(so, fr->default_ctx, SSLCTX_MAGIC);
-	else
-		CAST_OBJ_NOTNULL(so, default_ctx, SSLCTX_MAGIC);
-
-	SSL *ssl = SSL_new(so->ctx);
-	if (ssl == NULL) {
-		(void)close(ps->fd_down);
-		(void)close(client);
-		backend_deref(&ps->backend);
-		free(ps);
-		ERR("{SSL_new}: %s\n", strerror(errno));
-		return;
-	}
-
-	long mode = SSL_MODE_ENABLE_PARTIAL_WRITE;
-#ifdef SSL_MODE_RELEASE_BUFFERS
-	mode |= SSL_MODE_RELEASE_BUFFERS;
-#endif
-	SSL_set_mode(ssl, mode);
-	SSL_set_accept_state(ssl);
-	SSL_set_fd(ssl, client);
-
-	ps->fd_up = client;
-	ps->ssl = ssl;
-	ps->want_shutdown = 0;
-	ps->clear_connected = 0;
-	ps->handshaked = 0;
-	ps->renegotiation = 0;
-	ps->remote_ip = addr;
-	ps->connect_port = 0;
-
-	ringbuffer_init(&ps->ring_clear2ssl, CONFIG->RING_SLOTS,
-	    CONFIG->RING_DATA_LEN);
-	ringbuffer_init(&ps->ring_ssl2clear, CONFIG->RING_SLOTS,
-	    CONFIG->RING_DATA_LEN);
+/* Set up the events of a connection, on its sockets */
+static void
+proxystate_events(proxystate *ps)
+{
 
-	/* set up events */
-	ev_io_init(&ps->ev_r_ssl, ssl_read, client, EV_READ);
-	ev_io_init(&ps->ev_w_ssl, ssl_write, client, EV_WRITE);
+	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	ev_io_init(&ps->ev_r_ssl, ssl_read, ps->fd_up, EV_READ);
+	ev_io_init(&ps->ev_w_ssl, ssl_write, ps->fd_up, EV_WRITE);
 
-	ev_io_init(&ps->ev_r_handshake, client_handshake, client, EV_READ);
-	ev_io_init(&ps->ev_w_handshake, client_handshake, client, EV_WRITE);
+	ev_io_init(&ps->ev_r_handshake, client_pending, ps->fd_up, EV_READ);
+	ev_io_init(&ps->ev_w_handshake, client_handshake, ps->fd_up,
+	    EV_WRITE);
 	ev_timer_init(&ps->ev_t_handshake, handshake_timeout,
-	    CONFIG->SSL_HANDSHAKE_TIMEOUT, 0.);
+	    adapt_tmo(CONFIG->SSL_HANDSHAKE_TIMEOUT), 0.);
 
-	ev_io_init(&ps->ev_proxy, client_proxy_proxy, client, EV_READ);
+	ev_io_init(&ps->ev_proxy, client_proxy_proxy, ps->fd_up, EV_READ);
 	ev_io_init(&ps->ev_w_connect, handle_connect, ps->fd_down, EV_WRITE);
 	ev_timer_init(&ps->ev_t_connect, connect_timeout,
 	    CONFIG->BACKEND_CONNECT_TIMEOUT, 0.);
@@ -2714,19 +3906,63 @@ handle_accept(struct ev_loop *loop, ev_io *w, int revents)
 	ps->ev_r_handshake.data = ps;
 	ps->ev_w_handshake.data = ps;
 	ps->ev_t_handshake.data = ps;
+}
 
-	/* Link back proxystate to SSL state */
-	SSL_set_app_data(ssl, ps);
+/* Set up an accepted connection to wait for its first bytes */
+static void
+client_new(struct ev_loop *loop, int client,
+    const struct sockaddr_storage *addr, struct frontend *fr,
+    const struct hrl_src *src)
+{
+	proxystate *ps;
+
+	ALLOC_OBJ(ps, PROXYSTATE_MAGIC);
+	if (ps == NULL) {
+		(void)close(client);
+		ERR("{malloc-err}: %s\n", strerror(errno));
+		return;
+	}
 
+	/* The backend socket is created at the connect, the TLS state
+	 * and the buffers once the first bytes arrive. */
+	ps->backend = backend_ref();
+	ps->fd_down = -1;
+	ps->fd_up = client;
+	ps->want_shutdown = 0;
+	ps->clear_connected = 0;
+	ps->handshaked = 0;
+	ps->renegotiation = 0;
+	ps->remote_ip = *addr;
+	ps->connect_port = 0;
+	ps->frontend = fr;
+	ps->stats_fe = fr->stats_idx;
+	ps->hrl_src = *src;
+	if (CONFIG->FLIGHT_RECORDER > 0)
+		ps->rec = HREC_new();
+	HREC(ps, accept, ps->fd_up, 0);
+	ps->t_accept = ev_time();
+	if (CONFIG->CONN_TRACE)
+		ps->trace = HTRACE_new(ps->t_accept);
+
+	proxystate_events(ps);
+
+	HCONN_add(ps, HCONN_PENDING, ps->t_accept);
+	n_pending++;
+	HSTAT_SET(pending, n_pending);
 	n_conns++;
+	if (n_conns > n_conns_peak)
+		n_conns_peak = n_conns;
+	if (accept_limited(100))
+		accept_pause(0);
+	HSTAT_INC(accepts);
+	HSTAT_SET(conns, n_conns);
+	HSTAT_FE_INC(ps->stats_fe, accepts);
+	HSTAT_FE_INC(ps->stats_fe, conns);
+	HPROBE(accept, ps);
 
 	LOGPROXY(ps, "proxy connect\n");
-	if (CONFIG->PROXY_PROXY_LINE) {
-		ev_io_start(loop, &ps->ev_proxy);
-	} else {
-		/* for client-first handshake */
-		start_handshake(ps, SSL_ERROR_WANT_READ);
-	}
+	ev_io_start(loop, &ps->ev_r_handshake);
+	ev_timer_start(loop, &ps->ev_t_handshake);
 }
 
 
@@ -2736,6 +3972,7 @@ check_ppid(struct ev_loop *loop, ev_timer *w, int revents)
 	struct frontend *fr;
 	struct listen_sock *ls;
 	(void)revents;
+	HLOOP_MARK(NULL);
 	pid_t ppid = getppid();
 	if (ppid != master_pid) {
 		ERR("{core} Process %d detected parent death, "
@@ -2752,6 +3989,18 @@ check_ppid(struct ev_loop *loop, ev_timer *w, int revents)
 	}
 }
 
+/* Publish the CPU time used so far, for the master to scale on */
+static void
+cpu_publish(struct ev_loop *loop, ev_timer *w, int revents)
+{
+
+	(void)loop;
+	(void)w;
+	(void)revents;
+	HLOOP_MARK(NULL);
+	HSTAT_cpu();
+}
+
 static const void *
 Get_Sockaddr(const struct sockaddr *sa, socklen_t *sl)
 {
@@ -2775,51 +4024,684 @@ Get_Sockaddr(const struct sockaddr *sa, socklen_t *sl)
 	return (sa);
 }
 
-static void
-handle_mgt_rd(struct ev_loop *loop, ev_io *w, int revents)
+static void drain_sweep(struct ev_loop *loop, ev_timer *w, int revents);
+
+/* Send a session or a connection to hand over to the master, with
+ * nfd descriptors, waiting for room until the deadline at the latest */
+static int
+worker_handover_send(const void *buf, size_t len, const int *fds, int nfd,
+    double deadline)
 {
-	ssize_t r;
-	struct frontend *fr;
-	struct listen_sock *ls;
-	struct worker_update wu;
+	struct pollfd pfd;
+	int i, ms;
 
-	(void) revents;
-	r = read(w->fd, &wu, sizeof(wu));
-	if (r  == -1) {
-		if (errno == EWOULDBLOCK || errno == EAGAIN)
-			return;
-		LOGL("Error in mgt->worker read operation. "
-		    "Restarting process.");
-		/* If something went wrong here, the process will be
-		 * left in utter limbo as to whether it should keep
-		 * running or not. Kill the process and let the mgt
-		 * process start it back up. */
-		_exit(1);
-	} else if (r == 0) {
-		/* Parent died .. */
-		_exit(1);
+	while (HUPG_send_fds(handoff_fd, buf, len, fds, nfd) != 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			return (-1);
+		pfd.fd = handoff_fd;
+		pfd.events = POLLOUT;
+		ms = (deadline - Time_now()) * 1e3;
+		if (ms <= 0)
+			return (-1);
+		i = poll(&pfd, 1, ms);
+		if (i < 0 && errno == EINTR)
+			continue;
+		if (i <= 0)
+			return (-1);
 	}
+	return (0);
+}
 
-	if (wu.type == WORKER_GEN && wu.payload.gen != worker_gen) {
-		/* This means this process has reached its retirement age. */
-		if (worker_state == WORKER_EXITING)
-			return;
-		worker_state = WORKER_EXITING;
+/* Send the recent sessions still in the cache to the current
+ * generation, through the master. All of them share one deadline, so
+ * that a master slow to take them does not hold up the drain. */
+static void
+worker_sess_export(void)
+{
+	struct worker_handoff wh;
+	struct sess_recent *sr;
+	const sslctx *sc;
+	unsigned char *p;
+	unsigned u, n = 0, mdlen;
+	double deadline;
+	time_t now;
+	int l;
 
-		/* Stop accepting new connections. */
-		VTAILQ_FOREACH(fr, &frontends, list) {
-			CHECK_OBJ_NOTNULL(fr, FRONTEND_MAGIC);
-			VTAILQ_FOREACH(ls, &fr->socks, list) {
-				CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
-				ev_io_stop(loop, &ls->listener);
-				close(ls->sock);
+	now = time(NULL);
+	deadline = Time_now() + WORKER_REPLY_TIMEOUT * 1e-3;
+	for (u = 0; u < SESS_EXPORT_MAX; u++) {
+		sr = &sess_recent[u];
+		if (sr->sess == NULL || SSL_SESSION_get_time(sr->sess) +
+		    SSL_SESSION_get_timeout(sr->sess) <= now)
+			continue;
+		l = i2d_SSL_SESSION(sr->sess, NULL);
+		if (l <= 0 || l > (int)sizeof wh.sess)
+			continue;
+		sc = frontend_sess_ctx(sr->frontend);
+		/* Sessions dropped from the cache are not handed over.
+		 * No remove callback: it would have OpenSSL cache the
+		 * TLSv1.3 sessions too. */
+		if (lh_SSL_SESSION_retrieve(SSL_CTX_sessions(sc->ctx),
+		    sr->sess) != sr->sess)
+			continue;
+		memset(&wh, 0, HANDOFF_HDR_LEN);
+		wh.magic = WORKER_HANDOFF_MAGIC;
+		CHECK_OBJ_NOTNULL(sr->sc, SSLCTX_MAGIC);
+		if (snprintf(wh.frontend, sizeof wh.frontend, "%s",
+		    sr->frontend->pspec) >= (int)sizeof wh.frontend ||
+		    snprintf(wh.cert, sizeof wh.cert, "%s",
+		    sr->sc->filename) >= (int)sizeof wh.cert ||
+		    sr->sc->x509 == NULL ||
+		    !X509_digest(sr->sc->x509, EVP_sha256(), wh.md, &mdlen))
+			continue;
+		p = wh.sess;
+		wh.len = i2d_SSL_SESSION(sr->sess, &p);
+		if (worker_handover_send(&wh, HANDOFF_HDR_LEN + wh.len, NULL,
+		    0, deadline) != 0)
+			break;
+		n++;
+	}
+	HSTAT_ADD(sessions_exported, n);
+	LOG("{core} Worker %d (gen: %d): Exported %u sessions\n", core_id,
+	    worker_gen, n);
+}
+
+/* Take a session of a draining worker into the cache of the frontend,
+ * unless the certificate that served it changed since, or is gone. */
+static void
+worker_sess_import(struct frontend *fr, const struct worker_handoff *wh)
+{
+	unsigned char md[EVP_MAX_MD_SIZE];
+	const unsigned char *p;
+	SSL_SESSION *sess;
+	sslctx *sc;
+	unsigned len;
+
+	HASH_FIND_STR(fr->ssl_ctxs, wh->cert, sc);
+	if (sc == NULL)
+		sc = find_ctx(wh->cert);
+	if (sc == NULL && default_ctx != NULL &&
+	    strcmp(default_ctx->filename, wh->cert) == 0)
+		sc = default_ctx;
+	if (sc == NULL || sc->x509 == NULL ||
+	    !X509_digest(sc->x509, EVP_sha256(), md, &len) ||
+	    memcmp(md, wh->md, len) != 0)
+		return;
+	p = wh->sess;
+	sess = d2i_SSL_SESSION(NULL, &p, wh->len);
+	if (sess == NULL) {
+		ERR_clear_error();
+		return;
+	}
+	/* Sessions are cached by the context a connection starts with */
+	if (SSL_CTX_add_session(frontend_sess_ctx(fr)->ctx, sess)) {
+		HSTAT_INC(sessions_imported);
+		sess_remember(fr, sc, sess);
+	} else
+		SSL_SESSION_free(sess);
+}
+
+static struct frontend *
+frontend_by_pspec(const char *pspec)
+{
+	struct frontend *fr;
+
+	VTAILQ_FOREACH(fr, &frontends, list) {
+		CHECK_OBJ_NOTNULL(fr, FRONTEND_MAGIC);
+		if (strcmp(fr->pspec, pspec) == 0)
+			return (fr);
+	}
+	return (NULL);
+}
+
+#ifdef HAVE_KTLS
+/* Take over a connection migrated by a draining worker, with its
+ * client and backend sockets in fds. Its TLS state is in the kernel,
+ * the client side is read and written with kTLS from now on. Returns
+ * -1 if it could not be. */
+static int
+worker_adopt(struct ev_loop *loop, const struct worker_migrate *wm,
+    size_t len, const int *fds)
+{
+	struct frontend *fr;
+	proxystate *ps;
+	int slots;
+
+	if (len < MIGRATE_HDR_LEN || wm->up_len > MIGRATE_RING_MAX ||
+	    wm->down_len > MIGRATE_RING_MAX ||
+	    len != MIGRATE_HDR_LEN + wm->up_len + wm->down_len ||
+	    worker_state != WORKER_ACTIVE)
+		return (-1);
+	fr = frontend_by_pspec(wm->frontend);
+	if (fr == NULL)
+		return (-1);
+	slots = ring_slots(n_pending);
+	if (slots == 0 || (size_t)slots * (CONFIG->RING_DATA_LEN ?
+	    CONFIG->RING_DATA_LEN : DEF_RING_DATA_LEN) < MIGRATE_RING_MAX)
+		return (-1);
+	ALLOC_OBJ(ps, PROXYSTATE_MAGIC);
+	if (ps == NULL)
+		return (-1);
+
+	ps->backend = backend_ref();
+	ps->fd_up = fds[0];
+	ps->fd_down = fds[1];
+	ps->handshaked = 1;
+	ps->clear_connected = 1;
+	ps->ktls = 1;
+	ps->backend_replied = 1;
+	ps->remote_ip = wm->addr;
+	ps->connect_port = wm->connect_port;
+	ps->frontend = fr;
+	ps->stats_fe = fr->stats_idx;
+	ps->t_accept = wm->t_accept;
+	ps->ssl2clear_bytes = wm->ssl2clear_bytes;
+	ps->clear2ssl_bytes = wm->clear2ssl_bytes;
+	if (CONFIG->FLIGHT_RECORDER > 0)
+		ps->rec = HREC_new();
+	if (CONFIG->CONN_TRACE)
+		ps->trace = HTRACE_new(ps->t_accept);
+
+	ringbuffer_init(&ps->ring_clear2ssl, slots, CONFIG->RING_DATA_LEN);
+	ringbuffer_init(&ps->ring_ssl2clear, slots, CONFIG->RING_DATA_LEN);
+	buf_bytes += ringbuffer_bytes(&ps->ring_clear2ssl) +
+	    ringbuffer_bytes(&ps->ring_ssl2clear);
+	HSTAT_SET(buffer_bytes, buf_bytes);
+	if (wm->up_len > 0) {
+		memcpy(ringbuffer_write_ptr(&ps->ring_ssl2clear), wm->data,
+		    wm->up_len);
+		ringbuffer_write_append(&ps->ring_ssl2clear, wm->up_len);
+	}
+	if (wm->down_len > 0) {
+		memcpy(ringbuffer_write_ptr(&ps->ring_clear2ssl),
+		    wm->data + wm->up_len, wm->down_len);
+		ringbuffer_write_append(&ps->ring_clear2ssl, wm->down_len);
+	}
+
+	proxystate_events(ps);
+	ev_set_cb(&ps->ev_r_ssl, ktls_read);
+	ev_set_cb(&ps->ev_w_ssl, ktls_write);
+
+	HCONN_add(ps, HCONN_ESTABLISHED, ps->t_accept);
+	n_conns++;
+	if (n_conns > n_conns_peak)
+		n_conns_peak = n_conns;
+	HSTAT_INC(conns_adopted);
+	HSTAT_SET(conns, n_conns);
+	HSTAT_FE_INC(ps->stats_fe, conns);
+	HREC(ps, accept, ps->fd_up, 0);
+	LOGPROXY(ps, "proxy taken over with kTLS\n");
+
+	if (!ringbuffer_is_full(&ps->ring_ssl2clear))
+		ev_io_start(loop, &ps->ev_r_ssl);
+	if (!ringbuffer_is_empty(&ps->ring_clear2ssl))
+		ev_io_start(loop, &ps->ev_w_ssl);
+	if (!ringbuffer_is_full(&ps->ring_clear2ssl))
+		ev_io_start(loop, &ps->ev_r_clear);
+	if (!ringbuffer_is_empty(&ps->ring_ssl2clear))
+		ev_io_start(loop, &ps->ev_w_clear);
+	return (0);
+}
+#endif
+
+/* Take the sessions and the connections handed over by a draining
+ * worker */
+static void
+handle_handoff(struct ev_loop *loop, ev_io *w, int revents)
+{
+	static union worker_handover wu;
+	struct frontend *fr;
+	ssize_t l;
+	int fds[2], i, n;
+
+	(void)loop;
+	(void)revents;
+	HLOOP_MARK(NULL);
+	while (n = 2, (l = HUPG_recv_fds(w->fd, &wu, sizeof wu, fds,
+	    &n)) >= 0) {
+		if (l >= (ssize_t)sizeof wu.magic &&
+		    wu.magic == WORKER_MIGRATE_MAGIC && n == 2) {
+			wu.conn.frontend[sizeof wu.conn.frontend - 1] = '\0';
+#ifdef HAVE_KTLS
+			if (worker_adopt(loop, &wu.conn, l, fds) == 0)
+				continue;
+#endif
+			ERR("{core} Worker %d (gen: %d): Unable to take a "
+			    "connection over\n", core_id, worker_gen);
+		}
+		for (i = 0; i < n; i++)
+			(void)close(fds[i]);
+		if (n > 0 || l < (ssize_t)HANDOFF_HDR_LEN ||
+		    wu.magic != WORKER_HANDOFF_MAGIC ||
+		    wu.sess.len > l - HANDOFF_HDR_LEN)
+			continue;
+		wu.sess.frontend[sizeof wu.sess.frontend - 1] = '\0';
+		wu.sess.cert[sizeof wu.sess.cert - 1] = '\0';
+		fr = frontend_by_pspec(wu.sess.frontend);
+		if (fr != NULL)
+			worker_sess_import(fr, &wu.sess);
+	}
+}
+
+#ifdef HAVE_KTLS
+struct worker_migrate_priv {
+	unsigned			magic;
+#define WORKER_MIGRATE_PRIV_MAGIC	0x49a7d1c3
+	struct worker_migrate		wm;
+	double				deadline;
+	int				failed;
+};
+
+/* Migrate a connection to the current generation, through the master,
+ * if all of its TLS state is in the kernel: kTLS both ways, no records
+ * read ahead by OpenSSL or left to write, and few bytes buffered. */
+static void
+worker_migrate_one(void *priv, const struct hconn *hc)
+{
+	struct worker_migrate_priv *mp;
+	size_t up, down;
+	proxystate *ps;
+	int fds[2];
+
+	CAST_OBJ_NOTNULL(mp, priv, WORKER_MIGRATE_PRIV_MAGIC);
+	if (mp->failed || hc->state != HCONN_ESTABLISHED)
+		return;
+	CAST_OBJ_NOTNULL(ps, hc->ps, PROXYSTATE_MAGIC);
+	if (ps->ssl == NULL || !ps->handshaked || ps->want_shutdown ||
+	    ps->renegotiation ||
+	    !BIO_get_ktls_send(SSL_get_wbio(ps->ssl)) ||
+	    !BIO_get_ktls_recv(SSL_get_rbio(ps->ssl)) ||
+	    SSL_has_pending(ps->ssl) || SSL_want_write(ps->ssl))
+		return;
+	up = ringbuffer_peek(&ps->ring_ssl2clear, NULL, 0);
+	down = ringbuffer_peek(&ps->ring_clear2ssl, NULL, 0);
+	if (up > MIGRATE_RING_MAX || down > MIGRATE_RING_MAX)
+		return;
+
+	memset(&mp->wm, 0, MIGRATE_HDR_LEN);
+	mp->wm.magic = WORKER_MIGRATE_MAGIC;
+	if (snprintf(mp->wm.frontend, sizeof mp->wm.frontend, "%s",
+	    ps->frontend->pspec) >= (int)sizeof mp->wm.frontend)
+		return;
+	mp->wm.addr = ps->remote_ip;
+	mp->wm.connect_port = ps->connect_port;
+	mp->wm.t_accept = ps->t_accept;
+	mp->wm.ssl2clear_bytes = ps->ssl2clear_bytes;
+	mp->wm.clear2ssl_bytes = ps->clear2ssl_bytes;
+	mp->wm.up_len = up;
+	mp->wm.down_len = down;
+	(void)ringbuffer_peek(&ps->ring_ssl2clear, (char *)mp->wm.data, up);
+	(void)ringbuffer_peek(&ps->ring_clear2ssl,
+	    (char *)mp->wm.data + up, down);
+	fds[0] = ps->fd_up;
+	fds[1] = ps->fd_down;
+	if (worker_handover_send(&mp->wm, MIGRATE_HDR_LEN + up + down, fds,
+	    2, mp->deadline) != 0) {
+		mp->failed = 1;
+		return;
+	}
+	/* Counted first: migrating the last connection of a draining
+	 * worker ends it. */
+	HSTAT_INC(conns_migrated);
+	LOGPROXY(ps, "proxy migrated with kTLS\n");
+	ps->migrated = 1;
+	shutdown_proxy(ps, SHUTDOWN_HARD);
+}
+
+/* Migrate the established connections with kTLS to the current
+ * generation. All of them share one deadline, like the sessions. */
+static void
+worker_migrate(void)
+{
+	static struct worker_migrate_priv mp;
+
+	if (!CONFIG->KTLS || CONFIG->PMODE != SSL_SERVER || handoff_fd < 0)
+		return;
+	INIT_OBJ(&mp, WORKER_MIGRATE_PRIV_MAGIC);
+	mp.deadline = Time_now() + WORKER_REPLY_TIMEOUT * 1e-3;
+	HCONN_iter(worker_migrate_one, &mp);
+	if (mp.failed)
+		LOG("{core} Worker %d (gen: %d): Keeping %u connections: "
+		    "%s\n", core_id, worker_gen, HCONN_count(),
+		    strerror(errno));
+}
+#endif
+
+/* Stop accepting new connections, and exit once the active ones are
+ * done, or at the latest after drain-timeout. */
+static void
+worker_retire(struct ev_loop *loop)
+{
+	struct frontend *fr;
+	struct listen_sock *ls;
+
+	if (worker_state == WORKER_EXITING)
+		return;
+	worker_state = WORKER_EXITING;
+
+	VTAILQ_FOREACH(fr, &frontends, list) {
+		CHECK_OBJ_NOTNULL(fr, FRONTEND_MAGIC);
+		VTAILQ_FOREACH(ls, &fr->socks, list) {
+			CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+			ev_io_stop(loop, &ls->listener);
+			close(ls->sock);
+		}
+	}
+
+	if (handoff_fd >= 0)
+		worker_sess_export();
+#ifdef HAVE_KTLS
+	worker_migrate();
+#endif
+	check_exit_state();
+
+	LOGL("Worker %d (gen: %d): State %s\n", core_id, worker_gen,
+	    (worker_state == WORKER_EXITING) ? "EXITING" : "ACTIVE");
+
+	drain_t0 = ev_now(loop);
+	HSTAT_drain();
+	if (CONFIG->DRAIN_TIMEOUT > 0) {
+		ev_timer_init(&drain_timer, drain_sweep, 0., 1.0);
+		ev_timer_start(loop, &drain_timer);
+	}
+}
+
+/* Selects connections from the registry, to list or to close them */
+struct worker_conns_priv {
+	unsigned			magic;
+#define WORKER_CONNS_PRIV_MAGIC		0x6e2f90c3
+	const struct hconn_match	*match;
+	struct vsb			*vsb;
+	double				now;
+	unsigned			n;
+	int				kill;
+	uint64_t			*cnt;
+};
+
+static void
+worker_conns_one(void *priv, const struct hconn *hc)
+{
+	struct worker_conns_priv *wp;
+	char sni[256];
+	const char *fe, *s;
+	proxystate *ps;
+
+	CAST_OBJ_NOTNULL(wp, priv, WORKER_CONNS_PRIV_MAGIC);
+	if (!HCONN_match(wp->match, hc, wp->now))
+		return;
+	wp->n++;
+	CAST_OBJ_NOTNULL(ps, hc->ps, PROXYSTATE_MAGIC);
+	if (wp->kill) {
+		/* Counted first: closing the last connection of a
+		 * draining worker ends it. */
+		if (wp->cnt != NULL)
+			(*wp->cnt)++;
+		LOGPROXY(ps, "proxy closed by request\n");
+		shutdown_proxy(ps, SHUTDOWN_HARD);
+		return;
+	}
+	if (wp->vsb == NULL)
+		return;
+
+	fe = "-";
+	if (ps->frontend != NULL) {
+		CHECK_OBJ(ps->frontend, FRONTEND_MAGIC);
+		fe = ps->frontend->pspec;
+	}
+	s = NULL;
+#ifndef OPENSSL_NO_TLSEXT
+	if (ps->ssl != NULL)
+		s = SSL_get_servername(ps->ssl, TLSEXT_NAMETYPE_host_name);
+#endif
+	VSB_printf(wp->vsb, "  fd=%d client=%s frontend=%s state=%s "
+	    "age=%.3f idle=%.3f sni=%s in=%ju out=%ju\n", ps->fd_up,
+	    logproxy_addr(ps), fe, HCONN_state_name(hc->state),
+	    wp->now - hc->t_accept, wp->now - hc->t_active,
+	    access_field(sni, sizeof sni, s, s != NULL ? strlen(s) : 0),
+	    (uintmax_t)ps->ssl2clear_bytes,
+	    (uintmax_t)ps->clear2ssl_bytes);
+}
+
+/* Close the connections in a state for longer than 'age', or idle for
+ * longer than 'idle', and return their number */
+static unsigned
+tmo_sweep(struct ev_loop *loop, int state, double age, double idle)
+{
+	struct worker_conns_priv wp;
+	struct hconn_match m;
+
+	HCONN_match_init(&m);
+	m.state = state;
+	m.min_age = age;
+	m.min_idle = idle;
+
+	INIT_OBJ(&wp, WORKER_CONNS_PRIV_MAGIC);
+	wp.match = &m;
+	wp.now = ev_now(loop);
+	wp.kill = 1;
+	HCONN_iter(worker_conns_one, &wp);
+	return (wp.n);
+}
+
+/* Close the connections of a draining worker idle for longer than
+ * 'idle', all of them for 0, counting them in 'cnt'. */
+static void
+drain_close(struct ev_loop *loop, double idle, uint64_t *cnt)
+{
+	struct worker_conns_priv wp;
+	struct hconn_match m;
+
+	HCONN_match_init(&m);
+	m.min_idle = idle;
+
+	INIT_OBJ(&wp, WORKER_CONNS_PRIV_MAGIC);
+	wp.match = &m;
+	wp.now = ev_now(loop);
+	wp.kill = 1;
+	wp.cnt = cnt;
+	HCONN_iter(worker_conns_one, &wp);
+}
+
+/* Give up on the connections of a draining worker, and exit */
+static void
+worker_expire(struct ev_loop *loop)
+{
+
+	worker_retire(loop);
+	LOGL("Worker %d (gen: %d): Closing %ju connections\n", core_id,
+	    worker_gen, (uintmax_t)n_conns);
+	drain_close(loop, 0., &hstat->drain_expired);
+}
+
+/* Close the idle connections of a draining worker first: the ones idle
+ * for longer than the time left before drain-timeout, which shrinks to
+ * all of them at the deadline. */
+static void
+drain_sweep(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	double left;
+
+	(void)w;
+	(void)revents;
+	HLOOP_MARK(NULL);
+	left = drain_t0 + CONFIG->DRAIN_TIMEOUT - ev_now(loop);
+	if (left > 0)
+		drain_close(loop, left, &hstat->drain_idle_closed);
+	else
+		worker_expire(loop);
+}
+
+/* Close the established connections that sat idle for too long. With
+ * adaptive-timeouts, also report the effective timeouts, and close the
+ * handshakes that outlived a timeout shortened since they started. */
+static void
+idle_sweep(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	double hs, idle;
+
+	(void)w;
+	(void)revents;
+	HLOOP_MARK(NULL);
+	hs = adapt_tmo(CONFIG->SSL_HANDSHAKE_TIMEOUT);
+	idle = adapt_tmo(CONFIG->IDLE_TIMEOUT);
+	if (CONFIG->ADAPTIVE_TIMEOUTS) {
+		HSTAT_SET(handshake_timeout_ms, hs * 1000 + .5);
+		HSTAT_SET(connect_timeout_ms,
+		    adapt_tmo(CONFIG->BACKEND_CONNECT_TIMEOUT) * 1000 + .5);
+		HSTAT_SET(idle_timeout_ms, idle * 1000 + .5);
+	}
+	if (hs < CONFIG->SSL_HANDSHAKE_TIMEOUT)
+		HSTAT_ADD(hs_fail_timeout,
+		    tmo_sweep(loop, HCONN_PENDING, hs, 0.) +
+		    tmo_sweep(loop, HCONN_PROXY, hs, 0.) +
+		    tmo_sweep(loop, HCONN_HANDSHAKE, hs, 0.));
+	if (CONFIG->IDLE_TIMEOUT > 0)
+		HSTAT_ADD(idle_timeouts,
+		    tmo_sweep(loop, HCONN_ESTABLISHED, 0., idle));
+}
+
+#ifdef HAVE_MALLOC_TRIM
+/* Once a burst of connections is over, hand the memory that served it
+ * back to the system. The allocator keeps it resident otherwise. */
+static void
+mem_trim(struct ev_loop *loop, ev_timer *w, int revents)
+{
+
+	(void)loop;
+	(void)w;
+	(void)revents;
+	HLOOP_MARK(NULL);
+	if (n_conns_peak < MEM_TRIM_CONNS || n_conns > n_conns_peak / 2)
+		return;
+	(void)malloc_trim(0);
+	n_conns_peak = n_conns;
+}
+#endif
+
+/* Write what the master takes of the queued answers, and the rest once
+ * it read some */
+static void
+handle_mgt_wr(struct ev_loop *loop, ev_io *w, int revents)
+{
+	size_t len;
+	ssize_t l;
+
+	(void)revents;
+	HLOOP_MARK(NULL);
+	if (mgt_replyq != NULL) {
+		len = VSB_len(mgt_replyq);
+		while (mgt_replyq_off < len) {
+			l = write(w->fd, VSB_data(mgt_replyq) + mgt_replyq_off,
+			    len - mgt_replyq_off);
+			if (l < 0 && errno == EINTR)
+				continue;
+			if (l < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				ev_io_start(loop, w);
+				return;
 			}
+			if (l <= 0) {
+				ERR("{core} Worker %d: Unable to answer the "
+				    "master: %s\n", core_id, strerror(errno));
+				break;
+			}
+			mgt_replyq_off += l;
 		}
+		VSB_delete(mgt_replyq);
+		mgt_replyq = NULL;
+		mgt_replyq_off = 0;
+	}
+	ev_io_stop(loop, w);
+	check_exit_state();
+}
 
-		check_exit_state();
+/* Queue an answer to the master behind the ones not written yet, and
+ * write what the socket takes of it. The event loop never waits for
+ * the master. */
+static void
+worker_reply_queue(const struct worker_reply *wr, const struct vsb *body)
+{
+	struct vsb *q;
+
+	q = VSB_new_auto();
+	AN(q);
+	if (mgt_replyq != NULL) {
+		VSB_bcat(q, VSB_data(mgt_replyq) + mgt_replyq_off,
+		    VSB_len(mgt_replyq) - mgt_replyq_off);
+		VSB_delete(mgt_replyq);
+	}
+	VSB_bcat(q, wr, sizeof *wr);
+	VSB_bcat(q, VSB_data(body), VSB_len(body));
+	AZ(VSB_finish(q));
+	mgt_replyq = q;
+	mgt_replyq_off = 0;
+	handle_mgt_wr(loop, &mgt_wr, EV_WRITE);
+}
+
+/* Answer a connection query of the master. Matching connections are
+ * only closed once the answer is queued, a draining worker that closed
+ * its last one exits once the answer is written. */
+static void
+worker_reply(const struct worker_query *q)
+{
+	struct worker_conns_priv wp;
+	struct worker_reply wr;
+	struct vsb *vsb;
+
+	vsb = VSB_new_auto();
+	AN(vsb);
+	VSB_printf(vsb, "worker %d core %d gen %u: %ju connections%s\n",
+	    (int)getpid(), core_id, worker_gen, (uintmax_t)n_conns,
+	    worker_state == WORKER_EXITING ? " (draining)" : "");
+	INIT_OBJ(&wp, WORKER_CONNS_PRIV_MAGIC);
+	wp.match = &q->match;
+	wp.vsb = vsb;
+	wp.now = ev_now(loop);
+	HCONN_iter(worker_conns_one, &wp);
+	if (q->kill)
+		VSB_printf(vsb, "  closing %u connections\n", wp.n);
+	AZ(VSB_finish(vsb));
+
+	wr.seq = q->seq;
+	wr.len = VSB_len(vsb);
+	worker_reply_queue(&wr, vsb);
+	VSB_delete(vsb);
+
+	if (q->kill) {
+		wp.vsb = NULL;
+		wp.kill = 1;
+		HCONN_iter(worker_conns_one, &wp);
+	}
+}
+
+static void
+handle_mgt_rd(struct ev_loop *loop, ev_io *w, int revents)
+{
+	ssize_t r;
+	struct worker_update wu;
+
+	(void) revents;
+	HLOOP_MARK(NULL);
+	r = read(w->fd, &wu, sizeof(wu));
+	if (r  == -1) {
+		if (errno == EWOULDBLOCK || errno == EAGAIN)
+			return;
+		LOGL("Error in mgt->worker read operation. "
+		    "Restarting process.");
+		/* If something went wrong here, the process will be
+		 * left in utter limbo as to whether it should keep
+		 * running or not. Kill the process and let the mgt
+		 * process start it back up. */
+		HLOG_stop();
+		_exit(1);
+	} else if (r == 0) {
+		/* Parent died .. */
+		HLOG_stop();
+		_exit(1);
+	}
 
-		LOGL("Worker %d (gen: %d): State %s\n", core_id, worker_gen,
-		(worker_state == WORKER_EXITING) ? "EXITING" : "ACTIVE");
+	if (wu.type == WORKER_GEN && wu.payload.gen != worker_gen) {
+		/* This means this process has reached its retirement age. */
+		worker_retire(loop);
 	} else if (wu.type == WORKER_GEN && wu.payload.gen == worker_gen) {
 		return;
 	} else if (wu.type == BACKEND_REFRESH) {
@@ -2828,6 +4710,24 @@ handle_mgt_rd(struct ev_loop *loop, ev_io *w, int revents)
 		backend_deref(&backaddr);
 		backaddr = b;
 		AN(VSA_Sane(backaddr->backaddr));
+	} else if (wu.type == WORKER_DRAIN) {
+		worker_retire(loop);
+	} else if (wu.type == WORKER_LOG_LEVEL) {
+		CONFIG->LOG_LEVEL = wu.payload.level;
+	} else if (wu.type == WORKER_BACKEND_STATE) {
+		backend_down = wu.payload.down;
+	} else if (wu.type == WORKER_CONNS) {
+		worker_reply(&wu.payload.query);
+	} else if (wu.type == WORKER_EXPIRE) {
+		worker_expire(loop);
+	} else if (wu.type == WORKER_SHED) {
+		/* Let the other workers take the new connections for
+		 * a while */
+		if (worker_state == WORKER_ACTIVE) {
+			LOG("{core} Worker %d (gen: %d): Busier than the "
+			    "others, pausing accept\n", core_id, worker_gen);
+			accept_pause(1);
+		}
 	} else
 		WRONG("Invalid worker update state");
 }
@@ -2842,22 +4742,29 @@ handle_clear_accept(struct ev_loop *loop, ev_io *w, int revents)
 	sslctx *so;
 	proxystate *ps;
 	socklen_t sl = sizeof(addr);
+	int slots;
+	HLOOP_MARK(NULL);
 	int client = accept(w->fd, (struct sockaddr *) &addr, &sl);
 	if (client == -1) {
 		switch (errno) {
 		case EMFILE:
+			HSTAT_INC(accept_fail);
 			ERR("{client} accept() failed; "
 			    "too many open files for this process\n");
+			accept_pause(1);
 			break;
 
 		case ENFILE:
+			HSTAT_INC(accept_fail);
 			ERR("{client} accept() failed; "
 			    "too many open files for this system\n");
+			accept_pause(1);
 			break;
 
 		default:
 			if (errno != EINTR && errno != EWOULDBLOCK &&
 			    errno != EAGAIN && errno != ECONNABORTED) {
+				HSTAT_INC(accept_fail);
 				SOCKERR("{client} accept() failed");
 			}
 			break;
@@ -2865,6 +4772,20 @@ handle_clear_accept(struct ev_loop *loop, ev_io *w, int revents)
 		return;
 	}
 
+	if (backend_down) {
+		HSTAT_INC(backend_down_drops);
+		(void)close(client);
+		return;
+	}
+
+	slots = ring_slots(n_pending);
+	if (slots == 0) {
+		HSTAT_INC(overload_drops);
+		(void)close(client);
+		accept_pause(0);
+		return;
+	}
+
 	int flag = 1;
 	int ret = setsockopt(client, IPPROTO_TCP, TCP_NODELAY,
 	    (char *)&flag, sizeof(flag) );
@@ -2893,10 +4814,14 @@ handle_clear_accept(struct ev_loop *loop, ev_io *w, int revents)
 	ps->backend = backend_ref();
 	ps->fd_down = create_back_socket(ps->backend);
 	if (ps->fd_down == -1) {
+		int e = errno;
+
 		backend_deref(&ps->backend);
 		close(client);
 		free(ps);
-		ERR("{backend-socket}: %s\n", strerror(errno));
+		ERR("{backend-socket}: %s\n", strerror(e));
+		if (e == EMFILE || e == ENFILE)
+			accept_pause(1);
 		return;
 	}
 
@@ -2923,10 +4848,19 @@ handle_clear_accept(struct ev_loop *loop, ev_io *w, int revents)
 	ps->handshaked = 0;
 	ps->renegotiation = 0;
 	ps->remote_ip = addr;
-	ringbuffer_init(&ps->ring_clear2ssl, CONFIG->RING_SLOTS,
-	    CONFIG->RING_DATA_LEN);
-	ringbuffer_init(&ps->ring_ssl2clear, CONFIG->RING_SLOTS,
-	    CONFIG->RING_DATA_LEN);
+	ps->frontend = fr;
+	ps->stats_fe = fr->stats_idx;
+	if (CONFIG->FLIGHT_RECORDER > 0)
+		ps->rec = HREC_new();
+	HREC(ps, accept, ps->fd_up, 0);
+	ps->t_accept = ev_time();
+	if (CONFIG->CONN_TRACE)
+		ps->trace = HTRACE_new(ps->t_accept);
+	ringbuffer_init(&ps->ring_clear2ssl, slots, CONFIG->RING_DATA_LEN);
+	ringbuffer_init(&ps->ring_ssl2clear, slots, CONFIG->RING_DATA_LEN);
+	buf_bytes += ringbuffer_bytes(&ps->ring_clear2ssl) +
+	    ringbuffer_bytes(&ps->ring_ssl2clear);
+	HSTAT_SET(buffer_bytes, buf_bytes);
 
 	/* set up events */
 	ev_io_init(&ps->ev_r_clear, clear_read, client, EV_READ);
@@ -2958,12 +4892,45 @@ handle_clear_accept(struct ev_loop *loop, ev_io *w, int revents)
 	/* Link back proxystate to SSL state */
 	SSL_set_app_data(ssl, ps);
 
+	HCONN_add(ps, HCONN_CONNECT, ps->t_accept);
 	n_conns++;
+	if (n_conns > n_conns_peak)
+		n_conns_peak = n_conns;
+	if (accept_limited(100))
+		accept_pause(0);
+	HSTAT_INC(accepts);
+	HSTAT_SET(conns, n_conns);
+	HSTAT_FE_INC(ps->stats_fe, accepts);
+	HSTAT_FE_INC(ps->stats_fe, conns);
+	HPROBE(accept, ps);
 
 	ev_io_start(loop, &ps->ev_r_clear);
 	start_connect(ps); /* start connect */
 }
 
+#if defined(CPU_ZERO) && defined(CPU_SET)
+/* The nth CPU of the ones this process may run on, past the ones the
+ * workers of the configured number of cores are attached to. Returns
+ * -1 if there are not that many. */
+static int
+worker_free_cpu(int n)
+{
+	cpu_set_t cpus;
+	int cpu;
+
+	CPU_ZERO(&cpus);
+	if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0)
+		return (-1);
+	for (cpu = CONFIG->NCORES; cpu < CPU_SETSIZE; cpu++) {
+		if (!CPU_ISSET(cpu, &cpus))
+			continue;
+		if (n-- == 0)
+			return (cpu);
+	}
+	return (-1);
+}
+#endif
+
 /* Set up the child (worker) process including libev event loop, read event
  * on the bound sockets, etc */
 static void
@@ -2980,6 +4947,9 @@ handle_connections(int mgt_fd)
 	/* child cannot create new children... */
 	create_workers = 0;
 
+	/* keep log writes out of the event loop */
+	HLOG_start();
+
 	/* nor can they handle SIGHUP */
 	sa.sa_flags = 0;
 	sa.sa_handler = SIG_IGN;
@@ -2988,24 +4958,63 @@ handle_connections(int mgt_fd)
 
 #if defined(CPU_ZERO) && defined(CPU_SET)
 	cpu_set_t cpus;
+	int cpu = core_id;
 
-	CPU_ZERO(&cpus);
-	CPU_SET(core_id, &cpus);
+	/* Workers started over the number of cores, under load, take one
+	 * of the allowed CPUs the others are not attached to, if any. */
+	if (core_id >= CONFIG->NCORES)
+		cpu = worker_free_cpu(core_id - CONFIG->NCORES);
 
-	int res = sched_setaffinity(0, sizeof(cpus), &cpus);
-	if (!res)
-		LOG("{core} Successfully attached to CPU #%d\n", core_id);
-	else
-		ERR("{core-warning} Unable to attach to CPU #%d; "
-		    "do you have that many cores?\n", core_id);
+	if (cpu < 0) {
+		LOG("{core} No free CPU for process %d, not attaching\n",
+		    core_id);
+	} else {
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+
+		int res = sched_setaffinity(0, sizeof(cpus), &cpus);
+		if (!res)
+			LOG("{core} Successfully attached to CPU #%d\n", cpu);
+		else
+			ERR("{core-warning} Unable to attach to CPU #%d; "
+			    "do you have that many cores?\n", cpu);
+	}
 #endif
 
 	loop = ev_default_loop(EVFLAG_AUTO);
+	HLOOP_init(loop, core_id, CONFIG->STALL_THRESHOLD,
+	    CONFIG->STALL_WATCHDOG);
 
 	ev_timer timer_ppid_check;
 	ev_timer_init(&timer_ppid_check, check_ppid, 1.0, 1.0);
 	ev_timer_start(loop, &timer_ppid_check);
 
+	ev_timer timer_cpu;
+	ev_timer_init(&timer_cpu, cpu_publish, 0., 1.0);
+	ev_timer_start(loop, &timer_cpu);
+
+	ev_timer timer_idle_sweep;
+	if (CONFIG->IDLE_TIMEOUT > 0 || CONFIG->ADAPTIVE_TIMEOUTS) {
+		ev_timer_init(&timer_idle_sweep, idle_sweep, 0., 1.0);
+		ev_timer_start(loop, &timer_idle_sweep);
+	}
+
+#ifdef HAVE_MALLOC_TRIM
+	ev_timer timer_mem_trim;
+	ev_timer_init(&timer_mem_trim, mem_trim, 5.0, 5.0);
+	ev_timer_start(loop, &timer_mem_trim);
+#endif
+
+	ev_timer_init(&accept_retry, handle_accept_retry, ACCEPT_RETRY, 0.);
+	ev_idle_init(&hs_idle, hs_wait);
+	ev_check_init(&hs_check, hs_sched);
+	ev_set_priority(&hs_check, EV_MINPRI);
+	if (CONFIG->HANDSHAKE_BUDGET > 0)
+		ev_check_start(loop, &hs_check);
+	buf_budget = (size_t)CONFIG->MAX_BUFFER_MEMORY * 1024 * 1024 /
+	    workers_max();
+	AZ(HFP_deny_init(CONFIG->FINGERPRINT_DENY));
+
 	VTAILQ_FOREACH(fr, &frontends, list) {
 		VTAILQ_FOREACH(ls, &fr->socks, list) {
 			ev_io_init(&ls->listener,
@@ -3037,9 +5046,17 @@ handle_connections(int mgt_fd)
 	AZ(setnonblocking(mgt_fd));
 	ev_io_init(&mgt_rd, handle_mgt_rd, mgt_fd, EV_READ);
 	ev_io_start(loop, &mgt_rd);
+	ev_io_init(&mgt_wr, handle_mgt_wr, mgt_fd, EV_WRITE);
+
+	if (handoff_fd >= 0) {
+		AZ(setnonblocking(handoff_fd));
+		ev_io_init(&handoff_rd, handle_handoff, handoff_fd, EV_READ);
+		ev_io_start(loop, &handoff_rd);
+	}
 
 	ev_loop(loop, 0);
 	ERR("Worker %d (gen: %d) exiting.\n", core_id, worker_gen);
+	HLOG_stop();
 	_exit(1);
 }
 
@@ -3244,13 +5261,34 @@ init_globals(void)
 		    CONFIG->SYSLOG_FACILITY);
 }
 
+static void mgt_handoff(struct ev_loop *loop, ev_io *w, int revents);
+static void mgt_handoff_close(struct worker_proc *c);
+
+/* A child has no business with the other workers' channels, nor with
+ * the other master of an upgrade */
+static void
+close_worker_channels(void)
+{
+	struct worker_proc *c;
+
+	VTAILQ_FOREACH(c, &worker_procs, list) {
+		(void)close(c->pfd);
+		if (c->hfd >= 0)
+			(void)close(c->hfd);
+	}
+	if (upgrade_fd >= 0)
+		(void)close(upgrade_fd);
+	HSTAT_close_fds();
+	HCTL_close_fds();
+}
+
 /* Forks COUNT children starting with START_INDEX.  We keep a struct
  * child_proc per child so the parent can manage it later. */
 void
 start_workers(int start_index, int count)
 {
 	struct worker_proc *c;
-	int pfd[2];
+	int pfd[2], hfd[2];
 
 	/* don't do anything if we're not allowed to create new workers */
 	if (!create_workers)
@@ -3259,9 +5297,12 @@ start_workers(int start_index, int count)
 	for (core_id = start_index;
 	    core_id < start_index + count; core_id++) {
 		ALLOC_OBJ(c, WORKER_PROC_MAGIC);
-		AZ(pipe(pfd));
+		AZ(socketpair(PF_UNIX, SOCK_STREAM, 0, pfd));
+		AZ(socketpair(PF_UNIX, SOCK_DGRAM, 0, hfd));
 		c->pfd = pfd[1];
+		c->hfd = hfd[1];
 		c->gen = worker_gen;
+		c->slab = HSTAT_slab_alloc(core_id, worker_gen);
 		c->pid = fork();
 		c->core_id = core_id;
 		if (c->pid == -1) {
@@ -3270,6 +5311,10 @@ start_workers(int start_index, int count)
 			exit(1);
 		} else if (c->pid == 0) { /* child */
 			close(pfd[1]);
+			close(hfd[1]);
+			close_worker_channels();
+			handoff_fd = hfd[0];
+			HSTAT_slab_attach(c->slab);
 			FREE_OBJ(c);
 			if (CONFIG->CHROOT && CONFIG->CHROOT[0])
 				change_root();
@@ -3281,6 +5326,13 @@ start_workers(int start_index, int count)
 			exit(0);
 		} else { /* parent. Track new child. */
 			close(pfd[0]);
+			close(hfd[0]);
+			AZ(setnonblocking(c->hfd));
+			ev_io_init(&c->ev_handoff, mgt_handoff, c->hfd,
+			    EV_READ);
+			c->ev_handoff.data = c;
+			ev_io_start(mgt_loop, &c->ev_handoff);
+			HSTAT_slab_pid(c->slab, c->pid);
 			VTAILQ_INSERT_TAIL(&worker_procs, c, list);
 		}
 	}
@@ -3295,6 +5347,7 @@ start_ocsp_proc(void)
 		ERR("{core}: fork() failed: %s: Exiting.\n", strerror(errno));
 		exit(1);
 	} else if (ocsp_proc_pid == 0) {
+		close_worker_channels();
 		if (CONFIG->UID >= 0 || CONFIG->GID >= 0)
 			drop_privileges();
 		if (!verify_privileges())
@@ -3317,8 +5370,12 @@ replace_child_with_pid(pid_t pid)
 	VTAILQ_FOREACH_SAFE(c, &worker_procs, list, cp) {
 		if (c->pid == pid) {
 			VTAILQ_REMOVE(&worker_procs, c, list);
-			/* Only replace if it matches current generation. */
-			if (c->gen == worker_gen)
+			(void)close(c->pfd);
+			mgt_handoff_close(c);
+			HSTAT_slab_free(c->slab);
+			/* Only replace if it matches current generation,
+			 * and was not drained on purpose. */
+			if (c->gen == worker_gen && !c->draining)
 				start_workers(c->core_id, 1);
 			FREE_OBJ(c);
 			return;
@@ -3367,11 +5424,15 @@ do_wait(void)
 	/* also check if the ocsp worker killed itself */
 	if (ocsp_proc_pid != 0)
 		WAIT_PID(ocsp_proc_pid,
-		    if (CONFIG->OCSP_DIR) {
+		    if (CONFIG->OCSP_DIR && !mgt_retired) {
 			    start_ocsp_proc();
 		    } else {
 			    ocsp_proc_pid = 0;
 		    });
+
+	/* and the new master, or its parent if it daemonized */
+	if (upgrade_pid != 0)
+		WAIT_PID(upgrade_pid, upgrade_pid = 0);
 }
 
 static void
@@ -3644,6 +5705,8 @@ cert_fr_query(struct frontend *fr, struct front_arg *fa,
 		sc = make_ctx_fr(cf, fr, fa);
 		if (sc == NULL)
 			return (-1);
+		HASH_FIND_STR(fr->ssl_ctxs, cf->filename, sctmp);
+		sctx_keep_tickets(sc, sctmp);
 		o = make_cfg_obj(CFG_CERT, CFG_TPC_NEW,
 		    sc, fr, cert_rollback, cert_commit);
 		VTAILQ_INSERT_TAIL(cfg_objs, o, list);
@@ -3771,214 +5834,1169 @@ dcert_commit(struct cfg_tpc_obj *o)
 	}
 }
 
-/* Query reload of certificate files */
+/* Query reload of certificate files */
+static int
+cert_query(hitch_config *cfg, struct cfg_tpc_obj_head *cfg_objs)
+{
+	struct cfg_cert_file *cf, *cftmp;
+	sslctx *sc, *sctmp;
+	struct cfg_tpc_obj *o;
+
+	/* NB: The ordering here is significant. It is imperative that
+	 * all DROP objects are inserted before any NEW objects, in
+	 * order to not wreak havoc in cert_commit().  */
+	HASH_ITER(hh, ssl_ctxs, sc, sctmp) {
+		HASH_FIND_STR(cfg->CERT_FILES, sc->filename, cf);
+		if (cf != NULL && cf->mtim <= sc->mtim
+		    && !ocsp_cfg_changed(cf, sc)) {
+			cf->mark = 1;
+		} else {
+			o = make_cfg_obj(CFG_CERT, CFG_TPC_DROP,
+			    sc, NULL, cert_rollback, cert_commit);
+			VTAILQ_INSERT_TAIL(cfg_objs, o, list);
+		}
+	}
+
+	/* handle default cert. Default cert has its own
+	 * rollback/commit functions. */
+	if (cfg->CERT_DEFAULT != NULL) {
+		cf = cfg->CERT_DEFAULT;
+		CHECK_OBJ_NOTNULL(default_ctx, SSLCTX_MAGIC);
+		if (strcmp(default_ctx->filename, cf->filename) != 0
+		    || cf->mtim > default_ctx->mtim
+		    || ocsp_cfg_changed(cf, default_ctx)) {
+			sc = make_ctx(cf);
+			if (sc == NULL)
+				return (-1);
+			if (strcmp(default_ctx->filename, cf->filename) == 0)
+				sctx_keep_tickets(sc, default_ctx);
+			o = make_cfg_obj(CFG_CERT, CFG_TPC_NEW,
+			    sc, NULL, dcert_rollback, dcert_commit);
+			VTAILQ_INSERT_TAIL(cfg_objs, o, list);
+		}
+	}
+
+	HASH_ITER(hh, cfg->CERT_FILES, cf, cftmp) {
+		if (cf->mark)
+			continue;
+		sc = make_ctx(cf);
+		if (sc == NULL)
+			return (-1);
+		HASH_FIND_STR(ssl_ctxs, cf->filename, sctmp);
+		sctx_keep_tickets(sc, sctmp);
+		o = make_cfg_obj(CFG_CERT, CFG_TPC_NEW,
+		    sc, NULL, cert_rollback, cert_commit);
+		VTAILQ_INSERT_TAIL(cfg_objs, o, list);
+	}
+
+	return (0);
+}
+
+static int
+mgt_send(struct worker_proc *c, const struct worker_update *wu)
+{
+	int i;
+
+	CHECK_OBJ_NOTNULL(c, WORKER_PROC_MAGIC);
+	do {
+		i = write(c->pfd, wu, sizeof(*wu));
+	} while (i == -1 && errno == EINTR);
+	return (i == -1 ? -1 : 0);
+}
+
+/* Pass the sessions handed over by a draining worker on to the workers
+ * of the current generation, each of which has its own session cache,
+ * and each connection it migrates to the one with the fewest */
+static void
+mgt_handoff(struct ev_loop *loop, ev_io *w, int revents)
+{
+	static union worker_handover wu;
+	struct worker_proc *c, *c2, *idle;
+	ssize_t l;
+	int fds[2], i, n;
+
+	(void)loop;
+	(void)revents;
+	CAST_OBJ_NOTNULL(c, w->data, WORKER_PROC_MAGIC);
+	while (n = 2, (l = HUPG_recv_fds(c->hfd, &wu, sizeof wu, fds,
+	    &n)) >= 0) {
+		if (n == 0 && l >= (ssize_t)HANDOFF_HDR_LEN) {
+			VTAILQ_FOREACH(c2, &worker_procs, list) {
+				if (c2->gen != worker_gen || c2->draining ||
+				    c2->hfd < 0)
+					continue;
+				(void)HUPG_send_fd(c2->hfd, &wu, l, -1);
+			}
+			continue;
+		}
+		idle = NULL;
+		VTAILQ_FOREACH(c2, &worker_procs, list) {
+			if (c2->gen != worker_gen || c2->draining ||
+			    c2->hfd < 0)
+				continue;
+			if (idle == NULL || HSTAT_slab_conns(c2->slab) <
+			    HSTAT_slab_conns(idle->slab))
+				idle = c2;
+		}
+		if (n != 2 || idle == NULL ||
+		    HUPG_send_fds(idle->hfd, &wu, l, fds, n) != 0)
+			ERR("{core} Unable to migrate a connection of worker "
+			    "%d\n", c->core_id);
+		for (i = 0; i < n; i++)
+			(void)close(fds[i]);
+	}
+}
+
+/* Stop taking sessions over from a worker, once the ones it sent are
+ * passed on */
+static void
+mgt_handoff_close(struct worker_proc *c)
+{
+
+	CHECK_OBJ_NOTNULL(c, WORKER_PROC_MAGIC);
+	if (c->hfd < 0)
+		return;
+	mgt_handoff(mgt_loop, &c->ev_handoff, EV_READ);
+	ev_io_stop(mgt_loop, &c->ev_handoff);
+	(void)close(c->hfd);
+	c->hfd = -1;
+}
+
+static void
+notify_workers(struct worker_update *wu)
+{
+	struct worker_proc *c;
+	VTAILQ_FOREACH(c, &worker_procs, list) {
+		if (wu->type == WORKER_GEN && wu->payload.gen == c->gen)
+			continue;
+		if (wu->type == WORKER_GEN)
+			c->draining = 1;
+		if (mgt_send(c, wu) == 0)
+			continue;
+		if (wu->type == WORKER_GEN)
+			ERR("WARNING: {core} Unable to "
+			"gracefully reload worker %d"
+			" (%s).\n",
+			c->pid, strerror(errno));
+		else
+			ERR("WARNING: {core} Unable to "
+			"notify worker %d (%s).\n",
+			c->pid, strerror(errno));
+		(void)kill(c->pid, SIGTERM);
+	}
+}
+
+/* Number of worker generations still serving connections, and the
+ * oldest of them */
+static unsigned
+mgt_gens(unsigned *oldest)
+{
+	struct worker_proc *c, *c2;
+	unsigned n = 0;
+
+	AN(oldest);
+	*oldest = worker_gen;
+	VTAILQ_FOREACH(c, &worker_procs, list) {
+		CHECK_OBJ_NOTNULL(c, WORKER_PROC_MAGIC);
+		if (c->expired)
+			continue;
+		if (c->gen < *oldest)
+			*oldest = c->gen;
+		/* Only count a generation at its first worker */
+		VTAILQ_FOREACH(c2, &worker_procs, list) {
+			if (c2 == c || (!c2->expired && c2->gen == c->gen))
+				break;
+		}
+		if (c2 == c)
+			n++;
+	}
+	return (n);
+}
+
+/* Make the workers of the oldest generations close their connections
+ * and exit, until no more than max-generations are left. */
+static void
+mgt_gen_cap(void)
+{
+	struct worker_update wu;
+	struct worker_proc *c;
+	unsigned oldest;
+
+	if (CONFIG->MAX_GENERATIONS <= 0)
+		return;
+
+	memset(&wu, 0, sizeof wu);
+	wu.type = WORKER_EXPIRE;
+	while (mgt_gens(&oldest) > (unsigned)CONFIG->MAX_GENERATIONS) {
+		assert(oldest != worker_gen);
+		LOGL("{core} Expiring worker generation %u, over "
+		    "max-generations\n", oldest);
+		VTAILQ_FOREACH(c, &worker_procs, list) {
+			if (c->gen != oldest)
+				continue;
+			c->expired = 1;
+			if (mgt_send(c, &wu) == 0)
+				continue;
+			ERR("WARNING: {core} Unable to "
+			    "notify worker %d (%s).\n",
+			    c->pid, strerror(errno));
+			(void)kill(c->pid, SIGTERM);
+		}
+	}
+}
+
+/* Have a worker finish its connections and exit, without taking new
+ * ones */
+static void
+mgt_drain(struct worker_proc *c)
+{
+	struct worker_update wu;
+
+	CHECK_OBJ_NOTNULL(c, WORKER_PROC_MAGIC);
+	c->draining = 1;
+	memset(&wu, 0, sizeof wu);
+	wu.type = WORKER_DRAIN;
+	if (mgt_send(c, &wu) == 0)
+		return;
+	ERR("WARNING: {core} Unable to drain worker %d (%s).\n",
+	    c->pid, strerror(errno));
+	(void)kill(c->pid, SIGTERM);
+}
+
+/* Workers of the current generation taking connections */
+static unsigned
+mgt_workers(void)
+{
+	struct worker_proc *c;
+	unsigned n = 0;
+
+	VTAILQ_FOREACH(c, &worker_procs, list) {
+		CHECK_OBJ_NOTNULL(c, WORKER_PROC_MAGIC);
+		if (c->gen == worker_gen && !c->draining)
+			n++;
+	}
+	return (n);
+}
+
+/* How busy a worker was since the last sample, from 0 to 1: its share
+ * of a CPU, or how close it is to max-connections when closer. The
+ * first sample of a worker only counts its connections. */
+static double
+mgt_worker_load(struct worker_proc *c, double now)
+{
+	double cpu, conns, load = 0.;
+
+	CHECK_OBJ_NOTNULL(c, WORKER_PROC_MAGIC);
+	cpu = HSTAT_slab_cpu(c->slab);
+	if (c->cpu_t > 0. && now > c->cpu_t)
+		load = (cpu - c->cpu) / (now - c->cpu_t);
+	c->cpu = cpu;
+	c->cpu_t = now;
+	if (CONFIG->MAX_CONNECTIONS > 0) {
+		conns = (double)HSTAT_slab_conns(c->slab) /
+		    CONFIG->MAX_CONNECTIONS;
+		if (conns > load)
+			load = conns;
+	}
+	return (load);
+}
+
+/* Start a worker on the first core free in the current generation */
+static void
+mgt_scale_up(void)
+{
+	struct worker_proc *c;
+	int core;
+
+	for (core = 0; ; core++) {
+		VTAILQ_FOREACH(c, &worker_procs, list) {
+			if (c->gen == worker_gen && !c->draining &&
+			    c->core_id == core)
+				break;
+		}
+		if (c == NULL)
+			break;
+	}
+	LOGL("{core} Starting worker %d (gen: %u), over workers-load\n",
+	    core, worker_gen);
+	start_workers(core, 1);
+	HSTAT_INC(workers_scaled_up);
+}
+
+/* Sample the load of the workers of the current generation. Start or
+ * retire workers to keep it under workers-load, and have a worker
+ * persistently busier than the others stop accepting for a while, for
+ * the new connections to go to the others. */
+static void
+handle_scale(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	static unsigned up, down;
+	struct worker_proc *c, *hot = NULL, *idle = NULL;
+	struct worker_update wu;
+	double now, sum = 0., target;
+	unsigned n = 0;
+
+	(void)w;
+	(void)revents;
+	now = ev_now(loop);
+	target = CONFIG->WORKERS_LOAD / 100.;
+	VTAILQ_FOREACH(c, &worker_procs, list) {
+		CHECK_OBJ_NOTNULL(c, WORKER_PROC_MAGIC);
+		if (c->gen != worker_gen || c->draining)
+			continue;
+		c->load = mgt_worker_load(c, now);
+		sum += c->load;
+		n++;
+		if (hot == NULL || c->load > hot->load)
+			hot = c;
+		if (idle == NULL || HSTAT_slab_conns(c->slab) <
+		    HSTAT_slab_conns(idle->slab))
+			idle = c;
+	}
+	if (n == 0)
+		return;
+
+	VTAILQ_FOREACH(c, &worker_procs, list) {
+		if (c != hot)
+			c->hot = 0;
+	}
+	if (n > 1 && hot->load > target &&
+	    hot->load > SCALE_HOT_RATIO * (sum - hot->load) / (n - 1) &&
+	    ++hot->hot >= SCALE_HOT_SAMPLES) {
+		hot->hot = 0;
+		memset(&wu, 0, sizeof wu);
+		wu.type = WORKER_SHED;
+		if (mgt_send(hot, &wu) == 0) {
+			LOG("{core} Worker %d is busier than the others\n",
+			    hot->pid);
+			HSTAT_INC(worker_rebalances);
+		}
+	}
+
+	up = sum / n > target ? up + 1 : 0;
+	down = n > CONFIG->NCORES && sum / (n - 1) < target / 2 ?
+	    down + 1 : 0;
+	if (up >= SCALE_UP_SAMPLES && n < (unsigned)CONFIG->WORKERS_MAX) {
+		up = 0;
+		mgt_scale_up();
+	} else if (down >= SCALE_DOWN_SAMPLES) {
+		down = 0;
+		LOGL("{core} Retiring worker %d (gen: %u), under "
+		    "workers-load\n", idle->pid, worker_gen);
+		mgt_drain(idle);
+		HSTAT_INC(workers_scaled_down);
+	}
+}
+
+/* Start a new generation of workers, and retire the current one. With
+ * workers-max, the new one starts with as many workers as the current
+ * one runs. */
+static void
+mgt_new_gen(void)
+{
+	struct worker_update wu;
+	long n;
+
+	n = mgt_workers();
+	if (n < CONFIG->NCORES || CONFIG->WORKERS_MAX <= CONFIG->NCORES)
+		n = CONFIG->NCORES;
+	else if (n > CONFIG->WORKERS_MAX)
+		n = CONFIG->WORKERS_MAX;
+
+	worker_gen++;
+	HSTAT_worker_gen(worker_gen);
+	start_workers(0, n);
+
+	wu.type = WORKER_GEN;
+	wu.payload.gen = worker_gen;
+	notify_workers(&wu);
+	mgt_gen_cap();
+
+	if (ocsp_proc_pid > 0) {
+		(void) kill(ocsp_proc_pid, SIGTERM);
+		/*
+		 * Restarting the OCSP process is taken
+		 * care of in do_wait
+		 */
+	} else if (CONFIG->OCSP_DIR != NULL && ocsp_proc_pid <= 0) {
+		start_ocsp_proc();
+	}
+}
+
+static void
+reconfigure(int argc, char **argv)
+{
+	hitch_config *cfg_new;
+	struct cfg_tpc_obj_head cfg_objs;
+	struct cfg_tpc_obj *cto, *cto_tmp;
+	struct timeval tv;
+	double t0, t1;
+	struct frontend *fr;
+
+	if (mgt_retired) {
+		LOGL("Received SIGHUP: Ignored after an upgrade.\n");
+		return;
+	}
+
+	LOGL("Received SIGHUP: Initiating configuration reload.\n");
+	AZ(gettimeofday(&tv, NULL));
+	t0 = tv.tv_sec + 1e-6 * tv.tv_usec;
+
+	VTAILQ_INIT(&cfg_objs);
+	cfg_new = config_new();
+	AN(cfg_new);
+	if (config_parse_cli(argc, argv, cfg_new) != 0) {
+		ERR("Config reload failed: %s\n", config_error_get());
+		config_destroy(cfg_new);
+		return;
+	}
+
+	/* NB: the ordering of the foo_query() calls here is
+	 * significant. */
+	if (frontend_query(cfg_new->LISTEN_ARGS, &cfg_objs) < 0
+	    || cert_query(cfg_new, &cfg_objs) < 0) {
+		VTAILQ_FOREACH_SAFE(cto, &cfg_objs, list, cto_tmp) {
+			VTAILQ_REMOVE(&cfg_objs, cto, list);
+			AN(cto->rollback);
+			cto->rollback(cto);
+			FREE_OBJ(cto);
+		}
+		ERR("{core} Config reload failed.\n");
+		return;
+	} else {
+		VTAILQ_FOREACH_SAFE(cto, &cfg_objs, list, cto_tmp) {
+			VTAILQ_REMOVE(&cfg_objs, cto, list);
+			AN(cto->commit);
+			cto->commit(cto);
+			FREE_OBJ(cto);
+		}
+	}
+
+	/* Rewire default sslctx and rates of each frontend after a
+	 * reload */
+	VTAILQ_FOREACH(fr, &frontends, list) {
+		struct front_arg *fa;
+		struct cfg_cert_file *cf;
+		sslctx *sc;
+
+		HASH_FIND_STR(cfg_new->LISTEN_ARGS, fr->pspec, fa);
+		if (fa != NULL) {
+			fr->hs_rate = fa->handshake_rate;
+			fr->hs_rate_resumed = fa->handshake_rate_resumed;
+		}
+
+		if (HASH_COUNT(fr->ssl_ctxs) == 0) {
+			fr->default_ctx = NULL;
+			continue;
+		}
+
+		AN(fa);
+		cf = fa->certs;
+		CHECK_OBJ_NOTNULL(cf, CFG_CERT_FILE_MAGIC);
+		while (cf->hh.next != NULL)
+			cf = cf->hh.next;
+		HASH_FIND_STR(fr->ssl_ctxs, cf->filename, sc);
+		CHECK_OBJ_NOTNULL(sc, SSLCTX_MAGIC);
+		fr->default_ctx = sc;
+	}
+
+	AZ(gettimeofday(&tv, NULL));
+	t1 = tv.tv_sec + 1e-6 * tv.tv_usec;
+
+	LOGL("{core} Config reloaded in %.2lf seconds. "
+	    "Starting new child processes.\n", t1 - t0);
+
+	config_destroy(CONFIG);
+	CONFIG = cfg_new;
+
+	mgt_new_gen();
+}
+
+static void
+handle_backend_refresh(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	struct worker_update wu;
+	socklen_t len;
+	const void *addr;
+
+	(void)loop;
+	(void)w;
+	(void)revents;
+
+	if (!backaddr_init())
+		return;
+
+	wu.type = BACKEND_REFRESH;
+	addr = VSA_Get_Sockaddr(backaddr->backaddr, &len);
+	AN(addr);
+	memcpy(&(wu.payload.addr), addr, len);
+	notify_workers(&wu);
+}
+
+/* (Re)arm the master's periodic tasks after (re)loading the
+ * configuration */
+static void
+mgt_timers_update(void)
+{
+	double t = CONFIG->BACKEND_REFRESH_TIME;
+
+	ev_timer_stop(mgt_loop, &mgt_backend_refresh);
+	if (t > 0) {
+		ev_timer_set(&mgt_backend_refresh, t, t);
+		ev_timer_start(mgt_loop, &mgt_backend_refresh);
+	}
+
+	ev_timer_stop(mgt_loop, &mgt_scaler);
+	if (CONFIG->WORKERS_MAX > CONFIG->NCORES) {
+		ev_timer_set(&mgt_scaler, SCALE_INTERVAL, SCALE_INTERVAL);
+		ev_timer_start(mgt_loop, &mgt_scaler);
+	}
+}
+
+static void
+mgt_stats_cert(hstat_cert_f *func, void *priv, const sslctx *sc,
+    const char *fe)
+{
+	struct stat st;
+	double not_after = -1., staple = -1.;
+#ifdef HAVE_ASN1_TIME_DIFF
+	int days, secs;
+#endif
+
+	CHECK_OBJ_NOTNULL(sc, SSLCTX_MAGIC);
+#ifdef HAVE_ASN1_TIME_DIFF
+	if (sc->x509 != NULL && ASN1_TIME_diff(&days, &secs, NULL,
+	    X509_get_notAfter(sc->x509)))
+		not_after = Time_now() + days * 86400. + secs;
+#endif
+	if (sc->staple_fn != NULL && stat(sc->staple_fn, &st) == 0)
+		staple = st.st_mtime;
+	func(priv, sc->filename, fe, not_after, staple);
+}
+
+/* Certificates for the stats report */
+static void
+mgt_stats_certs(hstat_cert_f *func, void *priv)
+{
+	struct frontend *fr;
+	sslctx *sc, *sctmp;
+
+	if (default_ctx != NULL && find_ctx(default_ctx->filename) == NULL)
+		mgt_stats_cert(func, priv, default_ctx, NULL);
+	HASH_ITER(hh, ssl_ctxs, sc, sctmp)
+		mgt_stats_cert(func, priv, sc, NULL);
+	VTAILQ_FOREACH(fr, &frontends, list) {
+		CHECK_OBJ_NOTNULL(fr, FRONTEND_MAGIC);
+		HASH_ITER(hh, fr->ssl_ctxs, sc, sctmp)
+			mgt_stats_cert(func, priv, sc, fr->pspec);
+	}
+}
+
+/* Read exactly len bytes of a worker's answer, before the deadline */
+static int
+mgt_read(int fd, void *buf, size_t len, double deadline)
+{
+	struct pollfd pfd;
+	char *p = buf;
+	ssize_t l;
+	int i, ms;
+
+	while (len > 0) {
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		ms = (deadline - Time_now()) * 1e3;
+		if (ms < 0)
+			ms = 0;
+		i = poll(&pfd, 1, ms);
+		if (i < 0 && errno == EINTR)
+			continue;
+		if (i <= 0)
+			return (-1);
+		l = read(fd, p, len);
+		if (l < 0 && errno == EINTR)
+			continue;
+		if (l <= 0)
+			return (-1);
+		p += l;
+		len -= l;
+	}
+	return (0);
+}
+
+/* Read a worker's answer to the connections query seq, sent along with
+ * the ones to the other workers. Late answers to earlier queries that
+ * timed out are skipped. */
+static int
+mgt_worker_conns(struct worker_proc *c, unsigned seq, double deadline,
+    struct vsb *vsb)
+{
+	struct worker_reply wr;
+	char buf[4096];
+	size_t l;
+
+	CHECK_OBJ_NOTNULL(c, WORKER_PROC_MAGIC);
+	if (c->conns_seq != seq)
+		return (-1);
+
+	do {
+		if (mgt_read(c->pfd, &wr, sizeof wr, deadline) != 0)
+			return (-1);
+		while (wr.len > 0) {
+			l = wr.len < sizeof buf ? wr.len : sizeof buf;
+			if (mgt_read(c->pfd, buf, l, deadline) != 0)
+				return (-1);
+			if (wr.seq == seq)
+				VSB_bcat(vsb, buf, l);
+			wr.len -= l;
+		}
+	} while (wr.seq != seq);
+	return (0);
+}
+
+static struct worker_proc *
+mgt_find_worker(const char *arg)
+{
+	struct worker_proc *c;
+	char *end;
+	long pid;
+
+	pid = strtol(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || pid <= 0)
+		return (NULL);
+	VTAILQ_FOREACH(c, &worker_procs, list)
+		if (c->pid == pid)
+			return (c);
+	return (NULL);
+}
+
+static int
+mgt_ctl_workers(struct vsb *vsb)
+{
+	struct worker_proc *c;
+
+	VSB_printf(vsb, "%-8s %-5s %-5s %-9s %s\n",
+	    "pid", "core", "gen", "state", "conns");
+	VTAILQ_FOREACH(c, &worker_procs, list) {
+		CHECK_OBJ_NOTNULL(c, WORKER_PROC_MAGIC);
+		VSB_printf(vsb, "%-8d %-5d %-5u %-9s %ju\n", (int)c->pid,
+		    c->core_id, c->gen, c->draining ? "draining" : "active",
+		    (uintmax_t)HSTAT_slab_conns(c->slab));
+	}
+	return (HCTL_OK);
+}
+
+static int
+mgt_ctl_log_level(struct vsb *vsb, int argc, char * const *argv)
+{
+	struct worker_update wu;
+	char *end;
+	long l;
+
+	if (argc > 1) {
+		l = strtol(argv[1], &end, 10);
+		if (*end != '\0' || l < 0 || l > 3) {
+			VSB_printf(vsb, "Invalid log level: %s\n", argv[1]);
+			return (HCTL_BAD_REQUEST);
+		}
+		CONFIG->LOG_LEVEL = l;
+		memset(&wu, 0, sizeof wu);
+		wu.type = WORKER_LOG_LEVEL;
+		wu.payload.level = l;
+		notify_workers(&wu);
+		LOGL("{core} Log level changed to %ld\n", l);
+	}
+	VSB_printf(vsb, "log-level %d\n", CONFIG->LOG_LEVEL);
+	return (HCTL_OK);
+}
+
+static int
+mgt_ctl_drain(struct vsb *vsb, int argc, char * const *argv)
+{
+	struct worker_proc *c;
+
+	if (argc != 2) {
+		VSB_cat(vsb, "Usage: drain PID\n");
+		return (HCTL_BAD_REQUEST);
+	}
+	c = mgt_find_worker(argv[1]);
+	if (c == NULL) {
+		VSB_printf(vsb, "No worker with pid %s\n", argv[1]);
+		return (HCTL_NOT_FOUND);
+	}
+	if (c->draining) {
+		VSB_printf(vsb, "Worker %d is already draining\n",
+		    (int)c->pid);
+		return (HCTL_BAD_REQUEST);
+	}
+
+	if (c->gen == worker_gen)
+		start_workers(c->core_id, 1);
+	mgt_drain(c);
+	LOGL("{core} Draining worker %d\n", (int)c->pid);
+	VSB_printf(vsb, "Draining worker %d\n", (int)c->pid);
+	return (HCTL_OK);
+}
+
 static int
-cert_query(hitch_config *cfg, struct cfg_tpc_obj_head *cfg_objs)
+mgt_ctl_backend(struct vsb *vsb, int argc, char * const *argv)
 {
-	struct cfg_cert_file *cf, *cftmp;
-	sslctx *sc, *sctmp;
-	struct cfg_tpc_obj *o;
+	struct worker_update wu;
 
-	/* NB: The ordering here is significant. It is imperative that
-	 * all DROP objects are inserted before any NEW objects, in
-	 * order to not wreak havoc in cert_commit().  */
-	HASH_ITER(hh, ssl_ctxs, sc, sctmp) {
-		HASH_FIND_STR(cfg->CERT_FILES, sc->filename, cf);
-		if (cf != NULL && cf->mtim <= sc->mtim
-		    && !ocsp_cfg_changed(cf, sc)) {
-			cf->mark = 1;
-		} else {
-			o = make_cfg_obj(CFG_CERT, CFG_TPC_DROP,
-			    sc, NULL, cert_rollback, cert_commit);
-			VTAILQ_INSERT_TAIL(cfg_objs, o, list);
+	if (argc > 1) {
+		if (strcmp(argv[1], "up") == 0)
+			backend_down = 0;
+		else if (strcmp(argv[1], "down") == 0)
+			backend_down = 1;
+		else {
+			VSB_cat(vsb, "Usage: backend [up|down]\n");
+			return (HCTL_BAD_REQUEST);
 		}
-	}
+		memset(&wu, 0, sizeof wu);
+		wu.type = WORKER_BACKEND_STATE;
+		wu.payload.down = backend_down;
+		notify_workers(&wu);
+		LOGL("{core} Backend marked %s\n", argv[1]);
+	}
+	VSB_printf(vsb, "backend %s\n", backend_down ? "down" : "up");
+	return (HCTL_OK);
+}
 
-	/* handle default cert. Default cert has its own
-	 * rollback/commit functions. */
-	if (cfg->CERT_DEFAULT != NULL) {
-		cf = cfg->CERT_DEFAULT;
-		CHECK_OBJ_NOTNULL(default_ctx, SSLCTX_MAGIC);
-		if (strcmp(default_ctx->filename, cf->filename) != 0
-		    || cf->mtim > default_ctx->mtim
-		    || ocsp_cfg_changed(cf, default_ctx)) {
-			sc = make_ctx(cf);
-			if (sc == NULL)
-				return (-1);
-			o = make_cfg_obj(CFG_CERT, CFG_TPC_NEW,
-			    sc, NULL, dcert_rollback, dcert_commit);
-			VTAILQ_INSERT_TAIL(cfg_objs, o, list);
+/* conns [PID] [FILTER...] and kill [PID] FILTER... */
+static int
+mgt_ctl_conns(struct vsb *vsb, int argc, char * const *argv, int kill)
+{
+	static unsigned seq;
+	struct worker_proc *c, *w = NULL;
+	struct worker_update wu;
+	struct hconn_match m;
+	double deadline;
+
+	if (argc > 1 && strchr(argv[1], '=') == NULL) {
+		w = mgt_find_worker(argv[1]);
+		if (w == NULL) {
+			VSB_printf(vsb, "No worker with pid %s\n", argv[1]);
+			return (HCTL_NOT_FOUND);
 		}
+		argc--;
+		argv++;
+	}
+	if (kill && argc < 2) {
+		VSB_cat(vsb, "Usage: kill [PID] FILTER...\n");
+		return (HCTL_BAD_REQUEST);
+	}
+	if (HCONN_match_parse(&m, argc - 1, argv + 1, vsb) != 0)
+		return (HCTL_BAD_REQUEST);
+
+	/* Ask all the workers first, for them to answer at once */
+	memset(&wu, 0, sizeof wu);
+	wu.type = WORKER_CONNS;
+	wu.payload.query.seq = ++seq;
+	wu.payload.query.kill = kill;
+	wu.payload.query.match = m;
+	VTAILQ_FOREACH(c, &worker_procs, list) {
+		if (w != NULL && c != w)
+			continue;
+		if (mgt_send(c, &wu) == 0)
+			c->conns_seq = seq;
 	}
 
-	HASH_ITER(hh, cfg->CERT_FILES, cf, cftmp) {
-		if (cf->mark)
+	deadline = Time_now() + WORKER_REPLY_TIMEOUT * 1e-3;
+	VTAILQ_FOREACH(c, &worker_procs, list) {
+		if (w != NULL && c != w)
 			continue;
+		if (mgt_worker_conns(c, seq, deadline, vsb) != 0)
+			VSB_printf(vsb, "worker %d did not answer\n",
+			    (int)c->pid);
+	}
+	return (HCTL_OK);
+}
+
+/* Certificates added or removed here only live until the next
+ * reload, which goes back to the configuration. */
+static int
+mgt_ctl_cert(struct vsb *vsb, int argc, char * const *argv)
+{
+	struct cfg_cert_file *cf;
+	sslctx *sc;
+
+	if (argc != 3 || (strcmp(argv[1], "add") != 0 &&
+	    strcmp(argv[1], "remove") != 0)) {
+		VSB_cat(vsb, "Usage: cert add|remove FILE\n");
+		return (HCTL_BAD_REQUEST);
+	}
+
+	if (strcmp(argv[1], "remove") == 0) {
+		sc = find_ctx(argv[2]);
+		if (sc == NULL) {
+			VSB_printf(vsb, "Certificate %s is not loaded\n",
+			    argv[2]);
+			return (HCTL_NOT_FOUND);
+		}
+		HASH_DEL(ssl_ctxs, sc);
+		sctx_free(sc, &sni_names);
+		LOGL("{core} Removed certificate %s\n", argv[2]);
+	} else {
+		if (find_ctx(argv[2]) != NULL || (default_ctx != NULL &&
+		    strcmp(default_ctx->filename, argv[2]) == 0)) {
+			VSB_printf(vsb, "Certificate %s is already loaded\n",
+			    argv[2]);
+			return (HCTL_BAD_REQUEST);
+		}
+		cf = cfg_cert_file_new();
+		cf->filename = strdup(argv[2]);
+		AN(cf->filename);
+		if (!cfg_cert_vfy(cf)) {
+			VSB_printf(vsb, "%s\n", config_error_get());
+			cfg_cert_file_free(&cf);
+			return (HCTL_FAILED);
+		}
 		sc = make_ctx(cf);
-		if (sc == NULL)
-			return (-1);
-		o = make_cfg_obj(CFG_CERT, CFG_TPC_NEW,
-		    sc, NULL, cert_rollback, cert_commit);
-		VTAILQ_INSERT_TAIL(cfg_objs, o, list);
+		cfg_cert_file_free(&cf);
+		if (sc == NULL) {
+			VSB_printf(vsb, "Unable to load certificate %s\n",
+			    argv[2]);
+			return (HCTL_FAILED);
+		}
+		HASH_ADD_KEYPTR(hh, ssl_ctxs, sc->filename,
+		    strlen(sc->filename), sc);
+#ifndef OPENSSL_NO_TLSEXT
+		insert_sni_names(sc, &sni_names);
+#endif
+		LOGL("{core} Added certificate %s\n", argv[2]);
 	}
 
-	return (0);
+	mgt_new_gen();
+	VSB_printf(vsb, "Started worker generation %u\n", worker_gen);
+	return (HCTL_OK);
 }
 
+/* Leave the listen sockets, the pid file and the stats and control
+ * sockets to the new master, and drain the workers like after a
+ * reload. The master exits once they are gone. */
 static void
-notify_workers(struct worker_update *wu)
+mgt_retire(void)
 {
 	struct worker_proc *c;
-	int i;
-	VTAILQ_FOREACH(c, &worker_procs, list) {
-		if ((wu->type == WORKER_GEN && wu->payload.gen != c->gen) ||
-		     (wu->type == BACKEND_REFRESH)) {
-			errno = 0;
-			do {
-				i = write(c->pfd, (void*)wu, sizeof(*wu));
-				if (i == -1 && errno != EINTR) {
-					if (wu->type == WORKER_GEN)
-						ERR("WARNING: {core} Unable to "
-						"gracefully reload worker %d"
-						" (%s).\n",
-						c->pid, strerror(errno));
-					else
-						ERR("WARNING: {core} Unable to "
-						"notify worker %d "
-						"with changed backend address (%s).\n",
-						c->pid, strerror(errno));
-
-					(void)kill(c->pid, SIGTERM);
-					break;
-				}
-			} while (i == -1 && errno == EINTR);
-
-			if (wu->type == WORKER_GEN)
-				(void)close(c->pfd);
+	struct worker_update wu;
+	struct frontend *fr;
+	struct listen_sock *ls;
 
+	mgt_retired = 1;
+	create_workers = 0;
+	VTAILQ_FOREACH(fr, &frontends, list) {
+		CHECK_OBJ_NOTNULL(fr, FRONTEND_MAGIC);
+		VTAILQ_FOREACH(ls, &fr->socks, list) {
+			CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+			(void)close(ls->sock);
+			ls->sock = -1;
 		}
 	}
+	HSTAT_stop();
+	HCTL_stop();
+	if (pfh != NULL) {
+		(void)VPF_Close(pfh);
+		pfh = NULL;
+	}
+	ev_timer_stop(mgt_loop, &mgt_backend_refresh);
+#ifdef USE_SHARED_CACHE
+	if (CONFIG->SHCUPD_PORT) {
+		ev_io_stop(mgt_loop, &shcupd_listener);
+		(void)close(shcupd_socket);
+	}
+#endif /* USE_SHARED_CACHE */
+	if (ocsp_proc_pid > 0)
+		(void)kill(ocsp_proc_pid, SIGTERM);
+
+	/* The new master has the current generation, the workers keep
+	 * their pending connections. */
+	VTAILQ_FOREACH(c, &worker_procs, list)
+		mgt_handoff_close(c);
+
+	worker_gen++;
+	memset(&wu, 0, sizeof wu);
+	wu.type = WORKER_GEN;
+	wu.payload.gen = worker_gen;
+	notify_workers(&wu);
 }
 
 static void
-reconfigure(int argc, char **argv)
+mgt_upgrade_close(void)
 {
-	hitch_config *cfg_new;
-	struct cfg_tpc_obj_head cfg_objs;
-	struct cfg_tpc_obj *cto, *cto_tmp;
-	struct timeval tv;
-	double t0, t1;
-	struct worker_update wu;
-	struct frontend *fr;
 
-	LOGL("Received SIGHUP: Initiating configuration reload.\n");
-	AZ(gettimeofday(&tv, NULL));
-	t0 = tv.tv_sec + 1e-6 * tv.tv_usec;
+	ev_io_stop(mgt_loop, &upgrade_watcher);
+	(void)close(upgrade_fd);
+	upgrade_fd = -1;
+}
 
-	VTAILQ_INIT(&cfg_objs);
-	cfg_new = config_new();
-	AN(cfg_new);
-	if (config_parse_cli(argc, argv, cfg_new) != 0) {
-		ERR("Config reload failed: %s\n", config_error_get());
-		config_destroy(cfg_new);
+/* The new master is ready once its workers are started */
+static void
+mgt_upgrade_cb(struct ev_loop *loop, ev_io *w, int revents)
+{
+	ssize_t l;
+	char c = 0;
+
+	(void)loop;
+	(void)revents;
+	do {
+		l = read(w->fd, &c, 1);
+	} while (l < 0 && errno == EINTR);
+
+	if (l != 1 || c != HUPG_READY) {
+		ERR("{core} The new master failed to start, "
+		    "carrying on.\n");
+		mgt_upgrade_close();
 		return;
 	}
 
-	/* NB: the ordering of the foo_query() calls here is
-	 * significant. */
-	if (frontend_query(cfg_new->LISTEN_ARGS, &cfg_objs) < 0
-	    || cert_query(cfg_new, &cfg_objs) < 0) {
-		VTAILQ_FOREACH_SAFE(cto, &cfg_objs, list, cto_tmp) {
-			VTAILQ_REMOVE(&cfg_objs, cto, list);
-			AN(cto->rollback);
-			cto->rollback(cto);
-			FREE_OBJ(cto);
-		}
-		ERR("{core} Config reload failed.\n");
-		return;
-	} else {
-		VTAILQ_FOREACH_SAFE(cto, &cfg_objs, list, cto_tmp) {
-			VTAILQ_REMOVE(&cfg_objs, cto, list);
-			AN(cto->commit);
-			cto->commit(cto);
-			FREE_OBJ(cto);
-		}
+	LOGL("{core} Handing over to the new master, "
+	    "draining the workers.\n");
+	mgt_retire();
+	c = HUPG_ACK;
+	if (write(upgrade_fd, &c, 1) != 1)
+		ERR("{core} Unable to hand over to the new master: %s\n",
+		    strerror(errno));
+	mgt_upgrade_close();
+}
+
+/* Execute the binary again, and send it the listen sockets and the
+ * shared session cache. */
+static int
+mgt_ctl_upgrade(struct vsb *vsb)
+{
+	struct frontend *fr;
+	struct listen_sock *ls;
+	char buf[16];
+	int sv[2];
+#ifdef USE_SHARED_CACHE
+	void *addr;
+	size_t len;
+	int fd;
+#endif
+
+	if (upgrade_fd >= 0 || mgt_retired) {
+		VSB_cat(vsb, "An upgrade is already in progress\n");
+		return (HCTL_BAD_REQUEST);
+	}
+	if (socketpair(PF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		VSB_printf(vsb, "Unable to create a socket pair: %s\n",
+		    strerror(errno));
+		return (HCTL_FAILED);
 	}
 
-	/* Rewire default sslctx for each frontend after a reload */
-	VTAILQ_FOREACH(fr, &frontends, list) {
-		struct front_arg *fa;
-		struct cfg_cert_file *cf;
-		sslctx *sc;
+	upgrade_pid = fork();
+	if (upgrade_pid < 0) {
+		VSB_printf(vsb, "Unable to fork: %s\n", strerror(errno));
+		upgrade_pid = 0;
+		(void)close(sv[0]);
+		(void)close(sv[1]);
+		return (HCTL_FAILED);
+	}
+	if (upgrade_pid == 0) {
+		/* Only stdio and the socket pair go to the new master */
+		HUPG_close_fds(sv[1]);
+		if (mgt_cwd != NULL)
+			(void)chdir(mgt_cwd);
+		(void)snprintf(buf, sizeof buf, "%d", sv[1]);
+		AZ(setenv(HUPG_ENV, buf, 1));
+		(void)execvp(mgt_exe, mgt_argv);
+		_exit(127);
+	}
 
-		if (HASH_COUNT(fr->ssl_ctxs) == 0) {
-			fr->default_ctx = NULL;
-			continue;
+	(void)close(sv[1]);
+	upgrade_fd = sv[0];
+	ev_io_init(&upgrade_watcher, mgt_upgrade_cb, upgrade_fd, EV_READ);
+	ev_io_start(mgt_loop, &upgrade_watcher);
+
+	VTAILQ_FOREACH(fr, &frontends, list) {
+		CHECK_OBJ_NOTNULL(fr, FRONTEND_MAGIC);
+		VTAILQ_FOREACH(ls, &fr->socks, list) {
+			CHECK_OBJ_NOTNULL(ls, LISTEN_SOCK_MAGIC);
+			if (HUPG_send(upgrade_fd, HUPG_LISTEN, ls->sock,
+			    NULL, 0) != 0)
+				goto send_err;
 		}
+	}
+#ifdef USE_SHARED_CACHE
+	fd = shared_context_fd(&addr, &len);
+	if (fd >= 0 &&
+	    HUPG_send(upgrade_fd, HUPG_SHCTX, fd, addr, len) != 0)
+		goto send_err;
+#endif
+	if (HUPG_send(upgrade_fd, HUPG_END, -1, NULL, 0) != 0)
+		goto send_err;
+
+	LOGL("{core} Upgrading, started new master %d\n", (int)upgrade_pid);
+	VSB_printf(vsb, "Started new master %d\n", (int)upgrade_pid);
+	return (HCTL_OK);
+
+send_err:
+	VSB_printf(vsb, "Unable to send the sockets to the new master: %s\n",
+	    strerror(errno));
+	mgt_upgrade_close();
+	return (HCTL_FAILED);
+}
 
-		HASH_FIND_STR(cfg_new->LISTEN_ARGS, fr->pspec, fa);
-		AN(fa);
-		cf = fa->certs;
-		CHECK_OBJ_NOTNULL(cf, CFG_CERT_FILE_MAGIC);
-		while (cf->hh.next != NULL)
-			cf = cf->hh.next;
-		HASH_FIND_STR(fr->ssl_ctxs, cf->filename, sc);
-		CHECK_OBJ_NOTNULL(sc, SSLCTX_MAGIC);
-		fr->default_ctx = sc;
+/* Receive the listen sockets and the shared session cache of the
+ * master being upgraded. */
+static int
+mgt_upgrade_recv(const char *arg)
+{
+	struct hupg_msg msg;
+	char *end;
+	long l;
+	int fd;
+
+	l = strtol(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || l <= STDERR_FILENO ||
+	    l > INT_MAX) {
+		ERR("{core} Invalid %s: %s\n", HUPG_ENV, arg);
+		return (-1);
 	}
+	upgrade_fd = l;
 
-	AZ(gettimeofday(&tv, NULL));
-	t1 = tv.tv_sec + 1e-6 * tv.tv_usec;
+	do {
+		if (HUPG_recv(upgrade_fd, &msg, &fd) != 0) {
+			ERR("{core} Unable to receive the sockets of the "
+			    "old master: %s\n", strerror(errno));
+			return (-1);
+		}
+		switch (msg.type) {
+		case HUPG_LISTEN:
+			if (fd >= 0)
+				(void)HUPG_inherit(fd);
+			break;
+		case HUPG_SHCTX:
+#ifdef USE_SHARED_CACHE
+			if (fd >= 0 && shared_context_attach(fd,
+			    (void *)msg.addr, msg.len,
+			    CONFIG->SHARED_CACHE) == 0) {
+				LOGL("{core} Took over the shared session "
+				    "cache\n");
+				break;
+			}
+			LOG("{core} Unable to take over the shared session "
+			    "cache\n");
+#endif
+			if (fd >= 0)
+				(void)close(fd);
+			break;
+		case HUPG_END:
+			break;
+		default:
+			if (fd >= 0)
+				(void)close(fd);
+			ERR("{core} Unexpected message %d from the old "
+			    "master\n", (int)msg.type);
+			return (-1);
+		}
+	} while (msg.type != HUPG_END);
+	return (0);
+}
 
-	LOGL("{core} Config reloaded in %.2lf seconds. "
-	    "Starting new child processes.\n", t1 - t0);
+/* Tell the old master that the workers are started, and wait for it to
+ * let go of its pid file and its stats and control sockets. */
+static void
+mgt_upgrade_ready(void)
+{
+	char c = HUPG_READY;
 
-	config_destroy(CONFIG);
-	CONFIG = cfg_new;
+	if (write(upgrade_fd, &c, 1) != 1 ||
+	    mgt_read(upgrade_fd, &c, 1,
+	    Time_now() + WORKER_REPLY_TIMEOUT * 1e-3) != 0 || c != HUPG_ACK)
+		ERR("WARNING: {core} No answer from the old master, "
+		    "taking over anyway.\n");
+	else
+		LOGL("{core} Took over from the old master\n");
+	(void)close(upgrade_fd);
+	upgrade_fd = -1;
+}
 
-	worker_gen++;
-	start_workers(0, CONFIG->NCORES);
+static int
+mgt_control(struct vsb *vsb, int argc, char * const *argv)
+{
+	const char *cmd = argv[0];
+
+	if (strcmp(cmd, "help") == 0) {
+		VSB_cat(vsb,
+		    "help               This text\n"
+		    "stats              Runtime statistics\n"
+		    "workers            List the worker processes\n"
+		    "log-level [NUM]    Show or change the log level\n"
+		    "drain PID          Retire a worker, starting a "
+		    "replacement\n"
+		    "backend [up|down]  Show or change the backend state\n"
+		    "conns [PID] [FILTER...]\n"
+		    "                   List the connections of the "
+		    "workers\n"
+		    "kill [PID] FILTER...\n"
+		    "                   Close the matching connections\n"
+		    "cert add FILE      Load a certificate\n"
+		    "cert remove FILE   Unload a certificate\n"
+		    "upgrade            Hand over to a new master, running "
+		    "the binary\n"
+		    "                   found on disk\n"
+		    "\n"
+		    "Filters: state=NAME age=SECS idle=SECS fd=NUM "
+		    "sni=NAME client=ADDR\n");
+		return (HCTL_OK);
+	}
+	if (strcmp(cmd, "stats") == 0) {
+		HSTAT_report(vsb);
+		return (HCTL_OK);
+	}
+	if (strcmp(cmd, "workers") == 0)
+		return (mgt_ctl_workers(vsb));
+	if (strcmp(cmd, "log-level") == 0)
+		return (mgt_ctl_log_level(vsb, argc, argv));
+	if (strcmp(cmd, "drain") == 0)
+		return (mgt_ctl_drain(vsb, argc, argv));
+	if (strcmp(cmd, "backend") == 0)
+		return (mgt_ctl_backend(vsb, argc, argv));
+	if (strcmp(cmd, "conns") == 0)
+		return (mgt_ctl_conns(vsb, argc, argv, 0));
+	if (strcmp(cmd, "kill") == 0)
+		return (mgt_ctl_conns(vsb, argc, argv, 1));
+	if (strcmp(cmd, "cert") == 0)
+		return (mgt_ctl_cert(vsb, argc, argv));
+	if (strcmp(cmd, "upgrade") == 0)
+		return (mgt_ctl_upgrade(vsb));
+
+	VSB_printf(vsb, "Unknown command: %s\n", cmd);
+	return (HCTL_BAD_REQUEST);
+}
 
-	wu.type = WORKER_GEN;
-	wu.payload.gen = worker_gen;
-	notify_workers(&wu);
+/* Bind the stats, admin and control sockets */
+static int
+mgt_admin_listen(void)
+{
 
-	if (ocsp_proc_pid > 0) {
-		(void) kill(ocsp_proc_pid, SIGTERM);
-		/*
-		 * Restarting the OCSP process is taken
-		 * care of in do_wait
-		 */
-	} else if (CONFIG->OCSP_DIR != NULL && ocsp_proc_pid <= 0) {
-		start_ocsp_proc();
-	}
+	if (CONFIG->STATS_SOCKET != NULL &&
+	    HSTAT_listen(CONFIG->STATS_SOCKET) != 0)
+		return (-1);
+	if (CONFIG->ADMIN_PORT != NULL &&
+	    HSTAT_listen_tcp(CONFIG->ADMIN_IP, CONFIG->ADMIN_PORT) != 0)
+		return (-1);
+	if (CONFIG->CONTROL_SOCKET != NULL &&
+	    HCTL_listen(CONFIG->CONTROL_SOCKET) != 0)
+		return (-1);
+	return (0);
 }
 
-void
-sleep_and_refresh(hitch_config *CONFIG)
+static void
+mgt_pidfile(void)
 {
-	/* static backend address */
-	if (!CONFIG->BACKEND_REFRESH_TIME) {
-		pause();
+
+	if (CONFIG->PIDFILE == NULL)
 		return;
+	pfh = VPF_Open(CONFIG->PIDFILE, 0644, NULL);
+	if (pfh == NULL) {
+		ERR("FATAL: Could not open pid (-p) file (%s): %s\n",
+		    CONFIG->PIDFILE, strerror(errno));
+		exit(1);
 	}
 
-	int rv = 0;
-	while (1) {
-		rv = usleep(CONFIG->BACKEND_REFRESH_TIME*1000000);
-		if (rv == -1 && errno == EINTR)
-			break;
-		else if(backaddr_init()) {
-			struct worker_update wu;
-			wu.type = BACKEND_REFRESH;
-			socklen_t len;
-			const void *addr =
-			    VSA_Get_Sockaddr(backaddr->backaddr, &len);
-			AN(addr);
-			memcpy(&(wu.payload.addr), addr, len);
-			notify_workers(&wu);
-		}
-	}
+	AZ(VPF_Write(pfh));
+	atexit(remove_pfh);
 }
 
 /* Process command line args, create the bound socket,
@@ -3988,6 +7006,7 @@ main(int argc, char **argv)
 {
 	// initialize configuration
 	struct front_arg *fa, *ftmp;
+	const char *upgrade;
 
 	CONFIG = config_new();
 
@@ -4033,18 +7052,39 @@ main(int argc, char **argv)
 	LOGL("{core} %s starting\n", PACKAGE_STRING);
 	create_workers = 1;
 
+	/* Before daemonizing changes the working directory */
+	mgt_argv = argv;
+	mgt_exe = argv[0];
+	if (strchr(argv[0], '/') != NULL)
+		mgt_exe = realpath(argv[0], NULL);
+	if (mgt_exe == NULL)
+		mgt_exe = argv[0];
+	mgt_cwd = getcwd(NULL, 0);
+
 	openssl_check_version();
 
 	init_signals();
 	init_globals();
 	init_openssl();
 
+	/* Take over the listen sockets of systemd, or of the master
+	 * upgrading to this one */
+	if (HUPG_systemd() < 0)
+		exit(1);
+	upgrade = getenv(HUPG_ENV);
+	if (upgrade != NULL) {
+		if (mgt_upgrade_recv(upgrade) != 0)
+			exit(1);
+		AZ(unsetenv(HUPG_ENV));
+	}
+
 	HASH_ITER(hh, CONFIG->LISTEN_ARGS, fa, ftmp) {
 		struct frontend *fr = create_frontend(fa);
 		if (fr == NULL)
 			exit(1);
 		VTAILQ_INSERT_TAIL(&frontends, fr, list);
 	}
+	HUPG_close_unused();
 
 	/* load certificates, pass to handle_connections */
 	LOGL("{core} Loading certificate pem files (%d)\n",
@@ -4070,6 +7110,10 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
+	/* The old master keeps these until the workers are started */
+	if (upgrade == NULL && mgt_admin_listen() != 0)
+		exit(1);
+
 	if (CONFIG->DAEMONIZE) {
 		if (!CONFIG->SYSLOG && !CONFIG->LOG_FILENAME) {
 			LOG("{core} Warning: daemonizing with neither "
@@ -4078,67 +7122,83 @@ main(int argc, char **argv)
 		}
 		if (logfile == stdout || logfile == stderr)
 			logfile = NULL;
-		if (daemon(0, 0) == -1) {
+		/* The old master did already */
+		if (upgrade == NULL && daemon(0, 0) == -1) {
 			ERR("Unable to daemonize: %s\n", strerror(errno));
 			exit(1);
 		}
 	}
 
 	master_pid = getpid();
+	mgt_loop = ev_loop_new(EVFLAG_AUTO);
+	AN(mgt_loop);
+	/* Block until a signal arrives, even without any watcher */
+	ev_ref(mgt_loop);
 
-	if (CONFIG->PIDFILE) {
-		pfh = VPF_Open(CONFIG->PIDFILE, 0644, NULL);
-		if (pfh == NULL) {
-			ERR("FATAL: Could not open pid (-p) file (%s): %s\n",
-			    CONFIG->PIDFILE, strerror(errno));
-			exit(1);
-		}
+	if (upgrade == NULL)
+		mgt_pidfile();
 
-		AZ(VPF_Write(pfh));
-		atexit(remove_pfh);
-	}
+	/* Leave room for a few generations of workers draining
+	 * connections after reloads. */
+	if (HSTAT_init(8 * workers_max() + 64) != 0)
+		exit(1);
+	if (HRL_init() != 0)
+		exit(1);
 
 	start_workers(0, CONFIG->NCORES);
 
+	if (upgrade != NULL) {
+		mgt_upgrade_ready();
+		if (mgt_admin_listen() != 0)
+			exit(1);
+		mgt_pidfile();
+		/* Like daemon() would have */
+		if (CONFIG->DAEMONIZE)
+			AZ(chdir("/"));
+	}
+
 	if (CONFIG->OCSP_DIR != NULL)
 		start_ocsp_proc();
 
 #ifdef USE_SHARED_CACHE
 	if (CONFIG->SHCUPD_PORT) {
-		/* start event loop to receive cache updates */
-		loop = ev_default_loop(EVFLAG_AUTO);
+		/* receive cache updates in the master event loop */
 		ev_io_init(&shcupd_listener, handle_shcupd, shcupd_socket,
 		    EV_READ);
-		ev_io_start(loop, &shcupd_listener);
+		ev_io_start(mgt_loop, &shcupd_listener);
 	}
 #endif /* USE_SHARED_CACHE */
 
+	ev_timer_init(&mgt_backend_refresh, handle_backend_refresh, 0., 0.);
+	ev_timer_init(&mgt_scaler, handle_scale, 0., 0.);
+	mgt_timers_update();
+	HSTAT_worker_gen(worker_gen);
+	HSTAT_start(mgt_loop, mgt_stats_certs);
+	HCTL_start(mgt_loop, mgt_control);
+
 	LOGL("{core} %s initialization complete\n", PACKAGE_STRING);
 	for (;;) {
-#ifdef USE_SHARED_CACHE
-		if (CONFIG->SHCUPD_PORT) {
-			while (n_sighup == 0 && n_sigchld == 0) {
-				/* event loop to receive cache updates */
-				ev_loop(loop, EVRUN_ONCE);
-			}
-		} else
-			sleep_and_refresh(CONFIG);
-#else
-
-		sleep_and_refresh(CONFIG);
-		/* Sleep and let the children work.
-		 * Parent will be woken up if a signal arrives */
-#endif /* USE_SHARED_CACHE */
+		/* Let the children work. The loop is interrupted when
+		 * a signal arrives. */
+		while (n_sighup == 0 && n_sigchld == 0)
+			ev_loop(mgt_loop, EVRUN_ONCE);
 
 		while (n_sighup != 0) {
 			n_sighup = 0;
 			reconfigure(argc, argv);
+			mgt_timers_update();
 		}
 
 		while (n_sigchld != 0) {
 			n_sigchld = 0;
 			do_wait();
 		}
+
+		if (mgt_retired && VTAILQ_EMPTY(&worker_procs)) {
+			LOGL("{core} Workers drained after the upgrade, "
+			    "exiting.\n");
+			exit(0);
+		}
 	}
 
 	exit(0); /* just a formality; we never get here */
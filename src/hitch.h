@@ -37,6 +37,7 @@
 #include <arpa/inet.h>
 
 #include <ev.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <syslog.h>
 #include <sys/types.h>
@@ -51,6 +52,8 @@
 #include <openssl/x509v3.h>
 
 #include "configuration.h"
+#include "fingerprint.h"
+#include "ratelimit.h"
 #include "ringbuffer.h"
 #include "foreign/asn_gentm.h"
 #include "foreign/miniobj.h"
@@ -109,6 +112,9 @@ extern sni_name *sni_names;
 #endif /* OPENSSL_NO_TLSEXT */
 
 struct backend;
+struct frontend;
+struct hrec;
+struct htrace;
 
 /*
  * Proxied State
@@ -140,7 +146,8 @@ typedef struct proxystate {
 
 	int			fd_up;		/* Upstream (client) socket */
 	int			fd_down;	/* Downstream (backend)
-						 * socket */
+						 * socket, -1 until the
+						 * connect */
 	struct backend		*backend;
 
 	int			want_shutdown:1; /* Connection is
@@ -156,12 +163,58 @@ typedef struct proxystate {
 						     * a certificate
 						     * over the current
 						     * connection */
-
-	SSL			*ssl;		/* OpenSSL SSL state */
+	int			hello_seen:1;	/* ClientHello received */
+	int			backend_replied:1; /* First byte from the
+						    * backend received */
+	int			resume_offered:1; /* ClientHello offers
+						   * a session */
+	int			hs_queued:1;	/* In the full handshake
+						 * queue */
+	int			hs_admitted:1;	/* Full handshake let
+						 * through the queue */
+	int			fingerprinted:1; /* Fingerprint of the
+						  * ClientHello taken */
+	int			fingerprint_rated:1; /* Counted against
+						      * fingerprint-rate */
+	int			ktls:1;		/* Taken over with its TLS
+						 * records in the kernel,
+						 * without SSL state */
+	int			migrated:1;	/* Handed over to the next
+						 * generation */
+
+	SSL			*ssl;		/* OpenSSL SSL state, NULL
+						 * with the ring buffers
+						 * until the first bytes
+						 * arrive, and with kTLS
+						 * once taken over */
 
 	struct sockaddr_storage	remote_ip;	/* Remote ip returned
 						 * from `accept` */
 	int			connect_port;	/* local port for connection */
+	char			remote_str[INET6_ADDRSTRLEN + 9];
+						/* Remote address for
+						 * logging, formatted on
+						 * first use */
+
+	struct frontend		*frontend;
+	int			stats_fe;	/* Frontend statistics index */
+	struct hrl_src		hrl_src;	/* Handshake rate source */
+	uint8_t			fingerprint[HFP_LEN]; /* ClientHello JA3 */
+	int			shutdown_req;	/* First shutdown requestor */
+	double			t_accept;	/* Time of accept */
+	double			t_handshake;	/* Handshake start */
+	double			t_connect;	/* Backend connect start */
+	double			t_request;	/* First byte from the client */
+	double			d_handshake;	/* Handshake duration */
+	double			d_connect;	/* Backend connect duration */
+	double			d_ttfb;		/* Backend first byte time */
+	struct hrec		*rec;		/* Flight recorder */
+	struct htrace		*trace;		/* Connection trace */
+	uint64_t		ssl2clear_bytes;
+	uint64_t		clear2ssl_bytes;
+	unsigned		conn_idx;	/* Connection registry
+						 * entry */
+	VTAILQ_ENTRY(proxystate) hs_list;	/* Full handshake queue */
 } proxystate;
 
 
@@ -42,11 +42,14 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <grp.h>
 #include <libgen.h>
 #include <limits.h>
 #include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <sched.h>
 #include <signal.h>
@@ -62,6 +65,7 @@
 #include "hssl_locks.h"
 #include "ocsp.h"
 #include "shctx.h"
+#include "stats.h"
 #include "foreign/vpf.h"
 #include "foreign/uthash.h"
 
@@ -70,10 +74,46 @@ extern hitch_config *CONFIG;
 
 #define LOG_REOPEN_INTERVAL 60
 
+/*
+ * Asynchronous logging.
+ *
+ * A worker formats its log lines into a ring of fixed size records
+ * and a writer thread turns them into batched writes to the log file,
+ * and syslog calls. The ring has a single producer (the event loop)
+ * and a single consumer, so it needs no locks. When the ring is full
+ * lines are dropped and counted rather than blocking the event loop.
+ *
+ * The writer only gets a wakeup through the pipe when it announced
+ * that it is going idle, so a busy worker does not pay a system call
+ * per line.
+ */
+
+#define HLOG_SLOTS	256
+#define HLOG_MSG_LEN	1000
+#define HLOG_WBUF_LEN	65536
+
+struct hlog_rec {
+	struct timeval		tv;
+	int			level;
+	unsigned		len;
+	char			msg[HLOG_MSG_LEN];
+};
+
 FILE * logfile;
 struct stat logf_st;
 time_t logf_check_t;
 
+static struct hlog_rec *hlog_ring;
+static unsigned hlog_head;
+static unsigned hlog_tail;
+static unsigned hlog_idle;
+static unsigned hlog_stop;
+static uint64_t hlog_dropped;
+static int hlog_pipe[2] = { -1, -1 };
+static int hlog_follow = -1;
+static int hlog_run;
+static pthread_t hlog_thr;
+
 double
 Time_now(void)
 {
@@ -83,6 +123,248 @@ Time_now(void)
 	return (tv.tv_sec + 1e-9 * tv.tv_nsec);
 }
 
+/* Reopen the log file if it was moved away, e.g. by logrotate */
+static void
+log_reopen(time_t now)
+{
+	struct stat st;
+	int fd;
+
+	if (logfile == NULL || logfile == stdout || logfile == stderr ||
+	    now < logf_check_t + LOG_REOPEN_INTERVAL)
+		return;
+	if (stat(CONFIG->LOG_FILENAME, &st) < 0
+	    || st.st_dev != logf_st.st_dev
+	    || st.st_ino != logf_st.st_ino) {
+		fclose(logfile);
+
+		logfile = fopen(CONFIG->LOG_FILENAME, "a");
+		if (logfile == NULL
+		    || fstat(fileno(logfile), &logf_st) < 0)
+			memset(&logf_st, 0, sizeof(logf_st));
+		fd = __atomic_load_n(&hlog_follow, __ATOMIC_ACQUIRE);
+		if (logfile != NULL && fd >= 0 &&
+		    dup2(fileno(logfile), fd) == fd)
+			(void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+	}
+	logf_check_t = now;
+}
+
+/* A descriptor of the log of its own, for a signal handler to write to.
+ * A reopened log file takes its place, in one dup2(), so that it never
+ * refers to a closed descriptor, or one reused for something else. */
+int
+HLOG_dup(void)
+{
+	int fd;
+
+	fd = fcntl(logfile != NULL ? fileno(logfile) : STDERR_FILENO,
+	    F_DUPFD_CLOEXEC, 0);
+	if (fd >= 0 && logfile != NULL && logfile != stdout &&
+	    logfile != stderr)
+		__atomic_store_n(&hlog_follow, fd, __ATOMIC_RELEASE);
+	return (fd);
+}
+
+static void
+hlog_put(int level, const char *fmt, va_list ap)
+{
+	struct hlog_rec *r;
+	unsigned head, tail;
+	int l;
+
+	head = hlog_head;
+	tail = __atomic_load_n(&hlog_tail, __ATOMIC_ACQUIRE);
+	if (head - tail >= HLOG_SLOTS) {
+		__atomic_fetch_add(&hlog_dropped, 1, __ATOMIC_RELAXED);
+		HSTAT_INC(log_dropped);
+		return;
+	}
+
+	r = &hlog_ring[head % HLOG_SLOTS];
+	AZ(gettimeofday(&r->tv, NULL));
+	r->level = level;
+	l = vsnprintf(r->msg, sizeof r->msg, fmt, ap);
+	if (l < 0)
+		l = 0;
+	if (l >= (int)sizeof r->msg) {
+		l = sizeof r->msg - 1;
+		r->msg[l - 1] = '\n';
+	}
+	r->len = l;
+	__atomic_store_n(&hlog_head, head + 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&hlog_idle, __ATOMIC_SEQ_CST) &&
+	    __atomic_exchange_n(&hlog_idle, 0, __ATOMIC_SEQ_CST))
+		(void)write(hlog_pipe[1], "", 1);
+}
+
+struct hlog_wbuf {
+	char			buf[HLOG_WBUF_LEN];
+	size_t			len;
+	time_t			sec;
+	char			stamp[32];
+	pid_t			pid;
+};
+
+static void
+hlog_flush(struct hlog_wbuf *wb)
+{
+	if (wb->len > 0 && logfile != NULL)
+		(void)fwrite(wb->buf, 1, wb->len, logfile);
+	wb->len = 0;
+}
+
+static void
+hlog_line(struct hlog_wbuf *wb, const struct timeval *tv, const char *msg,
+    size_t len)
+{
+	struct tm tm;
+	int n;
+
+	if (logfile == NULL)
+		return;
+	if (wb->len + len + 64 > sizeof wb->buf)
+		hlog_flush(wb);
+	if (tv->tv_sec != wb->sec) {
+		AN(localtime_r(&tv->tv_sec, &tm));
+		AN(strftime(wb->stamp, sizeof wb->stamp, "%Y%m%dT%H%M%S",
+		    &tm));
+		wb->sec = tv->tv_sec;
+	}
+	n = snprintf(wb->buf + wb->len, sizeof wb->buf - wb->len,
+	    "%s.%06d [%5d] ", wb->stamp, (int)tv->tv_usec, wb->pid);
+	assert(n > 0 && wb->len + n + len <= sizeof wb->buf);
+	wb->len += n;
+	memcpy(wb->buf + wb->len, msg, len);
+	wb->len += len;
+}
+
+static void
+hlog_drain(struct hlog_wbuf *wb, uint64_t *reported)
+{
+	const struct hlog_rec *r;
+	struct timeval tv;
+	unsigned head, tail;
+	uint64_t dropped;
+	char buf[128];
+	int n;
+
+	head = __atomic_load_n(&hlog_head, __ATOMIC_SEQ_CST);
+	for (tail = hlog_tail; tail != head; tail++) {
+		r = &hlog_ring[tail % HLOG_SLOTS];
+		if (CONFIG->SYSLOG)
+			syslog(r->level, "%s", r->msg);
+		hlog_line(wb, &r->tv, r->msg, r->len);
+		__atomic_store_n(&hlog_tail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+	dropped = __atomic_load_n(&hlog_dropped, __ATOMIC_RELAXED);
+	if (dropped != *reported) {
+		n = snprintf(buf, sizeof buf, "{core} Log buffer full, "
+		    "%ju messages dropped\n", (uintmax_t)(dropped - *reported));
+		*reported = dropped;
+		if (CONFIG->SYSLOG)
+			syslog(LOG_ERR, "%s", buf);
+		AZ(gettimeofday(&tv, NULL));
+		hlog_line(wb, &tv, buf, n);
+	}
+	hlog_flush(wb);
+}
+
+static void *
+hlog_writer(void *priv)
+{
+	static struct hlog_wbuf wb;
+	struct pollfd pfd;
+	uint64_t reported = 0;
+	char c[64];
+
+	(void)priv;
+	wb.pid = getpid();
+	wb.sec = -1;
+	pfd.fd = hlog_pipe[0];
+	pfd.events = POLLIN;
+
+	for (;;) {
+		log_reopen(time(NULL));
+		if (__atomic_load_n(&hlog_head, __ATOMIC_SEQ_CST) !=
+		    hlog_tail) {
+			hlog_drain(&wb, &reported);
+			continue;
+		}
+		if (__atomic_load_n(&hlog_stop, __ATOMIC_SEQ_CST))
+			break;
+
+		/* Announce that we go to sleep, and look again in case a
+		 * line was queued before the producer could see it. */
+		__atomic_store_n(&hlog_idle, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&hlog_head, __ATOMIC_SEQ_CST) ==
+		    hlog_tail)
+			(void)poll(&pfd, 1, LOG_REOPEN_INTERVAL * 1000 / 4);
+		__atomic_store_n(&hlog_idle, 0, __ATOMIC_SEQ_CST);
+		while (read(hlog_pipe[0], c, sizeof c) > 0)
+			continue;
+	}
+	hlog_drain(&wb, &reported);
+	return (NULL);
+}
+
+/* Move logging of the current process to a writer thread. Called by
+ * the workers, the other processes log synchronously. */
+void
+HLOG_start(void)
+{
+	sigset_t set, oset;
+	int i;
+
+	if (hlog_run || (logfile == NULL && !CONFIG->SYSLOG))
+		return;
+
+	hlog_ring = calloc(HLOG_SLOTS, sizeof *hlog_ring);
+	if (hlog_ring == NULL || pipe(hlog_pipe) != 0) {
+		ERR("{core} Unable to set up the log buffer: %s\n",
+		    strerror(errno));
+		free(hlog_ring);
+		hlog_ring = NULL;
+		return;
+	}
+	for (i = 0; i < 2; i++) {
+		AZ(fcntl(hlog_pipe[i], F_SETFL,
+		    fcntl(hlog_pipe[i], F_GETFL) | O_NONBLOCK));
+		AZ(fcntl(hlog_pipe[i], F_SETFD, FD_CLOEXEC));
+	}
+
+	/* Signals are for the event loop to handle */
+	sigfillset(&set);
+	AZ(pthread_sigmask(SIG_BLOCK, &set, &oset));
+	errno = pthread_create(&hlog_thr, NULL, hlog_writer, NULL);
+	AZ(pthread_sigmask(SIG_SETMASK, &oset, NULL));
+	if (errno != 0) {
+		ERR("{core} Unable to start the log writer: %s\n",
+		    strerror(errno));
+		(void)close(hlog_pipe[0]);
+		(void)close(hlog_pipe[1]);
+		free(hlog_ring);
+		hlog_ring = NULL;
+		return;
+	}
+	hlog_run = 1;
+	AZ(atexit(HLOG_stop));
+}
+
+/* Write out everything queued and go back to synchronous logging */
+void
+HLOG_stop(void)
+{
+	if (!hlog_run)
+		return;
+	hlog_run = 0;
+	__atomic_store_n(&hlog_stop, 1, __ATOMIC_SEQ_CST);
+	(void)write(hlog_pipe[1], "", 1);
+	AZ(pthread_join(hlog_thr, NULL));
+}
+
 void
 VWLOG(int level, const char *fmt, va_list ap)
 {
@@ -92,6 +374,12 @@ VWLOG(int level, const char *fmt, va_list ap)
 	int n;
 	va_list ap1;
 
+	if (hlog_run) {
+		if (logfile != NULL || CONFIG->SYSLOG)
+			hlog_put(level, fmt, ap);
+		return;
+	}
+
 	va_copy(ap1, ap);
 	if (CONFIG->SYSLOG) {
 		vsyslog(level, fmt, ap);
@@ -102,21 +390,7 @@ VWLOG(int level, const char *fmt, va_list ap)
 		return;
 	}
 	AZ(gettimeofday(&tv, NULL));
-	if (logfile != stdout && logfile != stderr
-	    && tv.tv_sec >= logf_check_t + LOG_REOPEN_INTERVAL) {
-		struct stat st;
-		if (stat(CONFIG->LOG_FILENAME, &st) < 0
-		    || st.st_dev != logf_st.st_dev
-		    || st.st_ino != logf_st.st_ino) {
-			fclose(logfile);
-
-			logfile = fopen(CONFIG->LOG_FILENAME, "a");
-			if (logfile == NULL
-			    || fstat(fileno(logfile), &logf_st) < 0)
-				memset(&logf_st, 0, sizeof(logf_st));
-		}
-		logf_check_t = tv.tv_sec;
-	}
+	log_reopen(tv.tv_sec);
 
 	AN(localtime_r(&tv.tv_sec, &tm));
 	n = strftime(buf, sizeof(buf), "%Y%m%dT%H%M%S", &tm);
@@ -136,35 +410,47 @@ WLOG(int level, const char *fmt, ...)
 	va_end(ap);
 }
 
-void
-logproxy(int level, const proxystate* ps, const char *fmt, ...)
+/* The remote address is formatted on first use and kept with the
+ * connection. */
+const char *
+logproxy_addr(proxystate *ps)
 {
-	char buf[1024];
 	char hbuf[INET6_ADDRSTRLEN+1];
 	char sbuf[8];
-	int n;
-	va_list ap;
 	socklen_t salen;
 
-	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+	if (ps->remote_str[0] != '\0')
+		return (ps->remote_str);
 
 	salen = (ps->remote_ip.ss_family == AF_INET) ?
 	    sizeof(struct sockaddr) : sizeof(struct sockaddr_in6);
-	n = getnameinfo((struct sockaddr *) &ps->remote_ip, salen, hbuf,
+	if (getnameinfo((struct sockaddr *) &ps->remote_ip, salen, hbuf,
 		sizeof hbuf, sbuf, sizeof sbuf,
-		NI_NUMERICHOST | NI_NUMERICSERV);
-	if (n != 0) {
+		NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
 		strcpy(hbuf, "n/a");
 		strcpy(sbuf, "n/a");
 	}
 
-	va_start(ap, fmt);
 	if (ps->remote_ip.ss_family == AF_INET)
-		snprintf(buf, sizeof(buf), "%s:%s :%d %d:%d %s",
-		    hbuf, sbuf, ps->connect_port, ps->fd_up, ps->fd_down, fmt);
+		snprintf(ps->remote_str, sizeof ps->remote_str, "%s:%s",
+		    hbuf, sbuf);
 	else
-		snprintf(buf, sizeof(buf), "[%s]:%s :%d %d:%d %s",
-		    hbuf, sbuf, ps->connect_port, ps->fd_up, ps->fd_down, fmt);
+		snprintf(ps->remote_str, sizeof ps->remote_str, "[%s]:%s",
+		    hbuf, sbuf);
+	return (ps->remote_str);
+}
+
+void
+logproxy(int level, proxystate *ps, const char *fmt, ...)
+{
+	char buf[1024];
+	va_list ap;
+
+	CHECK_OBJ_NOTNULL(ps, PROXYSTATE_MAGIC);
+
+	va_start(ap, fmt);
+	snprintf(buf, sizeof(buf), "%s :%d %d:%d %s", logproxy_addr(ps),
+	    ps->connect_port, ps->fd_up, ps->fd_down, fmt);
 	VWLOG(level, buf, ap);
 	va_end(ap);
 }
@@ -56,12 +56,17 @@ double Time_now(void);
 
 void WLOG(int level, const char *fmt, ...)
 	__attribute__((format(printf, 2, 3)));
-void logproxy(int level, const proxystate* ps, const char *fmt, ...)
+const char *logproxy_addr(proxystate *ps);
+void logproxy(int level, proxystate *ps, const char *fmt, ...)
 	__attribute__((format(printf, 3, 4)));
 
 void VWLOG(int level, const char *fmt, va_list ap);
 void WLOG(int level, const char *fmt, ...);
 
+void HLOG_start(void);
+void HLOG_stop(void);
+int HLOG_dup(void);
+
 void log_ssl_error(proxystate *ps, const char *what, ...);
 
 void fail(const char *s);
@@ -0,0 +1,349 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#include "config.h"
+
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_EXECINFO_H
+#  include <execinfo.h>
+#endif
+
+#include "logging.h"
+#include "loopmon.h"
+#include "stats.h"
+#include "foreign/vas.h"
+
+#define HLOOP_BT_DEPTH		32
+
+/* hitch.c */
+extern hitch_config *CONFIG;
+
+/* logging.c */
+extern FILE *logfile;
+
+struct hloop_cb {
+	const char		*name;
+	double			t0;
+	double			dur;
+	int			fd;
+	struct sockaddr_storage	addr;
+};
+
+int hloop_track;
+
+static int hloop_core;
+static int hloop_thr_ms;
+static double hloop_thr;
+static double hloop_t_wake;
+static struct hloop_cb hloop_cur;
+static struct hloop_cb hloop_worst;
+static ev_check hloop_chk;
+static ev_prepare hloop_prep;
+
+/* Shared with the watchdog thread */
+static pthread_t hloop_main;
+static int hloop_fd = -1;
+static volatile unsigned hloop_beat;
+static volatile int hloop_busy;
+static const char * volatile hloop_cb_name;
+
+static void
+hloop_close(double now)
+{
+	if (hloop_cur.name == NULL)
+		return;
+	hloop_cur.dur = now - hloop_cur.t0;
+	HSTAT_observe(HSTAT_H_callback_seconds, hloop_cur.dur);
+	if (hloop_cur.dur > hloop_worst.dur)
+		hloop_worst = hloop_cur;
+	hloop_cur.name = NULL;
+}
+
+/* Called at the start of a callback. The previous callback is taken
+ * to have run until now. */
+void
+HLOOP_mark(const char *cb, const proxystate *ps)
+{
+	double now;
+
+	AN(cb);
+	now = ev_time();
+	hloop_close(now);
+	hloop_cur.name = cb;
+	hloop_cur.t0 = now;
+	if (ps != NULL) {
+		hloop_cur.fd = ps->fd_up;
+		hloop_cur.addr = ps->remote_ip;
+	} else {
+		hloop_cur.fd = -1;
+		hloop_cur.addr.ss_family = AF_UNSPEC;
+	}
+	hloop_cb_name = cb;
+}
+
+static void
+hloop_stall(double busy)
+{
+	char hbuf[INET6_ADDRSTRLEN + 1];
+	char sbuf[8];
+	socklen_t salen;
+	const struct hloop_cb *cb = &hloop_worst;
+
+	HSTAT_INC(loop_stalls);
+	if (cb->name == NULL) {
+		ERR("{core} Worker %d: event loop stalled for %.1f ms\n",
+		    hloop_core, busy * 1e3);
+		return;
+	}
+
+	salen = (cb->addr.ss_family == AF_INET) ?
+	    sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+	if (cb->addr.ss_family == AF_UNSPEC ||
+	    getnameinfo((const struct sockaddr *)&cb->addr, salen,
+	    hbuf, sizeof hbuf, sbuf, sizeof sbuf,
+	    NI_NUMERICHOST | NI_NUMERICSERV) != 0) {
+		ERR("{core} Worker %d: event loop stalled for %.1f ms, "
+		    "%s() ran for %.1f ms\n", hloop_core, busy * 1e3,
+		    cb->name, cb->dur * 1e3);
+		return;
+	}
+	ERR("{core} Worker %d: event loop stalled for %.1f ms, "
+	    "%s() ran for %.1f ms (client %s%s%s:%s, fd %d)\n",
+	    hloop_core, busy * 1e3, cb->name, cb->dur * 1e3,
+	    cb->addr.ss_family == AF_INET6 ? "[" : "", hbuf,
+	    cb->addr.ss_family == AF_INET6 ? "]" : "", sbuf, cb->fd);
+}
+
+/* Runs first thing after the loop wakes up */
+static void
+hloop_check(struct ev_loop *loop, ev_check *w, int revents)
+{
+	(void)loop;
+	(void)w;
+	(void)revents;
+	hloop_t_wake = ev_time();
+	hloop_beat++;
+	hloop_busy = 1;
+}
+
+/* Runs right before the loop goes back to sleep */
+static void
+hloop_prepare(struct ev_loop *loop, ev_prepare *w, int revents)
+{
+	double now, busy;
+
+	(void)loop;
+	(void)w;
+	(void)revents;
+	if (hloop_t_wake == 0.)
+		return;
+	now = ev_time();
+	busy = now - hloop_t_wake;
+	HSTAT_observe(HSTAT_H_loop_busy_seconds, busy);
+	if (hloop_track) {
+		hloop_close(now);
+		if (busy >= hloop_thr)
+			hloop_stall(busy);
+		hloop_worst.name = NULL;
+		hloop_worst.dur = 0.;
+		hloop_cb_name = NULL;
+	}
+	hloop_beat++;
+	hloop_busy = 0;
+}
+
+/* Formatting for the signal handler, where stdio is off limits. Both
+ * stop at the end of the buffer. */
+static char *
+hloop_cat(char *p, const char *e, const char *s)
+{
+
+	while (*s != '\0' && p < e)
+		*p++ = *s++;
+	return (p);
+}
+
+static char *
+hloop_int(char *p, const char *e, long v)
+{
+	char tmp[24];
+	unsigned long u;
+	int i = sizeof tmp;
+
+	u = v < 0 ? -(unsigned long)v : (unsigned long)v;
+	tmp[--i] = '\0';
+	do {
+		tmp[--i] = '0' + u % 10;
+		u /= 10;
+	} while (u != 0);
+	if (v < 0)
+		tmp[--i] = '-';
+	return (hloop_cat(p, e, tmp + i));
+}
+
+static void
+hloop_sigprof(int sig)
+{
+	char buf[256], *p, *e;
+	const char *cb;
+#ifdef HAVE_EXECINFO_H
+	void *bt[HLOOP_BT_DEPTH];
+	int n;
+#endif
+
+	(void)sig;
+	cb = hloop_cb_name;
+	p = buf;
+	e = buf + sizeof buf;
+	p = hloop_cat(p, e, "{core} Worker ");
+	p = hloop_int(p, e, hloop_core);
+	p = hloop_cat(p, e, ": event loop stuck for over ");
+	p = hloop_int(p, e, hloop_thr_ms);
+	p = hloop_cat(p, e, " ms in ");
+	p = hloop_cat(p, e, cb != NULL ? cb : "(unknown)");
+	p = hloop_cat(p, e, ", backtrace:\n");
+	if (write(hloop_fd, buf, p - buf) != p - buf)
+		return;
+#ifdef HAVE_EXECINFO_H
+	n = backtrace(bt, HLOOP_BT_DEPTH);
+	backtrace_symbols_fd(bt, n, hloop_fd);
+#endif
+}
+
+static void *
+hloop_watchdog(void *priv)
+{
+	struct timespec ts;
+	unsigned beat, fired = 0;
+	double t_beat;
+	long ns;
+
+	(void)priv;
+	/* Poll four times per threshold, but at least every millisecond */
+	ns = hloop_thr_ms * 250000L;
+	if (ns < 1000000L)
+		ns = 1000000L;
+	ts.tv_sec = ns / 1000000000L;
+	ts.tv_nsec = ns % 1000000000L;
+
+	beat = hloop_beat;
+	t_beat = Time_now();
+	for (;;) {
+		(void)nanosleep(&ts, NULL);
+		if (hloop_beat != beat) {
+			beat = hloop_beat;
+			t_beat = Time_now();
+			continue;
+		}
+		if (!hloop_busy || beat == fired ||
+		    Time_now() - t_beat < hloop_thr)
+			continue;
+		fired = beat;
+		(void)pthread_kill(hloop_main, SIGPROF);
+	}
+	return (NULL);
+}
+
+static void
+hloop_watchdog_start(void)
+{
+	struct sigaction sa;
+	sigset_t set;
+	pthread_t thr;
+#ifdef HAVE_EXECINFO_H
+	void *bt[1];
+
+	/* The first call may load libgcc, do it outside of the
+	 * signal handler. */
+	(void)backtrace(bt, 1);
+#endif
+
+	/* Looked up now, fileno() is not async-signal-safe either, and
+	 * kept valid across log rotations */
+	hloop_fd = HLOG_dup();
+	if (hloop_fd < 0)
+		hloop_fd = STDERR_FILENO;
+
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = hloop_sigprof;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	AZ(sigaction(SIGPROF, &sa, NULL));
+
+	hloop_main = pthread_self();
+
+	/* The watchdog itself should never take the signal */
+	sigemptyset(&set);
+	sigaddset(&set, SIGPROF);
+	AZ(pthread_sigmask(SIG_BLOCK, &set, NULL));
+	errno = pthread_create(&thr, NULL, hloop_watchdog, NULL);
+	AZ(pthread_sigmask(SIG_UNBLOCK, &set, NULL));
+	if (errno != 0) {
+		ERR("{core} Worker %d: unable to start the stall watchdog: "
+		    "%s\n", hloop_core, strerror(errno));
+		return;
+	}
+	AZ(pthread_detach(thr));
+}
+
+/* Called by a worker once its event loop is created */
+void
+HLOOP_init(struct ev_loop *loop, int core_id, int threshold_ms,
+    int watchdog)
+{
+	AN(loop);
+	hloop_core = core_id;
+	hloop_thr_ms = threshold_ms;
+	hloop_thr = threshold_ms * 1e-3;
+	hloop_track = threshold_ms > 0;
+
+	ev_check_init(&hloop_chk, hloop_check);
+	ev_set_priority(&hloop_chk, EV_MAXPRI);
+	ev_check_start(loop, &hloop_chk);
+	ev_unref(loop);
+	ev_prepare_init(&hloop_prep, hloop_prepare);
+	ev_set_priority(&hloop_prep, EV_MINPRI);
+	ev_prepare_start(loop, &hloop_prep);
+	ev_unref(loop);
+
+	if (watchdog && hloop_track)
+		hloop_watchdog_start();
+}
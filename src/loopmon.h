@@ -0,0 +1,63 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#ifndef LOOPMON_H_INCLUDED
+#define LOOPMON_H_INCLUDED
+
+#include <ev.h>
+
+#include "hitch.h"
+
+/*
+ * Event loop monitoring for the workers.
+ *
+ * The time each loop iteration spends running callbacks is always
+ * recorded in the loop_busy_seconds histogram. With a stall threshold
+ * configured, the callbacks mark themselves with HLOOP_MARK(), which
+ * allows the slowest callback of an iteration that stalled the loop to
+ * be logged along with its connection. The optional watchdog thread
+ * interrupts a loop that has not turned for the threshold, and logs a
+ * backtrace of where it is stuck.
+ */
+
+extern int hloop_track;
+
+#define HLOOP_MARK(ps)							\
+	do {								\
+		if (hloop_track)					\
+			HLOOP_mark(__func__, ps);			\
+	} while (0)
+
+void HLOOP_init(struct ev_loop *loop, int core_id, int threshold_ms,
+    int watchdog);
+void HLOOP_mark(const char *cb, const proxystate *ps);
+
+#endif /* LOOPMON_H_INCLUDED */
@@ -0,0 +1,705 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+/*
+ * Microbenchmarks of the hot paths, run with "make bench".
+ *
+ * Every benchmark runs a fixed number of operations on deterministic
+ * data, a few times over. One line is printed per benchmark, with the
+ * number of operations and the lowest, median and highest time per
+ * operation in nanoseconds, so that runs can be compared with each
+ * other by a script.
+ */
+
+#include "config.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "configuration.h"
+#include "hitch.h"
+#include "logging.h"
+#include "ocsp.h"
+#include "proxyhdr.h"
+#include "proxyv2.h"
+#include "ringbuffer.h"
+#include "shctx.h"
+#include "sni.h"
+#include "foreign/uthash.h"
+
+#define MB_MAX_REPS		32
+
+/* Referenced by the modules linked in */
+struct ev_loop *loop;
+hitch_config *CONFIG;
+
+X509 *
+Find_issuer(X509 *subj, STACK_OF(X509) *chain)
+{
+
+	(void)subj;
+	(void)chain;
+	return (NULL);
+}
+
+typedef void mb_init_f(void);
+typedef void mb_run_f(uint64_t n);
+typedef void mb_fini_f(void);
+
+struct mb {
+	const char		*name;
+	mb_init_f		*init;
+	mb_run_f		*run;
+	mb_fini_f		*fini;
+	uint64_t		n;
+};
+
+static double
+mb_now(void)
+{
+	struct timespec ts;
+
+	AZ(clock_gettime(CLOCK_MONOTONIC, &ts));
+	return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+/* Keep the compiler from optimizing results away */
+static volatile uintptr_t mb_sink;
+
+/*--------------------------------------------------------------------
+ * Ring buffers
+ */
+
+static ringbuffer mb_rb;
+static char mb_data[4096];
+
+static void
+mb_rb_init(void)
+{
+
+	ringbuffer_init(&mb_rb, 8, sizeof mb_data);
+	memset(mb_data, 'x', sizeof mb_data);
+}
+
+static void
+mb_rb_fini(void)
+{
+
+	ringbuffer_cleanup(&mb_rb);
+}
+
+static void
+mb_rb_cycle(uint64_t n)
+{
+	int len;
+
+	while (n--) {
+		mb_sink += (uintptr_t)ringbuffer_write_ptr(&mb_rb);
+		ringbuffer_write_append(&mb_rb, 1024);
+		mb_sink += (uintptr_t)ringbuffer_read_next(&mb_rb, &len);
+		ringbuffer_read_skip(&mb_rb, len / 2);
+		mb_sink += (uintptr_t)ringbuffer_read_next(&mb_rb, &len);
+		ringbuffer_read_pop(&mb_rb);
+	}
+}
+
+static void
+mb_rb_copy(uint64_t n)
+{
+	char *p;
+	int len;
+
+	while (n--) {
+		memcpy(ringbuffer_write_ptr(&mb_rb), mb_data, sizeof mb_data);
+		ringbuffer_write_append(&mb_rb, sizeof mb_data);
+		p = ringbuffer_read_next(&mb_rb, &len);
+		memcpy(mb_data, p, len);
+		ringbuffer_read_pop(&mb_rb);
+	}
+}
+
+static void
+mb_rb_fill(uint64_t n)
+{
+
+	while (n--) {
+		while (!ringbuffer_is_full(&mb_rb)) {
+			(void)ringbuffer_write_ptr(&mb_rb);
+			ringbuffer_write_append(&mb_rb, 512);
+		}
+		while (!ringbuffer_is_empty(&mb_rb))
+			ringbuffer_read_pop(&mb_rb);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * SNI tables
+ */
+
+#define MB_SNI_NAMES		100000
+#define MB_SNI_KEYS		4096
+
+static sni_name *mb_sni_tab;
+static sni_name *mb_sni;
+static char *mb_sni_keys[MB_SNI_KEYS];
+static sslctx mb_sni_ctx;
+
+/* Half exact names, half wildcards, as a large multi-tenant setup */
+static void
+mb_sni_init(void)
+{
+	char buf[128];
+	sni_name *sn;
+	unsigned i;
+
+	mb_sni = calloc(MB_SNI_NAMES, sizeof *mb_sni);
+	AN(mb_sni);
+	mb_sni_ctx.magic = SSLCTX_MAGIC;
+	for (i = 0; i < MB_SNI_NAMES; i++) {
+		sn = &mb_sni[i];
+		sn->magic = SNI_NAME_MAGIC;
+		sn->is_wildcard = i & 1;
+		(void)snprintf(buf, sizeof buf, "%s.tenant%06u.example.com",
+		    sn->is_wildcard ? "*" : "www", i);
+		sn->servername = strdup(buf);
+		AN(sn->servername);
+		sn->sni_key = sni_build_key(sn->servername);
+		sn->sctx = &mb_sni_ctx;
+		HASH_ADD_KEYPTR(hh, mb_sni_tab, sn->sni_key + sn->is_wildcard,
+		    strlen(sn->sni_key + sn->is_wildcard), sn);
+	}
+	/* Spread the lookups over the table, with a fixed seed */
+	srandom(1);
+	for (i = 0; i < MB_SNI_KEYS; i++) {
+		(void)snprintf(buf, sizeof buf, "%s.tenant%06ld.example.com",
+		    i & 2 ? "api" : "www", random() % MB_SNI_NAMES);
+		mb_sni_keys[i] = strdup(buf);
+		AN(mb_sni_keys[i]);
+	}
+}
+
+static void
+mb_sni_fini(void)
+{
+	unsigned i;
+
+	HASH_CLEAR(hh, mb_sni_tab);
+	for (i = 0; i < MB_SNI_NAMES; i++) {
+		free(mb_sni[i].servername);
+		free(mb_sni[i].sni_key);
+	}
+	free(mb_sni);
+	for (i = 0; i < MB_SNI_KEYS; i++)
+		free(mb_sni_keys[i]);
+}
+
+static void
+mb_sni_build_key(uint64_t n)
+{
+	char *key;
+
+	while (n--) {
+		key = sni_build_key("WWW.Tenant000042.Example.COM");
+		mb_sink += (uintptr_t)key;
+		free(key);
+	}
+}
+
+/* Exact, wildcard and missed lookups, in about equal parts */
+static void
+mb_sni_lookup(uint64_t n)
+{
+
+	while (n--)
+		mb_sink += (uintptr_t)sni_lookup(
+		    mb_sni_keys[n % MB_SNI_KEYS], mb_sni_tab);
+}
+
+static void
+mb_sni_lookup_miss(uint64_t n)
+{
+
+	while (n--)
+		mb_sink += (uintptr_t)sni_lookup("www.unknown.example.net",
+		    mb_sni_tab);
+}
+
+/*--------------------------------------------------------------------
+ * PROXY headers
+ */
+
+static struct sockaddr_storage mb_local4, mb_remote4;
+static struct sockaddr_storage mb_local6, mb_remote6;
+static char mb_hdr[1024];
+
+static void
+mb_proxy_init(void)
+{
+	struct sockaddr_in *sa4;
+	struct sockaddr_in6 *sa6;
+
+	sa4 = (struct sockaddr_in *)&mb_local4;
+	sa4->sin_family = AF_INET;
+	sa4->sin_port = htons(443);
+	AN(inet_pton(AF_INET, "192.0.2.1", &sa4->sin_addr));
+	sa4 = (struct sockaddr_in *)&mb_remote4;
+	sa4->sin_family = AF_INET;
+	sa4->sin_port = htons(51234);
+	AN(inet_pton(AF_INET, "198.51.100.123", &sa4->sin_addr));
+
+	sa6 = (struct sockaddr_in6 *)&mb_local6;
+	sa6->sin6_family = AF_INET6;
+	sa6->sin6_port = htons(443);
+	AN(inet_pton(AF_INET6, "2001:db8::1", &sa6->sin6_addr));
+	sa6 = (struct sockaddr_in6 *)&mb_remote6;
+	sa6->sin6_family = AF_INET6;
+	sa6->sin6_port = htons(51234);
+	AN(inet_pton(AF_INET6, "2001:db8:1234:5678::42", &sa6->sin6_addr));
+}
+
+static void
+mb_proxy_v1_ipv4(uint64_t n)
+{
+
+	while (n--)
+		mb_sink += proxy_hdr_v1(mb_hdr, sizeof mb_hdr,
+		    (struct sockaddr *)&mb_local4,
+		    (struct sockaddr *)&mb_remote4,
+		    sizeof(struct sockaddr_in));
+}
+
+static void
+mb_proxy_v1_ipv6(uint64_t n)
+{
+
+	while (n--)
+		mb_sink += proxy_hdr_v1(mb_hdr, sizeof mb_hdr,
+		    (struct sockaddr *)&mb_local6,
+		    (struct sockaddr *)&mb_remote6,
+		    sizeof(struct sockaddr_in6));
+}
+
+static void
+mb_proxy_v2_ipv4(uint64_t n)
+{
+	size_t len;
+
+	while (n--) {
+		len = proxy_hdr_v2(mb_hdr, sizeof mb_hdr,
+		    (struct sockaddr *)&mb_local4,
+		    (struct sockaddr *)&mb_remote4);
+		proxy_hdr_v2_len(mb_hdr, len);
+		mb_sink += len;
+	}
+}
+
+/* With the ALPN and authority TLVs */
+static void
+mb_proxy_v2_ipv6_tlv(uint64_t n)
+{
+	size_t len;
+
+	while (n--) {
+		len = proxy_hdr_v2(mb_hdr, sizeof mb_hdr,
+		    (struct sockaddr *)&mb_local6,
+		    (struct sockaddr *)&mb_remote6);
+		len += proxy_tlv_append(mb_hdr + len, sizeof mb_hdr - len,
+		    PP2_TYPE_ALPN, "h2", 2);
+		len += proxy_tlv_append(mb_hdr + len, sizeof mb_hdr - len,
+		    PP2_TYPE_AUTHORITY, "www.tenant000042.example.com", -1);
+		proxy_hdr_v2_len(mb_hdr, len);
+		mb_sink += len;
+	}
+}
+
+/*--------------------------------------------------------------------
+ * OCSP stapling
+ */
+
+#ifndef OPENSSL_NO_TLSEXT
+static SSL_CTX *mb_ocsp_ctx;
+static SSL *mb_ocsp_ssl;
+static sslstaple *mb_staple;
+
+static void
+mb_ocsp_init(void)
+{
+
+	mb_ocsp_ctx = SSL_CTX_new(SSLv23_server_method());
+	AN(mb_ocsp_ctx);
+	mb_ocsp_ssl = SSL_new(mb_ocsp_ctx);
+	AN(mb_ocsp_ssl);
+	ALLOC_OBJ(mb_staple, SSLSTAPLE_MAGIC);
+	AN(mb_staple);
+	/* The size of a typical response with one certificate */
+	mb_staple->len = 1500;
+	mb_staple->staple = malloc(mb_staple->len);
+	AN(mb_staple->staple);
+	memset(mb_staple->staple, 0x30, mb_staple->len);
+	mb_staple->nextupd = Time_now() + 3600;
+}
+
+static void
+mb_ocsp_fini(void)
+{
+
+	SSL_free(mb_ocsp_ssl);
+	SSL_CTX_free(mb_ocsp_ctx);
+	HOCSP_free(&mb_staple);
+}
+
+static void
+mb_ocsp_staple_cb(uint64_t n)
+{
+
+	while (n--)
+		mb_sink += HOCSP_staple_cb(mb_ocsp_ssl, mb_staple);
+}
+#endif
+
+/*--------------------------------------------------------------------
+ * Scanning of pem-dir
+ */
+
+static char mb_pemdir[64];
+static unsigned mb_pemdir_n;
+
+static void
+mb_pemdir_mk(unsigned n)
+{
+	char path[128];
+	unsigned i;
+	FILE *f;
+
+	mb_pemdir_n = n;
+	(void)snprintf(mb_pemdir, sizeof mb_pemdir, "/tmp/hitch-mb.XXXXXX");
+	AN(mkdtemp(mb_pemdir));
+	strcat(mb_pemdir, "/");
+	for (i = 0; i < n; i++) {
+		(void)snprintf(path, sizeof path, "%scert%06u.pem",
+		    mb_pemdir, i);
+		f = fopen(path, "w");
+		AN(f);
+		fputs("-----BEGIN CERTIFICATE-----\n", f);
+		AZ(fclose(f));
+	}
+}
+
+static void
+mb_pemdir_init_1k(void)
+{
+
+	mb_pemdir_mk(1000);
+}
+
+static void
+mb_pemdir_init_10k(void)
+{
+
+	mb_pemdir_mk(10000);
+}
+
+static void
+mb_pemdir_fini(void)
+{
+	char path[128];
+	unsigned i;
+
+	for (i = 0; i < mb_pemdir_n; i++) {
+		(void)snprintf(path, sizeof path, "%scert%06u.pem",
+		    mb_pemdir, i);
+		AZ(unlink(path));
+	}
+	AZ(rmdir(mb_pemdir));
+}
+
+/* One operation is a scan of the whole directory */
+static void
+mb_pemdir_scan(uint64_t n)
+{
+	hitch_config *cfg;
+
+	while (n--) {
+		cfg = config_new();
+		AN(cfg);
+		AZ(config_scan_pem_dir(mb_pemdir, cfg));
+		AN(cfg->CERT_DEFAULT);
+		config_destroy(cfg);
+	}
+}
+
+/*--------------------------------------------------------------------
+ * Shared session cache
+ */
+
+#ifdef USE_SHARED_CACHE
+#define MB_SHCTX_SESS		1024
+
+static SSL_CTX *mb_shctx_ctx;
+static SSL *mb_shctx_ssl;
+static SSL_SESSION *mb_shctx_sess[MB_SHCTX_SESS];
+
+static void
+mb_shctx_init(void)
+{
+	unsigned char id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+	unsigned i;
+
+	mb_shctx_ctx = SSL_CTX_new(SSLv23_server_method());
+	AN(mb_shctx_ctx);
+	AZ(shared_context_init(mb_shctx_ctx, MB_SHCTX_SESS * 4) < 0);
+	mb_shctx_ssl = SSL_new(mb_shctx_ctx);
+	AN(mb_shctx_ssl);
+	for (i = 0; i < MB_SHCTX_SESS; i++) {
+		memset(id, 0, sizeof id);
+		(void)snprintf((char *)id, sizeof id, "mb-session-%u", i);
+		mb_shctx_sess[i] = SSL_SESSION_new();
+		AN(mb_shctx_sess[i]);
+		AN(SSL_SESSION_set1_id(mb_shctx_sess[i], id, sizeof id));
+		AN(SSL_SESSION_set_protocol_version(mb_shctx_sess[i],
+		    TLS1_2_VERSION));
+	}
+}
+
+static void
+mb_shctx_fini(void)
+{
+	unsigned i;
+
+	for (i = 0; i < MB_SHCTX_SESS; i++)
+		SSL_SESSION_free(mb_shctx_sess[i]);
+	SSL_free(mb_shctx_ssl);
+	SSL_CTX_free(mb_shctx_ctx);
+}
+
+/* Each operation stores a session and looks up another one */
+static void
+mb_shctx_work(uint64_t n, unsigned seed)
+{
+	int (*new_cb)(SSL *, SSL_SESSION *);
+	SSL_SESSION *(*get_cb)(SSL *, const unsigned char *, int, int *);
+	const unsigned char *id;
+	SSL_SESSION *sess;
+	unsigned len;
+	int copy;
+
+	new_cb = SSL_CTX_sess_get_new_cb(mb_shctx_ctx);
+	get_cb = SSL_CTX_sess_get_get_cb(mb_shctx_ctx);
+	AN(new_cb);
+	AN(get_cb);
+	while (n--) {
+		(void)new_cb(mb_shctx_ssl,
+		    mb_shctx_sess[(n + seed) % MB_SHCTX_SESS]);
+		id = SSL_SESSION_get_id(
+		    mb_shctx_sess[(n * 7 + seed) % MB_SHCTX_SESS], &len);
+		sess = get_cb(mb_shctx_ssl, id, len, &copy);
+		if (sess != NULL)
+			SSL_SESSION_free(sess);
+	}
+}
+
+/* The operations are shared by the processes */
+static void
+mb_shctx_procs(uint64_t n, unsigned procs)
+{
+	pid_t pid[16];
+	unsigned i;
+	int status;
+
+	assert(procs <= sizeof pid / sizeof *pid);
+	for (i = 0; i < procs; i++) {
+		pid[i] = fork();
+		assert(pid[i] >= 0);
+		if (pid[i] == 0) {
+			mb_shctx_work(n / procs, i * 131);
+			_exit(0);
+		}
+	}
+	for (i = 0; i < procs; i++) {
+		assert(waitpid(pid[i], &status, 0) == pid[i]);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+}
+
+static void
+mb_shctx_1proc(uint64_t n)
+{
+
+	mb_shctx_procs(n, 1);
+}
+
+static void
+mb_shctx_4proc(uint64_t n)
+{
+
+	mb_shctx_procs(n, 4);
+}
+#endif
+
+/*--------------------------------------------------------------------*/
+
+static const struct mb mb_tab[] = {
+	{ "ringbuffer_cycle", mb_rb_init, mb_rb_cycle, mb_rb_fini,
+	    10000000 },
+	{ "ringbuffer_copy_4k", mb_rb_init, mb_rb_copy, mb_rb_fini,
+	    1000000 },
+	{ "ringbuffer_fill", mb_rb_init, mb_rb_fill, mb_rb_fini,
+	    2000000 },
+	{ "sni_build_key", NULL, mb_sni_build_key, NULL, 2000000 },
+	{ "sni_lookup_100k", mb_sni_init, mb_sni_lookup, mb_sni_fini,
+	    5000000 },
+	{ "sni_lookup_miss_100k", mb_sni_init, mb_sni_lookup_miss,
+	    mb_sni_fini, 5000000 },
+	{ "proxy_v1_ipv4", mb_proxy_init, mb_proxy_v1_ipv4, NULL, 500000 },
+	{ "proxy_v1_ipv6", mb_proxy_init, mb_proxy_v1_ipv6, NULL, 500000 },
+	{ "proxy_v2_ipv4", mb_proxy_init, mb_proxy_v2_ipv4, NULL,
+	    20000000 },
+	{ "proxy_v2_ipv6_tlv", mb_proxy_init, mb_proxy_v2_ipv6_tlv, NULL,
+	    10000000 },
+#ifndef OPENSSL_NO_TLSEXT
+	{ "ocsp_staple_cb", mb_ocsp_init, mb_ocsp_staple_cb, mb_ocsp_fini,
+	    2000000 },
+#endif
+	{ "pem_dir_scan_1k", mb_pemdir_init_1k, mb_pemdir_scan,
+	    mb_pemdir_fini, 100 },
+	{ "pem_dir_scan_10k", mb_pemdir_init_10k, mb_pemdir_scan,
+	    mb_pemdir_fini, 10 },
+#ifdef USE_SHARED_CACHE
+	{ "shctx_1proc", mb_shctx_init, mb_shctx_1proc, mb_shctx_fini,
+	    1000000 },
+	{ "shctx_4proc", mb_shctx_init, mb_shctx_4proc, mb_shctx_fini,
+	    1000000 },
+#endif
+	{ NULL, NULL, NULL, NULL, 0 }
+};
+
+static int
+mb_cmp(const void *a, const void *b)
+{
+	const double *x = a, *y = b;
+
+	return (*x < *y ? -1 : *x > *y);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: microbench [-l] [-r REPS] [-s SCALE] [NAME...]\n"
+	    "\n"
+	    "  -l        List the benchmarks\n"
+	    "  -r REPS   Repetitions of each benchmark (Default: 5)\n"
+	    "  -s SCALE  Scale the number of operations (Default: 1)\n"
+	    "  NAME      Only run the benchmarks with names starting so\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	const struct mb *mb;
+	double t[MB_MAX_REPS], t0, scale = 1.;
+	uint64_t n;
+	int i, o, reps = 5, list = 0;
+
+	while ((o = getopt(argc, argv, "lr:s:")) != -1) {
+		switch (o) {
+		case 'l':
+			list = 1;
+			break;
+		case 'r':
+			reps = atoi(optarg);
+			if (reps < 1 || reps > MB_MAX_REPS)
+				usage();
+			break;
+		case 's':
+			scale = atof(optarg);
+			if (scale <= 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	CONFIG = config_new();
+	AN(CONFIG);
+	CONFIG->LOG_LEVEL = 0;
+
+	if (!list)
+		printf("# name ops min_ns median_ns max_ns\n");
+	for (mb = mb_tab; mb->name != NULL; mb++) {
+		for (i = 0; i < argc; i++)
+			if (strncmp(mb->name, argv[i], strlen(argv[i])) == 0)
+				break;
+		if (argc > 0 && i == argc)
+			continue;
+		if (list) {
+			printf("%s\n", mb->name);
+			continue;
+		}
+
+		n = mb->n * scale;
+		if (n == 0)
+			n = 1;
+		if (mb->init != NULL)
+			mb->init();
+		for (i = 0; i < reps; i++) {
+			t0 = mb_now();
+			mb->run(n);
+			t[i] = (mb_now() - t0) * 1e9 / n;
+		}
+		if (mb->fini != NULL)
+			mb->fini();
+
+		qsort(t, reps, sizeof *t, mb_cmp);
+		printf("%s %ju %.2f %.2f %.2f\n", mb->name, (uintmax_t)n,
+		    t[0], t[reps / 2], t[reps - 1]);
+		fflush(stdout);
+	}
+	config_destroy(CONFIG);
+	return (0);
+}
@@ -23,5 +23,8 @@ char * HOCSP_fn(const char *certfn);
 int HOCSP_init_file(const char *ocspfn, sslctx *sc, int is_cached);
 void HOCSP_mktask(sslctx *sc, ocspquery *oq, double refresh_hint);
 void HOCSP_ev_stat(sslctx *sc);
+#ifndef OPENSSL_NO_TLSEXT
+int HOCSP_staple_cb(SSL *ssl, void *priv);
+#endif
 
 #endif   /* OCSP_H_INCLUDED */
@@ -0,0 +1,63 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#ifndef PROBES_H_INCLUDED
+#define PROBES_H_INCLUDED
+
+/*
+ * Statically defined tracepoints.
+ *
+ * When hitch is built with USDT support, every probe is a single nop in
+ * the provider "hitch" that bpftrace, perf or systemtap can attach to,
+ * for example:
+ *
+ *   bpftrace -e 'usdt:/usr/sbin/hitch:hitch:handshake__done
+ *       { @[arg3] = count(); }'
+ *
+ * The first three arguments of all probes are the proxystate pointer,
+ * the client fd and the backend fd. HPROBE_ARG() adds a fourth one, see
+ * the call sites for what it is. Without USDT support the probes
+ * compile to nothing and their arguments are not evaluated.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#  include <sys/sdt.h>
+#  define HPROBE(name, ps)						\
+	DTRACE_PROBE3(hitch, name, (ps), (ps)->fd_up, (ps)->fd_down)
+#  define HPROBE_ARG(name, ps, arg)					\
+	DTRACE_PROBE4(hitch, name, (ps), (ps)->fd_up, (ps)->fd_down,	\
+	    (arg))
+#else
+#  define HPROBE(name, ps)		do { } while (0)
+#  define HPROBE_ARG(name, ps, arg)	do { } while (0)
+#endif
+
+#endif /* PROBES_H_INCLUDED */
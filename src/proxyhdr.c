@@ -0,0 +1,186 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "proxyhdr.h"
+#include "proxyv2.h"
+#include "foreign/vas.h"
+
+union proxy_addr {
+	struct sockaddr		sa;
+	struct sockaddr_in	sa4;
+	struct sockaddr_in6	sa6;
+};
+
+size_t
+proxy_hdr_v1(char *buf, size_t len, const struct sockaddr *local,
+    const struct sockaddr *remote, socklen_t slen)
+{
+	char src_addr[INET6_ADDRSTRLEN+1], dst_addr[INET6_ADDRSTRLEN+1];
+	char src_port[8], dst_port[8];
+	int n;
+
+	n = getnameinfo(local, slen, dst_addr, sizeof dst_addr, dst_port,
+	    sizeof dst_port, NI_NUMERICHOST | NI_NUMERICSERV);
+	AZ(n);
+
+	n = getnameinfo(remote, slen, src_addr, sizeof src_addr, src_port,
+	    sizeof src_port, NI_NUMERICHOST | NI_NUMERICSERV);
+	AZ(n);
+
+	assert(local->sa_family == AF_INET || local->sa_family == AF_INET6);
+	n = snprintf(buf, len, "PROXY %s %s %s %s %s\r\n",
+	    local->sa_family == AF_INET ? "TCP4" : "TCP6",
+	    src_addr, dst_addr, src_port, dst_port);
+	assert(n > 0 && (size_t)n < len);
+	return (n);
+}
+
+size_t
+proxy_hdr_v2(char *buf, size_t len, const struct sockaddr *local,
+    const struct sockaddr *remote)
+{
+	struct pp2_hdr *p;
+	const union proxy_addr *l, *r;
+
+	assert(len >= 16 + 36);
+	p = (struct pp2_hdr *)buf;
+	l = (const union proxy_addr *)local;
+	r = (const union proxy_addr *)remote;
+
+	memcpy(&p->sig, PP2_SIG, sizeof PP2_SIG);
+	p->ver_cmd = PP2_VERSION|PP2_CMD_PROXY;
+	p->fam = l->sa.sa_family == AF_INET ?
+	    PP2_TRANS_STREAM|PP2_FAM_INET :
+	    PP2_TRANS_STREAM|PP2_FAM_INET6;
+
+	if (l->sa.sa_family == AF_INET) {
+		/* src/client */
+		memcpy(&p->addr.ipv4.src_addr, &r->sa4.sin_addr.s_addr,
+		    sizeof p->addr.ipv4.src_addr);
+		memcpy(&p->addr.ipv4.src_port, &r->sa4.sin_port,
+		    sizeof p->addr.ipv4.src_port);
+
+		/* dst/server */
+		memcpy(&p->addr.ipv4.dst_addr, &l->sa4.sin_addr.s_addr,
+		    sizeof p->addr.ipv4.dst_addr);
+		memcpy(&p->addr.ipv4.dst_port, &l->sa4.sin_port,
+		    sizeof p->addr.ipv4.dst_port);
+		return (16 + 12);
+	}
+
+	assert (l->sa.sa_family == AF_INET6);
+
+	/* src/client */
+	memcpy(&p->addr.ipv6.src_addr, &r->sa6.sin6_addr.s6_addr,
+	    sizeof p->addr.ipv6.src_addr);
+	memcpy(&p->addr.ipv6.src_port, &r->sa6.sin6_port,
+	    sizeof p->addr.ipv6.src_port);
+
+	/* dst/server */
+	memcpy(&p->addr.ipv6.dst_addr, &l->sa6.sin6_addr.s6_addr,
+	    sizeof p->addr.ipv6.dst_addr);
+	memcpy(&p->addr.ipv6.dst_port, &l->sa6.sin6_port,
+	    sizeof p->addr.ipv6.dst_port);
+	return (16 + 36);
+}
+
+int
+proxy_tlv_append(char *dst, ssize_t dstlen, unsigned type,
+    const char *val, ssize_t len)
+{
+	if (len == -1)
+		len = strlen(val);
+	if (dstlen < len + 3)
+		return (0);
+	dst[0] = type;
+	dst[1] = (len >> 8) & 0xff;
+	dst[2] = len & 0xff;
+	memcpy(dst + 3, val, len);
+	return (len + 3);
+}
+
+void
+proxy_hdr_v2_len(char *buf, size_t len)
+{
+	struct pp2_hdr *p;
+
+	assert(len >= 16 && len - 16 <= UINT16_MAX);
+	p = (struct pp2_hdr *)buf;
+	p->len = htons(len - 16);
+}
+
+/* The client address of a PROXY v1 line, returns -1 if it has none */
+int
+proxy_v1_src(const char *line, size_t len, struct sockaddr_storage *ss)
+{
+	union proxy_addr *pa;
+	char buf[108], *p, *e;
+	int af;
+
+	AN(line);
+	AN(ss);
+	if (len >= sizeof buf)
+		return (-1);
+	memcpy(buf, line, len);
+	buf[len] = '\0';
+	if (strncmp(buf, "PROXY TCP4 ", 11) == 0)
+		af = AF_INET;
+	else if (strncmp(buf, "PROXY TCP6 ", 11) == 0)
+		af = AF_INET6;
+	else
+		return (-1);
+	p = buf + 11;
+	e = strchr(p, ' ');
+	if (e == NULL)
+		return (-1);
+	*e = '\0';
+
+	memset(ss, 0, sizeof *ss);
+	pa = (void *)ss;
+	pa->sa.sa_family = af;
+	if (inet_pton(af, p, af == AF_INET ? (void *)&pa->sa4.sin_addr :
+	    (void *)&pa->sa6.sin6_addr) != 1)
+		return (-1);
+	return (0);
+}
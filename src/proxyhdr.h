@@ -0,0 +1,58 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#ifndef PROXYHDR_H_INCLUDED
+#define PROXYHDR_H_INCLUDED
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ * PROXY protocol headers sent to the backend ahead of the client's data.
+ *
+ * proxy_hdr_v2() only writes the fixed part of a v2 header. The caller
+ * may append TLVs with proxy_tlv_append(), and then sets the length of
+ * the header with proxy_hdr_v2_len().
+ *
+ * proxy_v1_src() goes the other way, and reads the client address of a
+ * v1 line received from a load balancer in front of Hitch.
+ */
+
+size_t proxy_hdr_v1(char *buf, size_t len, const struct sockaddr *local,
+    const struct sockaddr *remote, socklen_t slen);
+size_t proxy_hdr_v2(char *buf, size_t len, const struct sockaddr *local,
+    const struct sockaddr *remote);
+int proxy_tlv_append(char *dst, ssize_t dstlen, unsigned type,
+    const char *val, ssize_t len);
+void proxy_hdr_v2_len(char *buf, size_t len);
+int proxy_v1_src(const char *line, size_t len, struct sockaddr_storage *ss);
+
+#endif /* PROXYHDR_H_INCLUDED */
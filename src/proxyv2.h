@@ -37,7 +37,7 @@ struct pp2_hdr {
 	union pp2_addr	addr;
 }__attribute__((packed));
 
-const uint8_t PP2_SIG[12] = {
+static const uint8_t PP2_SIG[12] = {
     0x0D, 0x0A, 0x0D, 0x0A, 0x00, 0x0D,
     0x0A, 0x51, 0x55, 0x49, 0x54, 0x0A
 };
@@ -86,6 +86,7 @@ struct pp2_tlv {
 #define PP2_TYPE_NETNS		0x30
 
 #define PP2_TYPE_MIN_CUSTOM	0xE0
+#define PP2_TYPE_FINGERPRINT	0xE0	/* ClientHello JA3 hash, hex */
 #define PP2_TYPE_MAX_CUSTOM	0xEF
 
 #define PP2_TYPE_MIN_EXPERIMENT	0xF0
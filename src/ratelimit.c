@@ -0,0 +1,356 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#include "config.h"
+
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <netinet/in.h>
+
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/rand.h>
+
+#include "logging.h"
+#include "ratelimit.h"
+#include "stats.h"
+#include "foreign/vas.h"
+
+#ifndef MAP_ANONYMOUS
+#  define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* hitch.c */
+extern hitch_config *CONFIG;
+
+#define HRL_SPINS	100		/* Before yielding the CPU */
+#define HRL_YIELDS	100		/* Before checking on the owner */
+#define HRL_BACKOFF	50000L		/* Longest sleep in ns */
+
+enum hrl_kind {
+	HRL_FULL,
+	HRL_RESUMED,
+	HRL__MAX
+};
+
+struct hrl_entry {
+	uint8_t			addr[16];
+	int16_t			fe;
+	uint8_t			family;		/* 0 when free */
+	uint8_t			resumed;	/* Last handshake was */
+	float			tok[HRL__MAX];
+	double			t;		/* Last refill */
+};
+
+struct hrl_set {
+	pid_t			lock;		/* Owner, 0 if unlocked */
+	struct hrl_entry	e[HRL_WAYS];
+} __attribute__((aligned(64)));
+
+struct hrl_tbl {
+	uint32_t		seed;
+	struct hrl_set		set[HRL_SETS];
+};
+
+static struct hrl_tbl *hrl_tbl;
+
+/* Called by the master before forking any workers. Pages of the table
+ * are only backed by memory once a source lands in them. */
+int
+HRL_init(void)
+{
+	void *p;
+
+	AZ(hrl_tbl);
+	p = mmap(NULL, sizeof *hrl_tbl, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		ERR("{core} Unable to map handshake rate table: %s\n",
+		    strerror(errno));
+		return (-1);
+	}
+	hrl_tbl = p;
+	/* Keep clients from choosing the set they land in */
+	if (RAND_bytes((void *)&hrl_tbl->seed, sizeof hrl_tbl->seed) != 1)
+		hrl_tbl->seed = (uint32_t)getpid() ^ (uint32_t)time(NULL);
+	return (0);
+}
+
+void
+HRL_src(struct hrl_src *src, const struct sockaddr *sa, int prefix4,
+    int prefix6)
+{
+	const struct sockaddr_in6 *sin6;
+	int bits, i;
+
+	AN(src);
+	AN(sa);
+	memset(src, 0, sizeof *src);
+	if (sa->sa_family == AF_INET) {
+		memcpy(src->addr,
+		    &((const struct sockaddr_in *)(const void *)sa)->sin_addr,
+		    4);
+		src->family = AF_INET;
+		bits = prefix4;
+	} else if (sa->sa_family == AF_INET6) {
+		sin6 = (const void *)sa;
+		if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+			memcpy(src->addr, sin6->sin6_addr.s6_addr + 12, 4);
+			src->family = AF_INET;
+			bits = prefix4;
+		} else {
+			memcpy(src->addr, sin6->sin6_addr.s6_addr, 16);
+			src->family = AF_INET6;
+			bits = prefix6;
+		}
+	} else
+		return;
+
+	for (i = 0; i < 16; i++, bits -= 8) {
+		if (bits <= 0)
+			src->addr[i] = 0;
+		else if (bits < 8)
+			src->addr[i] &= 0xff << (8 - bits);
+	}
+}
+
+/* 'fp' is HFP_LEN bytes, the size of an address */
+void
+HRL_src_fingerprint(struct hrl_src *src, const uint8_t *fp)
+{
+
+	AN(src);
+	AN(fp);
+	memcpy(src->addr, fp, sizeof src->addr);
+	src->family = HRL_FINGERPRINT;
+}
+
+static struct hrl_set *
+hrl_set(const struct hrl_src *src, int fe)
+{
+	uint32_t h;
+	unsigned u;
+
+	/* FNV-1a */
+	h = 2166136261U ^ hrl_tbl->seed;
+	for (u = 0; u < sizeof src->addr; u++)
+		h = (h ^ src->addr[u]) * 16777619U;
+	h = (h ^ src->family) * 16777619U;
+	h = (h ^ (uint8_t)fe) * 16777619U;
+	return (&hrl_tbl->set[h % HRL_SETS]);
+}
+
+static void
+hrl_lock(struct hrl_set *s)
+{
+	struct timespec ts;
+	pid_t me, owner;
+	unsigned n = 0;
+	long ns = 1000;
+
+	me = getpid();
+	while (1) {
+		owner = 0;
+		if (__atomic_compare_exchange_n(&s->lock, &owner, me, 0,
+		    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return;
+		if (++n < HRL_SPINS)
+			continue;
+		if (n < HRL_SPINS + HRL_YIELDS) {
+			(void)sched_yield();
+			continue;
+		}
+
+		/* Take over the lock of a process killed holding it */
+		if (kill(owner, 0) != 0 && errno == ESRCH) {
+			(void)__atomic_compare_exchange_n(&s->lock, &owner, 0,
+			    0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+			continue;
+		}
+
+		/* The owner may be descheduled, stop competing with it */
+		ts.tv_sec = 0;
+		ts.tv_nsec = ns;
+		(void)nanosleep(&ts, NULL);
+		if (ns < HRL_BACKOFF)
+			ns *= 2;
+		n = HRL_SPINS;
+	}
+}
+
+static void
+hrl_unlock(struct hrl_set *s)
+{
+
+	__atomic_store_n(&s->lock, 0, __ATOMIC_RELEASE);
+}
+
+static float
+hrl_cap(unsigned rate)
+{
+
+	return ((float)rate * HRL_BURST);
+}
+
+static void
+hrl_refill(struct hrl_entry *e, const struct hrl_rates *r, double now)
+{
+	double d;
+
+	/* The clocks of the workers may be a little apart */
+	d = now - e->t;
+	if (d <= 0)
+		return;
+	e->t = now;
+	e->tok[HRL_FULL] += d * r->full;
+	if (e->tok[HRL_FULL] > hrl_cap(r->full))
+		e->tok[HRL_FULL] = hrl_cap(r->full);
+	e->tok[HRL_RESUMED] += d * r->resumed;
+	if (e->tok[HRL_RESUMED] > hrl_cap(r->resumed))
+		e->tok[HRL_RESUMED] = hrl_cap(r->resumed);
+}
+
+/* The entry of a source, taking a free one or the least recently seen
+ * one of its set if it has none. Called with the set locked. */
+static struct hrl_entry *
+hrl_get(struct hrl_set *s, const struct hrl_src *src, int fe,
+    const struct hrl_rates *r, double now)
+{
+	struct hrl_entry *e, *old = NULL;
+	unsigned u;
+
+	for (u = 0; u < HRL_WAYS; u++) {
+		e = &s->e[u];
+		if (e->family == src->family && e->fe == fe &&
+		    memcmp(e->addr, src->addr, sizeof e->addr) == 0) {
+			hrl_refill(e, r, now);
+			return (e);
+		}
+		if (old == NULL ||
+		    (old->family != 0 && (e->family == 0 || e->t < old->t)))
+			old = e;
+	}
+
+	AN(old);
+	if (old->family != 0)
+		HSTAT_INC(rate_evictions);
+	memcpy(old->addr, src->addr, sizeof old->addr);
+	old->family = src->family;
+	old->fe = fe;
+	old->resumed = 0;
+	old->tok[HRL_FULL] = hrl_cap(r->full);
+	old->tok[HRL_RESUMED] = hrl_cap(r->resumed);
+	old->t = now;
+	return (old);
+}
+
+/* Returns -1 if the source is to be refused at accept */
+int
+HRL_accept(const struct hrl_src *src, int fe, const struct hrl_rates *r,
+    double now)
+{
+	struct hrl_set *s;
+	struct hrl_entry *e;
+	int ok;
+
+	AN(src);
+	AN(r);
+	if (hrl_tbl == NULL || src->family == 0 || r->full == 0)
+		return (0);
+	s = hrl_set(src, fe);
+	hrl_lock(s);
+	e = hrl_get(s, src, fe, r, now);
+	ok = e->tok[HRL_FULL] >= 1 || (e->resumed &&
+	    (r->resumed == 0 || e->tok[HRL_RESUMED] >= 1));
+	hrl_unlock(s);
+	return (ok ? 0 : -1);
+}
+
+/* Takes a token for a handshake offering, or not, to resume a session.
+ * Returns -1 if there is none left. */
+int
+HRL_hello(const struct hrl_src *src, int fe, const struct hrl_rates *r,
+    int resume, double now)
+{
+	struct hrl_set *s;
+	struct hrl_entry *e;
+	enum hrl_kind k;
+	int ok = 0;
+
+	AN(src);
+	AN(r);
+	k = resume ? HRL_RESUMED : HRL_FULL;
+	if (hrl_tbl == NULL || src->family == 0 ||
+	    (k == HRL_FULL ? r->full : r->resumed) == 0)
+		return (0);
+	s = hrl_set(src, fe);
+	hrl_lock(s);
+	e = hrl_get(s, src, fe, r, now);
+	if (e->tok[k] >= 1) {
+		e->tok[k] -= 1;
+		ok = 1;
+	}
+	hrl_unlock(s);
+	return (ok ? 0 : -1);
+}
+
+/* Records how a handshake ended. One that was charged as a resumption
+ * but turned out to be a full handshake is charged again, and may leave
+ * the source owing tokens for up to HRL_BURST seconds. */
+void
+HRL_done(const struct hrl_src *src, int fe, const struct hrl_rates *r,
+    int offered, int resumed, double now)
+{
+	struct hrl_set *s;
+	struct hrl_entry *e;
+
+	AN(src);
+	AN(r);
+	if (hrl_tbl == NULL || src->family == 0 ||
+	    (r->full == 0 && r->resumed == 0))
+		return;
+	s = hrl_set(src, fe);
+	hrl_lock(s);
+	e = hrl_get(s, src, fe, r, now);
+	e->resumed = resumed ? 1 : 0;
+	if (offered && !resumed && r->full > 0) {
+		e->tok[HRL_FULL] -= 1;
+		if (e->tok[HRL_FULL] < -hrl_cap(r->full))
+			e->tok[HRL_FULL] = -hrl_cap(r->full);
+	}
+	hrl_unlock(s);
+}
@@ -0,0 +1,94 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#ifndef RATELIMIT_H_INCLUDED
+#define RATELIMIT_H_INCLUDED
+
+#include <sys/socket.h>
+
+#include <stdint.h>
+
+/*
+ * Handshake rate limits per client source.
+ *
+ * The master maps a table of token buckets, shared by all the workers
+ * and all their generations, keyed by frontend and by client address
+ * truncated to a prefix. Each source has two buckets: one for full
+ * handshakes and one for resumed handshakes, refilled at the rates of
+ * its frontend and holding up to HRL_BURST seconds worth of tokens.
+ *
+ * A connection is checked when accepted, or once its PROXY line gave
+ * the real client address, and then charged when its ClientHello
+ * tells whether it tries to resume a session. A source that used up
+ * its full handshakes, and did not resume its last handshake, is
+ * refused right at accept, before any TLS state is allocated for it.
+ *
+ * Sources can also be ClientHello fingerprints, with fingerprint-rate
+ * full handshakes per second for each across all the frontends. Those
+ * are only checked at the ClientHello.
+ *
+ * The table is set associative, each set under a spin lock holding the
+ * pid of its owner, so that the lock of a killed worker can be taken
+ * over. Sources beyond the capacity of a set evict the one seen least
+ * recently.
+ */
+
+#define HRL_BURST	2
+#define HRL_SETS	8192
+#define HRL_WAYS	8
+
+/* Family of the sources keyed by ClientHello fingerprint */
+#define HRL_FINGERPRINT	0xff
+
+/* A client address, truncated to the prefix, family 0 if unlimited */
+struct hrl_src {
+	uint8_t			addr[16];
+	uint8_t			family;
+};
+
+/* Handshakes per second, 0 for no limit */
+struct hrl_rates {
+	unsigned		full;
+	unsigned		resumed;
+};
+
+int HRL_init(void);
+void HRL_src(struct hrl_src *src, const struct sockaddr *sa, int prefix4,
+    int prefix6);
+void HRL_src_fingerprint(struct hrl_src *src, const uint8_t *fp);
+int HRL_accept(const struct hrl_src *src, int fe, const struct hrl_rates *r,
+    double now);
+int HRL_hello(const struct hrl_src *src, int fe, const struct hrl_rates *r,
+    int resume, double now);
+void HRL_done(const struct hrl_src *src, int fe, const struct hrl_rates *r,
+    int offered, int resumed, double now);
+
+#endif /* RATELIMIT_H_INCLUDED */
@@ -30,6 +30,7 @@
   **/
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "foreign/vas.h"
 #include "ringbuffer.h"
@@ -96,6 +97,25 @@ ringbuffer_read_pop(ringbuffer *rb)
 }
 
 
+/* Copy up to len of the unconsumed bytes to dst, from the head on.
+ * Returns how many unconsumed bytes there are in all. */
+size_t
+ringbuffer_peek(const ringbuffer *rb, char *dst, size_t len)
+{
+	const bufent *b;
+	size_t n = 0, l;
+	int i;
+
+	for (i = 0, b = rb->head; i < rb->used; i++, b = b->next) {
+		if (n < len) {
+			l = b->left < len - n ? b->left : len - n;
+			memcpy(dst + n, b->ptr, l);
+		}
+		n += b->left;
+	}
+	return (n);
+}
+
 /** WRITE FUNCTIONS **/
 
 /* Return the tail ptr (current target of new writes) */
@@ -129,6 +149,13 @@ ringbuffer_size(ringbuffer *rb)
     return (rb->used);
 }
 
+/* Memory held by the slots of the ringbuffer */
+size_t
+ringbuffer_bytes(const ringbuffer *rb)
+{
+    return ((size_t)rb->num_slots * rb->data_len);
+}
+
 /* Used size of the ringbuffer */
 int
 ringbuffer_capacity(ringbuffer *rb)
@@ -59,11 +59,13 @@ void ringbuffer_cleanup(ringbuffer *rb);
 char * ringbuffer_read_next(ringbuffer *rb, int * length);
 void ringbuffer_read_skip(ringbuffer *rb, int length);
 void ringbuffer_read_pop(ringbuffer *rb);
+size_t ringbuffer_peek(const ringbuffer *rb, char *dst, size_t len);
 
 char * ringbuffer_write_ptr(ringbuffer *rb);
 void ringbuffer_write_append(ringbuffer *rb, int length);
 
 int ringbuffer_size(ringbuffer *rb);
+size_t ringbuffer_bytes(const ringbuffer *rb);
 int ringbuffer_capacity(ringbuffer *rb);
 int ringbuffer_is_empty(ringbuffer *rb);
 int ringbuffer_is_full(ringbuffer *rb);
@@ -11,8 +11,9 @@
 
 #include <sys/mman.h>
 
+#include <unistd.h>
+
 #ifdef USE_SYSCALL_FUTEX
-#  include <unistd.h>
 #  include <linux/futex.h>
 #  include <sys/syscall.h>
 #else
@@ -45,6 +46,8 @@ struct shared_context {
 
 /* Static shared context */
 static struct shared_context *shctx = NULL;
+static size_t shctx_len;
+static int shctx_fd = -1;
 
 /* Callbacks */
 shsess_new_f *shared_session_new_cbk;
@@ -370,12 +373,26 @@ shared_context_alloc(int size)
 
 	assert(size > 0);
 
-	shctx = mmap(NULL,
-	    sizeof *shctx + (size * sizeof(struct shared_session)),
-	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
-
-	if (shctx == MAP_FAILED)
+	shctx_len = sizeof *shctx + (size * sizeof(struct shared_session));
+#ifdef HAVE_MEMFD_CREATE
+	/* Backed by a descriptor, to hand it over in a hot upgrade */
+	shctx_fd = memfd_create("hitch-shctx", MFD_CLOEXEC);
+	if (shctx_fd >= 0 && ftruncate(shctx_fd, shctx_len) != 0) {
+		(void)close(shctx_fd);
+		shctx_fd = -1;
+	}
+#endif
+	if (shctx_fd >= 0)
+		shctx = mmap(NULL, shctx_len, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, shctx_fd, 0);
+	else
+		shctx = mmap(NULL, shctx_len, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (shctx == MAP_FAILED) {
+		shctx = NULL;
 		return (-1);
+	}
 
 #ifdef USE_SYSCALL_FUTEX
 	shctx->waiters = 0;
@@ -426,3 +443,41 @@ shared_context_init(SSL_CTX *ctx, int size)
 
 	return (ret);
 }
+
+/* The descriptor of the shared memory, or -1, with where it is mapped
+ * and its size. */
+int
+shared_context_fd(void **addr, size_t *len)
+{
+
+	AN(addr);
+	AN(len);
+	*addr = shctx;
+	*len = shctx_len;
+	return (shctx_fd);
+}
+
+/* Map the shared memory of the master before a hot upgrade. It must go
+ * at the same address, since the sessions point to each other, and be
+ * of the same size. Returns -1 if it can not be used. */
+int
+shared_context_attach(int fd, void *addr, size_t len, int size)
+{
+	void *p;
+
+	AZ(shctx);
+	if (size <= 0 ||
+	    len != sizeof *shctx + (size * sizeof(struct shared_session)))
+		return (-1);
+	p = mmap(addr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		return (-1);
+	if (p != addr) {
+		(void)munmap(p, len);
+		return (-1);
+	}
+	shctx = p;
+	shctx_len = len;
+	shctx_fd = fd;
+	return (0);
+}
@@ -57,4 +57,8 @@ void shctx_sess_add(const unsigned char *sess, unsigned len, long cdate);
  * perform callbacks registration */
 int shared_context_init(SSL_CTX *ctx, int size);
 
+/* Hand the shared memory over to a new master in a hot upgrade */
+int shared_context_fd(void **addr, size_t *len);
+int shared_context_attach(int fd, void *addr, size_t len, int size);
+
 #endif /* SHCTX_H */
@@ -0,0 +1,99 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "sni.h"
+#include "foreign/miniobj.h"
+#include "foreign/uthash.h"
+#include "foreign/vas.h"
+
+char *
+sni_build_key(const char *servername)
+{
+	char *key, *c;
+
+	if (servername == NULL)
+		return (NULL);
+
+	AN(servername);
+	key = strdup(servername);
+
+	for (c = key; *c != '\0'; c++)
+		*c = tolower(*c);
+	return (key);
+}
+
+#ifndef OPENSSL_NO_TLSEXT
+static int
+sni_match(const sni_name *sn, const char *srvname)
+{
+	if (!sn->is_wildcard)
+		return (strcasecmp(srvname, sn->sni_key) == 0);
+	else {
+		char *s = strchr(srvname, '.');
+		if (s == NULL)
+			return (0);
+		return (strcasecmp(s, sn->sni_key + 1) == 0);
+	}
+}
+
+const sslctx *
+sni_lookup(const char *sni_key, const sni_name *sn_tab)
+{
+	const sni_name *sn;
+
+	AN(sni_key);
+	CHECK_OBJ_NOTNULL(sn_tab, SNI_NAME_MAGIC);
+
+	HASH_FIND_STR(sn_tab, sni_key, sn);
+	if (sn == NULL) {
+		char *s;
+		/* attempt another lookup for wildcard matches */
+		s = strchr(sni_key, '.');
+		if (s != NULL)
+			HASH_FIND_STR(sn_tab, s, sn);
+	}
+
+	if (sn != NULL) {
+		CHECK_OBJ_NOTNULL(sn, SNI_NAME_MAGIC);
+		if (sni_match(sn, sni_key))
+			return (sn->sctx);
+	}
+
+	return (NULL);
+}
+#endif /* OPENSSL_NO_TLSEXT */
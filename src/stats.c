@@ -0,0 +1,1217 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#include "config.h"
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "stats.h"
+#include "foreign/miniobj.h"
+#include "foreign/vas.h"
+#include "foreign/vqueue.h"
+
+#ifndef MAP_ANONYMOUS
+#  define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/* hitch.c */
+extern hitch_config *CONFIG;
+
+#define HSTAT_SESS_TIMEOUT	5.0
+#define HSTAT_REQ_LEN		1024
+#define HSTAT_MAX_LISTEN	2
+#define HSTAT_HS_MIN		1e-4
+#define HSTAT_NAME_LEN		48
+
+#define HSTAT_CT_TEXT		"text/plain"
+#define HSTAT_CT_OPENMETRICS						\
+	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+struct hstat_hist {
+	uint64_t		bucket[HSTAT_HIST_BUCKETS + 1];
+	double			sum;
+};
+
+/* Handshake durations by cipher and key exchange group. The last
+ * slot collects whatever does not fit in the others. */
+struct hstat_hs {
+	char			cipher[HSTAT_NAME_LEN];
+	char			group[HSTAT_NAME_LEN];
+	struct hstat_hist	full;
+	struct hstat_hist	resumed;
+};
+
+/* Everything a worker counts */
+struct hstat_all {
+	struct hstat_counters	c;
+	struct hstat_fe_counters fe[HSTAT_MAX_FE];
+	struct hstat_hist	h[HSTAT_H__MAX];
+	struct hstat_hs		hs[HSTAT_MAX_HS];
+};
+
+struct hstat_slab {
+	unsigned		magic;
+#define HSTAT_SLAB_MAGIC	0x7a3e05c1
+	pid_t			pid;
+	int			core_id;
+	unsigned		gen;
+	double			drain_t0;
+	uint64_t		drain_conns;
+	double			cpu;
+	struct hstat_all	a;
+} __attribute__((aligned(64)));
+
+/* A connection to the stats socket */
+struct hstat_sess {
+	unsigned		magic;
+#define HSTAT_SESS_MAGIC	0x1d6f8b32
+	int			fd;
+	ev_io			ev_r;
+	ev_io			ev_w;
+	ev_timer		ev_t;
+	char			req[HSTAT_REQ_LEN];
+	size_t			req_len;
+	struct vsb		*resp;
+	ssize_t			resp_off;
+	VTAILQ_ENTRY(hstat_sess)	list;
+};
+
+static VTAILQ_HEAD(, hstat_sess) hstat_sessions =
+    VTAILQ_HEAD_INITIALIZER(hstat_sessions);
+
+/* Passed through the certificate iterator */
+struct hstat_cert_priv {
+	unsigned		magic;
+#define HSTAT_CERT_PRIV_MAGIC	0x52c90e4d
+	struct vsb		*vsb;
+	double			now;
+	int			openmetrics;
+	int			staple;
+};
+
+static const double hstat_hist_min[HSTAT_H__MAX] = {
+#define HSTAT_HIST(n, m, d)	m,
+#include "stats_hist_tbl.h"
+#undef HSTAT_HIST
+};
+
+/* Processes without a slab (the master, the ocsp process, or a
+ * worker that did not get one) count into this. */
+static struct hstat_all hstat_private;
+struct hstat_counters *hstat = &hstat_private.c;
+struct hstat_fe_counters *hstat_fe = hstat_private.fe;
+static struct hstat_hist *hstat_hist = hstat_private.h;
+static struct hstat_hs *hstat_hs = hstat_private.hs;
+
+static struct hstat_slab *hstat_slabs;
+static unsigned hstat_nslab;
+static struct hstat_slab *hstat_self;
+
+/* Counters of reaped workers. Only ever touched by the master. */
+static struct hstat_all hstat_retired;
+static double hstat_t0;
+static unsigned hstat_gen;
+
+/* Frontend names, indexed like hstat_fe, the number of frontends
+ * using each index, and the generation that last used a released one.
+ * A frontend keeps its index over a reload, and with it its counters.
+ * The index of a removed frontend goes to another one once the workers
+ * that counted into it are gone. */
+static char *hstat_fe_name[HSTAT_MAX_FE];
+static unsigned hstat_fe_refs[HSTAT_MAX_FE];
+static unsigned hstat_fe_gen[HSTAT_MAX_FE];
+
+static pid_t hstat_master;
+static int hstat_fd[HSTAT_MAX_LISTEN] = { -1, -1 };
+static unsigned hstat_nfd;
+static ev_io hstat_listener[HSTAT_MAX_LISTEN];
+static char *hstat_path;
+static struct ev_loop *hstat_loop;
+static hstat_cert_iter_f *hstat_cert_iter;
+
+int
+HSTAT_init(unsigned nslab)
+{
+	void *p;
+
+	AZ(hstat_slabs);
+	AN(nslab);
+	p = mmap(NULL, nslab * sizeof *hstat_slabs, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		ERR("{core} Unable to map statistics segment: %s\n",
+		    strerror(errno));
+		return (-1);
+	}
+	hstat_slabs = p;
+	hstat_nslab = nslab;
+	hstat_t0 = Time_now();
+	return (0);
+}
+
+/* Called by the master before forking a worker. */
+struct hstat_slab *
+HSTAT_slab_alloc(int core_id, unsigned gen)
+{
+	struct hstat_slab *s;
+	unsigned u;
+
+	if (hstat_slabs == NULL)
+		return (NULL);
+
+	for (u = 0; u < hstat_nslab; u++) {
+		s = &hstat_slabs[u];
+		if (s->magic != 0)
+			continue;
+		memset(s, 0, sizeof *s);
+		s->magic = HSTAT_SLAB_MAGIC;
+		s->core_id = core_id;
+		s->gen = gen;
+		return (s);
+	}
+
+	ERR("{core} No free statistics slab for worker %d (gen: %u)\n",
+	    core_id, gen);
+	return (NULL);
+}
+
+void
+HSTAT_slab_pid(struct hstat_slab *s, pid_t pid)
+{
+	if (s == NULL)
+		return;
+	CHECK_OBJ(s, HSTAT_SLAB_MAGIC);
+	s->pid = pid;
+}
+
+/* Active connections of a worker, as last published by it */
+uint64_t
+HSTAT_slab_conns(const struct hstat_slab *s)
+{
+	if (s == NULL)
+		return (0);
+	CHECK_OBJ(s, HSTAT_SLAB_MAGIC);
+	return (s->a.c.conns);
+}
+
+/* CPU time used by a worker, as last published by it */
+double
+HSTAT_slab_cpu(const struct hstat_slab *s)
+{
+	if (s == NULL)
+		return (0.);
+	CHECK_OBJ(s, HSTAT_SLAB_MAGIC);
+	return (s->cpu);
+}
+
+/* Called in a child right after fork(): the stats listeners and their
+ * sessions belong to the master. */
+void
+HSTAT_close_fds(void)
+{
+	struct hstat_sess *hs;
+	unsigned u;
+
+	VTAILQ_FOREACH(hs, &hstat_sessions, list)
+		(void)close(hs->fd);
+	for (u = 0; u < hstat_nfd; u++) {
+		(void)close(hstat_fd[u]);
+		hstat_fd[u] = -1;
+	}
+	hstat_nfd = 0;
+}
+
+/* Called by the worker right after fork() */
+void
+HSTAT_slab_attach(struct hstat_slab *s)
+{
+
+	if (s == NULL)
+		return;
+	CHECK_OBJ(s, HSTAT_SLAB_MAGIC);
+	hstat_self = s;
+	hstat = &s->a.c;
+	hstat_fe = s->a.fe;
+	hstat_hist = s->a.h;
+	hstat_hs = s->a.hs;
+}
+
+static void
+hstat_hist_sum(struct hstat_hist *dst, const struct hstat_hist *src)
+{
+	unsigned u;
+
+	for (u = 0; u <= HSTAT_HIST_BUCKETS; u++)
+		dst->bucket[u] += src->bucket[u];
+	dst->sum += src->sum;
+}
+
+static struct hstat_hs *
+hstat_hs_find(struct hstat_hs *tbl, const char *cipher, const char *group)
+{
+	struct hstat_hs *hs;
+	unsigned u;
+
+	for (u = 0; u < HSTAT_MAX_HS - 1; u++) {
+		hs = &tbl[u];
+		if (hs->cipher[0] == '\0') {
+			(void)snprintf(hs->group, sizeof hs->group, "%s", group);
+			(void)snprintf(hs->cipher, sizeof hs->cipher, "%s",
+			    cipher);
+			return (hs);
+		}
+		if (strncmp(hs->cipher, cipher, sizeof hs->cipher - 1) == 0 &&
+		    strncmp(hs->group, group, sizeof hs->group - 1) == 0)
+			return (hs);
+	}
+	hs = &tbl[u];
+	if (hs->cipher[0] == '\0') {
+		strcpy(hs->group, "other");
+		strcpy(hs->cipher, "other");
+	}
+	return (hs);
+}
+
+/* Add the counters of 'src' to 'dst'. Gauges are only carried over
+ * if 'gauges' is set, and minimums only kept when lower. */
+static void
+hstat_sum(struct hstat_all *dst, const struct hstat_all *src, int gauges)
+{
+	struct hstat_hs *hs;
+	unsigned u;
+
+#define hstat_sum_counter(n)	dst->c.n += src->c.n;
+#define hstat_sum_gauge(n)	if (gauges) dst->c.n += src->c.n;
+#define hstat_sum_minimum(n)						\
+	if (gauges && src->c.n != 0 &&					\
+	    (dst->c.n == 0 || src->c.n < dst->c.n))			\
+		dst->c.n = src->c.n;
+#define HSTAT_FIELD(n, t, d)	hstat_sum_##t(n)
+#include "stats_tbl.h"
+#undef HSTAT_FIELD
+#undef hstat_sum_minimum
+#undef hstat_sum_gauge
+#undef hstat_sum_counter
+
+	for (u = 0; u < HSTAT_MAX_FE; u++) {
+#define hstat_sum_counter(n)	dst->fe[u].n += src->fe[u].n;
+#define hstat_sum_gauge(n)	if (gauges) dst->fe[u].n += src->fe[u].n;
+#define HSTAT_FE_FIELD(n, t, d)	hstat_sum_##t(n)
+#include "stats_fe_tbl.h"
+#undef HSTAT_FE_FIELD
+#undef hstat_sum_gauge
+#undef hstat_sum_counter
+	}
+
+	for (u = 0; u < HSTAT_H__MAX; u++)
+		hstat_hist_sum(&dst->h[u], &src->h[u]);
+
+	for (u = 0; u < HSTAT_MAX_HS; u++) {
+		if (src->hs[u].cipher[0] == '\0')
+			break;
+		hs = hstat_hs_find(dst->hs, src->hs[u].cipher,
+		    src->hs[u].group);
+		hstat_hist_sum(&hs->full, &src->hs[u].full);
+		hstat_hist_sum(&hs->resumed, &src->hs[u].resumed);
+	}
+}
+
+/* Called by a worker as it starts draining, to report its progress */
+void
+HSTAT_drain(void)
+{
+	if (hstat_self == NULL)
+		return;
+	CHECK_OBJ(hstat_self, HSTAT_SLAB_MAGIC);
+	hstat_self->drain_conns = hstat->conns;
+	hstat_self->drain_t0 = Time_now();
+}
+
+/* Called by a worker every second, for the master to tell how busy it
+ * is */
+void
+HSTAT_cpu(void)
+{
+	struct rusage ru;
+
+	if (hstat_self == NULL || getrusage(RUSAGE_SELF, &ru) != 0)
+		return;
+	CHECK_OBJ(hstat_self, HSTAT_SLAB_MAGIC);
+	hstat_self->cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+	    (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+}
+
+/* Called by the master when the worker owning the slab is reaped. */
+void
+HSTAT_slab_free(struct hstat_slab *s)
+{
+	if (s == NULL)
+		return;
+	CHECK_OBJ(s, HSTAT_SLAB_MAGIC);
+	hstat_sum(&hstat_retired, &s->a, 0);
+	memset(s, 0, sizeof *s);
+}
+
+/* Whether no worker left counts into a released frontend index */
+static int
+hstat_fe_free(int i)
+{
+	const struct hstat_slab *s;
+	unsigned u;
+
+	if (hstat_fe_refs[i] != 0)
+		return (0);
+	for (u = 0; u < hstat_nslab; u++) {
+		s = &hstat_slabs[u];
+		if (s->magic == HSTAT_SLAB_MAGIC && s->gen <= hstat_fe_gen[i])
+			return (0);
+	}
+	return (1);
+}
+
+/* Called by the master when a frontend is created. Returns the index
+ * to use with HSTAT_FE_INC() and friends, or -1 if there is none. */
+int
+HSTAT_fe_register(const char *name)
+{
+	int i, j = -1;
+
+	AN(name);
+	for (i = 0; i < HSTAT_MAX_FE; i++) {
+		if (hstat_fe_name[i] == NULL)
+			break;
+		if (strcmp(hstat_fe_name[i], name) == 0) {
+			hstat_fe_refs[i]++;
+			return (i);
+		}
+		if (j < 0 && hstat_fe_free(i))
+			j = i;
+	}
+	if (i == HSTAT_MAX_FE && j < 0) {
+		LOG("{core} Too many frontends, no statistics for %s\n",
+		    name);
+		return (-1);
+	}
+	if (i == HSTAT_MAX_FE) {
+		/* The counters of the frontend removed go with it */
+		i = j;
+		free(hstat_fe_name[i]);
+		memset(&hstat_retired.fe[i], 0, sizeof hstat_retired.fe[i]);
+		memset(&hstat_private.fe[i], 0, sizeof hstat_private.fe[i]);
+	}
+	hstat_fe_name[i] = strdup(name);
+	AN(hstat_fe_name[i]);
+	hstat_fe_refs[i] = 1;
+	return (i);
+}
+
+/* Called by the master when a frontend is destroyed */
+void
+HSTAT_fe_release(int i)
+{
+
+	if (i < 0)
+		return;
+	assert(i < HSTAT_MAX_FE);
+	AN(hstat_fe_refs[i]);
+	if (--hstat_fe_refs[i] == 0)
+		hstat_fe_gen[i] = hstat_gen;
+}
+
+/* Upper bound of bucket 'i' */
+static double
+hstat_hist_bound(double min, unsigned i)
+{
+	if (i == 0)
+		return (min);
+	if (i >= HSTAT_HIST_BUCKETS)
+		return (HUGE_VAL);
+	i--;
+	for (; i >= HSTAT_HIST_SUB; i -= HSTAT_HIST_SUB)
+		min *= 2;
+	return (min * (1. + (i + 1.) / HSTAT_HIST_SUB));
+}
+
+static void
+hstat_hist_add(struct hstat_hist *h, double min, double v)
+{
+	double b = min;
+	unsigned o, j;
+
+	if (!(v > b)) {
+		h->bucket[0]++;
+		h->sum += v > 0. ? v : 0.;
+		return;
+	}
+	h->sum += v;
+
+	/* Find the power of two, then the linear step within it */
+	for (o = 0; v > 2 * b; o++, b *= 2) {
+		if (o + 1 == HSTAT_HIST_OCTAVES) {
+			h->bucket[HSTAT_HIST_BUCKETS]++;
+			return;
+		}
+	}
+	for (j = 1; j < HSTAT_HIST_SUB; j++)
+		if (v <= b * (1. + (double)j / HSTAT_HIST_SUB))
+			break;
+	h->bucket[o * HSTAT_HIST_SUB + j]++;
+}
+
+/* Estimate a quantile as the upper bound of the bucket it falls in */
+static double
+hstat_hist_quantile(const struct hstat_hist *h, double min, double q)
+{
+	uint64_t n = 0, t = 0;
+	unsigned u;
+
+	for (u = 0; u <= HSTAT_HIST_BUCKETS; u++)
+		n += h->bucket[u];
+	if (n == 0)
+		return (0.);
+	for (u = 0; u < HSTAT_HIST_BUCKETS; u++) {
+		t += h->bucket[u];
+		if (t >= q * n)
+			break;
+	}
+	return (hstat_hist_bound(min, u));
+}
+
+void
+HSTAT_observe(enum hstat_hist_e e, double v)
+{
+	assert(e < HSTAT_H__MAX);
+	hstat_hist_add(&hstat_hist[e], hstat_hist_min[e], v);
+}
+
+void
+HSTAT_handshake(const char *cipher, const char *group, int resumed,
+    double v)
+{
+	struct hstat_hs *hs;
+
+	if (cipher == NULL || *cipher == '\0')
+		cipher = "unknown";
+	hs = hstat_hs_find(hstat_hs, cipher, group != NULL ? group : "");
+	hstat_hist_add(resumed ? &hs->resumed : &hs->full, HSTAT_HS_MIN, v);
+}
+
+void
+HSTAT_worker_gen(unsigned gen)
+{
+	hstat_gen = gen;
+}
+
+static void
+hstat_total(struct hstat_all *tot)
+{
+	struct hstat_slab *s;
+	unsigned u;
+
+	*tot = hstat_retired;
+	/* What the master counts itself */
+	hstat_sum(tot, &hstat_private, 1);
+	for (u = 0; u < hstat_nslab; u++) {
+		s = &hstat_slabs[u];
+		if (s->magic != HSTAT_SLAB_MAGIC)
+			continue;
+		hstat_sum(tot, &s->a, 1);
+	}
+}
+
+/* Label values are escaped as per the OpenMetrics specification */
+static void
+hstat_label(struct vsb *vsb, const char *name, const char *val)
+{
+	VSB_printf(vsb, "%s=\"", name);
+	for (; *val != '\0'; val++) {
+		if (*val == '\\' || *val == '"')
+			VSB_printf(vsb, "\\%c", *val);
+		else if (*val == '\n')
+			VSB_cat(vsb, "\\n");
+		else
+			VSB_putc(vsb, *val);
+	}
+	VSB_putc(vsb, '"');
+}
+
+static void
+hstat_cert(void *priv, const char *cert, const char *fe,
+    double not_after, double staple_mtime)
+{
+	struct hstat_cert_priv *cp;
+	const char *name;
+	double v;
+
+	CAST_OBJ_NOTNULL(cp, priv, HSTAT_CERT_PRIV_MAGIC);
+	AN(cert);
+
+	if (cp->staple) {
+		if (staple_mtime < 0)
+			return;
+		name = cp->openmetrics ? "hitch_ocsp_staple_age_seconds" :
+		    "ocsp_staple_age";
+		v = cp->now - staple_mtime;
+	} else {
+		if (not_after < 0)
+			return;
+		name = cp->openmetrics ?
+		    "hitch_cert_not_after_timestamp_seconds" : "cert_expiry";
+		v = cp->openmetrics ? not_after : not_after - cp->now;
+	}
+
+	VSB_printf(cp->vsb, "%s{", name);
+	hstat_label(cp->vsb, "cert", cert);
+	if (fe != NULL) {
+		VSB_putc(cp->vsb, ',');
+		hstat_label(cp->vsb, "frontend", fe);
+	}
+	VSB_printf(cp->vsb, "} %.0f", v);
+	if (!cp->openmetrics)
+		VSB_printf(cp->vsb, "  %s", cp->staple ?
+		    "Seconds since the OCSP staple was fetched" :
+		    "Seconds until the certificate expires");
+	VSB_putc(cp->vsb, '\n');
+}
+
+static void
+hstat_certs(struct vsb *vsb, int openmetrics, int staple)
+{
+	struct hstat_cert_priv cp;
+
+	if (hstat_cert_iter == NULL)
+		return;
+	INIT_OBJ(&cp, HSTAT_CERT_PRIV_MAGIC);
+	cp.vsb = vsb;
+	cp.now = Time_now();
+	cp.openmetrics = openmetrics;
+	cp.staple = staple;
+	hstat_cert_iter(hstat_cert, &cp);
+}
+
+static void
+hstat_txt_hist(struct vsb *vsb, const char *name, const char *labels,
+    const char *descr, const struct hstat_hist *h, double min)
+{
+	uint64_t n = 0;
+	unsigned u;
+	char buf[160];
+
+	for (u = 0; u <= HSTAT_HIST_BUCKETS; u++)
+		n += h->bucket[u];
+	if (n == 0 && *labels != '\0')
+		return;
+	(void)snprintf(buf, sizeof buf, "%s_count%s", name, labels);
+	VSB_printf(vsb, "%-40s %14ju  %s (count)\n", buf, (uintmax_t)n,
+	    descr);
+	(void)snprintf(buf, sizeof buf, "%s_sum%s", name, labels);
+	VSB_printf(vsb, "%-40s %14.6f  %s (sum)\n", buf, h->sum, descr);
+	(void)snprintf(buf, sizeof buf, "%s_p50%s", name, labels);
+	VSB_printf(vsb, "%-40s %14.6f  %s (median)\n", buf,
+	    hstat_hist_quantile(h, min, .5), descr);
+	(void)snprintf(buf, sizeof buf, "%s_p99%s", name, labels);
+	VSB_printf(vsb, "%-40s %14.6f  %s (99th percentile)\n", buf,
+	    hstat_hist_quantile(h, min, .99), descr);
+}
+
+static void
+hstat_report(struct vsb *vsb)
+{
+	struct hstat_all tot;
+	struct hstat_slab *s;
+	struct hstat_hs *hs;
+	struct vsb *lbl;
+	unsigned u, v;
+
+	hstat_total(&tot);
+	lbl = VSB_new_auto();
+	AN(lbl);
+
+	VSB_printf(vsb, "%-40s %14.0f  %s\n", "uptime",
+	    Time_now() - hstat_t0, "Seconds since startup");
+	VSB_printf(vsb, "%-40s %14u  %s\n", "worker_gen", hstat_gen,
+	    "Current worker generation");
+#define HSTAT_FIELD(n, t, d)						\
+	VSB_printf(vsb, "%-40s %14ju  %s\n", #n, (uintmax_t)tot.c.n, d);
+#include "stats_tbl.h"
+#undef HSTAT_FIELD
+
+	for (u = 0; u < HSTAT_MAX_FE && hstat_fe_name[u] != NULL; u++) {
+#define HSTAT_FE_FIELD(n, t, d)						\
+		VSB_printf(vsb, "frontend_%s{frontend=\"%s\"} %ju  %s\n",	\
+		    #n, hstat_fe_name[u], (uintmax_t)tot.fe[u].n, d);
+#include "stats_fe_tbl.h"
+#undef HSTAT_FE_FIELD
+	}
+
+#define HSTAT_HIST(n, m, d)						\
+	hstat_txt_hist(vsb, #n, "", d, &tot.h[HSTAT_H_##n], m);
+#include "stats_hist_tbl.h"
+#undef HSTAT_HIST
+
+	for (u = 0; u < HSTAT_MAX_HS && tot.hs[u].cipher[0] != '\0'; u++) {
+		hs = &tot.hs[u];
+		for (v = 0; v < 2; v++) {
+			VSB_clear(lbl);
+			VSB_printf(lbl, "{cipher=\"%s\",group=\"%s\","
+			    "type=\"%s\"}", hs->cipher, hs->group,
+			    v ? "resumed" : "full");
+			AZ(VSB_finish(lbl));
+			hstat_txt_hist(vsb, "handshake_seconds", VSB_data(lbl),
+			    "TLS handshake duration",
+			    v ? &hs->resumed : &hs->full, HSTAT_HS_MIN);
+		}
+	}
+	VSB_delete(lbl);
+
+	for (u = 0; u < hstat_nslab; u++) {
+		s = &hstat_slabs[u];
+		if (s->magic != HSTAT_SLAB_MAGIC || s->pid == 0)
+			continue;
+		VSB_printf(vsb, "worker_conns{pid=\"%d\",core=\"%d\","
+		    "gen=\"%u\"} %ju  %s\n", (int)s->pid, s->core_id, s->gen,
+		    (uintmax_t)s->a.c.conns, "Active client connections");
+		VSB_printf(vsb, "worker_cpu_seconds{pid=\"%d\",core=\"%d\","
+		    "gen=\"%u\"} %.3f  %s\n", (int)s->pid, s->core_id, s->gen,
+		    s->cpu, "CPU time used by the worker");
+		if (s->drain_t0 == 0)
+			continue;
+		VSB_printf(vsb, "worker_drain_seconds{pid=\"%d\",core=\"%d\","
+		    "gen=\"%u\"} %.3f  %s\n", (int)s->pid, s->core_id, s->gen,
+		    Time_now() - s->drain_t0,
+		    "Seconds since the worker started draining");
+		VSB_printf(vsb, "worker_drain_conns{pid=\"%d\",core=\"%d\","
+		    "gen=\"%u\"} %ju  %s\n", (int)s->pid, s->core_id, s->gen,
+		    (uintmax_t)s->drain_conns,
+		    "Client connections when the worker started draining");
+	}
+
+	hstat_certs(vsb, 0, 0);
+	hstat_certs(vsb, 0, 1);
+}
+
+/* The plain text report, for the control socket */
+void
+HSTAT_report(struct vsb *vsb)
+{
+	AN(vsb);
+	hstat_report(vsb);
+}
+
+static void
+hstat_om_head(struct vsb *vsb, const char *name, const char *type,
+    const char *help)
+{
+	VSB_printf(vsb, "# TYPE hitch_%s %s\n", name, type);
+	VSB_printf(vsb, "# HELP hitch_%s %s\n", name, help);
+}
+
+/* 'labels' is either empty or a list of labels ending in a comma */
+static void
+hstat_om_hist(struct vsb *vsb, const char *name, const char *labels,
+    const struct hstat_hist *h, double min)
+{
+	uint64_t n = 0;
+	unsigned u;
+	size_t l;
+
+	for (u = 0; u < HSTAT_HIST_BUCKETS; u++) {
+		n += h->bucket[u];
+		VSB_printf(vsb, "hitch_%s_bucket{%sle=\"%.12g\"} %ju\n",
+		    name, labels, hstat_hist_bound(min, u), (uintmax_t)n);
+	}
+	n += h->bucket[u];
+	VSB_printf(vsb, "hitch_%s_bucket{%sle=\"+Inf\"} %ju\n", name,
+	    labels, (uintmax_t)n);
+
+	/* Drop the trailing comma for the other samples */
+	l = strlen(labels);
+	if (l > 0)
+		l--;
+	VSB_printf(vsb, "hitch_%s_count%s%.*s%s %ju\n", name,
+	    l > 0 ? "{" : "", (int)l, labels, l > 0 ? "}" : "",
+	    (uintmax_t)n);
+	VSB_printf(vsb, "hitch_%s_sum%s%.*s%s %.6f\n", name,
+	    l > 0 ? "{" : "", (int)l, labels, l > 0 ? "}" : "", h->sum);
+}
+
+/* Connections and worker processes per generation */
+static void
+hstat_om_gens(struct vsb *vsb, int workers)
+{
+	struct hstat_slab *s, *s2;
+	uint64_t n;
+	unsigned u, u2;
+
+	for (u = 0; u < hstat_nslab; u++) {
+		s = &hstat_slabs[u];
+		if (s->magic != HSTAT_SLAB_MAGIC || s->pid == 0)
+			continue;
+		/* Only report a generation at its first slab */
+		for (u2 = 0; u2 < u; u2++) {
+			s2 = &hstat_slabs[u2];
+			if (s2->magic == HSTAT_SLAB_MAGIC && s2->pid != 0 &&
+			    s2->gen == s->gen)
+				break;
+		}
+		if (u2 < u)
+			continue;
+		for (n = 0, u2 = u; u2 < hstat_nslab; u2++) {
+			s2 = &hstat_slabs[u2];
+			if (s2->magic != HSTAT_SLAB_MAGIC || s2->pid == 0 ||
+			    s2->gen != s->gen)
+				continue;
+			n += workers ? 1 : s2->a.c.conns;
+		}
+		VSB_printf(vsb, "hitch_%s{gen=\"%u\",state=\"%s\"} %ju\n",
+		    workers ? "workers" : "worker_connections", s->gen,
+		    s->gen == hstat_gen ? "active" : "draining",
+		    (uintmax_t)n);
+	}
+}
+
+/* How long the draining workers have been at it */
+static void
+hstat_om_drain(struct vsb *vsb)
+{
+	struct hstat_slab *s;
+	unsigned u;
+
+	for (u = 0; u < hstat_nslab; u++) {
+		s = &hstat_slabs[u];
+		if (s->magic != HSTAT_SLAB_MAGIC || s->pid == 0 ||
+		    s->drain_t0 == 0)
+			continue;
+		VSB_printf(vsb, "hitch_worker_drain_seconds{pid=\"%d\","
+		    "gen=\"%u\"} %.3f\n", (int)s->pid, s->gen,
+		    Time_now() - s->drain_t0);
+	}
+}
+
+static void
+hstat_openmetrics(struct vsb *vsb)
+{
+	struct hstat_all tot;
+	struct hstat_hs *hs;
+	struct vsb *lbl;
+	unsigned u, v;
+
+	hstat_total(&tot);
+
+	hstat_om_head(vsb, "uptime_seconds", "gauge",
+	    "Seconds since startup");
+	VSB_printf(vsb, "hitch_uptime_seconds %.3f\n", Time_now() - hstat_t0);
+	hstat_om_head(vsb, "worker_generation", "gauge",
+	    "Current worker generation");
+	VSB_printf(vsb, "hitch_worker_generation %u\n", hstat_gen);
+	hstat_om_head(vsb, "workers", "gauge",
+	    "Worker processes per generation");
+	hstat_om_gens(vsb, 1);
+	hstat_om_head(vsb, "worker_connections", "gauge",
+	    "Active client connections per worker generation");
+	hstat_om_gens(vsb, 0);
+	hstat_om_head(vsb, "worker_drain_seconds", "gauge",
+	    "Seconds since a draining worker started draining");
+	hstat_om_drain(vsb);
+
+#define hstat_om_counter(n, d)						\
+	hstat_om_head(vsb, #n, "counter", d);				\
+	VSB_printf(vsb, "hitch_%s_total %ju\n", #n, (uintmax_t)tot.c.n);
+#define hstat_om_gauge(n, d)						\
+	hstat_om_head(vsb, #n, "gauge", d);				\
+	VSB_printf(vsb, "hitch_%s %ju\n", #n, (uintmax_t)tot.c.n);
+#define hstat_om_minimum(n, d)	hstat_om_gauge(n, d)
+#define HSTAT_FIELD(n, t, d)	hstat_om_##t(n, d)
+#include "stats_tbl.h"
+#undef HSTAT_FIELD
+#undef hstat_om_minimum
+#undef hstat_om_gauge
+#undef hstat_om_counter
+
+#define hstat_om_counter(n)						\
+	VSB_printf(vsb, "hitch_frontend_%s_total{", #n);
+#define hstat_om_gauge(n)						\
+	VSB_printf(vsb, "hitch_frontend_%s{", #n);
+#define HSTAT_FE_FIELD(n, t, d)						\
+	hstat_om_head(vsb, "frontend_" #n, #t, d);			\
+	for (u = 0; u < HSTAT_MAX_FE && hstat_fe_name[u] != NULL; u++) {\
+		hstat_om_##t(n)						\
+		hstat_label(vsb, "frontend", hstat_fe_name[u]);		\
+		VSB_printf(vsb, "} %ju\n", (uintmax_t)tot.fe[u].n);	\
+	}
+#include "stats_fe_tbl.h"
+#undef HSTAT_FE_FIELD
+#undef hstat_om_gauge
+#undef hstat_om_counter
+
+#define HSTAT_HIST(n, m, d)						\
+	hstat_om_head(vsb, #n, "histogram", d);				\
+	hstat_om_hist(vsb, #n, "", &tot.h[HSTAT_H_##n], m);
+#include "stats_hist_tbl.h"
+#undef HSTAT_HIST
+
+	hstat_om_head(vsb, "handshake_seconds", "histogram",
+	    "TLS handshake duration");
+	lbl = VSB_new_auto();
+	AN(lbl);
+	for (u = 0; u < HSTAT_MAX_HS && tot.hs[u].cipher[0] != '\0'; u++) {
+		hs = &tot.hs[u];
+		for (v = 0; v < 2; v++) {
+			VSB_clear(lbl);
+			hstat_label(lbl, "cipher", hs->cipher);
+			VSB_putc(lbl, ',');
+			hstat_label(lbl, "group", hs->group);
+			VSB_printf(lbl, ",type=\"%s\",",
+			    v ? "resumed" : "full");
+			AZ(VSB_finish(lbl));
+			hstat_om_hist(vsb, "handshake_seconds", VSB_data(lbl),
+			    v ? &hs->resumed : &hs->full, HSTAT_HS_MIN);
+		}
+	}
+	VSB_delete(lbl);
+
+	hstat_om_head(vsb, "cert_not_after_timestamp_seconds", "gauge",
+	    "Certificate expiry time");
+	hstat_certs(vsb, 1, 0);
+	hstat_om_head(vsb, "ocsp_staple_age_seconds", "gauge",
+	    "Seconds since the OCSP staple was fetched");
+	hstat_certs(vsb, 1, 1);
+
+	VSB_cat(vsb, "# EOF\n");
+}
+
+static void
+hstat_sess_close(struct hstat_sess *hs)
+{
+	CHECK_OBJ_NOTNULL(hs, HSTAT_SESS_MAGIC);
+	ev_io_stop(hstat_loop, &hs->ev_r);
+	ev_io_stop(hstat_loop, &hs->ev_w);
+	ev_timer_stop(hstat_loop, &hs->ev_t);
+	VTAILQ_REMOVE(&hstat_sessions, hs, list);
+	(void)close(hs->fd);
+	if (hs->resp != NULL)
+		VSB_delete(hs->resp);
+	FREE_OBJ(hs);
+}
+
+static void
+hstat_sess_respond(struct hstat_sess *hs)
+{
+	struct vsb *body;
+	const char *status = "200 OK";
+	const char *ctype = HSTAT_CT_TEXT;
+	size_t l;
+	char *p;
+
+	CHECK_OBJ_NOTNULL(hs, HSTAT_SESS_MAGIC);
+	body = VSB_new_auto();
+	AN(body);
+
+	if (strncmp(hs->req, "GET ", 4) != 0) {
+		status = "405 Method Not Allowed";
+	} else {
+		p = hs->req + 4;
+		l = strcspn(p, " ?\r\n");
+		if ((l == 1 && *p == '/') ||
+		    (l == 6 && strncmp(p, "/stats", l) == 0)) {
+			hstat_report(body);
+		} else if (l == 8 && strncmp(p, "/metrics", l) == 0) {
+			hstat_openmetrics(body);
+			ctype = HSTAT_CT_OPENMETRICS;
+		} else
+			status = "404 Not Found";
+	}
+	AZ(VSB_finish(body));
+
+	hs->resp = VSB_new_auto();
+	AN(hs->resp);
+	VSB_printf(hs->resp, "HTTP/1.0 %s\r\n"
+	    "Content-Type: %s\r\n"
+	    "Content-Length: %zd\r\n"
+	    "Connection: close\r\n\r\n", status, ctype, VSB_len(body));
+	VSB_bcat(hs->resp, VSB_data(body), VSB_len(body));
+	AZ(VSB_finish(hs->resp));
+	VSB_delete(body);
+
+	ev_io_stop(hstat_loop, &hs->ev_r);
+	ev_io_start(hstat_loop, &hs->ev_w);
+}
+
+static void
+hstat_sess_rd(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct hstat_sess *hs;
+	ssize_t l;
+
+	(void)loop;
+	(void)revents;
+	CAST_OBJ_NOTNULL(hs, w->data, HSTAT_SESS_MAGIC);
+
+	l = read(hs->fd, hs->req + hs->req_len,
+	    sizeof hs->req - 1 - hs->req_len);
+	if (l < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (l <= 0) {
+		hstat_sess_close(hs);
+		return;
+	}
+	hs->req_len += l;
+	hs->req[hs->req_len] = '\0';
+
+	/* Wait for the complete request header */
+	if (strstr(hs->req, "\r\n\r\n") == NULL &&
+	    strstr(hs->req, "\n\n") == NULL &&
+	    hs->req_len < sizeof hs->req - 1)
+		return;
+
+	hstat_sess_respond(hs);
+}
+
+static void
+hstat_sess_wr(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct hstat_sess *hs;
+	ssize_t l;
+
+	(void)loop;
+	(void)revents;
+	CAST_OBJ_NOTNULL(hs, w->data, HSTAT_SESS_MAGIC);
+	AN(hs->resp);
+
+	l = write(hs->fd, VSB_data(hs->resp) + hs->resp_off,
+	    VSB_len(hs->resp) - hs->resp_off);
+	if (l < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (l > 0)
+		hs->resp_off += l;
+	if (l <= 0 || hs->resp_off == VSB_len(hs->resp))
+		hstat_sess_close(hs);
+}
+
+static void
+hstat_sess_timeout(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	struct hstat_sess *hs;
+
+	(void)loop;
+	(void)revents;
+	CAST_OBJ_NOTNULL(hs, w->data, HSTAT_SESS_MAGIC);
+	hstat_sess_close(hs);
+}
+
+static void
+hstat_accept(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct hstat_sess *hs;
+	int fd;
+
+	(void)revents;
+	fd = accept4(w->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK &&
+		    errno != EINTR && errno != ECONNABORTED)
+			ERR("{stats} accept() failed: %s\n", strerror(errno));
+		return;
+	}
+
+	ALLOC_OBJ(hs, HSTAT_SESS_MAGIC);
+	if (hs == NULL) {
+		(void)close(fd);
+		return;
+	}
+	hs->fd = fd;
+	VTAILQ_INSERT_TAIL(&hstat_sessions, hs, list);
+	ev_io_init(&hs->ev_r, hstat_sess_rd, fd, EV_READ);
+	ev_io_init(&hs->ev_w, hstat_sess_wr, fd, EV_WRITE);
+	ev_timer_init(&hs->ev_t, hstat_sess_timeout, HSTAT_SESS_TIMEOUT, 0.);
+	hs->ev_r.data = hs;
+	hs->ev_w.data = hs;
+	hs->ev_t.data = hs;
+	ev_io_start(loop, &hs->ev_r);
+	ev_timer_start(loop, &hs->ev_t);
+}
+
+
+static int
+hstat_add_fd(int fd)
+{
+	int flags;
+
+	assert(hstat_nfd < HSTAT_MAX_LISTEN);
+	flags = fcntl(fd, F_GETFL);
+	AZ(flags < 0);
+	AZ(fcntl(fd, F_SETFL, flags | O_NONBLOCK));
+	hstat_fd[hstat_nfd++] = fd;
+	return (0);
+}
+
+/* Bind the stats socket. Called before daemonizing, so that relative
+ * paths work as expected. */
+int
+HSTAT_listen(const char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	AN(path);
+	AZ(hstat_path);
+	if (strlen(path) >= sizeof sun.sun_path) {
+		ERR("{core} Stats socket path too long: %s\n", path);
+		return (-1);
+	}
+
+	memset(&sun, 0, sizeof sun);
+	sun.sun_family = PF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	fd = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		ERR("{core} Unable to create stats socket: %s\n",
+		    strerror(errno));
+		return (-1);
+	}
+
+	/* Remove a stale socket left behind by an earlier instance */
+	(void)unlink(path);
+	if (bind(fd, (struct sockaddr *)&sun, sizeof sun) != 0 ||
+	    listen(fd, 16) != 0) {
+		ERR("{core} Unable to bind stats socket %s: %s\n",
+		    path, strerror(errno));
+		(void)close(fd);
+		return (-1);
+	}
+
+	hstat_path = realpath(path, NULL);
+	if (hstat_path == NULL)
+		hstat_path = strdup(path);
+	AN(hstat_path);
+	return (hstat_add_fd(fd));
+}
+
+/* Bind the admin listener. A NULL host means all addresses. */
+int
+HSTAT_listen_tcp(const char *host, const char *port)
+{
+	struct addrinfo hints, *ai, *it;
+	int fd = -1, r, t = 1;
+
+	AN(port);
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG;
+	r = getaddrinfo(host, port, &hints, &ai);
+	if (r != 0) {
+		ERR("{core} Unable to resolve admin address %s:%s: %s\n",
+		    host != NULL ? host : "*", port, gai_strerror(r));
+		return (-1);
+	}
+
+	for (it = ai; it != NULL; it = it->ai_next) {
+		fd = socket(it->ai_family, SOCK_STREAM | SOCK_CLOEXEC,
+		    IPPROTO_TCP);
+		if (fd < 0)
+			continue;
+		(void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &t, sizeof t);
+		if (bind(fd, it->ai_addr, it->ai_addrlen) == 0 &&
+		    listen(fd, 16) == 0)
+			break;
+		(void)close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		ERR("{core} Unable to bind admin listener %s:%s: %s\n",
+		    host != NULL ? host : "*", port, strerror(errno));
+	freeaddrinfo(ai);
+	if (fd < 0)
+		return (-1);
+	return (hstat_add_fd(fd));
+}
+
+static void
+hstat_atexit(void)
+{
+	if (getpid() != hstat_master || hstat_path == NULL)
+		return;
+	(void)unlink(hstat_path);
+}
+
+/* Start serving the stats listeners from the master's event loop.
+ * Reports are rendered there too, so the workers are never blocked
+ * by a scrape. */
+void
+HSTAT_start(struct ev_loop *loop, hstat_cert_iter_f *certs)
+{
+	unsigned u;
+
+	AN(loop);
+	hstat_loop = loop;
+	hstat_cert_iter = certs;
+	hstat_master = getpid();
+
+	for (u = 0; u < hstat_nfd; u++) {
+		ev_io_init(&hstat_listener[u], hstat_accept, hstat_fd[u],
+		    EV_READ);
+		ev_io_start(loop, &hstat_listener[u]);
+	}
+	if (hstat_path != NULL)
+		AZ(atexit(hstat_atexit));
+}
+
+/* Stop serving the stats listeners, leaving the socket file to the
+ * master taking over after a hot upgrade. */
+void
+HSTAT_stop(void)
+{
+	unsigned u;
+
+	for (u = 0; u < hstat_nfd; u++) {
+		if (hstat_loop != NULL)
+			ev_io_stop(hstat_loop, &hstat_listener[u]);
+		(void)close(hstat_fd[u]);
+		hstat_fd[u] = -1;
+	}
+	hstat_nfd = 0;
+	free(hstat_path);
+	hstat_path = NULL;
+}
@@ -0,0 +1,144 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include <sys/types.h>
+
+#include <ev.h>
+#include <stdint.h>
+
+#include "foreign/vsb.h"
+
+/*
+ * Runtime statistics.
+ *
+ * The master process maps a shared memory segment before forking
+ * any workers. Each worker is handed its own cache line aligned
+ * slab in that segment, and is the only writer of it, so counters
+ * are bumped without locks or atomics. The master reads the slabs
+ * when a report is requested, and folds the counters of a worker
+ * into a private total when the worker is reaped.
+ *
+ * Reports are served over HTTP by the master, either as plain text or
+ * in the OpenMetrics exposition format, from a UNIX socket and/or a
+ * TCP admin listener.
+ */
+
+#define HSTAT_MAX_FE		32
+#define HSTAT_MAX_HS		16
+
+/* Histograms are log-linear: every power of two above the minimum is
+ * split into HSTAT_HIST_SUB linear buckets. */
+#define HSTAT_HIST_OCTAVES	24
+#define HSTAT_HIST_SUB		2
+#define HSTAT_HIST_BUCKETS	(HSTAT_HIST_OCTAVES * HSTAT_HIST_SUB + 1)
+
+struct hstat_counters {
+#define HSTAT_FIELD(n, t, d)	uint64_t n;
+#include "stats_tbl.h"
+#undef HSTAT_FIELD
+};
+
+struct hstat_fe_counters {
+#define HSTAT_FE_FIELD(n, t, d)	uint64_t n;
+#include "stats_fe_tbl.h"
+#undef HSTAT_FE_FIELD
+};
+
+enum hstat_hist_e {
+#define HSTAT_HIST(n, m, d)	HSTAT_H_##n,
+#include "stats_hist_tbl.h"
+#undef HSTAT_HIST
+	HSTAT_H__MAX
+};
+
+struct hstat_slab;
+
+/* Counters of the current process. Never NULL. */
+extern struct hstat_counters *hstat;
+
+#define HSTAT_INC(n)		(hstat->n++)
+#define HSTAT_ADD(n, v)		(hstat->n += (v))
+#define HSTAT_SET(n, v)		(hstat->n = (v))
+
+/* Per-frontend counters of the current process, indexed by the value
+ * returned from HSTAT_fe_register(). Never NULL. */
+extern struct hstat_fe_counters *hstat_fe;
+
+#define HSTAT_FE_INC(i, n)						\
+	do {								\
+		if ((i) >= 0)						\
+			hstat_fe[i].n++;				\
+	} while (0)
+#define HSTAT_FE_ADD(i, n, v)						\
+	do {								\
+		if ((i) >= 0)						\
+			hstat_fe[i].n += (v);				\
+	} while (0)
+#define HSTAT_FE_DEC(i, n)						\
+	do {								\
+		if ((i) >= 0)						\
+			hstat_fe[i].n--;				\
+	} while (0)
+
+/* Reports one certificate: its file name, the frontend it belongs to
+ * (NULL for the global ones), its notAfter time and the modification
+ * time of its OCSP staple. Unknown times are passed as negative. */
+typedef void hstat_cert_f(void *priv, const char *cert, const char *fe,
+    double not_after, double staple_mtime);
+typedef void hstat_cert_iter_f(hstat_cert_f *func, void *priv);
+
+int HSTAT_init(unsigned nslab);
+struct hstat_slab *HSTAT_slab_alloc(int core_id, unsigned gen);
+void HSTAT_slab_pid(struct hstat_slab *slab, pid_t pid);
+uint64_t HSTAT_slab_conns(const struct hstat_slab *slab);
+double HSTAT_slab_cpu(const struct hstat_slab *slab);
+void HSTAT_slab_attach(struct hstat_slab *slab);
+void HSTAT_close_fds(void);
+void HSTAT_slab_free(struct hstat_slab *slab);
+void HSTAT_drain(void);
+void HSTAT_cpu(void);
+int HSTAT_fe_register(const char *name);
+void HSTAT_fe_release(int idx);
+void HSTAT_observe(enum hstat_hist_e h, double v);
+void HSTAT_handshake(const char *cipher, const char *group, int resumed,
+    double v);
+void HSTAT_worker_gen(unsigned gen);
+
+int HSTAT_listen(const char *path);
+int HSTAT_listen_tcp(const char *host, const char *port);
+void HSTAT_start(struct ev_loop *loop, hstat_cert_iter_f *certs);
+void HSTAT_stop(void);
+void HSTAT_report(struct vsb *vsb);
+
+#endif /* STATS_H_INCLUDED */
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2020 Varnish Software
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    1. Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * HSTAT_FE_FIELD(name, type, description)
+ *
+ * Per-frontend counters, labelled with the frontend address in the
+ * OpenMetrics output. See stats_tbl.h for the meaning of type.
+ */
+
+HSTAT_FE_FIELD(accepts, counter, "Accepted client connections")
+HSTAT_FE_FIELD(conns, gauge, "Active client connections")
+HSTAT_FE_FIELD(hs_full, counter, "Completed full TLS handshakes")
+HSTAT_FE_FIELD(hs_resumed, counter, "Completed resumed TLS handshakes")
+HSTAT_FE_FIELD(hs_fail, counter, "Failed TLS handshakes")
+HSTAT_FE_FIELD(rate_limited, counter,
+    "Connections refused over the handshake rate")
+HSTAT_FE_FIELD(ssl2clear_bytes, counter, "Bytes read from the TLS side")
+HSTAT_FE_FIELD(clear2ssl_bytes, counter, "Bytes read from the clear side")
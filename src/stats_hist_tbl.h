@@ -0,0 +1,47 @@
+/*
+ * Copyright 2020 Varnish Software
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    1. Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * HSTAT_HIST(name, min, description)
+ *
+ * Log-linear histograms with HSTAT_HIST_BUCKETS buckets, the first
+ * one having an upper bound of 'min', plus an overflow bucket. The
+ * name carries the unit, following the OpenMetrics conventions.
+ */
+
+HSTAT_HIST(conn_duration_seconds, 1e-3, "Client connection lifetime")
+HSTAT_HIST(conn_bytes, 1024., "Bytes proxied per client connection")
+HSTAT_HIST(clienthello_seconds, 1e-4,
+    "Time from accept to the TLS ClientHello")
+HSTAT_HIST(backend_connect_seconds, 1e-5, "Backend connect time")
+HSTAT_HIST(backend_ttfb_seconds, 1e-4,
+    "Time from the first client byte to the first backend byte")
+HSTAT_HIST(loop_busy_seconds, 1e-5,
+    "Time spent running callbacks per event loop iteration")
+HSTAT_HIST(callback_seconds, 1e-6,
+    "Event loop callback run time, with a stall threshold set")
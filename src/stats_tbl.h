@@ -0,0 +1,120 @@
+/*
+ * Copyright 2020 Varnish Software
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    1. Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above
+ *       copyright notice, this list of conditions and the following
+ *       disclaimer in the documentation and/or other materials
+ *       provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS''
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+ * USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * HSTAT_FIELD(name, type, description)
+ *
+ * type is either 'counter' (monotonically increasing, summed into
+ * the totals when a worker is retired), 'gauge' (current value,
+ * only reported for live workers) or 'minimum' (current value, the
+ * lowest non-zero one of the live workers).
+ */
+
+HSTAT_FIELD(accepts, counter, "Accepted client connections")
+HSTAT_FIELD(accept_fail, counter, "Failed accept() calls")
+HSTAT_FIELD(conns, gauge, "Active client connections")
+HSTAT_FIELD(hs_full, counter, "Completed full TLS handshakes")
+HSTAT_FIELD(hs_resumed, counter, "Completed resumed TLS handshakes")
+HSTAT_FIELD(hs_fail_timeout, counter, "Handshakes failed: timeout")
+HSTAT_FIELD(hs_fail_ssl, counter, "Handshakes failed: TLS error")
+HSTAT_FIELD(hs_fail_closed, counter, "Handshakes failed: peer closed")
+HSTAT_FIELD(hs_fail_syscall, counter, "Handshakes failed: socket error")
+HSTAT_FIELD(hs_fail_alpn, counter, "Handshakes failed: no ALPN match")
+HSTAT_FIELD(hs_fail_shed, counter,
+    "Handshakes failed: dropped from a full handshake queue")
+HSTAT_FIELD(hs_queued, counter,
+    "Full handshakes queued over the handshake budget")
+HSTAT_FIELD(hs_queue, gauge, "Full handshakes waiting in the queue")
+HSTAT_FIELD(ssl2clear_bytes, counter, "Bytes read from the TLS side")
+HSTAT_FIELD(clear2ssl_bytes, counter, "Bytes read from the clear side")
+HSTAT_FIELD(ssl2clear_ring_full, counter,
+    "Reads paused on a full TLS to clear ring")
+HSTAT_FIELD(clear2ssl_ring_full, counter,
+    "Reads paused on a full clear to TLS ring")
+HSTAT_FIELD(backend_conn, counter, "Backend connections established")
+HSTAT_FIELD(backend_conn_fail, counter, "Backend connection failures")
+HSTAT_FIELD(backend_conn_timeout, counter, "Backend connection timeouts")
+HSTAT_FIELD(backend_down_drops, counter,
+    "Connections closed while the backend was marked down")
+HSTAT_FIELD(pending, gauge,
+    "Connections accepted and waiting for their first bytes")
+HSTAT_FIELD(pending_closed, counter,
+    "Connections closed before sending any data")
+HSTAT_FIELD(pending_rejected, counter,
+    "Connections closed for not starting with a TLS handshake")
+HSTAT_FIELD(rate_limited_accept, counter,
+    "Connections refused at accept over the handshake rate")
+HSTAT_FIELD(rate_limited_hello, counter,
+    "Handshakes refused at the ClientHello over the handshake rate")
+HSTAT_FIELD(rate_evictions, counter,
+    "Sources evicted from the handshake rate table")
+HSTAT_FIELD(fingerprints, counter, "ClientHellos fingerprinted")
+HSTAT_FIELD(fingerprint_failed, counter,
+    "ClientHellos that could not be fingerprinted")
+HSTAT_FIELD(fingerprint_denied, counter,
+    "Handshakes refused for a denied ClientHello fingerprint")
+HSTAT_FIELD(fingerprint_rate_limited, counter,
+    "Handshakes refused over the fingerprint rate")
+HSTAT_FIELD(accept_paused, gauge,
+    "Workers not accepting at the connection or memory limits")
+HSTAT_FIELD(accept_pauses, counter,
+    "Times accepting paused at the connection or memory limits")
+HSTAT_FIELD(overload_drops, counter,
+    "Connections closed at accept over the buffer memory limit")
+HSTAT_FIELD(ring_reduced, counter,
+    "Connections given smaller buffers under memory pressure")
+HSTAT_FIELD(buffer_bytes, gauge, "Memory of the connection buffers")
+HSTAT_FIELD(handshake_timeout_ms, minimum,
+    "Effective handshake timeout, shortened under load")
+HSTAT_FIELD(connect_timeout_ms, minimum,
+    "Effective backend connect timeout, shortened under load")
+HSTAT_FIELD(idle_timeout_ms, minimum,
+    "Effective idle timeout, shortened under load")
+HSTAT_FIELD(idle_timeouts, counter,
+    "Established connections closed for being idle")
+HSTAT_FIELD(drain_idle_closed, counter,
+    "Idle connections closed early by draining workers")
+HSTAT_FIELD(drain_expired, counter,
+    "Connections closed at the end of a drain")
+HSTAT_FIELD(sessions_exported, counter,
+    "TLS sessions handed over by draining workers")
+HSTAT_FIELD(sessions_imported, counter,
+    "TLS sessions taken over from draining workers")
+HSTAT_FIELD(conns_migrated, counter,
+    "Connections handed over by draining workers, with kTLS")
+HSTAT_FIELD(conns_adopted, counter,
+    "Connections taken over from draining workers, with kTLS")
+HSTAT_FIELD(workers_scaled_up, counter,
+    "Workers started by the master under load")
+HSTAT_FIELD(workers_scaled_down, counter,
+    "Workers retired by the master for lack of load")
+HSTAT_FIELD(worker_rebalances, counter,
+    "Times a hot worker paused accepting for the others")
+HSTAT_FIELD(loop_stalls, counter,
+    "Event loop iterations over the stall threshold")
+HSTAT_FIELD(log_dropped, counter, "Log lines dropped on a full buffer")
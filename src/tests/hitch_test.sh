@@ -66,6 +66,12 @@ cleanup() {
 		kill "$(cat "$PID")"
 	done
 
+	if [ -n "${PERF_LOCK:-}" ] &&
+	    [ "$(cat "$PERF_LOCK/pid" 2>/dev/null)" = $$ ]
+	then
+		rm -rf "$PERF_LOCK"
+	fi
+
 	rm -rf "$TEST_TMPDIR"
 }
 
@@ -292,6 +298,38 @@ curl_hitch() {
 	fail "expected status $CURL_STATUS got $RESP_STATUS"
 }
 
+#-
+# Usage: hitch_ctl socket command [args...]
+#
+# Send a command to the control socket of a hitch server, and print the
+# response body. The test fails if the response status is different than
+# ${CTL_STATUS} (or 200 if it isn't set).
+#
+# Should not be used in a sub-shell.
+
+hitch_ctl() {
+	cmd python3 ||
+	skip "python3 is needed to talk to the control socket"
+
+	CTL_SOCK=$1
+	shift
+	printf 'Running: hitch_ctl %s\n' "$*" >&2
+
+	python3 -c '
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.settimeout(10)
+s.connect(sys.argv[1])
+s.sendall((sys.argv[2] + "\n").encode())
+f = s.makefile("rb")
+status, length = f.readline().split()
+sys.stdout.write(f.read(int(length)).decode())
+if status.decode() != sys.argv[3]:
+    sys.exit("expected status %s got %s" % (sys.argv[3], status.decode()))
+' "$CTL_SOCK" "$*" "${CTL_STATUS:-200}" ||
+	fail "control command failed: $*"
+}
+
 #-
 # Usage: [!] s_client [args...]
 #
@@ -376,3 +414,107 @@ subj_name_eq() {
     s_client_parse "$2"
     test "$SUBJECT_NAME" = "$1"
 }
+
+#-
+# Usage: hitch_procs
+#
+# Print the PIDs of the daemon started with `start_hitch` and of its
+# children, one per line.
+
+hitch_procs() {
+	ps -A -o pid= -o ppid= |
+	awk -v pid="$(hitch_pid)" '$1 == pid || $2 == pid { print $1 }'
+}
+
+#-
+# Usage: hitch_rss
+#
+# Print the resident memory in kilobytes of the daemon started with
+# `start_hitch` and of its children.
+
+hitch_rss() {
+	ps -A -o pid= -o ppid= -o rss= |
+	awk -v pid="$(hitch_pid)" '
+		$1 == pid || $2 == pid { rss += $3 }
+		END { print rss }'
+}
+
+#-
+# Usage: hitch_fds
+#
+# Print the number of file descriptors opened by the daemon started with
+# `start_hitch` and by its children.
+
+hitch_fds() {
+	for FDS_PID in $(hitch_procs)
+	do
+		if [ -d /proc/$FDS_PID/fd ]
+		then
+			ls /proc/$FDS_PID/fd
+		elif cmd lsof
+		then
+			lsof -F f -a -p $FDS_PID -d 0-999999 | grep '^f'
+		else
+			fail "none of procfs or lsof available"
+		fi
+	done |
+	wc -l |
+	tr -d ' '
+}
+
+#-
+# Usage: perf_test
+#
+# Mark a test as a performance test, skipped unless ${HITCH_PERF} is set
+# to `yes`. Performance tests run one at a time, since they would skew
+# each other's measurements otherwise.
+#
+# Should not be used in a sub-shell.
+
+perf_test() {
+	test "${HITCH_PERF:-no}" = yes ||
+	skip "performance tests are disabled, set HITCH_PERF=yes"
+
+	PERF_LOCK=${TMPDIR:-/tmp}/hitch-perf.lock
+	until mkdir "$PERF_LOCK" 2>/dev/null
+	do
+		# break the lock of a test that died
+		LOCK_PID=$(cat "$PERF_LOCK/pid" 2>/dev/null) &&
+		! kill -0 "$LOCK_PID" 2>/dev/null &&
+		rm -rf "$PERF_LOCK"
+		sleep 1
+	done
+	echo $$ >"$PERF_LOCK/pid"
+}
+
+#-
+# Usage: perf_check name value
+#
+# Check a measurement against its limit in the performance baseline, a
+# file of `name min|max limit` lines. The file is ${HITCH_PERF_BASELINE}
+# or else `perf-baseline` in the test directory. The measurement is also
+# appended to ${HITCH_PERF_RECORD} when it is set, to collect the numbers
+# of a machine and tighten its own baseline.
+#
+# Should not be used in a sub-shell.
+
+perf_check() {
+	PERF_FILE=${HITCH_PERF_BASELINE:-${TESTDIR}perf-baseline}
+	printf 'Measured: %s %s\n' "$1" "$2" >&2
+	printf '%s %s\n' "$1" "$2" >>perf.dump
+
+	if [ -n "${HITCH_PERF_RECORD:-}" ]
+	then
+		printf '%s %s\n' "$1" "$2" >>"$HITCH_PERF_RECORD"
+	fi
+
+	set -- "$1" "$2" $(awk -v name="$1" '$1 == name { print $2, $3 }' \
+	    "$PERF_FILE")
+	test $# -eq 4 ||
+	error "no limit for $1 in $PERF_FILE"
+
+	awk -v val="$2" -v op="$3" -v lim="$4" 'BEGIN {
+		exit !(op == "max" ? val <= lim : val >= lim)
+	}' ||
+	fail "$1 is $2, expected $3 $4"
+}
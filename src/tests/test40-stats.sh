@@ -0,0 +1,50 @@
+#!/bin/sh
+#
+# Test the statistics socket.
+#
+. hitch_test.sh
+
+curl --help all 2>/dev/null | grep -q -e --unix-socket ||
+curl --help | grep -q -e --unix-socket ||
+skip "curl: unknown option --unix-socket"
+
+start_hitch \
+	--backend="[hitch-tls.org]:80" \
+	--frontend="[localhost]:$LISTENPORT" \
+	--stats-socket=stats.sock \
+	"${CERTSDIR}/site1.example.com"
+
+curl_hitch
+curl_hitch
+
+run_cmd curl --silent --max-time 5 --unix-socket stats.sock \
+	http://localhost/stats >stats.dump
+
+grep -q "^accepts  *2 " stats.dump ||
+fail "expected 2 accepted connections"
+
+grep -q "^hs_full  *2 " stats.dump ||
+fail "expected 2 full handshakes"
+
+grep -q "^backend_conn  *2 " stats.dump ||
+fail "expected 2 backend connections"
+
+grep -q "^worker_conns{pid=" stats.dump ||
+fail "expected per-worker lines"
+
+# counters survive a reload
+kill -HUP $(hitch_pid)
+sleep 2
+
+run_cmd curl --silent --max-time 5 --unix-socket stats.sock \
+	http://localhost/stats >stats2.dump
+
+grep -q "^accepts  *2 " stats2.dump ||
+fail "expected 2 accepted connections after reload"
+
+grep -q "^worker_gen  *1 " stats2.dump ||
+fail "expected worker generation 1"
+
+stop_hitch
+test ! -S stats.sock ||
+fail "stats socket was not removed"
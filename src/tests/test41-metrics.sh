@@ -0,0 +1,76 @@
+#!/bin/sh
+#
+# Test the OpenMetrics endpoint of the admin listener.
+#
+. hitch_test.sh
+
+ADMINPORT=$(expr $LISTENPORT + 4100)
+
+start_hitch \
+	--backend="[hitch-tls.org]:80" \
+	--frontend="[localhost]:$LISTENPORT" \
+	--admin-listen="[127.0.0.1]:$ADMINPORT" \
+	"${CERTSDIR}/site1.example.com"
+
+curl_hitch
+curl_hitch
+
+run_cmd curl --silent --max-time 5 --dump-header headers.dump \
+	http://127.0.0.1:$ADMINPORT/metrics >metrics.dump
+
+grep -q "^Content-Type: application/openmetrics-text" headers.dump ||
+fail "wrong content type"
+
+tail -n 1 metrics.dump | grep -q "^# EOF$" ||
+fail "missing EOF marker"
+
+grep -q "^hitch_accepts_total 2$" metrics.dump ||
+fail "expected 2 accepted connections"
+
+grep -q "^hitch_frontend_hs_full_total{frontend=\"\[localhost\]:$LISTENPORT\"} 2$" \
+    metrics.dump ||
+fail "expected 2 full handshakes on the frontend"
+
+grep -q '^hitch_conn_duration_seconds_count 2$' metrics.dump ||
+fail "expected 2 connection durations"
+
+grep -q '^hitch_conn_bytes_bucket{le="+Inf"} 2$' metrics.dump ||
+fail "expected 2 connection sizes"
+
+grep -q '^hitch_backend_connect_seconds_count 2$' metrics.dump ||
+fail "expected 2 backend connect times"
+
+grep -q '^hitch_handshake_seconds_count{cipher=".*",type="full"} 2$' \
+    metrics.dump ||
+fail "expected 2 full handshake durations"
+
+grep -q '^hitch_cert_not_after_timestamp_seconds{cert=".*site1.example.com"} ' \
+    metrics.dump ||
+fail "expected certificate expiry"
+
+grep -q '^hitch_worker_generation 0$' metrics.dump ||
+fail "expected worker generation 0"
+
+# the old generation is reported as draining until its workers exit
+kill -HUP $(hitch_pid)
+sleep 2
+
+run_cmd curl --silent --max-time 5 \
+	http://127.0.0.1:$ADMINPORT/metrics >metrics2.dump
+
+grep -q '^hitch_worker_generation 1$' metrics2.dump ||
+fail "expected worker generation 1"
+
+grep -q '^hitch_workers{gen="1",state="active"} ' metrics2.dump ||
+fail "expected active workers"
+
+grep -q "^hitch_frontend_accepts_total{frontend=\"\[localhost\]:$LISTENPORT\"} 2$" \
+    metrics2.dump ||
+fail "expected frontend counters to survive a reload"
+
+run_cmd curl --silent --max-time 5 --output /dev/null \
+	--write-out '%{http_code}\n' \
+	http://127.0.0.1:$ADMINPORT/nonexistent >status.dump
+
+grep -q '^404$' status.dump ||
+fail "expected 404 for an unknown path"
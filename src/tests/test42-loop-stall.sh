@@ -0,0 +1,29 @@
+#!/bin/sh
+#
+# Test event loop monitoring.
+#
+. hitch_test.sh
+
+ADMINPORT=$(expr $LISTENPORT + 4200)
+
+start_hitch \
+	--backend="[hitch-tls.org]:80" \
+	--frontend="[localhost]:$LISTENPORT" \
+	--admin-listen="[127.0.0.1]:$ADMINPORT" \
+	--stall-threshold=1000 \
+	--stall-watchdog \
+	"${CERTSDIR}/site1.example.com"
+
+curl_hitch
+
+run_cmd curl --silent --max-time 5 \
+	http://127.0.0.1:$ADMINPORT/metrics >metrics.dump
+
+grep -q '^hitch_loop_busy_seconds_count [1-9]' metrics.dump ||
+fail "expected event loop iterations"
+
+grep -q '^hitch_callback_seconds_count [1-9]' metrics.dump ||
+fail "expected callback run times"
+
+grep -q '^hitch_loop_stalls_total 0$' metrics.dump ||
+fail "expected no stalls"
@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Test buffered logging in the workers.
+#
+. hitch_test.sh
+
+ADMINPORT=$(expr $LISTENPORT + 4300)
+
+start_hitch \
+	--backend="[hitch-tls.org]:80" \
+	--frontend="[localhost]:$LISTENPORT" \
+	--admin-listen="[127.0.0.1]:$ADMINPORT" \
+	--log-level=2 \
+	"${CERTSDIR}/site1.example.com"
+
+curl_hitch
+
+run_cmd curl --silent --max-time 5 \
+	http://127.0.0.1:$ADMINPORT/metrics >metrics.dump
+
+grep -q '^hitch_log_dropped_total 0$' metrics.dump ||
+fail "expected no dropped log lines"
+
+stop_hitch
+
+# Per-connection lines are written by the worker's log writer
+grep -q ':[0-9]* :[0-9]* [0-9]*:-\?[0-9]* ssl end handshake$' hitch.log ||
+fail "expected the handshake in the log"
@@ -0,0 +1,34 @@
+#!/bin/sh
+#
+# Test the per-connection access log record.
+#
+. hitch_test.sh
+
+start_hitch \
+	--backend="[hitch-tls.org]:80" \
+	--frontend="[localhost]:$LISTENPORT" \
+	--access-log \
+	"${CERTSDIR}/site1.example.com"
+
+curl_hitch
+
+stop_hitch
+
+grep '{access}' hitch.log >access.dump ||
+fail "expected an access log record"
+
+# timestamp [pid] {access}, then 15 fields
+awk -F '\t' 'NF != 16 { exit 1 }' access.dump ||
+fail "expected 15 fields in the access log record"
+
+cut -f 5 access.dump | grep -q 'site1.example.com$' ||
+fail "expected the certificate file"
+
+cut -f 6 access.dump | grep -q '^TLSv1' ||
+fail "expected the TLS version"
+
+cut -f 10 access.dump | grep -q '^full$' ||
+fail "expected a full handshake"
+
+cut -f 14 access.dump | grep -q '^[1-9][0-9]*$' ||
+fail "expected bytes from the backend"
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# Test that the flight recorder of a failed connection is logged.
+#
+. hitch_test.sh
+
+start_hitch \
+	--backend="[hitch-tls.org]:80" \
+	--frontend="[localhost]:$LISTENPORT" \
+	--flight-recorder=60000 \
+	"${CERTSDIR}/site1.example.com"
+
+curl_hitch
+
+# A plain text request is closed before its handshake
+curl --silent --max-time 5 http://localhost:$LISTENPORT/ &&
+fail "expected the plain text request to fail"
+
+# No cipher in common fails the handshake
+openssl s_client -connect localhost:$LISTENPORT -tls1_2 \
+	-cipher 'NULL-SHA:@SECLEVEL=0' </dev/null >s_client.dump 2>&1 &&
+fail "expected the handshake to fail"
+
+stop_hitch
+
+grep 'flight recorder: error, [0-9]* events' hitch.log >recorder.dump ||
+fail "expected a flight recorder dump"
+
+test "$(wc -l <recorder.dump)" -eq 2 ||
+fail "expected only the failed connections to be dumped"
+
+grep -q 'flight recorder: +[0-9.]* ms not_tls byte=71' hitch.log ||
+fail "expected the plain text byte in the flight recorder"
+
+grep -q 'flight recorder: +[0-9.]* ms ssl_error err=1' hitch.log ||
+fail "expected the TLS error in the flight recorder"
@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# Test the control socket.
+#
+. hitch_test.sh
+
+start_hitch \
+	--backend="[hitch-tls.org]:80" \
+	--frontend="[localhost]:$LISTENPORT" \
+	--control-socket=ctl.sock \
+	"${CERTSDIR}/site1.example.com"
+
+test -S ctl.sock ||
+fail "control socket was not created"
+
+hitch_ctl ctl.sock help >help.dump
+grep -q '^conns' help.dump ||
+fail "expected the list of commands"
+
+CTL_STATUS=400 hitch_ctl ctl.sock frobnicate
+
+hitch_ctl ctl.sock workers >workers.dump
+test "$(grep -c ' active ' workers.dump)" -eq 1 ||
+fail "expected one active worker"
+WORKER=$(awk '$4 == "active" { print $1 }' workers.dump)
+
+hitch_ctl ctl.sock log-level 2 | grep -q '^log-level 2$' ||
+fail "expected log level 2"
+
+curl_hitch
+
+hitch_ctl ctl.sock stats >stats.dump
+grep -q "^accepts  *1 " stats.dump ||
+fail "expected 1 accepted connection"
+
+hitch_ctl ctl.sock conns >conns.dump
+grep -q "^worker $WORKER core 0 gen 0: 0 connections" conns.dump ||
+fail "expected the connection table of the worker"
+
+# a backend marked down turns clients away
+hitch_ctl ctl.sock backend down | grep -q '^backend down$' ||
+fail "expected the backend to be down"
+curl --max-time 5 --silent --insecure \
+	"https://localhost:$LISTENPORT/" >/dev/null &&
+fail "expected the connection to be closed"
+hitch_ctl ctl.sock stats | grep -q "^backend_down_drops  *1 " ||
+fail "expected 1 connection dropped"
+hitch_ctl ctl.sock backend up
+curl_hitch
+
+# a drained worker is replaced
+hitch_ctl ctl.sock drain "$WORKER"
+sleep 1
+hitch_ctl ctl.sock workers >workers2.dump
+test "$(grep -c ' active ' workers2.dump)" -eq 1 ||
+fail "expected one active worker after the drain"
+grep -q "^$WORKER " workers2.dump &&
+fail "expected the drained worker to be gone"
+
+# certificates are added and removed at runtime
+s_client -servername site3.example.com >s_client.dump
+subj_name_eq "site1.example.com" s_client.dump ||
+fail "expected the certificate of site1 before the update"
+
+hitch_ctl ctl.sock cert add "${CERTSDIR}/site3.example.com" |
+grep -q '^Started worker generation 1$' ||
+fail "expected a new worker generation"
+sleep 1
+s_client -servername site3.example.com >s_client2.dump
+subj_name_eq "site3.example.com" s_client2.dump ||
+fail "expected the certificate of site3 after the update"
+
+CTL_STATUS=400 hitch_ctl ctl.sock cert add "${CERTSDIR}/site3.example.com"
+hitch_ctl ctl.sock cert remove "${CERTSDIR}/site3.example.com"
+CTL_STATUS=404 hitch_ctl ctl.sock cert remove "${CERTSDIR}/site3.example.com"
+
+stop_hitch
+test ! -S ctl.sock ||
+fail "control socket was not removed"
@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# Test the connection table: filters, kill and idle timeout.
+#
+. hitch_test.sh
+
+cmd python3 ||
+skip "python3 is needed for the backend"
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+# a backend that accepts connections and keeps them open
+python3 -c '
+import socket, sys
+s = socket.socket()
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind(("127.0.0.1", int(sys.argv[1])))
+s.listen(8)
+c = []
+while True:
+    c.append(s.accept()[0])
+' $BACKENDPORT &
+echo $! >backend.pid
+sleep 0.5
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[localhost]:$LISTENPORT" \
+	--control-socket=ctl.sock \
+	--idle-timeout=5 \
+	"${CERTSDIR}/site1.example.com"
+
+for CLIENT in 1 2
+do
+	sleep 10 | openssl s_client -connect "localhost:$LISTENPORT" \
+		>client$CLIENT.log 2>&1 &
+done
+sleep 1
+
+hitch_ctl ctl.sock conns state=established age=0.5 >conns.dump
+test "$(grep -c 'state=established' conns.dump)" -eq 2 ||
+fail "expected two established connections"
+
+hitch_ctl ctl.sock conns state=handshake >conns2.dump
+grep -q 'state=' conns2.dump &&
+fail "expected no connection in the handshake"
+
+CTL_STATUS=400 hitch_ctl ctl.sock conns bogus=1
+CTL_STATUS=400 hitch_ctl ctl.sock kill
+
+FD=$(sed -n 's/.* fd=\([0-9]*\) .*/\1/p' conns.dump | head -n 1)
+hitch_ctl ctl.sock kill fd=$FD >kill.dump
+grep -q 'closing 1 connections' kill.dump ||
+fail "expected one connection to be closed"
+
+hitch_ctl ctl.sock conns >conns3.dump
+test "$(grep -c 'state=' conns3.dump)" -eq 1 ||
+fail "expected one connection left"
+
+# the other one times out
+sleep 6
+hitch_ctl ctl.sock stats >stats.dump
+grep -q "^idle_timeouts  *1 " stats.dump ||
+fail "expected 1 idle timeout"
+hitch_ctl ctl.sock conns | grep -q ': 0 connections' ||
+fail "expected no connection left"
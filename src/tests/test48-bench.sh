@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# Run hitch-bench against hitch, through a PROXY v2 speaking backend.
+#
+. hitch_test.sh
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	--write-proxy-v2 \
+	"${CERTSDIR}/site1.example.com"
+
+hitch-bench client -c "[127.0.0.1]:$LISTENPORT" -m request -n 4 -d 1 \
+	>request.dump
+grep -q '^errors 0$' request.dump ||
+fail "expected no errors"
+grep -q '^requests [1-9]' request.dump ||
+fail "expected requests to be answered"
+grep -q '^request_p99_ms ' request.dump ||
+fail "expected request latency percentiles"
+
+hitch-bench client -c "[127.0.0.1]:$LISTENPORT" -m resume -n 2 -d 1 \
+	>resume.dump
+grep -q '^resumed [1-9]' resume.dump ||
+fail "expected resumed handshakes"
+
+hitch-bench client -c "[127.0.0.1]:$LISTENPORT" -m idle -n 10 -d 0.5 \
+	-p "$(hitch_pid)" >idle.dump
+grep -q '^established 10$' idle.dump ||
+fail "expected 10 idle connections"
+grep -q '^bytes_per_conn ' idle.dump ||
+fail "expected the memory per connection"
+
+kill -TERM "$(cat backend.pid)"
+rm backend.pid
+sleep 0.5
+grep -q '^proxy_v2 [1-9]' backend.dump ||
+fail "expected PROXY v2 headers on the backend"
@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+# Memory used by idle connections, and what is left once they are gone.
+#
+. hitch_test.sh
+
+perf_test
+
+test -d /proc/self || cmd lsof ||
+skip "procfs or lsof is needed to count file descriptors"
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+PERF_CONNS=${HITCH_PERF_CONNS:-10000}
+
+# Hitch holds a client and a backend descriptor per connection
+ulimit -n "$(ulimit -H -n)" 2>/dev/null || true
+NOFILE=$(ulimit -n)
+if [ "$NOFILE" != unlimited ] && [ $((PERF_CONNS * 2 + 200)) -gt "$NOFILE" ]
+then
+	PERF_CONNS=$(((NOFILE - 200) / 2))
+	test "$PERF_CONNS" -ge 1000 ||
+	skip "not enough file descriptors ($NOFILE)"
+	echo "Scaled down to $PERF_CONNS connections" >&2
+fi
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" -m sink >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	--workers=2 \
+	--backlog=4096 \
+	"${CERTSDIR}/site1.example.com"
+sleep 1
+
+FDS0=$(hitch_fds)
+RSS0=$(hitch_rss)
+
+hitch-bench client -c "[127.0.0.1]:$LISTENPORT" -m idle \
+	-n "$PERF_CONNS" -t 4 -d 1 -p "$(hitch_pid)" >idle.dump
+
+grep -q "^established $PERF_CONNS\$" idle.dump ||
+fail "expected $PERF_CONNS idle connections"
+
+perf_check idle_bytes_per_conn \
+	"$(awk '$1 == "bytes_per_conn" { print $2 }' idle.dump)"
+perf_check idle_rss_kb \
+	"$(awk '$1 == "rss_after_kb" { print $2 }' idle.dump)"
+
+# The client is gone, wait for hitch to close both ends
+for _ in $(seq 30)
+do
+	test "$(hitch_fds)" -le "$FDS0" && break
+	sleep 1
+done
+
+perf_check drain_fds_delta $(($(hitch_fds) - FDS0))
+
+# Workers trim their memory every 5 seconds after a burst
+sleep 6
+perf_check drain_rss_kb_delta $(($(hitch_rss) - RSS0))
@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Reload a configuration with thousands of certificates.
+#
+. hitch_test.sh
+
+perf_test
+
+PERF_CERTS=${HITCH_PERF_CERTS:-5000}
+
+mkdir certs
+seq "$PERF_CERTS" |
+while read -r N
+do
+	cp "${CERTSDIR}/site$((N % 3 + 1)).example.com" "certs/cert$N.pem"
+done
+
+cat >hitch.cfg <<EOF
+frontend = {
+	host = "127.0.0.1"
+	port = "$LISTENPORT"
+}
+
+pem-dir = "$PWD/certs"
+EOF
+
+start_hitch --config="$PWD/hitch.cfg"
+
+# Make sure every certificate is loaded again
+touch certs/*
+kill -HUP "$(hitch_pid)"
+
+for _ in $(seq 120)
+do
+	grep -q 'Config reloaded in' hitch.log && break
+	sleep 1
+done
+
+RELOAD_SECS=$(sed -n 's/.*Config reloaded in \([0-9.]*\) seconds.*/\1/p' \
+	hitch.log)
+test -n "$RELOAD_SECS" ||
+fail "the configuration was not reloaded"
+
+perf_check reload_secs "$RELOAD_SECS"
+
+s_client -servername site2.example.com >site2.dump
+subj_name_eq "site2.example.com" site2.dump ||
+fail "expected the site2 certificate after the reload"
@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# Request and handshake rates through a single worker.
+#
+. hitch_test.sh
+
+perf_test
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	"${CERTSDIR}/site1.example.com"
+
+hitch-bench client -c "[127.0.0.1]:$LISTENPORT" -m request -n 16 -d 3 \
+	>request.dump
+grep -q '^errors 0$' request.dump ||
+fail "expected no errors"
+perf_check requests_per_sec \
+	"$(awk '$1 == "requests_per_sec" { print $2 }' request.dump)"
+
+hitch-bench client -c "[127.0.0.1]:$LISTENPORT" -m handshake -n 4 -d 3 \
+	>handshake.dump
+perf_check handshakes_per_sec \
+	"$(awk '$1 == "handshakes_per_sec" { print $2 }' handshake.dump)"
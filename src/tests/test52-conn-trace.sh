@@ -0,0 +1,81 @@
+#!/bin/sh
+#
+# Record connection traces, and replay them with hitch-bench.
+#
+. hitch_test.sh
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" -s 2000 >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	--alpn-protos="http/1.1" \
+	--conn-trace \
+	"${CERTSDIR}/site1.example.com"
+
+hitch-bench client -c "[127.0.0.1]:$LISTENPORT" -m request -n 2 -d 0.5 \
+	-S site1.example.com >request.dump
+hitch-bench client -c "[127.0.0.1]:$LISTENPORT" -m resume -n 1 -d 0.5 \
+	>resume.dump
+
+# ALPN protocols are sent as is, they must not break up the record
+if cmd python3
+then
+	python3 -c '
+import socket, ssl, sys
+ctx = ssl._create_unverified_context()
+ctx.set_alpn_protocols(["h2\tx,y", "http/1.1"])
+s = ctx.wrap_socket(socket.create_connection(("127.0.0.1",
+    int(sys.argv[1]))))
+s.close()
+' "$LISTENPORT" ||
+	fail "the ALPN handshake failed"
+	ALPN_CHECK=yes
+fi
+
+stop_hitch
+
+grep '{trace}' hitch.log >trace.dump ||
+fail "expected conn-trace records"
+
+# timestamp [pid] {trace}, then 18 fields
+awk -F '\t' 'NF != 19 { exit 1 }' trace.dump ||
+fail "expected 18 fields in the conn-trace records"
+
+cut -f 5 trace.dump | grep -q '^site1.example.com$' ||
+fail "expected the SNI server name"
+
+cut -f 7 trace.dump | grep -q '^resumed$' ||
+fail "expected resumed handshakes"
+
+cut -f 16 trace.dump | grep -q '^[1-9][0-9]*$' ||
+fail "expected the number of ciphers offered"
+
+test -z "${ALPN_CHECK:-}" ||
+grep -q '	h2?x?y,http/1.1	' trace.dump ||
+fail "expected the ALPN protocols with separators replaced"
+
+cut -f 19 trace.dump | grep -q '^c[0-9]*:[1-9][0-9]*,b[0-9]*:[1-9]' ||
+fail "expected bursts from the client and the backend"
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	"${CERTSDIR}/site1.example.com"
+
+hitch-bench replay -c "[127.0.0.1]:$LISTENPORT" -f trace.dump -x 2 \
+	>replay.dump ||
+fail "the replay failed"
+
+grep -q "^connections $(wc -l <trace.dump)\$" replay.dump ||
+fail "expected every trace to be replayed"
+grep -q '^errors 0$' replay.dump ||
+fail "expected no replay errors"
+grep -q '^requests [1-9]' replay.dump ||
+fail "expected replayed requests"
+grep -q '^resumed [1-9]' replay.dump ||
+fail "expected replayed resumptions"
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Limit the rate of full handshakes per client address.
+#
+. hitch_test.sh
+
+curl --help all 2>/dev/null | grep -q -e --unix-socket ||
+curl --help | grep -q -e --unix-socket ||
+skip "curl: unknown option --unix-socket"
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	--stats-socket="$PWD/stats.sock" \
+	--handshake-rate=2 \
+	"${CERTSDIR}/site1.example.com"
+
+hitch-bench client -c "[127.0.0.1]:$LISTENPORT" -m handshake -n 2 -d 2 \
+	>handshake.dump
+
+# A burst of 4, then 2 per second
+HANDSHAKES=$(awk '$1 == "handshakes" { print $2 }' handshake.dump)
+test "$HANDSHAKES" -ge 1 ||
+fail "expected handshakes under the limit"
+test "$HANDSHAKES" -le 10 ||
+fail "expected at most 10 handshakes, got $HANDSHAKES"
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats.dump
+
+grep -q "^rate_limited_accept  *[1-9]" stats.dump ||
+fail "expected connections refused at accept"
+
+grep -q "^frontend_rate_limited{.*} [1-9]" stats.dump ||
+fail "expected refused connections in the frontend counters"
@@ -0,0 +1,73 @@
+#!/bin/sh
+#
+# Pause accepting at the connection limit, and resume below it.
+#
+. hitch_test.sh
+
+curl --help all 2>/dev/null | grep -q -e --unix-socket ||
+curl --help | grep -q -e --unix-socket ||
+skip "curl: unknown option --unix-socket"
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	--stats-socket="$PWD/stats.sock" \
+	--max-connections=2 \
+	--max-buffer-memory=64 \
+	"${CERTSDIR}/site1.example.com"
+
+# Connections over the limit wait in the listen queue
+hitch-bench client -c "[127.0.0.1]:$LISTENPORT" -m handshake -n 8 -d 2 \
+	>handshake.dump
+
+grep -q '^errors 0$' handshake.dump ||
+fail "expected no errors from queued connections"
+
+grep -q '^handshakes [1-9]' handshake.dump ||
+fail "expected handshakes"
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats.dump
+
+grep -q "^accept_pauses  *[1-9]" stats.dump ||
+fail "expected accepting to pause"
+
+grep -q "^overload_drops  *0 " stats.dump ||
+fail "expected no connections dropped over the buffer memory"
+
+grep -q "^accept_paused  *0 " stats.dump ||
+fail "expected accepting to resume"
+
+# Accepting again once the connections are gone
+curl_hitch
+
+stop_hitch
+
+# With 1MB of buffers, connections get smaller ones past 768kB
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	--stats-socket="$PWD/stats.sock" \
+	--max-buffer-memory=1 \
+	"${CERTSDIR}/site1.example.com"
+
+hitch-bench client -c "[127.0.0.1]:$LISTENPORT" -m request -n 16 -d 1 \
+	>request.dump
+
+grep -q '^errors 0$' request.dump ||
+fail "expected no errors under the buffer memory limit"
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats2.dump
+
+grep -q "^ring_reduced  *[1-9]" stats2.dump ||
+fail "expected smaller buffers under memory pressure"
+
+grep -q "^accept_pauses  *[1-9]" stats2.dump ||
+fail "expected accepting to pause at the buffer memory limit"
@@ -0,0 +1,99 @@
+#!/bin/sh
+#
+# Queue full handshakes over the handshake budget, and shed the oldest.
+#
+. hitch_test.sh
+
+cmd python3 ||
+skip "python3 is needed for the handshake burst"
+
+curl --help all 2>/dev/null | grep -q -e --unix-socket ||
+curl --help | grep -q -e --unix-socket ||
+skip "curl: unknown option --unix-socket"
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	--stats-socket="$PWD/stats.sock" \
+	--handshake-budget=1 \
+	--handshake-queue=4 \
+	--proxy-proxy \
+	"${CERTSDIR}/site1.example.com"
+
+# Get the connections accepted with their PROXY lines first, and stop
+# hitch while their ClientHellos are sent, so that it finds them all in
+# one loop iteration.
+python3 -c '
+import os, select, signal, socket, ssl, sys, time
+port, pids = int(sys.argv[1]), [int(p) for p in sys.argv[2:]]
+ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+ctx.check_hostname = False
+ctx.verify_mode = ssl.CERT_NONE
+conns = {}
+for _ in range(20):
+    s = socket.create_connection(("127.0.0.1", port))
+    s.sendall(b"PROXY TCP4 192.0.2.1 127.0.0.1 1234 443\r\n")
+    i, o = ssl.MemoryBIO(), ssl.MemoryBIO()
+    conns[s] = (ctx.wrap_bio(i, o), i, o)
+time.sleep(1)
+for p in pids:
+    os.kill(p, signal.SIGSTOP)
+for s, (t, i, o) in conns.items():
+    try:
+        t.do_handshake()
+    except ssl.SSLWantReadError:
+        pass
+    s.sendall(o.read())
+for p in pids:
+    os.kill(p, signal.SIGCONT)
+done = failed = 0
+end = time.time() + 10
+while conns and time.time() < end:
+    for s in select.select(list(conns), [], [], 1)[0]:
+        t, i, o = conns[s]
+        try:
+            b = s.recv(16384)
+        except OSError:
+            b = b""
+        if not b:
+            failed += 1
+            del conns[s]
+            continue
+        i.write(b)
+        try:
+            t.do_handshake()
+            done += 1
+            del conns[s]
+        except ssl.SSLWantReadError:
+            pass
+        except ssl.SSLError:
+            failed += 1
+            del conns[s]
+        s.sendall(o.read())
+print("handshakes %d" % done)
+print("failed %d" % failed)
+' "$LISTENPORT" $(hitch_procs) >burst.dump
+
+grep -q '^handshakes [1-9]' burst.dump ||
+fail "expected handshakes through the queue"
+
+grep -q '^failed [1-9]' burst.dump ||
+fail "expected handshakes shed from the queue"
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats.dump
+
+grep -q "^hs_queued  *[1-9]" stats.dump ||
+fail "expected queued full handshakes"
+
+grep -q "^hs_fail_shed  *[1-9]" stats.dump ||
+fail "expected handshakes shed from the queue"
+
+grep -q "^hs_queue  *0 " stats.dump ||
+fail "expected an empty queue after the burst"
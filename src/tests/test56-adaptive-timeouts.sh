@@ -0,0 +1,64 @@
+#!/bin/sh
+#
+# Shorten the timeouts of a worker nearing its connection limit.
+#
+. hitch_test.sh
+
+cmd python3 ||
+skip "python3 is needed to hold the connections"
+
+curl --help all 2>/dev/null | grep -q -e --unix-socket ||
+curl --help | grep -q -e --unix-socket ||
+skip "curl: unknown option --unix-socket"
+
+cat >hitch.cfg <<EOF
+frontend = "[127.0.0.1]:$LISTENPORT"
+pem-file = "${CERTSDIR}/site1.example.com"
+stats-socket = "$PWD/stats.sock"
+max-connections = 2
+adaptive-timeouts = on
+EOF
+
+start_hitch --config="$PWD/hitch.cfg"
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats.dump
+
+grep -q "^handshake_timeout_ms  *30000 " stats.dump ||
+fail "expected the full handshake timeout without load"
+
+# Hold two handshakes open for 8 seconds with the first byte of a
+# ClientHello, to get to the connection limit.
+python3 -c '
+import socket, sys, time
+conns = [socket.create_connection(("127.0.0.1", int(sys.argv[1])))
+    for _ in range(2)]
+for s in conns:
+    s.sendall(b"\x16")
+time.sleep(8)
+' "$LISTENPORT" &
+echo $! >python.pid
+sleep 1.5
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats2.dump
+
+# A tenth of 30s at the limit
+grep -q "^handshake_timeout_ms  *3000 " stats2.dump ||
+fail "expected a shorter handshake timeout under load"
+
+grep -q "^connect_timeout_ms  *3000 " stats2.dump ||
+fail "expected a shorter backend connect timeout under load"
+
+# Both handshakes outlive the shorter timeout before the python script
+# lets go of them.
+sleep 4
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats3.dump
+
+grep -q "^hs_fail_timeout  *2 " stats3.dump ||
+fail "expected the handshakes to time out early"
+
+grep -q "^handshake_timeout_ms  *30000 " stats3.dump ||
+fail "expected the full handshake timeout once the load is gone"
@@ -0,0 +1,107 @@
+#!/bin/sh
+#
+# Fingerprint ClientHellos, pass them to the backend, and deny or rate
+# limit them.
+#
+. hitch_test.sh
+
+curl --help all 2>/dev/null | grep -q -e --unix-socket ||
+curl --help | grep -q -e --unix-socket ||
+skip "curl: unknown option --unix-socket"
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+run_cmd -s 1 hitch --test --fingerprint-deny=0123abc \
+	"${CERTSDIR}/site1.example.com"
+
+parse_proxy_v2 $BACKENDPORT >proxy.dump &
+PARSE_PID=$!
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	--write-proxy-v2 \
+	--proxy-fingerprint \
+	"${CERTSDIR}/site1.example.com"
+
+sleep 0.1
+s_client >s_client.dump
+wait $PARSE_PID
+
+FP=$(awk -F '\t' '$1 == "Fingerprint extension:" { print $2 }' proxy.dump)
+test ${#FP} -eq 32 ||
+fail "expected the fingerprint in a PROXY v2 TLV"
+
+stop_hitch
+
+cat >hitch.cfg <<EOF
+frontend = "[127.0.0.1]:$LISTENPORT"
+pem-file = "${CERTSDIR}/site1.example.com"
+stats-socket = "$PWD/stats.sock"
+fingerprint-deny = "00000000000000000000000000000000,$FP"
+EOF
+
+start_hitch --config="$PWD/hitch.cfg"
+
+! s_client >denied.dump ||
+fail "expected the handshake to be refused"
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats.dump
+
+grep -q "^fingerprint_denied  *1 " stats.dump ||
+fail "expected a denied fingerprint"
+
+stop_hitch
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	--stats-socket="$PWD/stats.sock" \
+	--fingerprint-rate=2 \
+	"${CERTSDIR}/site1.example.com"
+
+hitch-bench client -c "[127.0.0.1]:$LISTENPORT" -m handshake -n 2 -d 2 \
+	>handshake.dump
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats2.dump
+
+grep -q "^fingerprint_rate_limited  *[1-9]" stats2.dump ||
+fail "expected handshakes over the fingerprint rate"
+
+# Four tokens to start with, and two per second
+HANDSHAKES=$(awk '$1 == "handshakes" { print $2 }' handshake.dump)
+test "$HANDSHAKES" -le 10 ||
+fail "expected at most 10 handshakes, got $HANDSHAKES"
+
+# A ClientHello padded with cipher suites is fingerprinted too
+if cmd python3
+then
+	BEFORE=$(awk '$1 == "fingerprints" { print $2 }' stats2.dump)
+	python3 -c '
+import socket, struct, sys
+ciphers = b"".join(struct.pack("!H", 0xc100 + i) for i in range(2000))
+ciphers += struct.pack("!H", 0x002f)
+body = struct.pack("!H", 0x0303) + bytes(32) + b"\x00" + \
+    struct.pack("!H", len(ciphers)) + ciphers + b"\x01\x00\x00\x00"
+hs = b"\x01" + struct.pack("!I", len(body))[1:] + body
+s = socket.create_connection(("127.0.0.1", int(sys.argv[1])))
+s.sendall(b"\x16\x03\x01" + struct.pack("!H", len(hs)) + hs)
+s.settimeout(5)
+s.recv(4096)
+' $LISTENPORT || fail "expected a ServerHello"
+
+	run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+		http://localhost/stats >stats3.dump
+
+	AFTER=$(awk '$1 == "fingerprints" { print $2 }' stats3.dump)
+	test "$AFTER" -gt "$BEFORE" ||
+	fail "expected the padded ClientHello fingerprinted"
+	! grep -q "^fingerprint_failed  *[1-9]" stats3.dump ||
+	fail "expected no unfingerprintable ClientHello"
+fi
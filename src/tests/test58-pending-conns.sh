@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Keep connections without data pending, and close the ones not
+# starting with a TLS handshake.
+#
+. hitch_test.sh
+
+cmd python3 ||
+skip "python3 is needed to hold the connections"
+
+curl --help all 2>/dev/null | grep -q -e --unix-socket ||
+curl --help | grep -q -e --unix-socket ||
+skip "curl: unknown option --unix-socket"
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	--stats-socket="$PWD/stats.sock" \
+	--defer-accept=0 \
+	--log-level=2 \
+	"${CERTSDIR}/site1.example.com"
+
+# Three idle connections, then plain HTTP on one and a close of another
+python3 -c '
+import socket, sys, time
+conns = [socket.create_connection(("127.0.0.1", int(sys.argv[1])))
+    for _ in range(3)]
+time.sleep(2)
+conns[0].sendall(b"GET / HTTP/1.0\r\n\r\n")
+conns[1].close()
+time.sleep(2)
+' "$LISTENPORT" &
+PYTHON_PID=$!
+sleep 1
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats.dump
+
+grep -q "^pending  *3 " stats.dump ||
+fail "expected three pending connections"
+
+grep -q "^buffer_bytes  *0 " stats.dump ||
+fail "expected no buffers for pending connections"
+
+sleep 2
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats2.dump
+
+grep -q "^pending_rejected  *1 " stats2.dump ||
+fail "expected the plain HTTP connection to be rejected"
+
+grep -q "^pending_closed  *1 " stats2.dump ||
+fail "expected a connection closed without data"
+
+grep -q "^pending  *1 " stats2.dump ||
+fail "expected one connection still pending"
+
+# Pending connections have no backend socket yet
+grep -q ' [0-9]*:-1 not a TLS handshake, first byte 0x47$' hitch.log ||
+fail "expected the rejected connection in the log"
+
+wait $PYTHON_PID
+
+# TLS connections still go through
+curl_hitch
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats3.dump
+
+grep -q "^pending  *0 " stats3.dump ||
+fail "expected no pending connections left"
@@ -0,0 +1,91 @@
+#!/bin/sh
+#
+# Hand the listen sockets over to a new master, and take them over from
+# systemd socket activation.
+#
+. hitch_test.sh
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+start_hitch \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	--control-socket=ctl.sock \
+	--log-level=2 \
+	"${CERTSDIR}/site1.example.com"
+
+sleep 0.5
+OLD_PID=$(hitch_pid)
+curl_hitch
+
+hitch_ctl ctl.sock upgrade | grep -q '^Started new master' ||
+fail "expected the upgrade to start"
+
+# The new master writes the pid file once the old one let go of it
+for _ in 1 2 3 4 5 6 7 8 9 10
+do
+	test "$(hitch_pid)" != "$OLD_PID" && break
+	sleep 1
+done
+test "$(hitch_pid)" != "$OLD_PID" ||
+fail "expected a new master"
+
+grep -q "Listening on 127.0.0.1:$LISTENPORT (inherited)" hitch.log ||
+fail "expected the listen socket to be handed over"
+
+curl_hitch
+
+# The old master exits once its idle worker is drained
+for _ in 1 2 3 4 5 6 7 8 9 10
+do
+	kill -0 "$OLD_PID" 2>/dev/null || break
+	sleep 1
+done
+kill -0 "$OLD_PID" 2>/dev/null &&
+fail "expected the old master to exit"
+
+hitch_ctl ctl.sock workers >workers.dump
+test "$(grep -c ' active ' workers.dump)" -eq 1 ||
+fail "expected one active worker in the new master"
+
+curl_hitch
+stop_hitch
+
+cmd python3 ||
+skip "python3 is needed to activate a socket"
+
+# Bind the listen socket like systemd would, and execute hitch with it
+python3 -c '
+import os, socket, sys
+s = socket.socket()
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind(("127.0.0.1", int(sys.argv[1])))
+s.listen(16)
+if s.fileno() != 3:
+	os.dup2(s.fileno(), 3)
+os.set_inheritable(3, True)
+os.environ["LISTEN_PID"] = str(os.getpid())
+os.environ["LISTEN_FDS"] = "1"
+os.execvp(sys.argv[2], sys.argv[2:])
+' "$LISTENPORT" hitch \
+	--pidfile="$TEST_TMPDIR/hitch.pid" \
+	--log-filename=systemd.log \
+	--log-level=2 \
+	--daemon \
+	$HITCH_USER \
+	--backend="[127.0.0.1]:$BACKENDPORT" \
+	--frontend="[127.0.0.1]:$LISTENPORT" \
+	"${CERTSDIR}/site1.example.com" ||
+fail "expected hitch to start with a socket from systemd"
+
+grep -q "Received 1 sockets from systemd" systemd.log ||
+fail "expected the socket from systemd"
+
+grep -q "Listening on 127.0.0.1:$LISTENPORT (inherited)" systemd.log ||
+fail "expected the frontend to take the socket from systemd"
+
+curl_hitch
@@ -0,0 +1,102 @@
+#!/bin/sh
+#
+# Bound the time workers spend draining after a reload, and the number
+# of worker generations running at once.
+#
+. hitch_test.sh
+
+cmd python3 ||
+skip "python3 is needed to hold the connections"
+
+curl --help all 2>/dev/null | grep -q -e --unix-socket ||
+curl --help | grep -q -e --unix-socket ||
+skip "curl: unknown option --unix-socket"
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+# Hold an idle TLS connection for 15 seconds
+hold_conn() {
+	python3 -c '
+import socket, ssl, sys, time
+ctx = ssl._create_unverified_context()
+s = ctx.wrap_socket(socket.create_connection(("127.0.0.1", int(sys.argv[1]))))
+time.sleep(15)
+' "$LISTENPORT" &
+	echo $! >"python$1.pid"
+	sleep 1
+}
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+cat >hitch.cfg <<EOF
+frontend = "[127.0.0.1]:$LISTENPORT"
+backend = "[127.0.0.1]:$BACKENDPORT"
+pem-file = "${CERTSDIR}/site1.example.com"
+stats-socket = "$PWD/stats.sock"
+drain-timeout = 4
+EOF
+
+start_hitch --config="$PWD/hitch.cfg"
+hold_conn 1
+
+kill -HUP $(hitch_pid)
+sleep 0.5
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats.dump
+
+grep -q '^worker_drain_conns{.*} 1 ' stats.dump ||
+fail "expected a worker draining one connection"
+
+# The connection is idle for longer than the time left before the
+# deadline after about a second and a half.
+sleep 3
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats2.dump
+
+grep -q '^drain_idle_closed  *1 ' stats2.dump ||
+fail "expected the idle connection to be closed early"
+
+grep -q '^worker_drain_seconds' stats2.dump &&
+fail "expected the draining worker to be gone"
+
+stop_hitch
+
+cat >hitch.cfg <<EOF
+frontend = "[127.0.0.1]:$LISTENPORT"
+backend = "[127.0.0.1]:$BACKENDPORT"
+pem-file = "${CERTSDIR}/site1.example.com"
+stats-socket = "$PWD/stats.sock"
+max-generations = 2
+EOF
+
+start_hitch --config="$PWD/hitch.cfg"
+hold_conn 2
+kill -HUP $(hitch_pid)
+sleep 0.5
+hold_conn 3
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats3.dump
+
+test $(grep -c '^worker_drain_seconds' stats3.dump) -eq 1 ||
+fail "expected one draining worker"
+
+# A third generation is one too many, the oldest one goes.
+kill -HUP $(hitch_pid)
+sleep 1
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats4.dump
+
+grep -q '^drain_expired  *1 ' stats4.dump ||
+fail "expected the connection of the oldest generation to be closed"
+
+test $(grep -c '^worker_drain_seconds' stats4.dump) -eq 1 ||
+fail "expected one draining worker left"
+
+grep -q 'Expiring worker generation' hitch.log ||
+fail "expected the oldest generation to expire"
@@ -0,0 +1,96 @@
+#!/bin/sh
+#
+# Resume TLS sessions across reloads: cached sessions are handed over
+# to the new generation, and a certificate reloaded unchanged keeps its
+# session ticket keys.
+#
+. hitch_test.sh
+
+curl --help all 2>/dev/null | grep -q -e --unix-socket ||
+curl --help | grep -q -e --unix-socket ||
+skip "curl: unknown option --unix-socket"
+
+cp "${CERTSDIR}/site1.example.com" site1.pem
+
+cat >hitch.cfg <<EOF
+frontend = "[127.0.0.1]:$LISTENPORT"
+pem-file = "$PWD/site1.pem"
+stats-socket = "$PWD/stats.sock"
+log-level = 2
+EOF
+
+start_hitch --config="$PWD/hitch.cfg"
+
+tls12() {
+	openssl s_client -connect "127.0.0.1:$LISTENPORT" -tls1_2 "$@" \
+		</dev/null 2>&1
+}
+
+# A session in the cache, without a ticket
+tls12 -no_ticket -sess_out sess.pem >first.dump
+grep -q '^New, ' first.dump ||
+fail "expected a new session"
+
+kill -HUP $(hitch_pid)
+sleep 1
+
+tls12 -no_ticket -sess_in sess.pem >cache.dump
+grep -q '^Reused, ' cache.dump ||
+fail "expected the cached session to resume after a reload"
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats.dump
+
+grep -q '^sessions_exported  *1 ' stats.dump ||
+fail "expected the session to be handed over"
+grep -q '^sessions_imported  *1 ' stats.dump ||
+fail "expected the session to be taken over"
+
+# A ticket, with the certificate file touched before the reload
+tls12 -sess_out ticket.pem >second.dump
+grep -q '^New, ' second.dump ||
+fail "expected a new session"
+
+sleep 1
+touch site1.pem
+kill -HUP $(hitch_pid)
+sleep 1
+
+tls12 -sess_in ticket.pem >ticket.dump
+grep -q '^Reused, ' ticket.dump ||
+fail "expected the ticket to resume after a reload"
+
+grep -q "Keeping the session ticket keys of '$PWD/site1.pem'" hitch.log ||
+fail "expected the reloaded certificate to keep its ticket keys"
+
+stop_hitch
+
+# Sessions are checked against the certificate that served them, after
+# SNI, not the default one
+cp "${CERTSDIR}/site2.example.com" site2.pem
+
+cat >hitch.cfg <<EOF2
+frontend = "[127.0.0.1]:$LISTENPORT"
+pem-file = "$PWD/site2.pem"
+pem-file = "$PWD/site1.pem"
+stats-socket = "$PWD/stats.sock"
+EOF2
+
+start_hitch --config="$PWD/hitch.cfg"
+
+tls12 -no_ticket -servername site2.example.com -sess_out sni.pem \
+	>sni.dump
+grep -q '^New, ' sni.dump ||
+fail "expected a new session"
+
+cp "${CERTSDIR}/site3.example.com" site2.pem
+kill -HUP $(hitch_pid)
+sleep 1
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats2.dump
+
+grep -q '^sessions_exported  *1 ' stats2.dump ||
+fail "expected the SNI session to be handed over"
+grep -q '^sessions_imported  *0 ' stats2.dump ||
+fail "expected the SNI session refused, its certificate changed"
@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# Start workers under load up to workers-max, have the busiest one stop
+# accepting for the others, and retire workers once the load is gone.
+#
+. hitch_test.sh
+
+cmd python3 ||
+skip "python3 is needed to hold the connections"
+
+curl --help all 2>/dev/null | grep -q -e --unix-socket ||
+curl --help | grep -q -e --unix-socket ||
+skip "curl: unknown option --unix-socket"
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+cat >hitch.cfg <<EOF
+frontend = "[127.0.0.1]:$LISTENPORT"
+backend = "[127.0.0.1]:$BACKENDPORT"
+pem-file = "${CERTSDIR}/site1.example.com"
+stats-socket = "$PWD/stats.sock"
+workers = 1
+workers-max = 2
+workers-load = 50
+max-connections = 10
+EOF
+
+start_hitch --config="$PWD/hitch.cfg"
+
+# Eight of the ten connections of the only worker, for 10 seconds
+python3 -c '
+import socket, ssl, sys, time
+ctx = ssl._create_unverified_context()
+conns = [ctx.wrap_socket(socket.create_connection(("127.0.0.1",
+    int(sys.argv[1])))) for _ in range(8)]
+time.sleep(10)
+' "$LISTENPORT" &
+PYTHON_PID=$!
+
+# Three samples over workers-load, a second apart
+sleep 5
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats.dump
+
+grep -q '^workers_scaled_up  *1 ' stats.dump ||
+fail "expected a second worker under load"
+
+test $(grep -c '^worker_conns' stats.dump) -eq 2 ||
+fail "expected two workers"
+
+# The first worker holds all the connections
+sleep 4
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats2.dump
+
+grep -q '^worker_rebalances  *[1-9]' stats2.dump ||
+fail "expected the busier worker to pause accepting"
+
+# Ten samples without load, once the connections are gone
+wait $PYTHON_PID
+sleep 12
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats3.dump
+
+grep -q '^workers_scaled_down  *1 ' stats3.dump ||
+fail "expected a worker to be retired without load"
+
+test $(grep -c '^worker_conns' stats3.dump) -eq 1 ||
+fail "expected one worker left"
+
+grep -q 'Retiring worker .*, under workers-load' hitch.log ||
+fail "expected the retired worker to be logged"
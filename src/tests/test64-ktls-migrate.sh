@@ -0,0 +1,91 @@
+#!/bin/sh
+#
+# Migrate established connections to the new generation with kTLS, or
+# keep them in the draining worker when the kernel can't do TLS.
+#
+. hitch_test.sh
+
+curl --help all 2>/dev/null | grep -q -e --unix-socket ||
+curl --help | grep -q -e --unix-socket ||
+skip "curl: unknown option --unix-socket"
+
+cmd python3 ||
+skip "python3 is needed to hold a connection over a reload"
+
+hitch --test --ktls "${CERTSDIR}/site1.example.com" 2>&1 |
+grep -q 'built without kTLS' &&
+skip "hitch is built without kTLS support"
+
+BACKENDPORT=$(expr $LISTENPORT + 1500)
+
+hitch-bench backend -l "[127.0.0.1]:$BACKENDPORT" -m echo >backend.dump &
+echo $! >backend.pid
+sleep 0.5
+
+cat >hitch.cfg <<EOF
+frontend = "[127.0.0.1]:$LISTENPORT"
+backend = "[127.0.0.1]:$BACKENDPORT"
+pem-file = "${CERTSDIR}/site1.example.com"
+stats-socket = "$PWD/stats.sock"
+ktls = on
+log-level = 2
+EOF
+
+start_hitch --config="$PWD/hitch.cfg"
+
+# Echo through one connection before and after the reload
+python3 -c '
+import socket, ssl, sys, time
+ctx = ssl.SSLContext(ssl.PROTOCOL_TLS_CLIENT)
+ctx.check_hostname = False
+ctx.verify_mode = ssl.CERT_NONE
+ctx.maximum_version = ssl.TLSVersion.TLSv1_2
+s = ctx.wrap_socket(socket.create_connection(("127.0.0.1",
+    int(sys.argv[1]))))
+s.settimeout(5)
+def echo(msg):
+	s.sendall(msg)
+	got = b""
+	while len(got) < len(msg):
+		buf = s.recv(len(msg) - len(got))
+		if not buf:
+			sys.exit("connection closed")
+		got += buf
+	if got != msg:
+		sys.exit("unexpected echo")
+echo(b"before the reload\n")
+open("hold", "w").close()
+while open("hold").read() == "":
+	time.sleep(0.1)
+echo(b"after the reload\n")
+' "$LISTENPORT" >echo.dump 2>&1 &
+ECHO_PID=$!
+
+for _ in 1 2 3 4 5 6 7 8 9 10
+do
+	test -f hold && break
+	sleep 0.5
+done
+test -f hold ||
+fail "expected the connection to be established"
+
+kill -HUP $(hitch_pid)
+sleep 1
+echo reloaded >hold
+
+wait $ECHO_PID ||
+fail "expected the connection to outlive the reload"
+
+run_cmd curl --silent --max-time 5 --unix-socket "$PWD/stats.sock" \
+	http://localhost/stats >stats.dump
+
+if grep -q '\btls\b' /proc/sys/net/ipv4/tcp_available_ulp 2>/dev/null
+then
+	grep -q '^conns_migrated  *1 ' stats.dump ||
+	fail "expected the connection to be migrated"
+	grep -q '^conns_adopted  *1 ' stats.dump ||
+	fail "expected the connection to be taken over"
+else
+	grep -q '^conns_migrated  *0 ' stats.dump ||
+	fail "expected the connection to stay, without kTLS"
+fi
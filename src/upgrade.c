@@ -0,0 +1,388 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+
+#include "config.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <netinet/in.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "upgrade.h"
+#include "foreign/miniobj.h"
+#include "foreign/vas.h"
+#include "foreign/vqueue.h"
+
+/* hitch.c */
+extern hitch_config *CONFIG;
+
+/* Descriptors HUPG_recv_fd() makes room for, to tell extra ones apart */
+#define HUPG_MAX_FDS		4
+
+/* The first descriptor passed by systemd, see sd_listen_fds(3) */
+#define HUPG_SD_FDS_START	3
+
+struct hupg_sock {
+	unsigned		magic;
+#define HUPG_SOCK_MAGIC		0x6c0d52e9
+	int			fd;
+	struct sockaddr_storage	addr;
+	VTAILQ_ENTRY(hupg_sock)	list;
+};
+
+static VTAILQ_HEAD(, hupg_sock) hupg_socks =
+    VTAILQ_HEAD_INITIALIZER(hupg_socks);
+
+/* Send a datagram of len bytes, with nfd descriptors */
+int
+HUPG_send_fds(int sock, const void *buf, size_t len, const int *fds,
+    int nfd)
+{
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	union {
+		struct cmsghdr	cm;
+		char		buf[CMSG_SPACE(HUPG_MAX_FDS * sizeof(int))];
+	} cmsg;
+	ssize_t l;
+
+	AN(buf);
+	assert(nfd >= 0 && nfd <= HUPG_MAX_FDS);
+	memset(&mh, 0, sizeof mh);
+	iov.iov_base = (void *)(uintptr_t)buf;
+	iov.iov_len = len;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	if (nfd > 0) {
+		AN(fds);
+		memset(&cmsg, 0, sizeof cmsg);
+		mh.msg_control = cmsg.buf;
+		mh.msg_controllen = CMSG_SPACE(nfd * sizeof(int));
+		cm = CMSG_FIRSTHDR(&mh);
+		cm->cmsg_level = SOL_SOCKET;
+		cm->cmsg_type = SCM_RIGHTS;
+		cm->cmsg_len = CMSG_LEN(nfd * sizeof(int));
+		memcpy(CMSG_DATA(cm), fds, nfd * sizeof(int));
+	}
+
+	do {
+		l = sendmsg(sock, &mh, MSG_NOSIGNAL);
+	} while (l < 0 && errno == EINTR);
+	return (l == (ssize_t)len ? 0 : -1);
+}
+
+/* Receive a datagram of up to len bytes, and the descriptors it came
+ * with, up to *nfd of them. Returns its length, and the number of
+ * descriptors in *nfd. A datagram with more descriptors, or more than
+ * fit, is a protocol error: all its descriptors are closed. */
+ssize_t
+HUPG_recv_fds(int sock, void *buf, size_t len, int *fds, int *nfd)
+{
+	struct msghdr mh;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	union {
+		struct cmsghdr	cm;
+		char		buf[CMSG_SPACE(HUPG_MAX_FDS * sizeof(int))];
+	} cmsg;
+	int tmp[HUPG_MAX_FDS], flags = 0;
+	size_t i, n = 0, m;
+	ssize_t l;
+
+	AN(buf);
+	AN(nfd);
+	assert(*nfd >= 0 && *nfd <= HUPG_MAX_FDS);
+	memset(&mh, 0, sizeof mh);
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cmsg.buf;
+	mh.msg_controllen = sizeof cmsg.buf;
+#ifdef MSG_CMSG_CLOEXEC
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+	do {
+		l = recvmsg(sock, &mh, flags);
+	} while (l < 0 && errno == EINTR);
+	if (l < 0)
+		return (-1);
+
+	for (cm = CMSG_FIRSTHDR(&mh); cm != NULL; cm = CMSG_NXTHDR(&mh, cm)) {
+		if (cm->cmsg_level != SOL_SOCKET ||
+		    cm->cmsg_type != SCM_RIGHTS)
+			continue;
+		m = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (i = 0; i < m && n < HUPG_MAX_FDS; i++, n++)
+			memcpy(&tmp[n], CMSG_DATA(cm) + i * sizeof(int),
+			    sizeof(int));
+	}
+
+	if (n > (size_t)*nfd || (mh.msg_flags & MSG_CTRUNC)) {
+		for (i = 0; i < n; i++)
+			(void)close(tmp[i]);
+		errno = EPROTO;
+		return (-1);
+	}
+	if (n > 0) {
+		AN(fds);
+		memcpy(fds, tmp, n * sizeof(int));
+	}
+	*nfd = n;
+	return (l);
+}
+
+/* Send a datagram of len bytes, with a descriptor unless fd is -1 */
+int
+HUPG_send_fd(int sock, const void *buf, size_t len, int fd)
+{
+
+	return (HUPG_send_fds(sock, buf, len, &fd, fd >= 0 ? 1 : 0));
+}
+
+/* Receive a datagram of up to len bytes, and its descriptor if it came
+ * with one. Returns its length. */
+ssize_t
+HUPG_recv_fd(int sock, void *buf, size_t len, int *fd)
+{
+	int n = 1;
+
+	AN(fd);
+	*fd = -1;
+	return (HUPG_recv_fds(sock, buf, len, fd, &n));
+}
+
+/* Close the descriptors above stderr, but keep */
+void
+HUPG_close_fds(int keep)
+{
+	struct dirent *de;
+	DIR *d;
+	int fd;
+
+#ifdef HAVE_CLOSE_RANGE
+	if (keep > STDERR_FILENO + 1)
+		(void)close_range(STDERR_FILENO + 1, keep - 1, 0);
+	if (close_range(keep + 1, ~0U, 0) == 0)
+		return;
+#endif
+
+	d = opendir("/proc/self/fd");
+	if (d == NULL)
+		d = opendir("/dev/fd");
+	if (d != NULL) {
+		while ((de = readdir(d)) != NULL) {
+			fd = atoi(de->d_name);
+			if (fd > STDERR_FILENO && fd != keep && fd != dirfd(d))
+				(void)close(fd);
+		}
+		(void)closedir(d);
+		return;
+	}
+
+	for (fd = sysconf(_SC_OPEN_MAX) - 1; fd > STDERR_FILENO; fd--)
+		if (fd != keep)
+			(void)close(fd);
+}
+
+/* Send a message, with a descriptor unless fd is -1 */
+int
+HUPG_send(int sock, enum hupg_type type, int fd, const void *addr,
+    size_t len)
+{
+	struct hupg_msg msg;
+
+	memset(&msg, 0, sizeof msg);
+	msg.magic = HUPG_MSG_MAGIC;
+	msg.type = type;
+	msg.addr = (uintptr_t)addr;
+	msg.len = len;
+	return (HUPG_send_fd(sock, &msg, sizeof msg, fd));
+}
+
+/* Receive a message, and its descriptor if it came with one */
+int
+HUPG_recv(int sock, struct hupg_msg *msg, int *fd)
+{
+	ssize_t l;
+
+	AN(msg);
+	l = HUPG_recv_fd(sock, msg, sizeof *msg, fd);
+	if (l < 0)
+		return (-1);
+	if (l != sizeof *msg || msg->magic != HUPG_MSG_MAGIC) {
+		if (*fd >= 0)
+			(void)close(*fd);
+		*fd = -1;
+		errno = EPROTO;
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+hupg_same_addr(const struct sockaddr *a, const struct sockaddr *b)
+{
+	const struct sockaddr_in *a4, *b4;
+	const struct sockaddr_in6 *a6, *b6;
+
+	if (a->sa_family != b->sa_family)
+		return (0);
+	if (a->sa_family == AF_INET) {
+		a4 = (const struct sockaddr_in *)a;
+		b4 = (const struct sockaddr_in *)b;
+		return (a4->sin_port == b4->sin_port &&
+		    a4->sin_addr.s_addr == b4->sin_addr.s_addr);
+	}
+	if (a->sa_family == AF_INET6) {
+		a6 = (const struct sockaddr_in6 *)a;
+		b6 = (const struct sockaddr_in6 *)b;
+		return (a6->sin6_port == b6->sin6_port &&
+		    memcmp(&a6->sin6_addr, &b6->sin6_addr,
+		    sizeof a6->sin6_addr) == 0);
+	}
+	return (0);
+}
+
+/* Add an inherited listen socket to the pool. Anything else is
+ * closed. */
+int
+HUPG_inherit(int fd)
+{
+	struct hupg_sock *hs;
+	socklen_t len;
+	int t = 0;
+
+	ALLOC_OBJ(hs, HUPG_SOCK_MAGIC);
+	AN(hs);
+	len = sizeof hs->addr;
+	if (getsockname(fd, (struct sockaddr *)&hs->addr, &len) != 0 ||
+	    (hs->addr.ss_family != AF_INET &&
+	    hs->addr.ss_family != AF_INET6)) {
+		ERR("{core} Inherited descriptor %d is not an IP socket\n",
+		    fd);
+		(void)close(fd);
+		FREE_OBJ(hs);
+		return (-1);
+	}
+	len = sizeof t;
+	if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &t, &len) != 0 ||
+	    t == 0) {
+		ERR("{core} Inherited socket %d is not listening\n", fd);
+		(void)close(fd);
+		FREE_OBJ(hs);
+		return (-1);
+	}
+	hs->fd = fd;
+	VTAILQ_INSERT_TAIL(&hupg_socks, hs, list);
+	return (0);
+}
+
+/* Add the listen sockets passed by systemd socket activation. Returns
+ * how many, or -1 if the environment is not usable. */
+int
+HUPG_systemd(void)
+{
+	const char *s;
+	char *end;
+	long pid, n, i;
+
+	s = getenv("LISTEN_PID");
+	if (s == NULL)
+		return (0);
+	pid = strtol(s, &end, 10);
+	if (*s == '\0' || *end != '\0' || pid != (long)getpid())
+		return (0);
+
+	s = getenv("LISTEN_FDS");
+	n = s != NULL ? strtol(s, &end, 10) : -1;
+	if (s == NULL || *s == '\0' || *end != '\0' || n < 0 || n > 1024) {
+		ERR("{core} Invalid LISTEN_FDS from systemd: %s\n",
+		    s != NULL ? s : "(unset)");
+		return (-1);
+	}
+
+	/* Not for our children */
+	AZ(unsetenv("LISTEN_PID"));
+	AZ(unsetenv("LISTEN_FDS"));
+	AZ(unsetenv("LISTEN_FDNAMES"));
+
+	for (i = 0; i < n; i++)
+		(void)HUPG_inherit(HUPG_SD_FDS_START + i);
+	LOGL("{core} Received %ld sockets from systemd\n", n);
+	return (n);
+}
+
+/* Take the inherited socket bound to this address, if any */
+int
+HUPG_take(const struct sockaddr *sa)
+{
+	struct hupg_sock *hs;
+	int fd;
+
+	AN(sa);
+	VTAILQ_FOREACH(hs, &hupg_socks, list) {
+		CHECK_OBJ_NOTNULL(hs, HUPG_SOCK_MAGIC);
+		if (!hupg_same_addr((struct sockaddr *)&hs->addr, sa))
+			continue;
+		VTAILQ_REMOVE(&hupg_socks, hs, list);
+		fd = hs->fd;
+		FREE_OBJ(hs);
+		return (fd);
+	}
+	return (-1);
+}
+
+/* Close the inherited sockets no frontend took */
+void
+HUPG_close_unused(void)
+{
+	struct hupg_sock *hs, *hs2;
+
+	VTAILQ_FOREACH_SAFE(hs, &hupg_socks, list, hs2) {
+		CHECK_OBJ_NOTNULL(hs, HUPG_SOCK_MAGIC);
+		LOG("{core} Closing inherited socket %d: no frontend "
+		    "listens on its address\n", hs->fd);
+		VTAILQ_REMOVE(&hupg_socks, hs, list);
+		(void)close(hs->fd);
+		FREE_OBJ(hs);
+	}
+}
@@ -0,0 +1,97 @@
+/**
+  * Copyright 2020 Varnish Software
+  *
+  * Redistribution and use in source and binary forms, with or without
+  * modification, are permitted provided that the following conditions
+  * are met:
+  *
+  *    1. Redistributions of source code must retain the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer.
+  *
+  *    2. Redistributions in binary form must reproduce the above
+  *       copyright notice, this list of conditions and the following
+  *       disclaimer in the documentation and/or other materials
+  *       provided with the distribution.
+  *
+  * THIS SOFTWARE IS PROVIDED BY VARNISH SOFTWARE ``AS IS'' AND
+  * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+  * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+  * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL BUMP
+  * TECHNOLOGIES, INC. OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+  * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+  * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+  * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+  * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+  *
+  */
+
+
+#ifndef UPGRADE_H_INCLUDED
+#define UPGRADE_H_INCLUDED
+
+#include <sys/socket.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Hot upgrade.
+ *
+ * The upgrade control command makes the master execute its binary
+ * again, with one end of a UNIX socket pair in the HITCH_UPGRADE_FD
+ * environment variable. It sends the new master its listen sockets and
+ * the mapping of the shared session cache over the socket pair, one
+ * SCM_RIGHTS message for each. The new master starts its workers on
+ * them and sends HUPG_READY. The old master then stops listening,
+ * hands over its pid file and its stats and control sockets with
+ * HUPG_ACK, and drains its workers like after a reload.
+ *
+ * The listen sockets received go to a pool, which systemd socket
+ * activation can fill too. The frontends take the sockets bound to
+ * their addresses from the pool instead of binding new ones.
+ *
+ * HUPG_send_fd() and HUPG_recv_fd() pass any datagram along with a
+ * descriptor, and also carry the TLS sessions handed over between
+ * workers. HUPG_send_fds() and HUPG_recv_fds() pass several, for the
+ * client and backend sockets of the connections migrated between
+ * workers.
+ */
+
+#define HUPG_ENV	"HITCH_UPGRADE_FD"
+#define HUPG_READY	'R'
+#define HUPG_ACK	'A'
+
+enum hupg_type {
+	HUPG_LISTEN = 1,
+	HUPG_SHCTX,
+	HUPG_END,
+};
+
+struct hupg_msg {
+	unsigned		magic;
+#define HUPG_MSG_MAGIC		0x3b1f7ac5
+	enum hupg_type		type;
+	/* Where the shared session cache is mapped, and its size */
+	uintptr_t		addr;
+	size_t			len;
+};
+
+int HUPG_send_fds(int sock, const void *buf, size_t len, const int *fds,
+    int nfd);
+ssize_t HUPG_recv_fds(int sock, void *buf, size_t len, int *fds, int *nfd);
+int HUPG_send_fd(int sock, const void *buf, size_t len, int fd);
+ssize_t HUPG_recv_fd(int sock, void *buf, size_t len, int *fd);
+int HUPG_send(int sock, enum hupg_type type, int fd, const void *addr,
+    size_t len);
+int HUPG_recv(int sock, struct hupg_msg *msg, int *fd);
+void HUPG_close_fds(int keep);
+int HUPG_inherit(int fd);
+int HUPG_systemd(void);
+int HUPG_take(const struct sockaddr *sa);
+void HUPG_close_unused(void);
+
+#endif /* UPGRADE_H_INCLUDED */
@@ -0,0 +1,1852 @@
+/*-
+ * Copyright (c) 2020 Varnish Software AS
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ */
+/*
+ * Load generator for hitch.
+ *
+ * hitch-bench backend runs a backend that accepts the PROXY protocol
+ * (v1 and v2) and answers HTTP requests, echoes or discards what it
+ * receives. hitch-bench client runs a number of non-blocking TLS
+ * connections over a few threads against a hitch frontend, and reports
+ * the rates and latency percentiles of the chosen workload as one
+ * "name value" pair per line. hitch-bench replay plays the connections
+ * of the conn-trace records of a hitch log again, with their timing.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ev.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "foreign/miniobj.h"
+
+#define BENCH_MAX_THREADS	64
+#define BENCH_BUFSIZE		16384
+#define BENCH_WINDOW		(256 * 1024)	/* Bulk bytes in flight */
+#define BENCH_OBUF_MAX		(4 * 1024 * 1024)
+#define BENCH_IDLE_RAMP		32		/* Idle handshakes in flight */
+#define BENCH_REQ_MAX		(16 * 1024 * 1024)
+#define RP_EXCHANGES		24		/* Bursts of a trace */
+#define RP_SESSIONS		64		/* Server names resumed */
+
+/* Log-linear latency histogram in microseconds, within 3% */
+#define LAT_SUB_BITS		6
+#define LAT_SUB			(1U << LAT_SUB_BITS)
+#define LAT_BUCKETS		(LAT_SUB + (40 - LAT_SUB_BITS) * (LAT_SUB / 2))
+
+static const char proxy_v2_sig[12] = {
+	'\r', '\n', '\r', '\n', '\0', '\r', '\n', 'Q', 'U', 'I', 'T', '\n'
+};
+
+static volatile sig_atomic_t bench_stop;
+
+static void
+die(const char *fmt, ...) __attribute__((__noreturn__, __format__(printf, 1, 2)));
+
+static void
+die(const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "hitch-bench: ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	assert(clock_gettime(CLOCK_MONOTONIC, &ts) == 0);
+	return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+static void
+setnonblocking(int fd)
+{
+	int fl;
+
+	fl = fcntl(fd, F_GETFL);
+	assert(fl >= 0);
+	assert(fcntl(fd, F_SETFL, fl | O_NONBLOCK) == 0);
+}
+
+static void
+raise_nofile(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		(void)setrlimit(RLIMIT_NOFILE, &rl);
+	}
+}
+
+/* [HOST]:PORT, HOST:PORT or a path to a UNIX socket */
+static struct addrinfo *
+resolve(const char *spec, int passive)
+{
+	struct addrinfo hints, *ai;
+	struct sockaddr_un *sun;
+	char host[256];
+	const char *port, *p;
+	size_t l;
+	int r;
+
+	if (strchr(spec, '/') != NULL) {
+		ai = calloc(1, sizeof *ai + sizeof *sun);
+		assert(ai != NULL);
+		sun = (void *)(ai + 1);
+		sun->sun_family = AF_UNIX;
+		if (strlen(spec) >= sizeof sun->sun_path)
+			die("Path too long: %s", spec);
+		strcpy(sun->sun_path, spec);
+		ai->ai_family = AF_UNIX;
+		ai->ai_socktype = SOCK_STREAM;
+		ai->ai_addr = (void *)sun;
+		ai->ai_addrlen = sizeof *sun;
+		return (ai);
+	}
+
+	if (*spec == '[') {
+		p = strchr(spec, ']');
+		if (p == NULL || p[1] != ':')
+			die("Invalid address: %s", spec);
+		spec++;
+		port = p + 2;
+	} else {
+		p = strrchr(spec, ':');
+		if (p == NULL)
+			die("Invalid address: %s", spec);
+		port = p + 1;
+	}
+	l = p - spec;
+	if (l >= sizeof host)
+		die("Invalid address: %s", spec);
+	memcpy(host, spec, l);
+	host[l] = '\0';
+
+	memset(&hints, 0, sizeof hints);
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (passive)
+		hints.ai_flags = AI_PASSIVE;
+	r = getaddrinfo(*host == '\0' || strcmp(host, "*") == 0 ?
+	    NULL : host, port, &hints, &ai);
+	if (r != 0)
+		die("%s: %s", spec, gai_strerror(r));
+	return (ai);
+}
+
+/*--------------------------------------------------------------------
+ * Latency histogram
+ */
+
+struct lat_hist {
+	uint64_t		n;
+	uint64_t		max;
+	uint64_t		bucket[LAT_BUCKETS];
+};
+
+static unsigned
+lat_bucket(uint64_t us)
+{
+	unsigned e, b;
+
+	if (us < LAT_SUB)
+		return (us);
+	e = 63 - __builtin_clzll(us);
+	b = LAT_SUB + (e - LAT_SUB_BITS) * (LAT_SUB / 2) +
+	    (unsigned)(us >> (e - LAT_SUB_BITS + 1)) - LAT_SUB / 2;
+	return (b < LAT_BUCKETS ? b : LAT_BUCKETS - 1);
+}
+
+static uint64_t
+lat_value(unsigned b)
+{
+	unsigned e;
+
+	if (b < LAT_SUB)
+		return (b);
+	e = (b - LAT_SUB) / (LAT_SUB / 2) + LAT_SUB_BITS;
+	return ((uint64_t)(LAT_SUB / 2 + (b - LAT_SUB) % (LAT_SUB / 2)) <<
+	    (e - LAT_SUB_BITS + 1));
+}
+
+static void
+lat_add(struct lat_hist *h, double t)
+{
+	uint64_t us;
+
+	us = t > 0 ? (uint64_t)(t * 1e6) : 0;
+	h->bucket[lat_bucket(us)]++;
+	h->n++;
+	if (us > h->max)
+		h->max = us;
+}
+
+static void
+lat_merge(struct lat_hist *to, const struct lat_hist *from)
+{
+	unsigned b;
+
+	for (b = 0; b < LAT_BUCKETS; b++)
+		to->bucket[b] += from->bucket[b];
+	to->n += from->n;
+	if (from->max > to->max)
+		to->max = from->max;
+}
+
+static double
+lat_pct(const struct lat_hist *h, double pct)
+{
+	uint64_t rank, n = 0;
+	unsigned b;
+
+	rank = (uint64_t)(h->n * pct / 100.);
+	for (b = 0; b < LAT_BUCKETS; b++) {
+		n += h->bucket[b];
+		if (n > rank)
+			return (lat_value(b) * 1e-3);
+	}
+	return (h->max * 1e-3);
+}
+
+static void
+lat_report(const char *name, const struct lat_hist *h)
+{
+	static const double pct[] = { 50, 90, 99, 99.9 };
+	static const char * const pname[] = { "p50", "p90", "p99", "p999" };
+	unsigned i;
+
+	if (h->n == 0)
+		return;
+	for (i = 0; i < sizeof pct / sizeof *pct; i++)
+		printf("%s_%s_ms %.3f\n", name, pname[i], lat_pct(h, pct[i]));
+	printf("%s_max_ms %.3f\n", name, h->max * 1e-3);
+}
+
+/*--------------------------------------------------------------------
+ * Backend: accepts an optional PROXY header, then answers each HTTP
+ * request with a fixed size response, echoes, or discards. A request
+ * for /bytes/N is answered with a body of N bytes instead.
+ */
+
+enum be_mode {
+	BE_HTTP,
+	BE_ECHO,
+	BE_SINK,
+};
+
+enum be_phase {
+	BE_DETECT,		/* Looking for a PROXY header */
+	BE_SKIP,		/* Skipping the rest of a v2 header */
+	BE_DATA,
+};
+
+struct be_conn {
+	unsigned		magic;
+#define BE_CONN_MAGIC		0x1c5d2a93
+	int			fd;
+	ev_io			io;
+	enum be_phase		phase;
+	char			hdr[108];	/* Longest v1 header */
+	size_t			hdr_len;
+	size_t			skip;
+	unsigned		crlf;		/* Matched of "\r\n\r\n" */
+	char			req[32];	/* Start of the request */
+	size_t			req_len;
+	char			*obuf;
+	size_t			olen;
+	size_t			ooff;
+	size_t			osz;
+};
+
+static struct {
+	enum be_mode		mode;
+	size_t			size;
+	char			*resp;
+	size_t			resp_len;
+	int			fd;
+	uint64_t		conns;
+	uint64_t		proxy_v1;
+	uint64_t		proxy_v2;
+	uint64_t		requests;
+	uint64_t		bytes_in;
+} be;
+
+static void
+be_close(struct ev_loop *loop, struct be_conn *c)
+{
+
+	CHECK_OBJ_NOTNULL(c, BE_CONN_MAGIC);
+	ev_io_stop(loop, &c->io);
+	(void)close(c->fd);
+	free(c->obuf);
+	FREE_OBJ(c);
+}
+
+static void
+be_out(struct be_conn *c, const char *p, size_t l)
+{
+
+	if (c->ooff == c->olen)
+		c->ooff = c->olen = 0;
+	if (c->olen + l > c->osz) {
+		if (c->ooff > 0) {
+			memmove(c->obuf, c->obuf + c->ooff,
+			    c->olen - c->ooff);
+			c->olen -= c->ooff;
+			c->ooff = 0;
+		}
+		while (c->olen + l > c->osz)
+			c->osz = c->osz == 0 ? BENCH_BUFSIZE : c->osz * 2;
+		c->obuf = realloc(c->obuf, c->osz);
+		assert(c->obuf != NULL);
+	}
+	memcpy(c->obuf + c->olen, p, l);
+	c->olen += l;
+}
+
+static void
+be_respond(struct be_conn *c)
+{
+	static const char fill[BENCH_BUFSIZE];
+	char hdr[80];
+	size_t n;
+
+	c->req[c->req_len] = '\0';
+	c->req_len = 0;
+	if (strncmp(c->req, "GET /bytes/", 11) != 0) {
+		be_out(c, be.resp, be.resp_len);
+		return;
+	}
+	n = strtoul(c->req + 11, NULL, 10);
+	be_out(c, hdr, snprintf(hdr, sizeof hdr,
+	    "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", n));
+	for (; n > sizeof fill; n -= sizeof fill)
+		be_out(c, fill, sizeof fill);
+	be_out(c, fill, n);
+}
+
+static void
+be_data(struct be_conn *c, const char *p, size_t l)
+{
+	size_t i;
+
+	switch (be.mode) {
+	case BE_ECHO:
+		be_out(c, p, l);
+		break;
+	case BE_HTTP:
+		for (i = 0; i < l; i++) {
+			if (c->req_len < sizeof c->req - 1)
+				c->req[c->req_len++] = p[i];
+			if (p[i] == (c->crlf & 1 ? '\n' : '\r'))
+				c->crlf++;
+			else
+				c->crlf = p[i] == '\r' ? 1 : 0;
+			if (c->crlf == 4) {
+				c->crlf = 0;
+				__atomic_add_fetch(&be.requests, 1,
+				    __ATOMIC_RELAXED);
+				be_respond(c);
+			}
+		}
+		break;
+	case BE_SINK:
+		break;
+	}
+}
+
+/* Returns -1 to close the connection */
+static int
+be_input(struct be_conn *c, const char *p, size_t l)
+{
+	size_t n;
+	char *nl;
+
+	while (l > 0 && c->phase != BE_DATA) {
+		if (c->phase == BE_SKIP) {
+			n = l < c->skip ? l : c->skip;
+			c->skip -= n;
+			p += n;
+			l -= n;
+			if (c->skip == 0)
+				c->phase = BE_DATA;
+			continue;
+		}
+
+		c->hdr[c->hdr_len++] = *p++;
+		l--;
+		if (memcmp(c->hdr, "PROXY ",
+		    c->hdr_len < 6 ? c->hdr_len : 6) == 0) {
+			if (c->hdr_len < 6)
+				continue;
+			nl = memchr(c->hdr, '\n', c->hdr_len);
+			if (nl != NULL) {
+				__atomic_add_fetch(&be.proxy_v1, 1,
+				    __ATOMIC_RELAXED);
+				c->phase = BE_DATA;
+			} else if (c->hdr_len == sizeof c->hdr)
+				return (-1);
+		} else if (memcmp(c->hdr, proxy_v2_sig, c->hdr_len < 12 ?
+		    c->hdr_len : 12) == 0) {
+			if (c->hdr_len < 16)
+				continue;
+			__atomic_add_fetch(&be.proxy_v2, 1, __ATOMIC_RELAXED);
+			c->skip = ((unsigned char)c->hdr[14] << 8) |
+			    (unsigned char)c->hdr[15];
+			c->phase = c->skip > 0 ? BE_SKIP : BE_DATA;
+		} else {
+			/* No PROXY header after all */
+			c->phase = BE_DATA;
+			be_data(c, c->hdr, c->hdr_len);
+		}
+	}
+	if (l > 0)
+		be_data(c, p, l);
+	return (0);
+}
+
+static void
+be_io(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct be_conn *c;
+	char buf[BENCH_BUFSIZE];
+	ssize_t l;
+	int ev;
+
+	CAST_OBJ_NOTNULL(c, w->data, BE_CONN_MAGIC);
+
+	if (revents & EV_READ) {
+		l = read(c->fd, buf, sizeof buf);
+		if (l == 0 || (l < 0 && errno != EAGAIN && errno != EINTR)) {
+			be_close(loop, c);
+			return;
+		}
+		if (l > 0) {
+			__atomic_add_fetch(&be.bytes_in, l, __ATOMIC_RELAXED);
+			if (be_input(c, buf, l) != 0) {
+				be_close(loop, c);
+				return;
+			}
+		}
+	}
+
+	while (c->ooff < c->olen) {
+		l = write(c->fd, c->obuf + c->ooff, c->olen - c->ooff);
+		if (l < 0 && errno == EINTR)
+			continue;
+		if (l < 0 && errno == EAGAIN)
+			break;
+		if (l <= 0) {
+			be_close(loop, c);
+			return;
+		}
+		c->ooff += l;
+	}
+
+	/* Stop reading while the peer does not read its answers */
+	ev = c->olen - c->ooff < BENCH_OBUF_MAX ? EV_READ : 0;
+	if (c->ooff < c->olen)
+		ev |= EV_WRITE;
+	if (ev != (w->events & (EV_READ | EV_WRITE))) {
+		ev_io_stop(loop, w);
+		ev_io_set(w, c->fd, ev);
+		ev_io_start(loop, w);
+	}
+}
+
+static void
+be_accept(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct be_conn *c;
+	int fd, one = 1;
+
+	(void)revents;
+	fd = accept(w->fd, NULL, NULL);
+	if (fd < 0)
+		return;
+	setnonblocking(fd);
+	(void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+	__atomic_add_fetch(&be.conns, 1, __ATOMIC_RELAXED);
+
+	ALLOC_OBJ(c, BE_CONN_MAGIC);
+	assert(c != NULL);
+	c->fd = fd;
+	c->phase = BE_DETECT;
+	ev_io_init(&c->io, be_io, fd, EV_READ);
+	c->io.data = c;
+	ev_io_start(loop, &c->io);
+}
+
+static void *
+be_thread(void *priv)
+{
+	struct ev_loop *loop;
+	ev_io listener;
+
+	(void)priv;
+	loop = ev_loop_new(EVFLAG_AUTO);
+	assert(loop != NULL);
+	ev_io_init(&listener, be_accept, be.fd, EV_READ);
+	ev_io_start(loop, &listener);
+	ev_loop(loop, 0);
+	return (NULL);
+}
+
+static void
+be_usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: hitch-bench backend [-l ADDR] [-m MODE] [-s SIZE] "
+	    "[-t THREADS]\n"
+	    "\n"
+	    "  -l ADDR     Listen on [HOST]:PORT or a UNIX socket path\n"
+	    "              (Default: [127.0.0.1]:8000)\n"
+	    "  -m MODE     http, echo or sink (Default: http)\n"
+	    "  -s SIZE     Body size of the HTTP responses, unless the\n"
+	    "              request is for /bytes/SIZE (Default: 0)\n"
+	    "  -t THREADS  Number of threads (Default: 1)\n"
+	    "\n"
+	    "The counters are printed on SIGINT or SIGTERM.\n");
+	exit(2);
+}
+
+static int
+bench_backend(int argc, char **argv)
+{
+	pthread_t thr[BENCH_MAX_THREADS];
+	const char *addr = "[127.0.0.1]:8000";
+	struct addrinfo *ai;
+	sigset_t ss;
+	int i, o, sig, threads = 1, one = 1;
+
+	be.mode = BE_HTTP;
+	while ((o = getopt(argc, argv, "l:m:s:t:")) != -1) {
+		switch (o) {
+		case 'l':
+			addr = optarg;
+			break;
+		case 'm':
+			if (strcmp(optarg, "http") == 0)
+				be.mode = BE_HTTP;
+			else if (strcmp(optarg, "echo") == 0)
+				be.mode = BE_ECHO;
+			else if (strcmp(optarg, "sink") == 0)
+				be.mode = BE_SINK;
+			else
+				be_usage();
+			break;
+		case 's':
+			be.size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			if (threads < 1 || threads > BENCH_MAX_THREADS)
+				be_usage();
+			break;
+		default:
+			be_usage();
+		}
+	}
+	if (optind != argc)
+		be_usage();
+
+	be.resp = malloc(be.size + 128);
+	assert(be.resp != NULL);
+	be.resp_len = sprintf(be.resp,
+	    "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", be.size);
+	memset(be.resp + be.resp_len, 'x', be.size);
+	be.resp_len += be.size;
+
+	raise_nofile();
+	ai = resolve(addr, 1);
+	be.fd = socket(ai->ai_family, SOCK_STREAM, 0);
+	if (be.fd < 0)
+		die("socket: %s", strerror(errno));
+	if (ai->ai_family == AF_UNIX)
+		(void)unlink(((struct sockaddr_un *)ai->ai_addr)->sun_path);
+	else
+		(void)setsockopt(be.fd, SOL_SOCKET, SO_REUSEADDR, &one,
+		    sizeof one);
+	if (bind(be.fd, ai->ai_addr, ai->ai_addrlen) != 0)
+		die("bind %s: %s", addr, strerror(errno));
+	if (listen(be.fd, 1024) != 0)
+		die("listen %s: %s", addr, strerror(errno));
+	setnonblocking(be.fd);
+
+	sigemptyset(&ss);
+	sigaddset(&ss, SIGINT);
+	sigaddset(&ss, SIGTERM);
+	sigaddset(&ss, SIGPIPE);
+	assert(pthread_sigmask(SIG_BLOCK, &ss, NULL) == 0);
+	for (i = 0; i < threads; i++)
+		assert(pthread_create(&thr[i], NULL, be_thread, NULL) == 0);
+
+	sigdelset(&ss, SIGPIPE);
+	assert(sigwait(&ss, &sig) == 0);
+	if (ai->ai_family == AF_UNIX)
+		(void)unlink(((struct sockaddr_un *)ai->ai_addr)->sun_path);
+	printf("conns %ju\n", (uintmax_t)be.conns);
+	printf("proxy_v1 %ju\n", (uintmax_t)be.proxy_v1);
+	printf("proxy_v2 %ju\n", (uintmax_t)be.proxy_v2);
+	printf("requests %ju\n", (uintmax_t)be.requests);
+	printf("bytes_in %ju\n", (uintmax_t)be.bytes_in);
+	fflush(stdout);
+	_exit(0);
+}
+
+/*--------------------------------------------------------------------
+ * Client
+ */
+
+enum bc_mode {
+	BC_HANDSHAKE,		/* Full handshakes */
+	BC_RESUME,		/* Resumed handshake and one request */
+	BC_REQUEST,		/* Requests over keep-alive connections */
+	BC_BULK,		/* Data through an echo backend */
+	BC_IDLE,		/* Idle connections */
+	BC_REPLAY,		/* Traced connections */
+};
+
+static const char * const bc_mode_name[] = {
+	[BC_HANDSHAKE] =	"handshake",
+	[BC_RESUME] =		"resume",
+	[BC_REQUEST] =		"request",
+	[BC_BULK] =		"bulk",
+	[BC_IDLE] =		"idle",
+	[BC_REPLAY] =		"replay",
+};
+
+enum bc_state {
+	BCS_CONNECT,
+	BCS_HANDSHAKE,
+	BCS_WRITE,
+	BCS_READ,
+	BCS_BULK,
+	BCS_IDLE,
+	BCS_PAUSE,		/* Replay waiting for its next exchange */
+};
+
+struct bc_stats {
+	uint64_t		handshakes;
+	uint64_t		resumed;
+	uint64_t		requests;
+	uint64_t		bytes_in;
+	uint64_t		bytes_out;
+	uint64_t		errors;
+	uint64_t		established;
+	struct lat_hist		hs_lat;
+	struct lat_hist		req_lat;
+};
+
+struct bench_thread;
+struct rp_conn;
+
+struct bc_conn {
+	unsigned		magic;
+#define BC_CONN_MAGIC		0x4f0b7de2
+	struct bench_thread	*bt;
+	int			fd;
+	SSL			*ssl;
+	SSL_SESSION		*sess;
+	ev_io			io;
+	enum bc_state		state;
+	double			t_start;
+	const char		*req;
+	size_t			req_len;
+	size_t			req_off;
+	size_t			hdr_len;
+	size_t			body_left;
+	char			hdr[1024];
+	const struct rp_conn	*rp;
+	ev_timer		tmr;
+	unsigned		ex;		/* Next replay exchange */
+	char			*rbuf;
+	size_t			rbuf_sz;
+};
+
+struct bench_thread {
+	unsigned		magic;
+#define BENCH_THREAD_MAGIC	0x7a6e13c8
+	pthread_t		thr;
+	struct ev_loop		*loop;
+	ev_timer		tick;
+	struct bc_conn		*conns;
+	unsigned		n_conns;
+	unsigned		n_started;
+	unsigned		n_done;
+	struct bc_stats		st;
+	struct lat_hist		lag;		/* Replay start lateness */
+};
+
+static struct {
+	enum bc_mode		mode;
+	struct addrinfo		*ai;
+	SSL_CTX			*ctx;
+	const char		*sni;
+	char			req[512];
+	size_t			req_len;
+	char			*chunk;
+	size_t			chunk_len;
+} bc;
+
+static void bc_start(struct bc_conn *c);
+static void bc_idle_next(struct bench_thread *bt);
+static void rp_ssl(struct bc_conn *c);
+static void rp_next(struct bc_conn *c);
+static void rp_done(struct bench_thread *bt);
+static int rp_new_session(struct bc_conn *c, SSL_SESSION *sess);
+
+static void
+bc_want(struct bc_conn *c, int ev)
+{
+
+	if (ev == (c->io.events & (EV_READ | EV_WRITE)) &&
+	    ev_is_active(&c->io))
+		return;
+	ev_io_stop(c->bt->loop, &c->io);
+	ev_io_set(&c->io, c->fd, ev);
+	ev_io_start(c->bt->loop, &c->io);
+}
+
+/* A session is only resumable once its connection was shut down */
+static void
+bc_close(struct bc_conn *c, int clean)
+{
+
+	ev_io_stop(c->bt->loop, &c->io);
+	ev_timer_stop(c->bt->loop, &c->tmr);
+	if (c->ssl != NULL) {
+		if (clean)
+			(void)SSL_shutdown(c->ssl);
+		SSL_free(c->ssl);
+		c->ssl = NULL;
+	}
+	if (c->fd >= 0)
+		(void)close(c->fd);
+	c->fd = -1;
+}
+
+/* Failed connections are started again on the next tick, but for replay */
+static void
+bc_fail(struct bc_conn *c)
+{
+
+	c->bt->st.errors++;
+	bc_close(c, 0);
+	if (bc.mode == BC_IDLE)
+		bc_idle_next(c->bt);
+	else if (bc.mode == BC_REPLAY)
+		rp_done(c->bt);
+}
+
+/* Handle the outcome of an SSL call. Returns 0 to retry later. */
+static int
+bc_ssl_error(struct bc_conn *c, int r, int ev)
+{
+
+	switch (SSL_get_error(c->ssl, r)) {
+	case SSL_ERROR_WANT_READ:
+		bc_want(c, EV_READ | ev);
+		return (0);
+	case SSL_ERROR_WANT_WRITE:
+		bc_want(c, EV_WRITE | ev);
+		return (0);
+	default:
+		ERR_clear_error();
+		bc_fail(c);
+		return (-1);
+	}
+}
+
+static void
+bc_request(struct bc_conn *c)
+{
+
+	c->state = BCS_WRITE;
+	c->t_start = now();
+	if (c->rp == NULL) {
+		c->req = bc.req;
+		c->req_len = bc.req_len;
+	}
+	c->req_off = 0;
+	c->hdr_len = 0;
+	c->body_left = 0;
+	bc_want(c, EV_WRITE);
+}
+
+static void
+bc_handshake_done(struct bc_conn *c)
+{
+	struct bc_stats *st = &c->bt->st;
+
+	st->handshakes++;
+	if (SSL_session_reused(c->ssl))
+		st->resumed++;
+	lat_add(&st->hs_lat, now() - c->t_start);
+
+	switch (bc.mode) {
+	case BC_HANDSHAKE:
+		bc_close(c, 1);
+		bc_start(c);
+		break;
+	case BC_RESUME:
+	case BC_REQUEST:
+		bc_request(c);
+		break;
+	case BC_BULK:
+		c->state = BCS_BULK;
+		bc_want(c, EV_READ | EV_WRITE);
+		break;
+	case BC_IDLE:
+		c->state = BCS_IDLE;
+		__atomic_add_fetch(&st->established, 1, __ATOMIC_RELAXED);
+		bc_want(c, EV_READ);
+		bc_idle_next(c->bt);
+		break;
+	case BC_REPLAY:
+		c->ex = 0;
+		rp_next(c);
+		break;
+	}
+}
+
+/* Parse a response as it comes in. Returns 1 once it is complete. */
+static int
+bc_response(struct bc_conn *c, const char *p, size_t l)
+{
+	const char *e, *cl;
+	size_t n;
+
+	while (l > 0) {
+		if (c->hdr_len == SIZE_MAX) {
+			n = l < c->body_left ? l : c->body_left;
+			c->body_left -= n;
+			p += n;
+			l -= n;
+		} else {
+			n = sizeof c->hdr - 1 - c->hdr_len;
+			if (n == 0)
+				return (-1);
+			if (n > l)
+				n = l;
+			memcpy(c->hdr + c->hdr_len, p, n);
+			c->hdr[c->hdr_len + n] = '\0';
+			e = strstr(c->hdr, "\r\n\r\n");
+			if (e == NULL) {
+				c->hdr_len += n;
+				p += n;
+				l -= n;
+				continue;
+			}
+			cl = strcasestr(c->hdr, "\r\nContent-Length:");
+			c->body_left = cl != NULL && cl < e ?
+			    strtoul(cl + 17, NULL, 10) : 0;
+			/* Skip the header bytes of this chunk */
+			n = (e + 4 - c->hdr) - c->hdr_len;
+			p += n;
+			l -= n;
+			c->hdr_len = SIZE_MAX;
+		}
+		if (c->hdr_len == SIZE_MAX && c->body_left == 0)
+			return (l == 0 ? 1 : -1);
+	}
+	return (c->hdr_len == SIZE_MAX && c->body_left == 0);
+}
+
+static void
+bc_io(struct ev_loop *loop, ev_io *w, int revents)
+{
+	struct bc_conn *c;
+	struct bc_stats *st;
+	char buf[BENCH_BUFSIZE];
+	socklen_t sl;
+	int r, err;
+
+	(void)loop;
+	(void)revents;
+	CAST_OBJ_NOTNULL(c, w->data, BC_CONN_MAGIC);
+	st = &c->bt->st;
+
+	switch (c->state) {
+	case BCS_CONNECT:
+		sl = sizeof err;
+		if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &sl) != 0 ||
+		    err != 0) {
+			bc_fail(c);
+			return;
+		}
+		c->state = BCS_HANDSHAKE;
+		/* FALLTHROUGH */
+	case BCS_HANDSHAKE:
+		r = SSL_connect(c->ssl);
+		if (r != 1) {
+			(void)bc_ssl_error(c, r, 0);
+			return;
+		}
+		bc_handshake_done(c);
+		return;
+	case BCS_WRITE:
+		while (c->req_off < c->req_len) {
+			r = SSL_write(c->ssl, c->req + c->req_off,
+			    c->req_len - c->req_off);
+			if (r <= 0) {
+				(void)bc_ssl_error(c, r, 0);
+				return;
+			}
+			st->bytes_out += r;
+			c->req_off += r;
+		}
+		c->state = BCS_READ;
+		bc_want(c, EV_READ);
+		/* FALLTHROUGH */
+	case BCS_READ:
+		while (1) {
+			r = SSL_read(c->ssl, buf, sizeof buf);
+			if (r <= 0) {
+				(void)bc_ssl_error(c, r, 0);
+				return;
+			}
+			st->bytes_in += r;
+			r = bc_response(c, buf, r);
+			if (r < 0) {
+				bc_fail(c);
+				return;
+			}
+			if (r > 0)
+				break;
+		}
+		st->requests++;
+		lat_add(&st->req_lat, now() - c->t_start);
+		if (bc.mode == BC_RESUME) {
+			bc_close(c, 1);
+			bc_start(c);
+		} else if (bc.mode == BC_REPLAY) {
+			c->ex++;
+			rp_next(c);
+		} else
+			bc_request(c);
+		return;
+	case BCS_BULK:
+		while (1) {
+			r = SSL_read(c->ssl, buf, sizeof buf);
+			if (r <= 0)
+				break;
+			st->bytes_in += r;
+		}
+		if (bc_ssl_error(c, r, 0) != 0)
+			return;
+		while (st->bytes_out - st->bytes_in < BENCH_WINDOW *
+		    c->bt->n_conns) {
+			r = SSL_write(c->ssl, bc.chunk, bc.chunk_len);
+			if (r <= 0) {
+				(void)bc_ssl_error(c, r, EV_READ);
+				return;
+			}
+			st->bytes_out += r;
+		}
+		bc_want(c, EV_READ);
+		return;
+	case BCS_IDLE:
+		r = SSL_read(c->ssl, buf, sizeof buf);
+		if (r > 0)
+			return;
+		if (bc_ssl_error(c, r, 0) != 0)
+			__atomic_sub_fetch(&st->established, 1,
+			    __ATOMIC_RELAXED);
+		return;
+	case BCS_PAUSE:
+		while ((r = SSL_read(c->ssl, buf, sizeof buf)) > 0)
+			st->bytes_in += r;
+		(void)bc_ssl_error(c, r, 0);
+		return;
+	}
+}
+
+static void
+bc_start(struct bc_conn *c)
+{
+	int one = 1;
+
+	CHECK_OBJ_NOTNULL(c, BC_CONN_MAGIC);
+	assert(c->fd < 0);
+	c->t_start = now();
+	c->fd = socket(bc.ai->ai_family, SOCK_STREAM, 0);
+	if (c->fd < 0) {
+		c->bt->st.errors++;
+		if (bc.mode == BC_REPLAY)
+			rp_done(c->bt);
+		return;
+	}
+	ev_io_init(&c->io, bc_io, c->fd, EV_WRITE);
+	c->io.data = c;
+	setnonblocking(c->fd);
+	(void)setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+	c->ssl = SSL_new(bc.ctx);
+	assert(c->ssl != NULL);
+	SSL_set_app_data(c->ssl, c);
+	assert(SSL_set_fd(c->ssl, c->fd) == 1);
+	if (bc.sni != NULL)
+		SSL_set_tlsext_host_name(c->ssl, bc.sni);
+	if (c->sess != NULL)
+		SSL_set_session(c->ssl, c->sess);
+	if (c->rp != NULL)
+		rp_ssl(c);
+
+	if (connect(c->fd, bc.ai->ai_addr, bc.ai->ai_addrlen) == 0)
+		c->state = BCS_HANDSHAKE;
+	else if (errno == EINPROGRESS)
+		c->state = BCS_CONNECT;
+	else {
+		bc_fail(c);
+		return;
+	}
+	ev_io_start(c->bt->loop, &c->io);
+}
+
+/*
+ * Idle connections are opened a few at a time, each handshake done
+ * starting the next one, so that thousands of them do not overflow the
+ * listen queue of hitch all at once.
+ */
+static void
+bc_idle_next(struct bench_thread *bt)
+{
+
+	if (bt->n_started < bt->n_conns)
+		bc_start(&bt->conns[bt->n_started++]);
+}
+
+/* Keep the last session of each connection for the next one */
+static int
+bc_new_session(SSL *ssl, SSL_SESSION *sess)
+{
+	struct bc_conn *c;
+
+	CAST_OBJ_NOTNULL(c, SSL_get_app_data(ssl), BC_CONN_MAGIC);
+	if (c->rp != NULL)
+		return (rp_new_session(c, sess));
+	if (c->sess != NULL)
+		SSL_SESSION_free(c->sess);
+	c->sess = sess;
+	return (1);
+}
+
+static void
+bc_tick(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	struct bench_thread *bt;
+	unsigned i;
+
+	(void)revents;
+	CAST_OBJ_NOTNULL(bt, w->data, BENCH_THREAD_MAGIC);
+	if (bench_stop) {
+		ev_unloop(loop, EVUNLOOP_ALL);
+		return;
+	}
+	if (bc.mode == BC_IDLE)
+		return;
+	for (i = 0; i < bt->n_conns; i++)
+		if (bt->conns[i].fd < 0)
+			bc_start(&bt->conns[i]);
+}
+
+static void *
+bc_thread(void *priv)
+{
+	struct bench_thread *bt;
+	unsigned i;
+
+	CAST_OBJ_NOTNULL(bt, priv, BENCH_THREAD_MAGIC);
+	if (bc.mode == BC_IDLE) {
+		for (i = 0; i < BENCH_IDLE_RAMP; i++)
+			bc_idle_next(bt);
+	} else {
+		for (i = 0; i < bt->n_conns; i++)
+			bc_start(&bt->conns[i]);
+	}
+	ev_loop(bt->loop, 0);
+	for (i = 0; i < bt->n_conns; i++)
+		bc_close(&bt->conns[i], 1);
+	return (NULL);
+}
+
+/* Resident memory of a process and of its descendants, in kB */
+static uint64_t
+rss_kb(pid_t pid)
+{
+	pid_t pids[256], ppid;
+	unsigned n = 0, i, pass;
+	uint64_t kb = 0;
+	struct dirent *de;
+	char path[300], line[256];
+	long v;
+	DIR *d;
+	FILE *f;
+
+	pids[n++] = pid;
+	for (pass = 0; pass < 3; pass++) {
+		d = opendir("/proc");
+		if (d == NULL)
+			return (0);
+		while ((de = readdir(d)) != NULL && n < 256) {
+			if (!isdigit((unsigned char)de->d_name[0]))
+				continue;
+			snprintf(path, sizeof path, "/proc/%s/stat",
+			    de->d_name);
+			f = fopen(path, "r");
+			if (f == NULL)
+				continue;
+			ppid = 0;
+			if (fgets(line, sizeof line, f) != NULL &&
+			    strrchr(line, ')') != NULL)
+				(void)sscanf(strrchr(line, ')'), ") %*c %d",
+				    &ppid);
+			(void)fclose(f);
+			for (i = 0; i < n; i++)
+				if (pids[i] == atoi(de->d_name))
+					break;
+			if (i < n)
+				continue;
+			for (i = 0; i < n; i++)
+				if (pids[i] == ppid)
+					break;
+			if (i < n)
+				pids[n++] = atoi(de->d_name);
+		}
+		(void)closedir(d);
+	}
+
+	for (i = 0; i < n; i++) {
+		snprintf(path, sizeof path, "/proc/%d/status", (int)pids[i]);
+		f = fopen(path, "r");
+		if (f == NULL)
+			continue;
+		while (fgets(line, sizeof line, f) != NULL)
+			if (sscanf(line, "VmRSS: %ld", &v) == 1)
+				kb += v;
+		(void)fclose(f);
+	}
+	return (kb);
+}
+
+static void
+bc_usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: hitch-bench client [-c ADDR] [-m MODE] [-n CONNS] "
+	    "[-t THREADS]\n"
+	    "                          [-d SECS] [-s SIZE] [-S SNI] "
+	    "[-p PID] [-P TLS]\n"
+	    "\n"
+	    "  -c ADDR     Connect to hitch on [HOST]:PORT "
+	    "(Default: [127.0.0.1]:8443)\n"
+	    "  -m MODE     handshake, resume, request, bulk or idle "
+	    "(Default: request)\n"
+	    "  -n CONNS    Concurrent connections (Default: 10)\n"
+	    "  -t THREADS  Number of threads (Default: 1)\n"
+	    "  -d SECS     Duration of the run (Default: 5)\n"
+	    "  -s SIZE     Write size in bulk mode (Default: 16384)\n"
+	    "  -S SNI      Server name to send\n"
+	    "  -p PID      Report the memory used by hitch per idle "
+	    "connection\n"
+	    "  -P TLS      Highest protocol version: 1.2 or 1.3\n");
+	exit(2);
+}
+
+static int
+bench_client(int argc, char **argv)
+{
+	struct bench_thread *bt;
+	struct bc_stats st;
+	const char *addr = "[127.0.0.1]:8443";
+	double t0, t1, dur = 5, wait;
+	unsigned conns = 10, i, j;
+	uint64_t rss0 = 0, rss1 = 0, est;
+	pid_t pid = 0;
+	int o, threads = 1, maxver = 0;
+	sigset_t ss;
+
+	bc.mode = BC_REQUEST;
+	bc.chunk_len = BENCH_BUFSIZE;
+	while ((o = getopt(argc, argv, "c:d:m:n:p:P:s:S:t:")) != -1) {
+		switch (o) {
+		case 'c':
+			addr = optarg;
+			break;
+		case 'd':
+			dur = atof(optarg);
+			break;
+		case 'm':
+			for (i = 0; i <= BC_IDLE; i++)
+				if (strcmp(optarg, bc_mode_name[i]) == 0)
+					break;
+			if (i > BC_IDLE)
+				bc_usage();
+			bc.mode = i;
+			break;
+		case 'n':
+			conns = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			pid = atoi(optarg);
+			break;
+		case 'P':
+			if (strcmp(optarg, "1.2") == 0)
+				maxver = TLS1_2_VERSION;
+#ifdef TLS1_3_VERSION
+			else if (strcmp(optarg, "1.3") == 0)
+				maxver = TLS1_3_VERSION;
+#endif
+			else
+				bc_usage();
+			break;
+		case 's':
+			bc.chunk_len = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			bc.sni = optarg;
+			break;
+		case 't':
+			threads = atoi(optarg);
+			if (threads < 1 || threads > BENCH_MAX_THREADS)
+				bc_usage();
+			break;
+		default:
+			bc_usage();
+		}
+	}
+	if (optind != argc || conns == 0 || bc.chunk_len == 0 || dur <= 0)
+		bc_usage();
+	if ((unsigned)threads > conns)
+		threads = conns;
+
+	raise_nofile();
+	sigemptyset(&ss);
+	sigaddset(&ss, SIGPIPE);
+	assert(pthread_sigmask(SIG_BLOCK, &ss, NULL) == 0);
+
+	bc.ai = resolve(addr, 0);
+	bc.req_len = snprintf(bc.req, sizeof bc.req,
+	    "GET / HTTP/1.1\r\nHost: %s\r\n\r\n",
+	    bc.sni != NULL ? bc.sni : "localhost");
+	bc.chunk = malloc(bc.chunk_len);
+	assert(bc.chunk != NULL);
+	memset(bc.chunk, 'x', bc.chunk_len);
+
+	bc.ctx = SSL_CTX_new(SSLv23_client_method());
+	assert(bc.ctx != NULL);
+	SSL_CTX_set_verify(bc.ctx, SSL_VERIFY_NONE, NULL);
+	SSL_CTX_set_mode(bc.ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+	    SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	if (maxver != 0)
+		SSL_CTX_set_max_proto_version(bc.ctx, maxver);
+	if (bc.mode == BC_RESUME) {
+		SSL_CTX_set_session_cache_mode(bc.ctx,
+		    SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(bc.ctx, bc_new_session);
+	} else {
+		SSL_CTX_set_session_cache_mode(bc.ctx, SSL_SESS_CACHE_OFF);
+		SSL_CTX_set_options(bc.ctx, SSL_OP_NO_TICKET);
+	}
+
+	if (pid > 0)
+		rss0 = rss_kb(pid);
+
+	bt = calloc(threads, sizeof *bt);
+	assert(bt != NULL);
+	for (i = 0; i < (unsigned)threads; i++) {
+		bt[i].magic = BENCH_THREAD_MAGIC;
+		bt[i].loop = ev_loop_new(EVFLAG_AUTO);
+		assert(bt[i].loop != NULL);
+		bt[i].n_conns = conns / threads +
+		    (i < conns % threads ? 1 : 0);
+		bt[i].conns = calloc(bt[i].n_conns, sizeof *bt[i].conns);
+		assert(bt[i].conns != NULL);
+		for (j = 0; j < bt[i].n_conns; j++) {
+			bt[i].conns[j].magic = BC_CONN_MAGIC;
+			bt[i].conns[j].bt = &bt[i];
+			bt[i].conns[j].fd = -1;
+		}
+		ev_timer_init(&bt[i].tick, bc_tick, 0.1, 0.1);
+		bt[i].tick.data = &bt[i];
+		ev_timer_start(bt[i].loop, &bt[i].tick);
+	}
+
+	t0 = now();
+	for (i = 0; i < (unsigned)threads; i++)
+		assert(pthread_create(&bt[i].thr, NULL, bc_thread,
+		    &bt[i]) == 0);
+
+	if (bc.mode == BC_IDLE) {
+		/* Measure once all the connections are up, or 120s */
+		for (wait = 0; wait < 120; wait += 0.1) {
+			for (i = 0, est = 0; i < (unsigned)threads; i++)
+				est += __atomic_load_n(&bt[i].st.established,
+				    __ATOMIC_RELAXED);
+			if (est == conns)
+				break;
+			(void)usleep(100000);
+		}
+		if (pid > 0)
+			rss1 = rss_kb(pid);
+	}
+
+	(void)usleep(dur * 1e6);
+	bench_stop = 1;
+	for (i = 0; i < (unsigned)threads; i++)
+		assert(pthread_join(bt[i].thr, NULL) == 0);
+	t1 = now() - t0;
+
+	memset(&st, 0, sizeof st);
+	for (i = 0; i < (unsigned)threads; i++) {
+		st.handshakes += bt[i].st.handshakes;
+		st.resumed += bt[i].st.resumed;
+		st.requests += bt[i].st.requests;
+		st.bytes_in += bt[i].st.bytes_in;
+		st.bytes_out += bt[i].st.bytes_out;
+		st.errors += bt[i].st.errors;
+		st.established += bt[i].st.established;
+		lat_merge(&st.hs_lat, &bt[i].st.hs_lat);
+		lat_merge(&st.req_lat, &bt[i].st.req_lat);
+	}
+
+	printf("mode %s\n", bc_mode_name[bc.mode]);
+	printf("threads %d\n", threads);
+	printf("connections %u\n", conns);
+	printf("duration %.3f\n", t1);
+	printf("errors %ju\n", (uintmax_t)st.errors);
+	printf("handshakes %ju\n", (uintmax_t)st.handshakes);
+	printf("handshakes_per_sec %.1f\n", st.handshakes / t1);
+	printf("resumed %ju\n", (uintmax_t)st.resumed);
+	printf("requests %ju\n", (uintmax_t)st.requests);
+	printf("requests_per_sec %.1f\n", st.requests / t1);
+	printf("bytes_in %ju\n", (uintmax_t)st.bytes_in);
+	printf("bytes_out %ju\n", (uintmax_t)st.bytes_out);
+	printf("mbytes_in_per_sec %.2f\n", st.bytes_in / t1 / 1e6);
+	printf("mbytes_out_per_sec %.2f\n", st.bytes_out / t1 / 1e6);
+	lat_report("handshake", &st.hs_lat);
+	lat_report("request", &st.req_lat);
+	if (bc.mode == BC_IDLE) {
+		printf("established %ju\n", (uintmax_t)st.established);
+		if (pid > 0) {
+			printf("rss_before_kb %ju\n", (uintmax_t)rss0);
+			printf("rss_after_kb %ju\n", (uintmax_t)rss1);
+			printf("bytes_per_conn %.0f\n", st.established > 0 ?
+			    ((double)rss1 - rss0) * 1024 / st.established :
+			    0);
+		}
+	}
+	return (st.errors > 0 && st.handshakes == 0 ? 1 : 0);
+}
+
+/*--------------------------------------------------------------------
+ * Replay: the connections of {trace} records, at the same offsets from
+ * the first one, with the same server name, highest TLS version, ALPN
+ * protocols and resumption. Each burst from the client becomes a request
+ * of its size, for a response as large as the bursts from the backend
+ * that follow it, so hitch is expected to have hitch-bench backend in
+ * http mode behind it.
+ */
+
+struct rp_ex {
+	double			at;		/* Since the accept */
+	size_t			req;
+	size_t			resp;
+};
+
+struct rp_conn {
+	double			at;		/* Since the first trace */
+	double			life;
+	char			sni[256];
+	int			maxver;
+	int			resume;
+	unsigned char		alpn[64];	/* Wire format */
+	unsigned		alpn_len;
+	unsigned		n_ex;
+	struct rp_ex		ex[RP_EXCHANGES];
+};
+
+static struct {
+	double			speed;
+	double			t0;
+	struct rp_conn		*conns;
+	unsigned		n;
+	unsigned		sz;
+	uint64_t		skipped;
+	unsigned		n_sess;
+	struct {
+		char		sni[256];
+		SSL_SESSION	*sess;
+	}			sess[RP_SESSIONS];
+} rp;
+
+static double
+rp_time(const struct bc_conn *c, double t)
+{
+
+	return (rp.t0 + (c->rp->at + t) / rp.speed);
+}
+
+/* The resumable session of a server name, NULL if out of slots */
+static SSL_SESSION **
+rp_session(const char *sni)
+{
+	unsigned i;
+
+	for (i = 0; i < rp.n_sess; i++)
+		if (strcmp(rp.sess[i].sni, sni) == 0)
+			return (&rp.sess[i].sess);
+	if (rp.n_sess == RP_SESSIONS)
+		return (NULL);
+	snprintf(rp.sess[rp.n_sess].sni, sizeof rp.sess[0].sni, "%s", sni);
+	return (&rp.sess[rp.n_sess++].sess);
+}
+
+static int
+rp_new_session(struct bc_conn *c, SSL_SESSION *sess)
+{
+	SSL_SESSION **sp;
+
+	sp = rp_session(c->rp->sni);
+	if (sp == NULL)
+		return (0);
+	if (*sp != NULL)
+		SSL_SESSION_free(*sp);
+	*sp = sess;
+	return (1);
+}
+
+static void
+rp_ssl(struct bc_conn *c)
+{
+	const struct rp_conn *rc = c->rp;
+	SSL_SESSION **sp;
+
+	if (rc->sni[0] != '\0')
+		SSL_set_tlsext_host_name(c->ssl, rc->sni);
+	if (rc->maxver != 0)
+		SSL_set_max_proto_version(c->ssl, rc->maxver);
+	if (rc->alpn_len > 0)
+		(void)SSL_set_alpn_protos(c->ssl, rc->alpn, rc->alpn_len);
+	if (rc->resume && (sp = rp_session(rc->sni)) != NULL && *sp != NULL)
+		SSL_set_session(c->ssl, *sp);
+}
+
+static void
+rp_done(struct bench_thread *bt)
+{
+
+	if (++bt->n_done == bt->n_conns)
+		ev_unloop(bt->loop, EVUNLOOP_ALL);
+}
+
+/* A request of the traced size, for a response of the traced size */
+static void
+rp_request(struct bc_conn *c)
+{
+	const struct rp_ex *ex = &c->rp->ex[c->ex];
+	size_t body, len, l, v;
+	unsigned d;
+
+	/* Less the response header, within a byte */
+	for (d = 1, v = ex->resp; v >= 10; v /= 10)
+		d++;
+	body = ex->resp > 37 + d ? ex->resp - 37 - d : 0;
+
+	len = ex->req < BENCH_REQ_MAX ? ex->req : BENCH_REQ_MAX;
+	if (len < 512)
+		len = 512;
+	if (c->rbuf_sz < len) {
+		c->rbuf = realloc(c->rbuf, len);
+		assert(c->rbuf != NULL);
+		c->rbuf_sz = len;
+	}
+	l = snprintf(c->rbuf, c->rbuf_sz,
+	    "GET /bytes/%zu HTTP/1.1\r\nHost: %s\r\n", body,
+	    c->rp->sni[0] != '\0' ? c->rp->sni : "localhost");
+	assert(l < c->rbuf_sz);
+	len = ex->req < BENCH_REQ_MAX ? ex->req : BENCH_REQ_MAX;
+	if (len >= l + 11) {
+		memcpy(c->rbuf + l, "X-Pad: ", 7);
+		memset(c->rbuf + l + 7, 'x', len - l - 11);
+		l = len - 4;
+		memcpy(c->rbuf + l, "\r\n", 2);
+		l += 2;
+	}
+	memcpy(c->rbuf + l, "\r\n", 2);
+	c->req = c->rbuf;
+	c->req_len = l + 2;
+}
+
+/* Wait for the next exchange, or for the end of the connection */
+static void
+rp_next(struct bc_conn *c)
+{
+	double at, t;
+
+	if (c->ex < c->rp->n_ex)
+		at = rp_time(c, c->rp->ex[c->ex].at);
+	else
+		at = rp_time(c, c->rp->life);
+	t = now();
+	c->state = BCS_PAUSE;
+	bc_want(c, EV_READ);
+	ev_timer_set(&c->tmr, at > t ? at - t : 0., 0.);
+	ev_timer_start(c->bt->loop, &c->tmr);
+}
+
+static void
+rp_timer(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	struct bc_conn *c;
+
+	(void)loop;
+	(void)revents;
+	CAST_OBJ_NOTNULL(c, w->data, BC_CONN_MAGIC);
+	if (c->ex < c->rp->n_ex) {
+		rp_request(c);
+		bc_request(c);
+		return;
+	}
+	bc_close(c, 1);
+	rp_done(c->bt);
+}
+
+/* Start the connections that are due, and wait for the next one */
+static void
+rp_tick(struct ev_loop *loop, ev_timer *w, int revents)
+{
+	struct bench_thread *bt;
+	struct bc_conn *c;
+	double at, t;
+
+	(void)revents;
+	CAST_OBJ_NOTNULL(bt, w->data, BENCH_THREAD_MAGIC);
+	t = now();
+	while (bt->n_started < bt->n_conns) {
+		c = &bt->conns[bt->n_started];
+		at = rp_time(c, 0);
+		if (at > t) {
+			ev_timer_set(w, at - t, 0.);
+			ev_timer_start(loop, w);
+			return;
+		}
+		bt->n_started++;
+		lat_add(&bt->lag, t - at);
+		bc_start(c);
+	}
+}
+
+static void
+rp_alpn(struct rp_conn *rc, char *list)
+{
+	char *p;
+	size_t l;
+
+	while ((p = strsep(&list, ",")) != NULL) {
+		l = strlen(p);
+		if (l == 0 || l > 255 ||
+		    rc->alpn_len + 1 + l > sizeof rc->alpn)
+			break;
+		rc->alpn[rc->alpn_len++] = l;
+		memcpy(rc->alpn + rc->alpn_len, p, l);
+		rc->alpn_len += l;
+	}
+}
+
+static int
+rp_version(const char *v)
+{
+
+	if (strcmp(v, "TLSv1.2") == 0)
+		return (TLS1_2_VERSION);
+#ifdef TLS1_3_VERSION
+	if (strcmp(v, "TLSv1.3") == 0)
+		return (TLS1_3_VERSION);
+#endif
+	return (0);
+}
+
+/*
+ * The fields after the {trace} tag, see conn-trace in hitch.conf(5):
+ * 0 accept time, 3 SNI, 4 version, 5 handshake type, 8 lifetime,
+ * 13 version offered, 15 session offered, 16 ALPN offered, 17 bursts.
+ */
+#define RP_FIELDS	18
+
+static void
+rp_parse(char *line)
+{
+	struct rp_conn *rc;
+	struct rp_ex *ex;
+	char *f[RP_FIELDS], *p, *b;
+	double ms;
+	size_t bytes;
+	unsigned n;
+
+	p = strstr(line, "{trace}\t");
+	if (p == NULL)
+		return;
+	p += 8;
+	p[strcspn(p, "\r\n")] = '\0';
+	for (n = 0; n < RP_FIELDS && p != NULL; n++)
+		f[n] = strsep(&p, "\t");
+	if (n < RP_FIELDS) {
+		rp.skipped++;
+		return;
+	}
+
+	if (rp.n == rp.sz) {
+		rp.sz = rp.sz == 0 ? 1024 : rp.sz * 2;
+		rp.conns = realloc(rp.conns, rp.sz * sizeof *rp.conns);
+		assert(rp.conns != NULL);
+	}
+	rc = &rp.conns[rp.n++];
+	memset(rc, 0, sizeof *rc);
+	rc->at = atof(f[0]);
+	rc->life = atof(f[8]) * 1e-3;
+	if (strcmp(f[3], "-") != 0)
+		snprintf(rc->sni, sizeof rc->sni, "%s", f[3]);
+	rc->maxver = rp_version(strcmp(f[13], "-") != 0 ? f[13] : f[4]);
+	rc->resume = strcmp(f[15], "1") == 0 || strcmp(f[5], "resumed") == 0;
+	if (strcmp(f[16], "-") != 0)
+		rp_alpn(rc, f[16]);
+
+	/* Bursts from the backend go with the request before them */
+	while ((b = strsep(&f[17], ",")) != NULL) {
+		if (sscanf(b + 1, "%lf:%zu", &ms, &bytes) != 2)
+			continue;
+		if (*b == 'c' && rc->n_ex < RP_EXCHANGES) {
+			ex = &rc->ex[rc->n_ex++];
+			ex->at = ms * 1e-3;
+			ex->req = bytes;
+			ex->resp = 0;
+		} else if (*b == 'b' && rc->n_ex > 0)
+			rc->ex[rc->n_ex - 1].resp += bytes;
+	}
+}
+
+static int
+rp_cmp(const void *a, const void *b)
+{
+	const struct rp_conn *x = a, *y = b;
+
+	return (x->at < y->at ? -1 : x->at > y->at);
+}
+
+static void
+rp_usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: hitch-bench replay [-c ADDR] [-f FILE] [-x SPEED]\n"
+	    "\n"
+	    "  -c ADDR     Connect to hitch on [HOST]:PORT "
+	    "(Default: [127.0.0.1]:8443)\n"
+	    "  -f FILE     Hitch log with conn-trace records "
+	    "(Default: stdin)\n"
+	    "  -x SPEED    Play the traces this many times faster "
+	    "(Default: 1)\n"
+	    "\n"
+	    "Hitch is expected to forward to hitch-bench backend "
+	    "in http mode.\n");
+	exit(2);
+}
+
+static int
+bench_replay(int argc, char **argv)
+{
+	struct bench_thread *bt;
+	const char *addr = "[127.0.0.1]:8443", *file = NULL;
+	char *line = NULL;
+	size_t lsz = 0;
+	double t1, span = 0, first;
+	unsigned i;
+	sigset_t ss;
+	FILE *f;
+	int o;
+
+	rp.speed = 1;
+	while ((o = getopt(argc, argv, "c:f:x:")) != -1) {
+		switch (o) {
+		case 'c':
+			addr = optarg;
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 'x':
+			rp.speed = atof(optarg);
+			break;
+		default:
+			rp_usage();
+		}
+	}
+	if (optind != argc || rp.speed <= 0)
+		rp_usage();
+
+	f = file != NULL ? fopen(file, "r") : stdin;
+	if (f == NULL)
+		die("%s: %s", file, strerror(errno));
+	while (getline(&line, &lsz, f) > 0)
+		rp_parse(line);
+	free(line);
+	if (f != stdin)
+		(void)fclose(f);
+	if (rp.n == 0)
+		die("No {trace} records");
+
+	/* Workers log in the order connections close */
+	qsort(rp.conns, rp.n, sizeof *rp.conns, rp_cmp);
+	first = rp.conns[0].at;
+	for (i = 0; i < rp.n; i++) {
+		rp.conns[i].at -= first;
+		if (rp.conns[i].at + rp.conns[i].life > span)
+			span = rp.conns[i].at + rp.conns[i].life;
+	}
+
+	raise_nofile();
+	sigemptyset(&ss);
+	sigaddset(&ss, SIGPIPE);
+	assert(pthread_sigmask(SIG_BLOCK, &ss, NULL) == 0);
+
+	bc.mode = BC_REPLAY;
+	bc.ai = resolve(addr, 0);
+	bc.ctx = SSL_CTX_new(SSLv23_client_method());
+	assert(bc.ctx != NULL);
+	SSL_CTX_set_verify(bc.ctx, SSL_VERIFY_NONE, NULL);
+	SSL_CTX_set_mode(bc.ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+	    SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_CTX_set_session_cache_mode(bc.ctx,
+	    SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(bc.ctx, bc_new_session);
+
+	bt = calloc(1, sizeof *bt);
+	assert(bt != NULL);
+	bt->magic = BENCH_THREAD_MAGIC;
+	bt->loop = ev_loop_new(EVFLAG_AUTO);
+	assert(bt->loop != NULL);
+	bt->n_conns = rp.n;
+	bt->conns = calloc(rp.n, sizeof *bt->conns);
+	assert(bt->conns != NULL);
+	for (i = 0; i < rp.n; i++) {
+		bt->conns[i].magic = BC_CONN_MAGIC;
+		bt->conns[i].bt = bt;
+		bt->conns[i].fd = -1;
+		bt->conns[i].rp = &rp.conns[i];
+		ev_timer_init(&bt->conns[i].tmr, rp_timer, 0., 0.);
+		bt->conns[i].tmr.data = &bt->conns[i];
+	}
+	ev_timer_init(&bt->tick, rp_tick, 0., 0.);
+	bt->tick.data = bt;
+	ev_timer_start(bt->loop, &bt->tick);
+
+	rp.t0 = now();
+	ev_loop(bt->loop, 0);
+	t1 = now() - rp.t0;
+
+	printf("mode %s\n", bc_mode_name[bc.mode]);
+	printf("connections %u\n", rp.n);
+	printf("skipped %ju\n", (uintmax_t)rp.skipped);
+	printf("speed %g\n", rp.speed);
+	printf("traced_duration %.3f\n", span);
+	printf("duration %.3f\n", t1);
+	printf("errors %ju\n", (uintmax_t)bt->st.errors);
+	printf("handshakes %ju\n", (uintmax_t)bt->st.handshakes);
+	printf("resumed %ju\n", (uintmax_t)bt->st.resumed);
+	printf("requests %ju\n", (uintmax_t)bt->st.requests);
+	printf("bytes_in %ju\n", (uintmax_t)bt->st.bytes_in);
+	printf("bytes_out %ju\n", (uintmax_t)bt->st.bytes_out);
+	lat_report("start_lag", &bt->lag);
+	lat_report("handshake", &bt->st.hs_lat);
+	lat_report("request", &bt->st.req_lat);
+	return (bt->st.errors > 0 && bt->st.handshakes == 0 ? 1 : 0);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr,
+	    "usage: hitch-bench backend [options]\n"
+	    "       hitch-bench client [options]\n"
+	    "       hitch-bench replay [options]\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+
+	if (argc < 2)
+		usage();
+	if (strcmp(argv[1], "backend") == 0)
+		return (bench_backend(argc - 1, argv + 1));
+	if (strcmp(argv[1], "client") == 0)
+		return (bench_client(argc - 1, argv + 1));
+	if (strcmp(argv[1], "replay") == 0)
+		return (bench_replay(argc - 1, argv + 1));
+	usage();
+	return (2);
+}
@@ -173,6 +173,10 @@ print_extensions(unsigned char *extensions, int extensions_len)
 			printf("Authority extension:\t%.*s\n", l,
 			    extensions + i);
 			break;
+		case PP2_TYPE_FINGERPRINT:
+			printf("Fingerprint extension:\t%.*s\n", l,
+			    extensions + i);
+			break;
 		case PP2_TYPE_SSL:
 			printf("PP2_TYPE_SSL client:\t0x%x\n",
 			    *((char *)extensions + i));